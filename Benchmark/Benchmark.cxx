@@ -0,0 +1,701 @@
+/*
+ * Benchmark/Benchmark.cxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#include "BenchmarkVM.hxx"
+#include "Compiler.hxx"
+#include "Optimizer.hxx"
+#include "Parser.hxx"
+
+#include <chrono>
+#include <cstdarg>
+
+using namespace tinyVM;
+
+// Results
+
+// Every result is a single line of "key=value" pairs. They are printed and, when an
+// output file is given (--output), appended to it so the runs can be compared over time.
+
+static FILE* resultsFile = NULL;
+
+static void Report(const charconst format, ...) {
+    va_list arguments;
+
+    va_start(arguments, format);
+    std::vprintf(format, arguments);
+    std::printf("\n");
+    va_end(arguments);
+
+    if (resultsFile) {
+        va_start(arguments, format);
+        std::vfprintf(resultsFile, format, arguments);
+        std::fprintf(resultsFile, "\n");
+        va_end(arguments);
+    }
+}
+
+// Files
+
+// The files of the benchmarks go in the temporary directory, named after the process so
+// that runs at the same time never use each other's files. They are removed when the
+// TemporaryFile goes out of scope, so every return of a benchmark cleans up after it.
+
+class TemporaryFile {
+    public:
+        TemporaryFile(const charconst fileName);
+        ~TemporaryFile();
+
+        charconst GetPath(void) const;
+
+    private:
+        string path;
+};
+
+TemporaryFile::TemporaryFile(const charconst fileName) {
+#if defined(WindowsOS)
+    char  directoryPath[MAX_PATH + 1];
+    DWORD directorySize = GetTempPathA(sizeof(directoryPath), directoryPath);    // Ends with a backslash.
+    int64 processId     = GetCurrentProcessId();
+
+    this->path = ((directorySize > 0) && (directorySize <= MAX_PATH)) ? string(directoryPath, directorySize) : string(".\\");
+#else
+    const charconst directoryPath = getenv("TMPDIR");
+    int64           processId     = getpid();
+
+    this->path = string(((directoryPath) && (directoryPath[0] != 0)) ? directoryPath : "/tmp") + "/";
+#endif
+
+    this->path += "tinyVM." + std::to_string(processId) + "." + fileName;
+}
+
+TemporaryFile::~TemporaryFile() {
+    remove(this->path.c_str());
+}
+
+charconst TemporaryFile::GetPath(void) const {
+    return this->path.c_str();
+}
+
+// Programs
+
+// Builds a straight-line block of instructions that is repeated by a final LOOP.
+// Every third instruction is a TICK when "mixed" is set, otherwise the block is made
+// of "opCode" only.
+
+static bool BuildProgram(Program& program, const int64 opCode, const bool mixed, const int64 blockSize, const int64 loops) {
+    if (!program.New())
+        return false;
+
+    Program::InstructionParameters noParameters = {NULL, NULL, NULL, NULL};
+
+    for (int64 instructionIndex = 0; instructionIndex < blockSize; ++instructionIndex)
+        if (!program.Emit((mixed && (instructionIndex % 3 == 2)) ? static_cast<int64>(BenchmarkVM::TickOpCode) : opCode, noParameters))
+            return false;
+
+    Program::InstructionParameters loopParameters = {NewIntValue(loops), NewIntValue(0), NULL, NULL};
+    bool                           emitted        = program.Emit(BenchmarkVM::LoopOpCode, loopParameters);
+
+    Program::DeleteParameters(loopParameters);
+    return emitted;
+}
+
+// Builds a block of ADDs on registers that is repeated by a final DEC, which counts the
+// loops down in a register (so every lane of a batch has its own counter).
+
+static bool BuildRegisterProgram(Program& program, const int64 blockSize, const int64 loops) {
+    if (!program.New())
+        return false;
+
+    Program::InstructionParameters setParameters   = {NewIntValue(1), NewIntValue(1), NULL, NULL};
+    Program::InstructionParameters loopsParameters = {NewIntValue(2), NewIntValue(loops), NULL, NULL};
+    Program::InstructionParameters addParameters   = {NewIntValue(0), NewIntValue(1), NULL, NULL};
+    Program::InstructionParameters decParameters   = {NewIntValue(2), NewIntValue(2), NULL, NULL};
+    bool                           emitted         = program.Emit(BenchmarkVM::SetOpCode, setParameters) && program.Emit(BenchmarkVM::SetOpCode, loopsParameters);
+
+    for (int64 instructionIndex = 0; emitted && (instructionIndex < blockSize); ++instructionIndex)
+        emitted = program.Emit(BenchmarkVM::AddOpCode, addParameters);
+
+    emitted = emitted && program.Emit(BenchmarkVM::CountdownOpCode, decParameters);
+
+    Program::DeleteParameters(setParameters);
+    Program::DeleteParameters(loopsParameters);
+    Program::DeleteParameters(addParameters);
+    Program::DeleteParameters(decParameters);
+
+    return emitted;
+}
+
+// Benchmarks
+
+// The optimized benchmarks still count the instructions of the program as it was built,
+// to show what the fusions save per source instruction. The native ones include the
+// time it takes to compile the program.
+
+static void RunBenchmark(const charconst name, const int64 opCode, const bool mixed, const bool optimized = false, const bool native = false) {
+    const int64 blockSize = 10000;
+    const int64 loops     = 1000;
+
+    BenchmarkVM vm;
+    Program     program;
+    Program     optimizedProgram;
+
+    if (!BuildProgram(program, opCode, mixed, blockSize, loops)) {
+        Error("Could not build the \"%s\" benchmark program.", name);
+        return;
+    }
+
+    if (optimized && (!Optimizer(&vm).Optimize(program, optimizedProgram))) {
+        Error("Could not optimize the \"%s\" benchmark program.", name);
+        return;
+    }
+
+    if (native)
+        vm.SetJitThreshold(0);
+
+    auto startTime = std::chrono::steady_clock::now();
+    vm.Start(optimized ? &optimizedProgram : &program);
+    auto endTime = std::chrono::steady_clock::now();
+
+    double elapsedNs = std::chrono::duration<double, std::nano>(endTime - startTime).count();
+    int64  executed  = (blockSize + 1) * loops;
+
+    Report("dispatch=%s benchmark=%s instructions=%ld ns_per_instruction=%.3f", DispatchName, name, executed, elapsedNs / executed);
+}
+
+// The same program over a number of lanes, once with a context for each lane and once as
+// a single batch (where every instruction is dispatched once for all the lanes).
+
+static void RunBatchBenchmark(const int numberOfLanes) {
+    const int64 blockSize = 100;
+    const int64 loops     = 1000;
+
+    BenchmarkVM vm;
+    Program     program;
+
+    if (!BuildRegisterProgram(program, blockSize, loops)) {
+        Error("Could not build the batch benchmark program.");
+        return;
+    }
+
+    ProgramImage*   image = vm.NewImage(&program);
+    ExecutionBatch* batch = image ? vm.NewBatch(image, numberOfLanes) : NULL;
+
+    if (!batch) {
+        Error("Could not create the batch benchmark image.");
+        delete image;
+        return;
+    }
+
+    int64 executed = ((blockSize + 1) * loops + 3) * numberOfLanes;
+    int64 expected = blockSize * loops;
+    bool  isValid  = true;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (int lane = 0; lane < numberOfLanes; ++lane) {
+        ExecutionContext* laneContext = vm.NewContext(image);
+
+        isValid = isValid && laneContext && vm.Start(laneContext) && (vm.GetIntRegister(0) == expected);
+        vm.DeleteContext(laneContext);
+    }
+
+    auto   endTime   = std::chrono::steady_clock::now();
+    double elapsedNs = std::chrono::duration<double, std::nano>(endTime - startTime).count();
+
+    Report("dispatch=%s benchmark=batch lanes=%d mode=contexts instructions=%ld ns_per_instruction=%.3f valid=%d", DispatchName, numberOfLanes, executed, elapsedNs / executed, isValid);
+
+    startTime = std::chrono::steady_clock::now();
+    isValid   = vm.Start(batch);
+    endTime   = std::chrono::steady_clock::now();
+    elapsedNs = std::chrono::duration<double, std::nano>(endTime - startTime).count();
+
+    for (int lane = 0; lane < numberOfLanes; ++lane)
+        isValid = isValid && (batch->GetIntRegister(lane, 0) == expected);
+
+    Report("dispatch=%s benchmark=batch lanes=%d mode=batch instructions=%ld ns_per_instruction=%.3f valid=%d", DispatchName, numberOfLanes, executed, elapsedNs / executed, isValid);
+
+    delete batch;
+    delete image;
+}
+
+// A snapshot taken half way through the register program is restored by another run of
+// the benchmark (--restore <snapshot file path>), where the operation methods are at other
+// addresses, which runs the rest of the program and exits with 0 if the result is right.
+
+static constexpr int64 SnapshotBlockSize = 100;
+static constexpr int64 SnapshotLoops     = 1000;
+
+static void RunSnapshotBenchmark(const charconst executablePath) {
+    TemporaryFile snapshotFilePath("bench.snapshot");
+    charconst     snapshotPath = snapshotFilePath.GetPath();
+
+    BenchmarkVM        vm;
+    Program            program;
+    std::vector<uint8> snapshot;
+
+    if (!BuildRegisterProgram(program, SnapshotBlockSize, SnapshotLoops)) {
+        Error("Could not build the snapshot benchmark program.");
+        return;
+    }
+
+    ProgramImage*     image   = vm.NewImage(&program);
+    ExecutionContext* context = image ? vm.NewContext(image) : NULL;
+
+    VirtualMachineCore::ExecutionBudget budget = {(SnapshotBlockSize + 1) * SnapshotLoops / 2, 0};
+
+    bool  isValid      = context && vm.Start(context, budget) && context->IsRunning() && vm.Snapshot(context, snapshot);
+    FILE* snapshotFile = isValid ? fopen(snapshotPath, "wb") : NULL;
+
+    isValid = snapshotFile && (fwrite(snapshot.data(), snapshot.size(), 1, snapshotFile) == 1);
+
+    if (snapshotFile)
+        fclose(snapshotFile);
+
+    vm.DeleteContext(context);
+    delete image;
+
+    string restoreCommand = string("\"") + executablePath + "\" --restore \"" + snapshotPath + "\"";
+
+    auto startTime = std::chrono::steady_clock::now();
+    isValid        = isValid && (std::system(restoreCommand.c_str()) == 0);
+    auto endTime   = std::chrono::steady_clock::now();
+
+    double elapsedMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+    Report("dispatch=%s benchmark=snapshot snapshot_bytes=%ld restore_process_ms=%.3f valid=%d", DispatchName, static_cast<int64>(snapshot.size()), elapsedMs, isValid);
+}
+
+static int RestoreSnapshot(const charconst snapshotPath) {
+    BenchmarkVM        vm;
+    Program            program;
+    std::vector<uint8> snapshot;
+
+    FILE* snapshotFile = fopen(snapshotPath, "rb");
+
+    if (!snapshotFile) {
+        Error("Could not open the snapshot file \"%s\".", snapshotPath);
+        return 1;
+    }
+
+    uint8  readBuffer[4096];
+    size_t readSize;
+
+    while ((readSize = fread(readBuffer, 1, sizeof(readBuffer), snapshotFile)) > 0)
+        snapshot.insert(snapshot.end(), readBuffer, readBuffer + readSize);
+
+    fclose(snapshotFile);
+
+    if (!BuildRegisterProgram(program, SnapshotBlockSize, SnapshotLoops)) {
+        Error("Could not build the snapshot benchmark program.");
+        return 1;
+    }
+
+    ProgramImage*     image   = vm.NewImage(&program);
+    ExecutionContext* context = image ? vm.Restore(image, snapshot.data(), snapshot.size()) : NULL;
+    bool              isValid = context && vm.Resume(context) && (!context->IsRunning()) && (vm.GetIntRegister(0) == SnapshotBlockSize * SnapshotLoops);
+
+    vm.DeleteContext(context);
+    delete image;
+
+    return isValid ? 0 : 1;
+}
+
+static void RunStartupBenchmark(void) {
+    const int64 numberOfMachines = 100000;
+
+    // Registered operations: every instance fills its own map and list.
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (int64 machineIndex = 0; machineIndex < numberOfMachines; ++machineIndex) {
+        VirtualMachineCore vm;
+        vm.BuildOperationsList();
+    }
+
+    auto   endTime   = std::chrono::steady_clock::now();
+    double elapsedNs = std::chrono::duration<double, std::nano>(endTime - startTime).count();
+
+    Report("benchmark=startup operations=registered ns_per_machine=%.3f", elapsedNs / numberOfMachines);
+
+    // Static operations: every instance shares the same list.
+
+    startTime = std::chrono::steady_clock::now();
+
+    for (int64 machineIndex = 0; machineIndex < numberOfMachines; ++machineIndex)
+        BenchmarkVM vm;
+
+    endTime   = std::chrono::steady_clock::now();
+    elapsedNs = std::chrono::duration<double, std::nano>(endTime - startTime).count();
+
+    Report("benchmark=startup operations=static ns_per_machine=%.3f", elapsedNs / numberOfMachines);
+}
+
+// Tokenizes a generated source file with labels, strings, literals and identifiers.
+
+static void RunLexerBenchmark(void) {
+    const int64   numberOfLines = 400000;
+    TemporaryFile sourceFilePath("bench.tvs");
+    charconst     sourcePath = sourceFilePath.GetPath();
+
+    FILE* sourceFile = fopen(sourcePath, "wb");
+
+    if (!sourceFile) {
+        Error("Could not create the lexer benchmark source file.");
+        return;
+    }
+
+    for (int64 lineIndex = 0; lineIndex < numberOfLines; ++lineIndex)
+        std::fprintf(sourceFile, "!Label%ld\nPRINT \"string literal number %ld\"\nSHOW %ld.25, true, name%ld\nLOOP %ld, !Label%ld\n", lineIndex, lineIndex, lineIndex, lineIndex, lineIndex, lineIndex);
+
+    int64 sourceSize = ftell(sourceFile);
+    fclose(sourceFile);
+
+    Arena         arena;
+    Parser        parser(arena);
+    Parser::Token token;
+    int64         numberOfTokens = 0;
+
+    if (!parser.Load(sourcePath))
+        return;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    while (parser.GetNextToken(token))
+        numberOfTokens++;
+
+    auto   endTime    = std::chrono::steady_clock::now();
+    double elapsedSec = std::chrono::duration<double>(endTime - startTime).count();
+
+    Report("benchmark=lexer bytes=%ld tokens=%ld mb_per_second=%.1f", sourceSize, numberOfTokens, sourceSize / elapsedSec / 1000000.0);
+
+    parser.Unload();
+}
+
+// Suite
+
+// Generated sources of a given number of instructions, with a label on every
+// "labelInterval" instructions (referenced by a REF at the end of its block) and a MARK
+// with its own string every "stringInterval" instructions, the rest are TICKs. A final
+// LOOP runs the whole program again until it executed about ExecutedInstructions.
+
+struct SuiteProfile {
+        charconst name;
+        int64     labelInterval;
+        int64     stringInterval;
+};
+
+static constexpr int64 ExecutedInstructions = 10000000;
+static constexpr int64 MeasuredBytes        = 16000000;    // Read at least this much when measuring the small programs.
+static constexpr int64 MaxRepeats           = 20;
+
+static bool GenerateSource(const charconst sourcePath, const int64 numberOfInstructions, const SuiteProfile& profile, const int64 loops, int64& sourceSize) {
+    FILE* sourceFile = fopen(sourcePath, "wb");
+
+    if (!sourceFile) {
+        Error("Could not create the \"%s\" benchmark source file.", sourcePath);
+        return false;
+    }
+
+    std::fprintf(sourceFile, "!Start\n");
+
+    for (int64 instructionIndex = 0; instructionIndex < numberOfInstructions - 1; ++instructionIndex) {
+        int64 labelIndex = instructionIndex % profile.labelInterval;
+
+        if (labelIndex == 0)
+            std::fprintf(sourceFile, "!Label%ld\n", instructionIndex);
+
+        if ((instructionIndex % profile.stringInterval) == 1)
+            std::fprintf(sourceFile, "MARK \"string number %ld\"\n", instructionIndex);
+        else if (labelIndex == profile.labelInterval - 1)
+            std::fprintf(sourceFile, "REF !Label%ld\n", instructionIndex - labelIndex);
+        else
+            std::fprintf(sourceFile, "TICK\n");
+    }
+
+    std::fprintf(sourceFile, "LOOP %ld, !Start\n", loops);
+
+    sourceSize = ftell(sourceFile);
+    fclose(sourceFile);
+
+    return true;
+}
+
+static int64 GetRepeats(const int64 size) {
+    return std::max(static_cast<int64>(1), std::min(MaxRepeats, MeasuredBytes / std::max(size, static_cast<int64>(1))));
+}
+
+static double GetSeconds(const std::chrono::steady_clock::time_point startTime) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+static void RunSuiteBenchmark(const int64 numberOfInstructions, const SuiteProfile& profile) {
+    TemporaryFile sourceFilePath("suite.tvs");
+    TemporaryFile binaryFilePath("suite.tvp");
+    charconst     sourcePath = sourceFilePath.GetPath();
+    charconst     binaryPath = binaryFilePath.GetPath();
+
+    int64 loops = std::max(static_cast<int64>(1), ExecutedInstructions / numberOfInstructions);
+    int64 sourceSize;
+
+    if (!GenerateSource(sourcePath, numberOfInstructions, profile, loops, sourceSize))
+        return;
+
+    // Lexer
+
+    int64 repeats        = GetRepeats(sourceSize);
+    int64 numberOfTokens = 0;
+    auto  startTime      = std::chrono::steady_clock::now();
+
+    for (int64 repeatIndex = 0; repeatIndex < repeats; ++repeatIndex) {
+        Arena         arena;
+        Parser        parser(arena);
+        Parser::Token token;
+
+        if (!parser.Load(sourcePath))
+            return;
+
+        while (parser.GetNextToken(token))
+            numberOfTokens++;
+
+        parser.Unload();
+    }
+
+    double tokensPerSecond = numberOfTokens / GetSeconds(startTime);
+
+    // Compiler
+
+    BenchmarkVM vm;
+    double      compileSeconds = 0;
+
+    for (int64 repeatIndex = 0; repeatIndex < repeats; ++repeatIndex) {
+        Compiler compiler;
+
+        if (!compiler.Load(sourcePath))
+            return;
+
+        startTime = std::chrono::steady_clock::now();
+
+        if (!compiler.Compile(&vm)) {
+            Error("Could not compile the \"%s\" benchmark program.", profile.name);
+            return;
+        }
+
+        compileSeconds += GetSeconds(startTime);
+
+        if ((repeatIndex == 0) && (!compiler.Save(binaryPath)))
+            return;
+    }
+
+    double compiledPerSecond = (numberOfInstructions * repeats) / compileSeconds;
+
+    // The same, compiling the chunks of the source in parallel (the small sources are
+    // still compiled serially).
+
+    compileSeconds = 0;
+
+    for (int64 repeatIndex = 0; repeatIndex < repeats; ++repeatIndex) {
+        Compiler compiler;
+
+        compiler.SetNumberOfThreads(0);
+
+        if (!compiler.Load(sourcePath))
+            return;
+
+        startTime = std::chrono::steady_clock::now();
+
+        if (!compiler.Compile(&vm)) {
+            Error("Could not compile the \"%s\" benchmark program in parallel.", profile.name);
+            return;
+        }
+
+        compileSeconds += GetSeconds(startTime);
+    }
+
+    double parallelCompiledPerSecond = (numberOfInstructions * repeats) / compileSeconds;
+
+    // Program Loading
+
+    FILE* binaryFile = fopen(binaryPath, "rb");
+
+    if (!binaryFile)
+        return;
+
+    fseek(binaryFile, 0, SEEK_END);
+    int64 binarySize = ftell(binaryFile);
+    fclose(binaryFile);
+
+    int64 loadRepeats = GetRepeats(binarySize);
+    startTime         = std::chrono::steady_clock::now();
+
+    for (int64 repeatIndex = 0; repeatIndex < loadRepeats; ++repeatIndex) {
+        Program program;
+
+        if (!program.Load(binaryPath))
+            return;
+    }
+
+    double loadMbPerSecond = (binarySize * loadRepeats) / GetSeconds(startTime) / 1000000.0;
+
+    // Execution
+
+    Program program;
+
+    if (!program.Load(binaryPath))
+        return;
+
+    ProgramImage*     image   = vm.NewImage(&program);
+    ExecutionContext* context = image ? vm.NewContext(image) : NULL;
+
+    if (!context) {
+        delete image;
+        return;
+    }
+
+    startTime = std::chrono::steady_clock::now();
+    vm.Start(context);
+
+    double executedPerSecond = (numberOfInstructions * loops) / GetSeconds(startTime);
+
+    vm.DeleteContext(context);
+    delete image;
+
+    Report("dispatch=%s benchmark=suite profile=%s instructions=%ld source_bytes=%ld binary_bytes=%ld tokens_per_second=%.0f compiled_per_second=%.0f parallel_compiled_per_second=%.0f load_mb_per_second=%.1f executed_per_second=%.0f", DispatchName, profile.name, numberOfInstructions, sourceSize, binarySize, tokensPerSecond, compiledPerSecond, parallelCompiledPerSecond, loadMbPerSecond, executedPerSecond);
+}
+
+static void RunSuite(const int64 maxInstructions) {
+    static const SuiteProfile profiles[] = {
+        {"sparse", 100, 100},
+        { "dense",   4,   4}
+    };
+
+    for (int64 numberOfInstructions = 1000; numberOfInstructions <= maxInstructions; numberOfInstructions *= 10)
+        for (auto profile = std::begin(profiles); profile != std::end(profiles); ++profile)
+            RunSuiteBenchmark(numberOfInstructions, *profile);
+}
+
+// Checks
+
+// Program files whose section offsets and sizes do not fit in the file (crafted so that
+// adding them up overflows) must be rejected by both load modes, never read or mapped.
+
+static bool WriteFile(const charconst filePath, const std::vector<uint8>& fileData) {
+    FILE* file      = fopen(filePath, "wb");
+    bool  isWritten = file && (fwrite(fileData.data(), fileData.size(), 1, file) == 1);
+
+    if (file)
+        fclose(file);
+
+    return isWritten;
+}
+
+static bool IsProgramRejected(const charconst programPath) {
+    Program copiedProgram, mappedProgram;
+    return (!copiedProgram.Load(programPath, Program::CopyFile)) && (!mappedProgram.Load(programPath, Program::MapFile));
+}
+
+static void RunHeaderCheck(void) {
+    TemporaryFile programFilePath("check.tvp");
+    charconst     programPath = programFilePath.GetPath();
+
+    Program            program;
+    std::vector<uint8> programData;
+
+    bool isValid = BuildProgram(program, BenchmarkVM::TickOpCode, false, 10, 1) && program.Save(programPath);
+
+    // Version 2: the strings section (the third entry) at a huge offset.
+
+    FILE* programFile = isValid ? fopen(programPath, "rb") : NULL;
+
+    if (programFile) {
+        uint8  readBuffer[4096];
+        size_t readSize;
+
+        while ((readSize = fread(readBuffer, 1, sizeof(readBuffer), programFile)) > 0)
+            programData.insert(programData.end(), readBuffer, readBuffer + readSize);
+
+        fclose(programFile);
+    }
+
+    int64 sectionOffset = 0x7ffffffffffffff0LL;
+    int64 sectionSize   = 0x20;
+
+    isValid = isValid && (programData.size() >= static_cast<size_t>(Program::HeaderSize + 3 * Program::SectionEntrySize));
+
+    if (isValid) {
+        uint8* stringsEntry = &programData[Program::HeaderSize + 2 * Program::SectionEntrySize];
+
+        memcpy(&stringsEntry[8], &sectionOffset, 8);
+        memcpy(&stringsEntry[16], &sectionSize, 8);
+    }
+
+    isValid = isValid && WriteFile(programPath, programData) && IsProgramRejected(programPath);
+
+    // Version 1: the code and data sizes add up past the end of the offsets.
+
+    std::vector<uint8> legacyData(Program::LegacyHeaderSize, 0);
+    int32              legacyVersion = Program::LegacyVersion;
+
+    memcpy(legacyData.data(), Program::Signature, 4);
+    memcpy(&legacyData[4], &legacyVersion, 4);
+    memcpy(&legacyData[8], &sectionOffset, 8);
+    memcpy(&legacyData[16], &sectionSize, 8);
+
+    isValid = isValid && WriteFile(programPath, legacyData) && IsProgramRejected(programPath);
+
+    Report("check=header valid=%d", isValid);
+}
+
+// Options: --output <results file path> (appends the results to it) and
+// --max-instructions <count> (the biggest suite program, 10M by default). --restore
+// <snapshot file path> is what the snapshot benchmark runs in the second process.
+
+int main(int numberOfArguments, char** argumentsValues) {
+    int64 maxInstructions = 10000000;
+
+    for (int argumentIndex = 1; argumentIndex < numberOfArguments; ++argumentIndex) {
+        string argument = argumentsValues[argumentIndex];
+
+        if ((argument == "--output") && (argumentIndex + 1 < numberOfArguments)) {
+            resultsFile = fopen(argumentsValues[++argumentIndex], "ab");
+
+            if (!resultsFile) {
+                Error("Could not open the results file \"%s\".", argumentsValues[argumentIndex]);
+                return 1;
+            }
+        } else if ((argument == "--max-instructions") && (argumentIndex + 1 < numberOfArguments)) {
+            maxInstructions = ToInt(argumentsValues[++argumentIndex]);
+        } else if ((argument == "--restore") && (argumentIndex + 1 < numberOfArguments)) {
+            return RestoreSnapshot(argumentsValues[++argumentIndex]);
+        } else {
+            Error("Unknown option \"%s\".", argument.c_str());
+            return 1;
+        }
+    }
+
+    Report("benchmark=build dispatch=%s os=%s arch=%s", DispatchName, OSName, ArchName);
+
+    RunHeaderCheck();
+
+    RunBenchmark("nop", 0, false);
+    RunBenchmark("tick", BenchmarkVM::TickOpCode, false);
+    RunBenchmark("mixed", 0, true);
+    RunBenchmark("tick-fused", BenchmarkVM::TickOpCode, false, true);
+    RunBenchmark("tick-native", BenchmarkVM::TickOpCode, false, false, true);
+    RunBenchmark("mixed-native", 0, true, false, true);
+    RunBatchBenchmark(8);
+    RunBatchBenchmark(64);
+    RunBatchBenchmark(1024);
+    RunSnapshotBenchmark(argumentsValues[0]);
+    RunStartupBenchmark();
+    RunLexerBenchmark();
+    RunSuite(maxInstructions);
+
+    if (resultsFile)
+        fclose(resultsFile);
+
+    return 0;
+}
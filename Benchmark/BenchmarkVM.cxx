@@ -0,0 +1,225 @@
+/*
+ * Benchmark/BenchmarkVM.cxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#include "BenchmarkVM.hxx"
+
+namespace tinyVM {
+
+// Benchmark VM
+
+BenchmarkVM::BenchmarkVM(void) :
+    VirtualMachineCore(VirtualMachineCore::GetStaticFusedOperations<BenchmarkVM>()),
+    ticks(0),
+    loops(0),
+    marks(0) {
+    // Empty
+}
+
+// Counters
+
+int64 BenchmarkVM::GetTicks(void) const {
+    return this->ticks;
+}
+
+int64 BenchmarkVM::GetMarks(void) const {
+    return this->marks;
+}
+
+// Operations
+
+const VirtualMachineCore::Operation BenchmarkVM::Operations[8] = {
+    {      BenchmarkVM::TickOpCode,  "TICK",       static_cast<OperationMethod>(&BenchmarkVM::OpTick),             {None, None, None, None}, NoFlags,                                                            NULL},
+    {      BenchmarkVM::LoopOpCode,  "LOOP",       static_cast<OperationMethod>(&BenchmarkVM::OpLoop),    {IntLiteral, Address, None, None}, NoFlags,                                                            NULL},
+    {BenchmarkVM::DoubleTickOpCode, "TICK2", static_cast<OperationMethod>(&BenchmarkVM::OpDoubleTick),             {None, None, None, None}, NoFlags,                                                            NULL},
+    {      BenchmarkVM::MarkOpCode,  "MARK",       static_cast<OperationMethod>(&BenchmarkVM::OpMark),    {StringLiteral, None, None, None}, NoFlags,                                                            NULL},
+    { BenchmarkVM::ReferenceOpCode,   "REF",  static_cast<OperationMethod>(&BenchmarkVM::OpReference),          {Address, None, None, None}, NoFlags,                                                            NULL},
+    {       BenchmarkVM::SetOpCode,   "SET",        static_cast<OperationMethod>(&BenchmarkVM::OpSet), {Identifier, IntLiteral, None, None}, NoFlags,       static_cast<BatchOperationMethod>(&BenchmarkVM::BatchSet)},
+    {       BenchmarkVM::AddOpCode,   "ADD",        static_cast<OperationMethod>(&BenchmarkVM::OpAdd), {Identifier, Identifier, None, None}, NoFlags,       static_cast<BatchOperationMethod>(&BenchmarkVM::BatchAdd)},
+    { BenchmarkVM::CountdownOpCode,   "DEC",  static_cast<OperationMethod>(&BenchmarkVM::OpCountdown),    {Identifier, Address, None, None}, NoFlags, static_cast<BatchOperationMethod>(&BenchmarkVM::BatchCountdown)}
+};
+
+const VirtualMachineCore::OperationFusion BenchmarkVM::Fusions[1] = {
+    {BenchmarkVM::DoubleTickOpCode, 2, {BenchmarkVM::TickOpCode, BenchmarkVM::TickOpCode, 0}}
+};
+
+bool BenchmarkVM::OpTick(const Program::InstructionParameters parameters) {
+    this->ticks++;
+    return true;
+}
+
+bool BenchmarkVM::OpLoop(const Program::InstructionParameters parameters) {
+    // LOOP <count>, <address>: jumps to the address until it was executed <count> times.
+
+    if (++this->loops < parameters[0]->asInt)
+        return this->Jump(parameters[1]->asInt);
+
+    this->loops = 0;
+    return true;
+}
+
+bool BenchmarkVM::OpDoubleTick(const Program::InstructionParameters parameters) {
+    this->ticks += 2;
+    return true;
+}
+
+bool BenchmarkVM::OpMark(const Program::InstructionParameters parameters) {
+    // MARK <string>: counts the string bytes.
+
+    this->marks += parameters[0]->size;
+    return true;
+}
+
+bool BenchmarkVM::OpReference(const Program::InstructionParameters parameters) {
+    // REF <address>: a reference to a label that never jumps.
+
+    return true;
+}
+
+bool BenchmarkVM::OpSet(const Program::InstructionParameters parameters) {
+    // SET <register>, <int>
+
+    this->SetIntRegister(parameters[0]->asInt, parameters[1]->asInt);
+    return true;
+}
+
+bool BenchmarkVM::OpAdd(const Program::InstructionParameters parameters) {
+    // ADD <register>, <register>: adds the second register to the first one.
+
+    this->SetIntRegister(parameters[0]->asInt, this->GetIntRegister(parameters[0]->asInt) + this->GetIntRegister(parameters[1]->asInt));
+    return true;
+}
+
+bool BenchmarkVM::OpCountdown(const Program::InstructionParameters parameters) {
+    // DEC <register>, <address>: decrements the register and jumps to the address until
+    // it gets to zero.
+
+    int64 counter = this->GetIntRegister(parameters[0]->asInt) - 1;
+    this->SetIntRegister(parameters[0]->asInt, counter);
+
+    if (counter != 0)
+        return this->Jump(parameters[1]->asInt);
+
+    return true;
+}
+
+// Batch Operations
+
+// When all the lanes are active the registers are worked on as whole arrays (with SIMD
+// instructions on x86_64), otherwise only the active lanes are touched.
+
+bool BenchmarkVM::BatchSet(const Program::InstructionParameters parameters, ExecutionBatch& batch) {
+    Slot*  targetLanes = batch.GetRegisterLanes(parameters[0]->asInt);
+    uint8* targetTypes = batch.GetRegisterTypeLanes(parameters[0]->asInt);
+    int64  value       = parameters[1]->asInt;
+
+    if (batch.AreAllLanesActive()) {
+        int numberOfLanes = batch.GetNumberOfLanes();
+
+        for (int lane = 0; lane < numberOfLanes; ++lane)
+            targetLanes[lane].asInt = value;
+
+        memset(targetTypes, IntSlot, numberOfLanes);
+        return true;
+    }
+
+    const int32* activeLanes = batch.GetActiveLanes();
+
+    for (int laneIndex = 0; laneIndex < batch.GetNumberOfActiveLanes(); ++laneIndex) {
+        targetLanes[activeLanes[laneIndex]].asInt = value;
+        targetTypes[activeLanes[laneIndex]]       = IntSlot;
+    }
+
+    return true;
+}
+
+bool BenchmarkVM::BatchAdd(const Program::InstructionParameters parameters, ExecutionBatch& batch) {
+    Slot*  targetLanes = batch.GetRegisterLanes(parameters[0]->asInt);
+    uint8* targetTypes = batch.GetRegisterTypeLanes(parameters[0]->asInt);
+    Slot*  sourceLanes = batch.GetRegisterLanes(parameters[1]->asInt);
+
+    if (batch.AreAllLanesActive()) {
+        int numberOfLanes = batch.GetNumberOfLanes();
+        int lane          = 0;
+
+        // The register lanes are cache line aligned.
+
+#if defined(X64Arch) && defined(__AVX2__)
+        for (; lane + 4 <= numberOfLanes; lane += 4) {
+            __m256i* target = reinterpret_cast<__m256i*>(&targetLanes[lane]);
+            _mm256_store_si256(target, _mm256_add_epi64(_mm256_load_si256(target), _mm256_load_si256(reinterpret_cast<const __m256i*>(&sourceLanes[lane]))));
+        }
+#elif defined(X64Arch)
+        for (; lane + 2 <= numberOfLanes; lane += 2) {
+            __m128i* target = reinterpret_cast<__m128i*>(&targetLanes[lane]);
+            _mm_store_si128(target, _mm_add_epi64(_mm_load_si128(target), _mm_load_si128(reinterpret_cast<const __m128i*>(&sourceLanes[lane]))));
+        }
+#endif
+
+        for (; lane < numberOfLanes; ++lane)
+            targetLanes[lane].asInt += sourceLanes[lane].asInt;
+
+        memset(targetTypes, IntSlot, numberOfLanes);
+        return true;
+    }
+
+    const int32* activeLanes = batch.GetActiveLanes();
+
+    for (int laneIndex = 0; laneIndex < batch.GetNumberOfActiveLanes(); ++laneIndex) {
+        int lane = activeLanes[laneIndex];
+
+        targetLanes[lane].asInt += sourceLanes[lane].asInt;
+        targetTypes[lane]        = IntSlot;
+    }
+
+    return true;
+}
+
+bool BenchmarkVM::BatchCountdown(const Program::InstructionParameters parameters, ExecutionBatch& batch) {
+    Slot*  counterLanes = batch.GetRegisterLanes(parameters[0]->asInt);
+    uint8* counterTypes = batch.GetRegisterTypeLanes(parameters[0]->asInt);
+    int64  address      = parameters[1]->asInt;
+
+    if (batch.AreAllLanesActive()) {
+        int numberOfLanes = batch.GetNumberOfLanes();
+        int finishedLanes = 0;
+
+        for (int lane = 0; lane < numberOfLanes; ++lane) {
+            counterLanes[lane].asInt--;
+            counterTypes[lane]  = IntSlot;
+            finishedLanes      += counterLanes[lane].asInt == 0;
+        }
+
+        // Most of the time all the lanes jump (or none of them does).
+
+        if (finishedLanes == 0)
+            return batch.Jump(address);
+
+        if (finishedLanes == numberOfLanes)
+            return true;
+
+        for (int lane = 0; lane < numberOfLanes; ++lane)
+            if ((counterLanes[lane].asInt != 0) && (!batch.Jump(lane, address)))
+                return false;
+
+        return true;
+    }
+
+    const int32* activeLanes = batch.GetActiveLanes();
+
+    for (int laneIndex = 0; laneIndex < batch.GetNumberOfActiveLanes(); ++laneIndex) {
+        int lane = activeLanes[laneIndex];
+
+        counterTypes[lane] = IntSlot;
+
+        if ((--counterLanes[lane].asInt != 0) && (!batch.Jump(lane, address)))
+            return false;
+    }
+
+    return true;
+}
+
+}    // namespace tinyVM
@@ -0,0 +1,69 @@
+/*
+ * Benchmark/BenchmarkVM.hxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#ifndef VM_BENCHMARK_VM_H
+#define VM_BENCHMARK_VM_H
+
+#include "VirtualMachine.hxx"
+
+namespace tinyVM {
+
+// Benchmark VM
+
+class BenchmarkVM : public VirtualMachineCore {
+    public:
+        BenchmarkVM(void);
+
+        // Operation Codes
+
+        enum {
+            TickOpCode = 10,
+            LoopOpCode,
+            DoubleTickOpCode,
+            MarkOpCode,
+            ReferenceOpCode,
+            SetOpCode,
+            AddOpCode,
+            CountdownOpCode
+        };
+
+        // Counters
+
+        int64 GetTicks(void) const;
+        int64 GetMarks(void) const;
+
+        // Operations
+
+        static const Operation       Operations[8];
+        static const OperationFusion Fusions[1];
+
+        bool OpTick(const Program::InstructionParameters parameters);
+        bool OpLoop(const Program::InstructionParameters parameters);
+        bool OpDoubleTick(const Program::InstructionParameters parameters);
+        bool OpMark(const Program::InstructionParameters parameters);
+        bool OpReference(const Program::InstructionParameters parameters);
+        bool OpSet(const Program::InstructionParameters parameters);
+        bool OpAdd(const Program::InstructionParameters parameters);
+        bool OpCountdown(const Program::InstructionParameters parameters);
+
+        // Batch Operations
+
+        bool BatchSet(const Program::InstructionParameters parameters, ExecutionBatch& batch);
+        bool BatchAdd(const Program::InstructionParameters parameters, ExecutionBatch& batch);
+        bool BatchCountdown(const Program::InstructionParameters parameters, ExecutionBatch& batch);
+
+    private:
+        // Counters
+
+        int64 ticks;
+        int64 loops;
+        int64 marks;
+};
+
+}    // namespace tinyVM
+
+#endif    // VM_BENCHMARK_VM_H
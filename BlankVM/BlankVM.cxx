@@ -12,8 +12,8 @@ namespace tinyVM {
 // BlankVM
 
 BlankVM::BlankVM(void) :
-    VirtualMachineCore() {
-    this->BuildOperationsList();
+    VirtualMachineCore(VirtualMachineCore::GetBuiltInOperations()) {
+    // Empty
 }
 
 }    // namespace tinyVM
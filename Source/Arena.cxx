@@ -0,0 +1,94 @@
+/*
+ * Source/Arena.cxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#include "Arena.hxx"
+
+namespace tinyVM {
+
+// Arena
+
+Arena::Arena(void) :
+    blockIndex(0),
+    blockOffset(0) {
+    // Empty
+}
+
+Arena::~Arena() {
+    this->Delete();
+}
+
+// General
+
+pointer Arena::Allocate(const int64 size) {
+    int64 alignedSize = AlignSize(size > 0 ? size : 1, Arena::Alignment);
+
+    // Anything bigger than a block gets its own buffer.
+
+    if (alignedSize > Arena::BlockSize) {
+        buffer largeBlock = NewBuffer(alignedSize);
+
+        if (largeBlock)
+            this->largeBlocks.push_back(largeBlock);
+
+        return largeBlock;
+    }
+
+    // Move to the next block (allocating it if needed) when the current one is full.
+
+    if ((this->blockIndex >= this->blocks.size()) || (this->blockOffset + alignedSize > Arena::BlockSize)) {
+        if (this->blockIndex < this->blocks.size())
+            this->blockIndex++;
+
+        if (this->blockIndex >= this->blocks.size()) {
+            buffer newBlock = NewBuffer(Arena::BlockSize);
+
+            if (!newBlock)
+                return NULL;
+
+            this->blocks.push_back(newBlock);
+        }
+
+        this->blockOffset = 0;
+    }
+
+    pointer allocation = &this->blocks[this->blockIndex][this->blockOffset];
+    this->blockOffset += alignedSize;
+
+    return allocation;
+}
+
+cstring Arena::NewCString(const charconst source, const int64 size) {
+    cstring str = static_cast<cstring>(this->Allocate(size + 1));
+
+    if (str) {
+        memcpy(str, source, size);
+        str[size] = '\0';
+    }
+
+    return str;
+}
+
+void Arena::Reset(void) {
+    for (auto largeBlock = this->largeBlocks.begin(); largeBlock != this->largeBlocks.end(); ++largeBlock)
+        DeleteBuffer(*largeBlock);
+
+    this->largeBlocks.clear();
+
+    this->blockIndex  = 0;
+    this->blockOffset = 0;
+}
+
+void Arena::Delete(void) {
+    this->Reset();
+
+    for (auto block = this->blocks.begin(); block != this->blocks.end(); ++block)
+        DeleteBuffer(*block);
+
+    this->blocks.clear();
+}
+
+};    // namespace tinyVM
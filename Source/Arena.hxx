@@ -0,0 +1,48 @@
+/*
+ * Source/Arena.hxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#ifndef VM_ARENA_H
+#define VM_ARENA_H
+
+#include "Core.hxx"
+
+namespace tinyVM {
+
+// Arena
+
+// A bump allocator: allocations are just an offset increment in the current block
+// and everything is released at once by Reset (which keeps the blocks for reuse).
+
+class Arena {
+    public:
+        Arena(void);
+        ~Arena();
+
+        // Constants
+
+        static constexpr int BlockSize = 65536;
+        static constexpr int Alignment = 8;
+
+        // General
+
+        pointer Allocate(const int64 size);
+        cstring NewCString(const charconst source, const int64 size);
+        void    Reset(void);
+        void    Delete(void);
+
+    private:
+        // Blocks
+
+        std::vector<buffer> blocks;
+        std::vector<buffer> largeBlocks;
+        int64               blockIndex;
+        int64               blockOffset;
+};
+
+};    // namespace tinyVM
+
+#endif    // VM_ARENA_H
@@ -7,6 +7,7 @@
 
 #include "Compiler.hxx"
 
+#include "Arena.hxx"
 #include "Core.hxx"
 #include "Parser.hxx"
 #include "Program.hxx"
@@ -17,16 +18,41 @@ namespace tinyVM {
 // Compiler
 
 Compiler::Compiler(void) :
-    parser(new Parser()),
+    arena(new Arena()),
+    parser(new Parser(*this->arena)),
     program(new Program()),
     hostMachine(NULL),
-    operationCounter(0) {
+    operationCounter(0),
+    parameterCounter(0),
+    stringCounter(0),
+    stringBytesCounter(0),
+    codeEncoding(Program::FixedEncoding),
+    isSinglePass(false),
+    hasDebugInfo(false),
+    isOptimizing(false),
+    numberOfThreads(1),
+    isIncremental(false),
+    mainCompiler(this),
+    chunkIndex(0),
+    baseAddress(0),
+    lineCounter(0),
+    endsWithNewLine(false),
+    isCaching(false),
+    cache(new CompilerCache()),
+    cachedProgram(NULL),
+    isCacheBuilt(false),
+    machineVersion(0) {
     // Empty
 }
 
 Compiler::~Compiler() {
+    this->DeleteChunks();
+
     delete this->parser;
     delete this->program;
+    delete this->cachedProgram;
+    delete this->cache;
+    delete this->arena;
 }
 
 // General
@@ -36,13 +62,116 @@ bool Compiler::Load(const string sourceFilePath) {
 }
 
 bool Compiler::Compile(VirtualMachineCore* hostMachine) {
-    this->operationCounter = 0;
-    this->hostMachine      = hostMachine;
+    this->hostMachine  = hostMachine;
+    this->isCacheBuilt = false;
+
+    // A program compiled before from the same source (and for the same machine) is used
+    // as it is.
+
+    string cachedProgramPath;
+
+    if (!this->programCachePath.empty()) {
+        cachedProgramPath = this->GetCachedProgramPath();
+
+        if (this->LoadCachedProgram(cachedProgramPath)) {
+            delete this->cachedProgram;
+            this->cachedProgram = NULL;
+
+            Info("Program loaded from the program cache.");
+            return true;
+        }
+    }
+
+    // Try to recompile only the changed lines first, the cached program is used up
+    // either way.
+
+    if (this->cachedProgram) {
+        bool isRecompiled = false;
+        bool isCompiled   = this->RecompileChanges(isRecompiled);
+
+        delete this->cachedProgram;
+        this->cachedProgram = NULL;
+
+        if (isRecompiled) {
+            this->arena->Reset();
+
+            if (!cachedProgramPath.empty())
+                this->SaveCachedProgram(cachedProgramPath);
+
+            Info("Program compiled successfully.");
+            return true;
+        }
+
+        if (!isCompiled)
+            return false;
+    }
+
+    this->operationCounter   = 0;
+    this->parameterCounter   = 0;
+    this->stringCounter      = 0;
+    this->stringBytesCounter = 0;
     this->labels.clear();
-    this->program->New();
+    this->registers.clear();
+    this->labelReferences.clear();
+    this->addressReferences.clear();
+    this->arena->Reset();
+    this->program->New(this->codeEncoding);
+
+    if (this->SplitSource()) {
+        if (!this->CompileChunks())
+            return false;
+    } else if (this->isSinglePass) {
+        if (!this->CompileSinglePass())
+            return false;
+    } else if ((!this->CompileFirstPass()) || (!this->ReserveProgramMemory()) || (!this->CompileSecondPass()))
+        return false;
+
+    if (this->hasDebugInfo && (!this->EmitLabelEntries()))
+        return false;
 
-    // First pass: create the labels map and count the total number of operations.
+    // The optimized program is written from scratch, with its strings already packed.
 
+    if (this->isOptimizing) {
+        if (!this->OptimizeProgram())
+            return false;
+    } else if (!this->program->PackStrings())
+        return false;
+
+    // All the token values are gone now.
+
+    this->arena->Reset();
+
+    if (this->isIncremental)
+        this->isCacheBuilt = this->BuildCache();
+
+    if (!cachedProgramPath.empty())
+        this->SaveCachedProgram(cachedProgramPath);
+
+    Info("Program compiled successfully.");
+    return true;
+}
+
+bool Compiler::Save(const string binaryFilePath) {
+    if (!this->program->Save(binaryFilePath))
+        return false;
+
+    // A cache that does not match the saved program would never be used anyway.
+
+    string cacheFilePath = binaryFilePath + CompilerCache::FileExtension;
+
+    if (this->isCacheBuilt)
+        this->cache->Save(cacheFilePath, binaryFilePath);
+    else if (this->isIncremental)
+        remove(cacheFilePath.c_str());
+
+    return true;
+}
+
+// Passes
+
+// First pass: create the labels map and count the total number of operations.
+
+bool Compiler::CompileFirstPass(void) {
     Debug("");
     Debug("Doing first pass...");
     Debug("");
@@ -56,17 +185,22 @@ bool Compiler::Compile(VirtualMachineCore* hostMachine) {
             case Parser::Token::Identifier: {
                 this->operationCounter++;
 
-                // Continue reading until we reach a new line or the end of the file.
-
-                Parser::DeleteToken(this->currentToken);
+                // Continue reading until we reach a new line or the end of the file, counting
+                // the parameters and strings so the program memory can be reserved up front.
 
                 while (this->parser->GetNextToken(this->currentToken)) {
-                    if (currentToken.type == Parser::Token::NewLine) {
-                        Parser::DeleteToken(this->currentToken);
+                    if (currentToken.type == Parser::Token::NewLine)
                         break;
-                    }
 
-                    Parser::DeleteToken(this->currentToken);
+                    if (currentToken.type == Parser::Token::ArgumentSeparator)
+                        continue;
+
+                    this->parameterCounter++;
+
+                    if (currentToken.type == Parser::Token::StringLiteral) {
+                        this->stringCounter++;
+                        this->stringBytesCounter += currentToken.value.size;
+                    }
                 }
 
                 break;
@@ -80,7 +214,6 @@ bool Compiler::Compile(VirtualMachineCore* hostMachine) {
             }
 
             case Parser::Token::NewLine: {
-                Parser::DeleteToken(this->currentToken);
                 break;
             }
 
@@ -91,8 +224,28 @@ bool Compiler::Compile(VirtualMachineCore* hostMachine) {
         }
     }
 
-    // Second pass: compile the operations.
+    return true;
+}
+
+// Reserve the program memory for everything counted in the first pass, so the second
+// pass does not have to grow it (the strings are a worst case, repeated ones are stored
+// only once).
+
+bool Compiler::ReserveProgramMemory(void) {
+    int64 codeBytes = this->operationCounter * Program::InstructionSize;
+
+    // Each compact operation code and parameter takes at most 10 bytes, plus the room
+    // the compact Emit checks for before writing.
 
+    if (this->codeEncoding == Program::CompactEncoding)
+        codeBytes = ((this->operationCounter + this->parameterCounter) * 10) + Program::MaxCompactInstructionSize;
+
+    return this->program->Reserve(codeBytes, this->stringBytesCounter, this->stringCounter * 16);
+}
+
+// Second pass: compile the operations.
+
+bool Compiler::CompileSecondPass(void) {
     Debug("");
     Debug("Doing second pass...");
     Debug("");
@@ -113,17 +266,11 @@ bool Compiler::Compile(VirtualMachineCore* hostMachine) {
             }
 
             default: {
-                Parser::DeleteToken(this->currentToken);
-
                 // Keep reading until we reach a new line or the end of the file.
 
                 while (this->parser->GetNextToken(this->currentToken)) {
-                    if (currentToken.type == Parser::Token::NewLine) {
-                        Parser::DeleteToken(this->currentToken);
+                    if (currentToken.type == Parser::Token::NewLine)
                         break;
-                    }
-
-                    Parser::DeleteToken(this->currentToken);
                 }
 
                 break;
@@ -131,203 +278,1126 @@ bool Compiler::Compile(VirtualMachineCore* hostMachine) {
         }
     }
 
-    Info("Program compiled successfully.");
     return true;
 }
 
-bool Compiler::Save(const string binaryFilePath) {
-    return this->program->Save(binaryFilePath);
+// Single pass: compile the operations as they come and patch the forward label
+// references at the end.
+
+bool Compiler::CompileSinglePass(void) {
+    Debug("");
+    Debug("Doing single pass...");
+    Debug("");
+
+    this->parser->Reset();
+
+    while (this->parser->GetNextToken(this->currentToken)) {
+        switch (this->currentToken.type) {
+            case Parser::Token::Identifier: {
+                if (!this->CompileOperation())
+                    return false;
+
+                break;
+            }
+
+            case Parser::Token::Label: {
+                if (!this->CompileLabel())
+                    return false;
+
+                break;
+            }
+
+            case Parser::Token::NewLine: {
+                break;
+            }
+
+            default: {
+                Error("Line %d: operation identifier or label expected, but \"%s\" was found.", currentToken.line, this->parser->TokenValueToString(currentToken).c_str());
+                return false;
+            }
+        }
+    }
+
+    return this->ResolveReferences();
+}
+
+bool Compiler::ResolveReferences(void) {
+    Debug("Resolving %ld label references...", this->labelReferences.size());
+
+    for (auto labelReference = this->labelReferences.begin(); labelReference != this->labelReferences.end(); ++labelReference) {
+        auto foundLabel = this->labels.find(labelReference->label);
+
+        if (foundLabel == this->labels.end()) {
+            Error("Line %ld: label !%s not found.", labelReference->line, labelReference->label.c_str());
+            return false;
+        }
+
+        if (!this->program->PatchAddress(labelReference->codeOffset, foundLabel->second))
+            return false;
+    }
+
+    for (auto addressReference = this->addressReferences.begin(); addressReference != this->addressReferences.end(); ++addressReference)
+        if (addressReference->address >= this->operationCounter) {
+            Error("Line %ld: address @%ld out of range.", addressReference->line, addressReference->address);
+            return false;
+        }
+
+    return true;
+}
+
+// Optimization: rewrite the program without the NOPs and with the host machine
+// superinstructions (see Optimizer).
+
+bool Compiler::OptimizeProgram(void) {
+    Optimizer optimizer(this->hostMachine);
+    Program*  optimizedProgram = new Program();
+
+    if (!optimizer.Optimize(*this->program, *optimizedProgram)) {
+        delete optimizedProgram;
+        return false;
+    }
+
+    delete this->program;
+    this->program = optimizedProgram;
+
+    return true;
+}
+
+// Options
+
+void Compiler::SetCodeEncoding(const Program::CodeEncoding codeEncoding) {
+    this->codeEncoding = codeEncoding;
+}
+
+void Compiler::SetSinglePass(const bool isSinglePass) {
+    this->isSinglePass = isSinglePass;
+}
+
+void Compiler::SetDebugInfo(const bool hasDebugInfo) {
+    this->hasDebugInfo = hasDebugInfo;
+}
+
+void Compiler::SetOptimize(const bool isOptimizing) {
+    this->isOptimizing = isOptimizing;
+}
+
+void Compiler::SetNumberOfThreads(const int numberOfThreads) {
+    this->numberOfThreads = numberOfThreads;
+}
+
+void Compiler::SetIncremental(const bool isIncremental) {
+    this->isIncremental = isIncremental;
+}
+
+bool Compiler::LoadCache(const string binaryFilePath) {
+    delete this->cachedProgram;
+    this->cachedProgram = NULL;
+
+    if (!this->cache->Load(binaryFilePath + CompilerCache::FileExtension, binaryFilePath))
+        return false;
+
+    // The cached program must be the one the cache was built for.
+
+    Program* cachedProgram = new Program();
+
+    if ((!cachedProgram->Load(binaryFilePath)) || (cachedProgram->GetCodeEncoding() != Program::FixedEncoding) || (cachedProgram->GetNumberOfInstructions() != static_cast<int64>(this->cache->instructionLines.size()))) {
+        Warning("The program \"%s\" does not match its compiler cache.", binaryFilePath.c_str());
+
+        delete cachedProgram;
+        this->cache->Clear();
+
+        return false;
+    }
+
+    this->cachedProgram = cachedProgram;
+    return true;
+}
+
+void Compiler::SetProgramCache(const string directoryPath, const string machineName, const uint machineVersion) {
+    this->programCachePath = directoryPath;
+    this->machineName      = machineName;
+    this->machineVersion   = machineVersion;
 }
 
 bool Compiler::CompileOperation(void) {
-    Debug("Compiling operation \"%s\"...", this->currentToken.value->asString);
+    Debug("Compiling operation \"%.*s\"...", static_cast<int>(this->currentToken.value.size), this->currentToken.value.asString);
+
+    // The parameter values live on the stack (strings point to the token values in
+    // the source code), there is nothing to allocate or free for them.
 
     int                                         parameterIndex = 0;
     VirtualMachineCore::OperationParameterTypes parameterTypes;
     Program::InstructionParameters              instructionParameters;
+    Value                                       parameterValues[4];
+    Value                                       pendingLabels[4];
 
     memset(parameterTypes, 0, sizeof(parameterTypes));
     memset(instructionParameters, 0, sizeof(instructionParameters));
+    memset(pendingLabels, 0, sizeof(pendingLabels));
 
     int64  line     = this->currentToken.line;
-    string mnemonic = this->currentToken.value->asString;
-    Parser::DeleteToken(this->currentToken);
+    string mnemonic(this->currentToken.value.asString, this->currentToken.value.size);
 
     // Get the operation parameters and try to find an operation that matches
     // the mnemonic and the parameter types.
 
     while (this->parser->GetNextToken(this->currentToken)) {
-        if (this->currentToken.type == Parser::Token::NewLine) {
-            Parser::DeleteToken(this->currentToken);
-            Program::DeleteParameters(instructionParameters);
+        if (this->currentToken.type == Parser::Token::NewLine)
             break;
-        }
 
-        if (parameterIndex == 3) {
+        if (parameterIndex == 4) {
             Error("Line %ld: too many parameters.", line);
-            Parser::DeleteToken(this->currentToken);
-            Program::DeleteParameters(instructionParameters);
             return false;
         }
 
         switch (this->currentToken.type) {
             case Parser::Token::Identifier: {
-                parameterTypes[parameterIndex++]      = VirtualMachineCore::Identifier;
-                instructionParameters[parameterIndex] = NewStringValue(this->currentToken.value->asString);
+                // Identifiers are registers, numbered in the order they first show up.
+
+                int64 registerIndex = this->GetRegisterIndex();
+
+                if (registerIndex < 0) {
+                    Error("Line %ld: too many registers (the maximum is %ld).", line, VirtualMachineCore::MaxNumberOfRegisters);
+                    return false;
+                }
+
+                parameterTypes[parameterIndex]        = VirtualMachineCore::Identifier;
+                instructionParameters[parameterIndex] = this->SetParameterValue(parameterValues[parameterIndex], registerIndex);
                 break;
             }
 
             case Parser::Token::Label: {
                 // Find the label address and use it.
 
-                auto foundLabel = this->labels.find(this->currentToken.value->asString);
+                // In single pass mode a label that was not declared yet may still come later,
+                // so its address is patched once the whole source was compiled.
 
-                if (foundLabel == this->labels.end()) {
-                    Error("Line %ld: label !%s not found.", line, this->currentToken.value->asString);
-                    Parser::DeleteToken(this->currentToken);
-                    Program::DeleteParameters(instructionParameters);
-                    return false;
+                int64 labelAddress = Program::AddressPlaceholder;
+
+                if (!this->FindLabel(labelAddress)) {
+                    if (!this->isSinglePass) {
+                        Error("Line %ld: label !%.*s not found.", line, static_cast<int>(this->currentToken.value.size), this->currentToken.value.asString);
+                        return false;
+                    }
+
+                    pendingLabels[parameterIndex] = this->currentToken.value;
                 }
 
-                parameterTypes[parameterIndex++]      = VirtualMachineCore::Address;
-                instructionParameters[parameterIndex] = NewIntValue(foundLabel->second);
+                parameterTypes[parameterIndex]        = VirtualMachineCore::Address;
+                instructionParameters[parameterIndex] = this->SetParameterValue(parameterValues[parameterIndex], labelAddress);
 
                 break;
             }
 
             case Parser::Token::Address: {
-                if (this->currentToken.value->asInt >= this->operationCounter) {
-                    Error("Line %ld: address @%ld out of range.", line, this->currentToken.value->asInt);
-                    Parser::DeleteToken(this->currentToken);
-                    Program::DeleteParameters(instructionParameters);
+                // The total number of operations is only known at the end in single pass mode.
+
+                if (this->isSinglePass) {
+                    AddressReference addressReference = {this->currentToken.value.asInt, line};
+                    this->addressReferences.push_back(addressReference);
+                } else if (this->currentToken.value.asInt >= this->mainCompiler->operationCounter) {
+                    Error("Line %ld: address @%ld out of range.", line, this->currentToken.value.asInt);
                     return false;
                 }
 
-                parameterTypes[parameterIndex++]      = VirtualMachineCore::Address;
-                instructionParameters[parameterIndex] = NewIntValue(this->currentToken.value->asInt);
+                parameterTypes[parameterIndex]        = VirtualMachineCore::Address;
+                instructionParameters[parameterIndex] = this->SetParameterValue(parameterValues[parameterIndex], this->currentToken.value);
 
                 break;
             }
 
             case Parser::Token::IntLiteral: {
-                parameterTypes[parameterIndex++]      = VirtualMachineCore::IntLiteral;
-                instructionParameters[parameterIndex] = NewIntValue(this->currentToken.value->asInt);
+                parameterTypes[parameterIndex]        = VirtualMachineCore::IntLiteral;
+                instructionParameters[parameterIndex] = this->SetParameterValue(parameterValues[parameterIndex], this->currentToken.value);
                 break;
             }
 
             case Parser::Token::BoolLiteral: {
-                parameterTypes[parameterIndex++]      = VirtualMachineCore::BoolLiteral;
-                instructionParameters[parameterIndex] = NewBoolValue(this->currentToken.value->asBool);
+                parameterTypes[parameterIndex]        = VirtualMachineCore::BoolLiteral;
+                instructionParameters[parameterIndex] = this->SetParameterValue(parameterValues[parameterIndex], this->currentToken.value);
                 break;
             }
 
             case Parser::Token::FloatLiteral: {
-                parameterTypes[parameterIndex++]      = VirtualMachineCore::FloatLiteral;
-                instructionParameters[parameterIndex] = NewFloatValue(this->currentToken.value->asFloat);
+                parameterTypes[parameterIndex]        = VirtualMachineCore::FloatLiteral;
+                instructionParameters[parameterIndex] = this->SetParameterValue(parameterValues[parameterIndex], this->currentToken.value);
                 break;
             }
 
             case Parser::Token::StringLiteral: {
-                parameterTypes[parameterIndex++]      = VirtualMachineCore::StringLiteral;
-                instructionParameters[parameterIndex] = NewStringValue(this->currentToken.value->asString);
+                parameterTypes[parameterIndex]        = VirtualMachineCore::StringLiteral;
+                instructionParameters[parameterIndex] = this->SetParameterValue(parameterValues[parameterIndex], this->currentToken.value);
                 break;
             }
 
             case Parser::Token::ArgumentSeparator: {
                 Error("Line %ld: parameter expected, but parameter separator found.", line);
-                Parser::DeleteToken(this->currentToken);
-                Program::DeleteParameters(instructionParameters);
                 return false;
             }
 
             default: {
                 Error("Line %ld: unexpected token type.", line);
-                Parser::DeleteToken(this->currentToken);
-                Program::DeleteParameters(instructionParameters);
                 return false;
             }
         }
 
-        Parser::DeleteToken(this->currentToken);
+        parameterIndex++;
 
         // After any parameter type we must have a parameter separator, a new line or the end of the file.
 
         if (this->parser->GetNextToken(this->currentToken)) {
             if ((this->currentToken.type != Parser::Token::ArgumentSeparator) && (this->currentToken.type != Parser::Token::NewLine)) {
                 Error("Line %ld: parameter separator or new line expected, but \"%s\" was found.", line, this->parser->TokenValueToString(this->currentToken).c_str());
-                Parser::DeleteToken(this->currentToken);
-                Program::DeleteParameters(instructionParameters);
                 return false;
             }
 
-            Parser::DeleteToken(this->currentToken);
+            if (this->currentToken.type == Parser::Token::NewLine)
+                break;
         }
     }
 
-    // Try to find and operation the matches the specified mnemonic and the parameter types.
+    // Find the operation that matches the specified mnemonic and the parameter types.
 
-    int  numberOfParameters = parameterIndex;
-    bool operationFound     = false;
+    int numberOfParameters = parameterIndex;
 
     Debug("Parameters: %d.", numberOfParameters);
 
-    const VirtualMachineCore::OperationList& vmOperations = this->hostMachine->GetOperations();
+    const VirtualMachineCore::Operation* foundOperation = this->hostMachine->FindOperation(mnemonic, parameterTypes);
 
-    for (auto currentOperation = vmOperations.begin(); currentOperation != vmOperations.end(); currentOperation++) {
-        if (currentOperation->mnemonic != mnemonic)
-            continue;
+    if (!foundOperation) {
+        Error("Line %d: unkown operation (%s) or could not find one that matches the specified parameters.", line, mnemonic.c_str());
+        return false;
+    }
+
+    Debug("Operation found with opcode %d.", foundOperation->opCode);
+
+    int64 parameterOffsets[4];
+    int64 address = this->baseAddress + this->program->GetNumberOfInstructions();
 
-        operationFound = true;
+    if (!this->program->Emit(foundOperation->opCode, instructionParameters, parameterOffsets))
+        return false;
+
+    // The chunk string indexes change when its program is appended to the main one.
 
+    if (this->mainCompiler != this)
         for (parameterIndex = 0; parameterIndex < numberOfParameters; ++parameterIndex)
-            if (parameterTypes[parameterIndex] != currentOperation->parameterTypes[parameterIndex]) {
-                operationFound = false;
-                break;
-            }
+            if (parameterTypes[parameterIndex] == VirtualMachineCore::StringLiteral)
+                this->stringOffsets.push_back(parameterOffsets[parameterIndex]);
 
-        if (operationFound) {
-            Debug("Operation found with opcode %d.", currentOperation->opCode);
-            this->program->Emit(currentOperation->opCode, instructionParameters);
-            break;
+    if (this->hasDebugInfo && (!this->program->AddLineEntry(address, line)))
+        return false;
+
+    for (parameterIndex = 0; parameterIndex < numberOfParameters; ++parameterIndex)
+        if (pendingLabels[parameterIndex].asString) {
+            LabelReference labelReference = {string(pendingLabels[parameterIndex].asString, pendingLabels[parameterIndex].size), parameterOffsets[parameterIndex], line};
+            this->labelReferences.push_back(labelReference);
         }
-    }
 
-    Program::DeleteParameters(instructionParameters);
+    if (this->isSinglePass)
+        this->operationCounter++;
 
-    if (!operationFound)
-        Error("Line %d: unkown operation (%s) or could not find one that matches the specified parameters.", line, mnemonic.c_str());
+    return true;
+}
 
-    return operationFound;
+val Compiler::SetParameterValue(Value& parameterValue, const Value& tokenValue) {
+    parameterValue = tokenValue;
+    return &parameterValue;
+}
+
+val Compiler::SetParameterValue(Value& parameterValue, const int64 intValue) {
+    parameterValue.type  = Value::Int;
+    parameterValue.size  = sizeof(int64);
+    parameterValue.asInt = intValue;
+
+    return &parameterValue;
 }
 
 // Labels
 
 bool Compiler::CompileLabel(void) {
-    auto foundLabel = this->labels.find(this->currentToken.value->asString);
+    string label(this->currentToken.value.asString, this->currentToken.value.size);
+    auto   foundLabel = this->labels.find(label);
 
     if (foundLabel != this->labels.end()) {
-        Error("Line %d: label !%s redeclared.", this->currentToken.line, this->currentToken.value->asString);
-        Parser::DeleteToken(this->currentToken);
+        Error("Line %d: label !%s redeclared.", this->currentToken.line, label.c_str());
         return false;
     }
 
-    Debug("Label !%s at operation %d.", this->currentToken.value->asString, this->operationCounter + 1);
-    this->labels[this->currentToken.value->asString] = this->operationCounter + 1;
-    Parser::DeleteToken(this->currentToken);
+    Debug("Label !%s at operation %ld.", label.c_str(), this->operationCounter);
+    this->labels[label] = this->operationCounter;
 
     // There must be a new line after the label declaration.
 
     if (this->parser->GetNextToken(this->currentToken)) {
         if (this->currentToken.type != Parser::Token::NewLine) {
             Error("Line %d: a label declaration must be followed by a new line.", this->currentToken.line);
-            Parser::DeleteToken(this->currentToken);
             return false;
         }
+    }
+
+    return true;
+}
+
+bool Compiler::FindLabel(int64& labelAddress) const {
+    const std::map<string, int64>* labelsMap = &this->mainCompiler->labels;
+    const Value&                   labelName = this->currentToken.value;
+
+    if (!this->mainCompiler->labelShards.empty())
+        labelsMap = &this->mainCompiler->labelShards[Hash(labelName.asString, labelName.size) % this->mainCompiler->labelShards.size()];
+
+    auto foundLabel = labelsMap->find(string(labelName.asString, labelName.size));
+
+    if (foundLabel == labelsMap->end())
+        return false;
+
+    labelAddress = foundLabel->second;
+    return true;
+}
+
+bool Compiler::EmitLabelEntries(void) {
+    for (auto label = this->labels.begin(); label != this->labels.end(); ++label)
+        if (!this->program->AddLabelEntry(label->second, label->first.data(), label->first.size()))
+            return false;
+
+    return true;
+}
+
+// Registers
+
+int64 Compiler::GetRegisterIndex(void) {
+    string registerName(this->currentToken.value.asString, this->currentToken.value.size);
+    auto   foundRegister = this->mainCompiler->registers.find(registerName);
+
+    if (foundRegister != this->mainCompiler->registers.end())
+        return foundRegister->second;
+
+    // The registers of the chunks are all merged before they are compiled.
+
+    if ((this->mainCompiler != this) || (this->registers.size() >= VirtualMachineCore::MaxNumberOfRegisters))
+        return -1;
+
+    int64 registerIndex           = this->registers.size();
+    this->registers[registerName] = registerIndex;
+
+    Debug("Register %s is %ld.", registerName.c_str(), registerIndex);
+    return registerIndex;
+}
+
+// Chunks
+
+// Splits the source in chunks and gets them ready to be compiled, or returns false (with
+// everything as it was) when the source has to be compiled serially.
+
+bool Compiler::SplitSource(void) {
+    if (this->ScanChunks())
+        return true;
+
+    this->DeleteChunks();
+
+    this->operationCounter   = 0;
+    this->parameterCounter   = 0;
+    this->stringCounter      = 0;
+    this->stringBytesCounter = 0;
+    this->registers.clear();
+
+    return false;
+}
+
+bool Compiler::ScanChunks(void) {
+    const Memory* sourceCode = this->parser->GetSourceCode();
+
+    if ((!sourceCode) || (this->numberOfThreads == 1))
+        return false;
+
+    int64 numberOfChunks = (this->numberOfThreads > 0) ? this->numberOfThreads : std::max(1U, std::thread::hardware_concurrency());
+    numberOfChunks       = std::min(numberOfChunks, sourceCode->size / Compiler::MinChunkSize);
+
+    if (numberOfChunks < 2)
+        return false;
+
+    // Each chunk ends right after the first line end past its share of the source.
+
+    charconst source     = reinterpret_cast<charconst>(sourceCode->data);
+    int64     sourceSize = sourceCode->size;
+    int64     chunkStart = 0;
+
+    while ((chunkStart < sourceSize) && (static_cast<int64>(this->chunks.size()) < numberOfChunks)) {
+        int64 chunkEnd = sourceSize;
+
+        if (static_cast<int64>(this->chunks.size()) < numberOfChunks - 1) {
+            int64       splitIndex = std::max(chunkStart, (sourceSize / numberOfChunks) * static_cast<int64>(this->chunks.size() + 1));
+            const void* lineEnd    = memchr(&source[splitIndex], '\n', sourceSize - splitIndex);
+
+            if (lineEnd)
+                chunkEnd = (static_cast<charconst>(lineEnd) - source) + 1;
+        }
+
+        if (!this->NewChunk(chunkStart, chunkEnd - chunkStart, 1))
+            return false;
 
-        Parser::DeleteToken(this->currentToken);
+        chunkStart = chunkEnd;
     }
 
+    if (this->chunks.size() < 2)
+        return false;
+
+    this->labelShards.resize(this->chunks.size());
+
+    for (auto chunk = this->chunks.begin(); chunk != this->chunks.end(); ++chunk)
+        (*chunk)->chunkLabels.resize(this->chunks.size());
+
+    if (!this->RunChunks(&Compiler::ScanChunk))
+        return false;
+
+    // Merge the chunk counters and registers (in the order they first show up). A chunk
+    // that does not end with a new line token has a token that goes into the next one.
+
+    int firstLine = 1;
+
+    for (auto chunk = this->chunks.begin(); chunk != this->chunks.end(); ++chunk) {
+        Compiler* chunkCompiler = *chunk;
+
+        if ((!chunkCompiler->endsWithNewLine) && (chunkCompiler != this->chunks.back()))
+            return false;
+
+        chunkCompiler->baseAddress = this->operationCounter;
+        chunkCompiler->parser->SetFirstLine(firstLine);
+
+        firstLine                += chunkCompiler->lineCounter;
+        this->operationCounter   += chunkCompiler->operationCounter;
+        this->parameterCounter   += chunkCompiler->parameterCounter;
+        this->stringCounter      += chunkCompiler->stringCounter;
+        this->stringBytesCounter += chunkCompiler->stringBytesCounter;
+
+        if (!this->MergeRegisters(*chunkCompiler))
+            return false;
+    }
+
+    // The labels are merged in parallel, each chunk compiler fills one of the shards.
+
+    return this->RunChunks(&Compiler::MergeLabelShard);
+}
+
+// Adds the registers of a chunk that are new (in the order they first show up in it).
+
+bool Compiler::MergeRegisters(const Compiler& chunkCompiler) {
+    std::vector<const string*> registerNames(chunkCompiler.registers.size());
+
+    for (auto chunkRegister = chunkCompiler.registers.begin(); chunkRegister != chunkCompiler.registers.end(); ++chunkRegister)
+        registerNames[chunkRegister->second] = &chunkRegister->first;
+
+    for (auto registerName = registerNames.begin(); registerName != registerNames.end(); ++registerName) {
+        if (this->registers.find(**registerName) != this->registers.end())
+            continue;
+
+        if (this->registers.size() >= VirtualMachineCore::MaxNumberOfRegisters)
+            return false;
+
+        int64 registerIndex              = this->registers.size();
+        this->registers[**registerName] = registerIndex;
+    }
+
+    return true;
+}
+
+// Compiles the chunks and appends their programs to the main one, in order. There is no
+// going back to the serial passes from here: every chunk reports its own errors.
+
+bool Compiler::CompileChunks(void) {
+    Debug("");
+    Debug("Compiling %ld chunks...", this->chunks.size());
+    Debug("");
+
+    bool  isCompiled = this->RunChunks(&Compiler::CompileChunk);
+    bool  isMerged   = isCompiled;
+    int64 codeBytes  = 0;
+
+    for (auto chunk = this->chunks.begin(); chunk != this->chunks.end(); ++chunk)
+        codeBytes += (*chunk)->program->GetCode()->index;
+
+    if (isMerged)
+        isMerged = this->program->Reserve(codeBytes, this->stringBytesCounter, this->stringCounter * 16);
+
+    for (auto chunk = this->chunks.begin(); (chunk != this->chunks.end()) && isMerged; ++chunk) {
+        isMerged = this->program->Append(*(*chunk)->program, (*chunk)->stringOffsets);
+        (*chunk)->program->Delete();
+    }
+
+    if (isMerged && this->hasDebugInfo)
+        for (auto labelShard = this->labelShards.begin(); labelShard != this->labelShards.end(); ++labelShard)
+            this->labels.insert(labelShard->begin(), labelShard->end());
+
+    this->DeleteChunks();
+
+    if (isCompiled && (!isMerged))
+        Error("Could not merge the compiled chunks.");
+
+    return isMerged;
+}
+
+bool Compiler::NewChunk(const int64 chunkStart, const int64 chunkSize, const int firstLine) {
+    Compiler* chunk = new (std::nothrow) Compiler();
+
+    if (!chunk)
+        return false;
+
+    this->chunks.push_back(chunk);
+
+    chunk->mainCompiler = this;
+    chunk->hostMachine  = this->hostMachine;
+    chunk->codeEncoding = this->codeEncoding;
+    chunk->hasDebugInfo = this->hasDebugInfo;
+    chunk->chunkIndex   = this->chunks.size() - 1;
+
+    if (!chunk->parser->LoadChunk(*this->parser, chunkStart, chunkSize))
+        return false;
+
+    chunk->parser->SetFirstLine(firstLine);
+    return chunk->program->New(this->codeEncoding);
+}
+
+void Compiler::DeleteChunks(void) {
+    for (auto chunk = this->chunks.begin(); chunk != this->chunks.end(); ++chunk)
+        delete *chunk;
+
+    this->chunks.clear();
+    this->labelShards.clear();
+}
+
+bool Compiler::RunChunks(bool (Compiler::*chunkPass)(void)) {
+    std::vector<std::thread> threads;
+    std::vector<uint8>       results(this->chunks.size(), 0);
+
+    for (int64 chunkIndex = 0; chunkIndex < static_cast<int64>(this->chunks.size()); ++chunkIndex)
+        threads.push_back(std::thread([this, chunkPass, chunkIndex, &results]() {
+            results[chunkIndex] = (this->chunks[chunkIndex]->*chunkPass)() ? 1 : 0;
+        }));
+
+    for (auto thread = threads.begin(); thread != threads.end(); ++thread)
+        thread->join();
+
+    return std::find(results.begin(), results.end(), 0) == results.end();
+}
+
+// Chunk passes: they run on the chunk compilers, each on its own thread.
+
+// Scans the chunk like the first pass does, but quietly: anything unexpected makes the
+// main compiler go back to the serial passes, which report it.
+
+bool Compiler::ScanChunk(void) {
+    const Memory* sourceCode     = this->parser->GetSourceCode();
+    int64         numberOfShards = this->chunkLabels.size();
+    int64         parameterIndex = 0;
+    bool          isLineStart    = true;
+    bool          isLabelLine    = false;
+
+    this->parser->Reset();
+
+    while (this->parser->GetNextToken(this->currentToken)) {
+        const Value& tokenValue = this->currentToken.value;
+
+        if (this->currentToken.type == Parser::Token::NewLine) {
+            this->lineCounter++;
+            isLineStart = true;
+            continue;
+        }
+
+        // The cache keeps each line on its own, no token may span a line end.
+
+        if (this->isCaching) {
+            const void* tokenData = &sourceCode->data[this->currentToken.offset];
+
+            if (memchr(tokenData, '\n', this->currentToken.length) || memchr(tokenData, '\r', this->currentToken.length))
+                return false;
+        }
+
+        // A label must be alone in its line, an operation is followed by its parameters.
+
+        if (!isLineStart) {
+            if (isLabelLine)
+                return false;
+
+            if (this->currentToken.type == Parser::Token::ArgumentSeparator)
+                continue;
+
+            this->parameterCounter++;
+
+            // Label parameters are where the addresses that may move are (in the fixed
+            // encoding).
+
+            if (this->isCaching) {
+                if (this->currentToken.type == Parser::Token::Label) {
+                    int64          codeOffset     = ((this->operationCounter - 1) * Program::InstructionSize) + ((parameterIndex + 1) * 8);
+                    LabelReference labelReference = {string(tokenValue.asString, tokenValue.size), codeOffset, this->currentToken.line};
+
+                    this->labelReferences.push_back(labelReference);
+                } else if (this->currentToken.type == Parser::Token::Address) {
+                    AddressReference addressReference = {tokenValue.asInt, this->currentToken.line};
+                    this->addressReferences.push_back(addressReference);
+                }
+            }
+
+            parameterIndex++;
+
+            if (this->currentToken.type == Parser::Token::StringLiteral) {
+                this->stringCounter++;
+                this->stringBytesCounter += tokenValue.size;
+            } else if (this->currentToken.type == Parser::Token::Identifier) {
+                string registerName(tokenValue.asString, tokenValue.size);
+
+                if (this->registers.find(registerName) == this->registers.end()) {
+                    int64 registerIndex           = this->registers.size();
+                    this->registers[registerName] = registerIndex;
+                }
+            }
+
+            continue;
+        }
+
+        isLineStart = false;
+        isLabelLine = (this->currentToken.type == Parser::Token::Label);
+
+        if (this->currentToken.type == Parser::Token::Identifier) {
+            this->operationCounter++;
+            parameterIndex = 0;
+
+            if (this->isCaching)
+                this->instructionLines.push_back(this->currentToken.line);
+        } else if (isLabelLine) {
+            ChunkLabel chunkLabel = {string(tokenValue.asString, tokenValue.size), this->operationCounter, this->currentToken.line};
+            this->chunkLabels[Hash(tokenValue.asString, tokenValue.size) % numberOfShards].push_back(chunkLabel);
+        } else
+            return false;
+    }
+
+    this->endsWithNewLine = isLineStart;
     return true;
 }
 
+// Fills the label shard of this chunk with the labels of every chunk.
+
+bool Compiler::MergeLabelShard(void) {
+    std::map<string, int64>& labelShard = this->mainCompiler->labelShards[this->chunkIndex];
+
+    for (auto chunk = this->mainCompiler->chunks.begin(); chunk != this->mainCompiler->chunks.end(); ++chunk) {
+        const std::vector<ChunkLabel>& labelsList = (*chunk)->chunkLabels[this->chunkIndex];
+
+        for (auto chunkLabel = labelsList.begin(); chunkLabel != labelsList.end(); ++chunkLabel)
+            if (!labelShard.insert(std::make_pair(chunkLabel->name, (*chunk)->baseAddress + chunkLabel->address)).second)
+                return false;
+    }
+
+    return true;
+}
+
+bool Compiler::CompileChunk(void) {
+    return this->ReserveProgramMemory() && this->CompileSecondPass();
+}
+
+// Compiler Cache
+
+bool Compiler::BuildCache(void) {
+    CompilerCache& cache      = *this->cache;
+    const Memory*  sourceCode = this->parser->GetSourceCode();
+
+    cache.Clear();
+
+    if ((!sourceCode) || (this->codeEncoding != Program::FixedEncoding) || this->isOptimizing || (!this->NewChunk(0, sourceCode->size, 1))) {
+        this->DeleteChunks();
+        return false;
+    }
+
+    Compiler*          chunkCompiler = this->chunks.back();
+    std::vector<int64> lineStarts;
+
+    chunkCompiler->isCaching = true;
+    chunkCompiler->chunkLabels.resize(1);
+
+    CompilerCache::HashLines(sourceCode, cache.lineHashes, lineStarts);
+
+    bool isBuilt = chunkCompiler->ScanChunk() && (chunkCompiler->lineCounter + 1 == static_cast<int64>(cache.lineHashes.size())) && (chunkCompiler->operationCounter == this->program->GetNumberOfInstructions());
+
+    if (isBuilt) {
+        const std::vector<ChunkLabel>& chunkLabels = chunkCompiler->chunkLabels[0];
+
+        cache.hasDebugInfo   = this->hasDebugInfo;
+        cache.operationsHash = static_cast<uint32>(this->hostMachine->GetOperationsHash());
+        cache.instructionLines.swap(chunkCompiler->instructionLines);
+
+        for (auto chunkLabel = chunkLabels.begin(); chunkLabel != chunkLabels.end(); ++chunkLabel) {
+            CompilerCache::Label label = {chunkLabel->name, chunkLabel->address, chunkLabel->line};
+            cache.labels.push_back(label);
+        }
+
+        std::sort(cache.labels.begin(), cache.labels.end(), [](const CompilerCache::Label& firstLabel, const CompilerCache::Label& secondLabel) {
+            return firstLabel.name < secondLabel.name;
+        });
+
+        for (auto labelReference = chunkCompiler->labelReferences.begin(); labelReference != chunkCompiler->labelReferences.end(); ++labelReference) {
+            CompilerCache::Reference reference = {cache.FindLabel(labelReference->label), labelReference->codeOffset};
+
+            isBuilt = isBuilt && (reference.labelIndex >= 0);
+            cache.references.push_back(reference);
+        }
+
+        for (auto addressReference = chunkCompiler->addressReferences.begin(); addressReference != chunkCompiler->addressReferences.end(); ++addressReference)
+            cache.maxAddress = std::max(cache.maxAddress, addressReference->address);
+
+        cache.registers.resize(this->registers.size());
+
+        for (auto registerEntry = this->registers.begin(); registerEntry != this->registers.end(); ++registerEntry)
+            cache.registers[registerEntry->second] = registerEntry->first;
+    }
+
+    this->DeleteChunks();
+
+    if (!isBuilt) {
+        Warning("The source cannot be compiled incrementally (a token spans a line end), no compiler cache was built.");
+        cache.Clear();
+    }
+
+    return isBuilt;
+}
+
+// Recompiles the changed lines into the cached program, which becomes the compiled one.
+// Returns false only when the changed lines have errors, isRecompiled is false when the
+// whole source has to be compiled.
+
+bool Compiler::RecompileChanges(bool& isRecompiled) {
+    CompilerCache* nextCache  = new CompilerCache();
+    bool           isCompiled = this->PatchChanges(*nextCache, isRecompiled);
+
+    this->DeleteChunks();
+
+    if (isRecompiled) {
+        std::swap(this->cache, nextCache);
+        this->isCacheBuilt = true;
+    }
+
+    delete nextCache;
+    return isCompiled;
+}
+
+bool Compiler::PatchChanges(CompilerCache& nextCache, bool& isRecompiled) {
+    const CompilerCache& cache      = *this->cache;
+    const Memory*        sourceCode = this->parser->GetSourceCode();
+
+    isRecompiled = false;
+
+    if ((!sourceCode) || (this->codeEncoding != Program::FixedEncoding) || this->isOptimizing || (this->hasDebugInfo != cache.hasDebugInfo))
+        return true;
+
+    // The unchanged lines were compiled to the operations of the machine the cache was
+    // saved for, which may have other operation codes (or parameter types) than this one.
+
+    if (cache.operationsHash != static_cast<uint32>(this->hostMachine->GetOperationsHash())) {
+        Info("The compiler cache is out of date (the host machine operations changed).");
+        return true;
+    }
+
+    if (!this->cachedProgram->Edit())
+        return true;
+
+    int64 numberOfStrings = this->cachedProgram->GetNumberOfStrings();
+
+    // Find the changed lines.
+
+    std::vector<CompilerCache::Change> changes;
+    std::vector<int64>                 lineStarts;
+
+    CompilerCache::HashLines(sourceCode, nextCache.lineHashes, lineStarts);
+
+    if (!CompilerCache::FindChanges(cache.lineHashes, nextCache.lineHashes, changes)) {
+        Info("More than %ld lines changed, compiling the whole source.", CompilerCache::MaxChangedLines);
+        return true;
+    }
+
+    // Scan each changed region with a chunk compiler (a region that ends the source has no
+    // line end after its last line). The code after a region moves by the difference in
+    // its number of instructions, the shifts are kept for each number of changes before.
+
+    int64              numberOfLines   = nextCache.lineHashes.size();
+    int64              numberOfChanges = changes.size();
+    std::vector<int64> firstAddresses(numberOfChanges);
+    std::vector<int64> endAddresses(numberOfChanges);
+    std::vector<int64> changeEnds(numberOfChanges);
+    std::vector<int64> addressShifts(numberOfChanges + 1, 0);
+    std::vector<int64> lineShifts(numberOfChanges + 1, 0);
+    int64              changedLines = 0;
+
+    this->operationCounter = cache.instructionLines.size();
+    this->labels.clear();
+    this->registers.clear();
+
+    for (int64 registerIndex = 0; registerIndex < static_cast<int64>(cache.registers.size()); ++registerIndex)
+        this->registers[cache.registers[registerIndex]] = registerIndex;
+
+    for (int64 changeIndex = 0; changeIndex < numberOfChanges; ++changeIndex) {
+        const CompilerCache::Change& change = changes[changeIndex];
+
+        bool  isSourceEnd = (change.newEnd >= numberOfLines);
+        int64 regionStart = (change.newStart < numberOfLines) ? lineStarts[change.newStart] : sourceCode->size;
+        int64 regionEnd   = isSourceEnd ? sourceCode->size : lineStarts[change.newEnd];
+        int64 lineEnds    = isSourceEnd ? std::max<int64>(0, change.newEnd - change.newStart - 1) : change.newEnd - change.newStart;
+
+        if (!this->NewChunk(regionStart, regionEnd - regionStart, change.newStart + 1))
+            return true;
+
+        Compiler* chunkCompiler = this->chunks.back();
+
+        chunkCompiler->hasDebugInfo = false;
+        chunkCompiler->isCaching    = true;
+        chunkCompiler->chunkLabels.resize(1);
+
+        if ((!chunkCompiler->ScanChunk()) || (chunkCompiler->lineCounter != lineEnds) || ((!chunkCompiler->endsWithNewLine) && (!isSourceEnd)) || (!this->MergeRegisters(*chunkCompiler))) {
+            Info("The lines changed at line %ld cannot be compiled on their own, compiling the whole source.", change.newStart + 1);
+            return true;
+        }
+
+        // The old instructions of the region are the ones of its old lines.
+
+        firstAddresses[changeIndex] = std::lower_bound(cache.instructionLines.begin(), cache.instructionLines.end(), change.oldStart + 1) - cache.instructionLines.begin();
+        endAddresses[changeIndex]   = std::lower_bound(cache.instructionLines.begin(), cache.instructionLines.end(), change.oldEnd + 1) - cache.instructionLines.begin();
+        changeEnds[changeIndex]     = change.oldEnd;
+
+        int64 addressShift = chunkCompiler->operationCounter - (endAddresses[changeIndex] - firstAddresses[changeIndex]);
+
+        chunkCompiler->baseAddress      = firstAddresses[changeIndex] + addressShifts[changeIndex];
+        addressShifts[changeIndex + 1]  = addressShifts[changeIndex] + addressShift;
+        lineShifts[changeIndex + 1]     = lineShifts[changeIndex] + (change.newEnd - change.newStart) - (change.oldEnd - change.oldStart);
+        this->operationCounter         += addressShift;
+        changedLines                   += change.newEnd - change.newStart;
+    }
+
+    // The labels of the unchanged lines move with them, the ones of the changed lines are
+    // declared again.
+
+    for (auto label = cache.labels.begin(); label != cache.labels.end(); ++label) {
+        int64 changeIndex = std::upper_bound(changeEnds.begin(), changeEnds.end(), label->line - 1) - changeEnds.begin();
+
+        if ((changeIndex < numberOfChanges) && (changes[changeIndex].oldStart < label->line))
+            continue;
+
+        CompilerCache::Label movedLabel = {label->name, label->address + addressShifts[changeIndex], label->line + lineShifts[changeIndex]};
+        nextCache.labels.push_back(movedLabel);
+    }
+
+    nextCache.maxAddress = cache.maxAddress;
+
+    for (auto chunk = this->chunks.begin(); chunk != this->chunks.end(); ++chunk) {
+        const Compiler&                chunkCompiler = **chunk;
+        const std::vector<ChunkLabel>& chunkLabels   = chunkCompiler.chunkLabels[0];
+
+        for (auto chunkLabel = chunkLabels.begin(); chunkLabel != chunkLabels.end(); ++chunkLabel) {
+            CompilerCache::Label label = {chunkLabel->name, chunkCompiler.baseAddress + chunkLabel->address, chunkLabel->line};
+            nextCache.labels.push_back(label);
+        }
+
+        for (auto addressReference = chunkCompiler.addressReferences.begin(); addressReference != chunkCompiler.addressReferences.end(); ++addressReference)
+            nextCache.maxAddress = std::max(nextCache.maxAddress, addressReference->address);
+    }
+
+    std::sort(nextCache.labels.begin(), nextCache.labels.end(), [](const CompilerCache::Label& firstLabel, const CompilerCache::Label& secondLabel) {
+        return firstLabel.name < secondLabel.name;
+    });
+
+    for (auto label = nextCache.labels.begin(); label != nextCache.labels.end(); ++label)
+        if (!this->labels.insert(std::make_pair(label->name, label->address)).second) {
+            Info("The label !%s is declared again, compiling the whole source.", label->name.c_str());
+            return true;
+        }
+
+    // The literal addresses are not checked again, but the highest one can still be.
+
+    if (nextCache.maxAddress >= this->operationCounter) {
+        Info("An address may be out of range now, compiling the whole source.");
+        return true;
+    }
+
+    // Compile the changed regions (now that the labels and registers are known) and splice
+    // their code from the last one, so the old addresses of the others stay valid.
+
+    for (auto chunk = this->chunks.begin(); chunk != this->chunks.end(); ++chunk)
+        if (!(*chunk)->CompileChunk())
+            return false;
+
+    for (int64 changeIndex = numberOfChanges - 1; changeIndex >= 0; --changeIndex) {
+        const Compiler& chunkCompiler = *this->chunks[changeIndex];
+
+        if (!this->cachedProgram->Splice(firstAddresses[changeIndex], endAddresses[changeIndex] - firstAddresses[changeIndex], *chunkCompiler.program, chunkCompiler.stringOffsets)) {
+            Warning("Could not splice the changed lines, compiling the whole source.");
+            return true;
+        }
+    }
+
+    // Move the label references of the unchanged lines, patching the addresses of the
+    // labels that moved (or going back to a full compilation for the ones that are gone).
+
+    std::vector<int64> labelIndexes(cache.labels.size());
+
+    for (int64 labelIndex = 0; labelIndex < static_cast<int64>(cache.labels.size()); ++labelIndex)
+        labelIndexes[labelIndex] = nextCache.FindLabel(cache.labels[labelIndex].name);
+
+    int64 changeIndex = 0;
+
+    for (auto reference = cache.references.begin(); reference != cache.references.end(); ++reference) {
+        int64 address = reference->codeOffset / Program::InstructionSize;
+
+        while ((changeIndex < numberOfChanges) && (endAddresses[changeIndex] <= address))
+            changeIndex++;
+
+        if ((changeIndex < numberOfChanges) && (firstAddresses[changeIndex] <= address))
+            continue;
+
+        const CompilerCache::Label& oldLabel   = cache.labels[reference->labelIndex];
+        int64                       labelIndex = labelIndexes[reference->labelIndex];
+
+        if (labelIndex < 0) {
+            Info("The label !%s is gone, compiling the whole source.", oldLabel.name.c_str());
+            return true;
+        }
+
+        CompilerCache::Reference movedReference = {labelIndex, reference->codeOffset + (addressShifts[changeIndex] * Program::InstructionSize)};
+        int64                    labelAddress   = nextCache.labels[labelIndex].address;
+
+        if ((labelAddress != oldLabel.address) && (!this->cachedProgram->PatchAddress(movedReference.codeOffset, labelAddress)))
+            return true;
+
+        nextCache.references.push_back(movedReference);
+    }
+
+    for (auto chunk = this->chunks.begin(); chunk != this->chunks.end(); ++chunk) {
+        const Compiler& chunkCompiler = **chunk;
+
+        for (auto labelReference = chunkCompiler.labelReferences.begin(); labelReference != chunkCompiler.labelReferences.end(); ++labelReference) {
+            CompilerCache::Reference reference = {nextCache.FindLabel(labelReference->label), labelReference->codeOffset + (chunkCompiler.baseAddress * Program::InstructionSize)};
+            nextCache.references.push_back(reference);
+        }
+    }
+
+    std::sort(nextCache.references.begin(), nextCache.references.end(), [](const CompilerCache::Reference& firstReference, const CompilerCache::Reference& secondReference) {
+        return firstReference.codeOffset < secondReference.codeOffset;
+    });
+
+    // The instruction lines of the unchanged code move like its labels.
+
+    int64 oldAddress = 0;
+
+    for (changeIndex = 0; changeIndex <= numberOfChanges; ++changeIndex) {
+        int64 segmentEnd = (changeIndex < numberOfChanges) ? firstAddresses[changeIndex] : cache.instructionLines.size();
+
+        for (; oldAddress < segmentEnd; ++oldAddress)
+            nextCache.instructionLines.push_back(cache.instructionLines[oldAddress] + lineShifts[changeIndex]);
+
+        if (changeIndex < numberOfChanges) {
+            const std::vector<int64>& chunkLines = this->chunks[changeIndex]->instructionLines;
+
+            nextCache.instructionLines.insert(nextCache.instructionLines.end(), chunkLines.begin(), chunkLines.end());
+            oldAddress = endAddresses[changeIndex];
+        }
+    }
+
+    nextCache.hasDebugInfo   = this->hasDebugInfo;
+    nextCache.operationsHash = cache.operationsHash;
+    nextCache.registers.resize(this->registers.size());
+
+    for (auto registerEntry = this->registers.begin(); registerEntry != this->registers.end(); ++registerEntry)
+        nextCache.registers[registerEntry->second] = registerEntry->first;
+
+    // The spliced program is the compiled one now, its debug information is written again.
+
+    std::swap(this->program, this->cachedProgram);
+
+    if (this->hasDebugInfo) {
+        this->program->ClearDebugInfo();
+
+        for (int64 address = 0; address < static_cast<int64>(nextCache.instructionLines.size()); ++address)
+            if (!this->program->AddLineEntry(address, nextCache.instructionLines[address]))
+                return false;
+
+        if (!this->EmitLabelEntries())
+            return false;
+    }
+
+    // The strings were packed already, unless the changed lines brought new ones.
+
+    if ((this->program->GetNumberOfStrings() > numberOfStrings) && (!this->program->PackStrings()))
+        return false;
+
+    Info("Program compiled incrementally (%ld changed lines).", changedLines);
+
+    isRecompiled = true;
+    return true;
+}
+
+// Program Cache
+
+string Compiler::GetCachedProgramPath(void) const {
+    const Memory* sourceCode = this->parser->GetSourceCode();
+    uint64        programKey = Hash(sourceCode->data, sourceCode->size);
+
+    programKey = Hash(this->machineName.c_str(), this->machineName.size() + 1, programKey);
+    programKey = Hash(&this->machineVersion, sizeof(this->machineVersion), programKey);
+
+    // The operation methods are left out, unlike in the operations table hash, as they
+    // are not the same from one run to the next.
+
+    const VirtualMachineCore::OperationList& operationsList = this->hostMachine->GetOperations();
+
+    for (auto operation = operationsList.begin(); operation != operationsList.end(); ++operation) {
+        programKey = Hash(&operation->opCode, sizeof(operation->opCode), programKey);
+        programKey = Hash(operation->mnemonic, strnlen(operation->mnemonic, sizeof(operation->mnemonic)), programKey);
+        programKey = Hash(operation->parameterTypes, sizeof(operation->parameterTypes), programKey);
+        programKey = Hash(&operation->flags, sizeof(operation->flags), programKey);
+    }
+
+    const VirtualMachineCore::OperationFusionList& fusionsList = this->hostMachine->GetFusions();
+
+    for (auto fusion = fusionsList.begin(); fusion != fusionsList.end(); ++fusion) {
+        programKey = Hash(&fusion->fusedOpCode, sizeof(fusion->fusedOpCode), programKey);
+        programKey = Hash(fusion->opCodes, fusion->numberOfOpCodes * sizeof(fusion->opCodes[0]), programKey);
+    }
+
+    // The single pass and the parallel compilation write the same programs.
+
+    const int32 programOptions[4] = {Program::Version, this->codeEncoding, this->hasDebugInfo, this->isOptimizing};
+    programKey = Hash(programOptions, sizeof(programOptions), programKey);
+
+    char programName[32];
+    snprintf(programName, sizeof(programName), "%016lx.tvp", programKey);
+
+    return this->programCachePath + "/" + programName;
+}
+
+bool Compiler::LoadCachedProgram(const string cachedProgramPath) {
+    FILE* cachedFile = fopen(cachedProgramPath.c_str(), "rb");
+
+    if (!cachedFile)
+        return false;
+
+    fclose(cachedFile);
+
+    if (this->program->Load(cachedProgramPath, Program::MapFile))
+        return true;
+
+    // A damaged program is replaced once the source is compiled.
+
+    Warning("The cached program \"%s\" could not be loaded.", cachedProgramPath.c_str());
+    return false;
+}
+
+void Compiler::SaveCachedProgram(const string cachedProgramPath) {
+#if defined(WindowsOS)
+    CreateDirectoryA(this->programCachePath.c_str(), NULL);
+#else
+    mkdir(this->programCachePath.c_str(), 0777);
+#endif
+
+    // The program is written next to its cache file and renamed over it (see
+    // ProgramWriter), so other compilers using the same cache never map half of it.
+
+    if (!this->program->Save(cachedProgramPath))
+        Warning("The program could not be kept in the program cache \"%s\".", this->programCachePath.c_str());
+}
+
 };    // namespace tinyVM
@@ -8,7 +8,10 @@
 #ifndef VM_COMPILER_H
 #define VM_COMPILER_H
 
+#include "Arena.hxx"
+#include "CompilerCache.hxx"
 #include "Core.hxx"
+#include "Optimizer.hxx"
 #include "Parser.hxx"
 #include "Program.hxx"
 #include "VirtualMachine.hxx"
@@ -17,6 +20,17 @@ namespace tinyVM {
 
 // Compiler
 
+// Big sources can be compiled in parallel (see SetNumberOfThreads): the source is split
+// in chunks at line boundaries, each chunk gets its own compiler (and thread) that scans
+// its labels and registers and, once those are merged, compiles its operations to a
+// program of its own. The chunk programs are then appended to the final one, which ends
+// up just like the one a serial compilation writes.
+//
+// An incremental compilation (see SetIncremental) keeps a compiler cache next to the
+// program it saves. The next compilation of the same source only compiles the lines that
+// changed since then (each changed region gets a chunk compiler) and splices their code
+// into the cached program, patching the label addresses the other lines refer to.
+
 class Compiler {
     public:
         Compiler(void);
@@ -28,22 +42,162 @@ class Compiler {
         bool Compile(VirtualMachineCore* hostMachine);
         bool Save(const string binaryFilePath);
 
+        // Options
+
+        void SetCodeEncoding(const Program::CodeEncoding codeEncoding);
+        void SetSinglePass(const bool isSinglePass);
+        void SetDebugInfo(const bool hasDebugInfo);
+        void SetOptimize(const bool isOptimizing);
+
+        // The number of threads used to compile (0 for one for each hardware thread), the
+        // default is 1 (a serial compilation). Sources smaller than two chunks and the ones
+        // that cannot be split safely (like a string literal that spans a chunk boundary or
+        // a duplicated label) are always compiled serially. The operation errors are
+        // reported by the chunks that have them, each on its own thread, so they can come
+        // out of order. The parallel compilation ignores the single pass option.
+
+        void SetNumberOfThreads(const int numberOfThreads);
+
+        // The incremental compilation only works with the fixed encoding and without the
+        // optimizer (those compile the whole source and do not keep a cache). LoadCache
+        // loads the cache and the program last saved to that path, which are used by the
+        // next Compile if they match the options. Whatever cannot be recompiled (too many
+        // changed lines, a changed region that cannot be compiled on its own or a label
+        // the unchanged lines refer to that is gone) is compiled from scratch.
+
+        void SetIncremental(const bool isIncremental);
+        bool LoadCache(const string binaryFilePath);
+
+        // The program cache is a directory with every program compiled with it, each one
+        // named by the hash of its source code, the machine name and version (from its
+        // Config.hxx), the machine operations and fusions and the options that change the
+        // program. Compiling a source that is already there only maps the cached program
+        // (see Program::MapFile), without parsing the source (nor building a compiler cache).
+
+        void SetProgramCache(const string directoryPath, const string machineName, const uint machineVersion);
+
     private:
         // General
 
+        Arena*              arena;
         Parser*             parser;
         Program*            program;
         VirtualMachineCore* hostMachine;
         Parser::Token       currentToken;
         int64               operationCounter;
+        int64               parameterCounter;
+        int64               stringCounter;
+        int64               stringBytesCounter;
+
+        // Options
+
+        Program::CodeEncoding codeEncoding;
+        bool                  isSinglePass;
+        bool                  hasDebugInfo;
+        bool                  isOptimizing;
+        int                   numberOfThreads;
+        bool                  isIncremental;
+
+        // Passes
+
+        bool CompileFirstPass(void);
+        bool CompileSecondPass(void);
+        bool ReserveProgramMemory(void);
+        bool CompileSinglePass(void);
+        bool ResolveReferences(void);
+        bool OptimizeProgram(void);
 
         bool CompileOperation(void);
+        val  SetParameterValue(Value& parameterValue, const Value& tokenValue);
+        val  SetParameterValue(Value& parameterValue, const int64 intValue);
 
         // Labels
 
-        std::map<string, int64> labels;
+        struct LabelReference {
+                string label;
+                int64  codeOffset;
+                int64  line;
+        };
+
+        struct AddressReference {
+                int64 address;
+                int64 line;
+        };
+
+        std::map<string, int64>       labels;
+        std::vector<LabelReference>   labelReferences;
+        std::vector<AddressReference> addressReferences;
 
         bool CompileLabel(void);
+        bool FindLabel(int64& labelAddress) const;
+        bool EmitLabelEntries(void);
+
+        // Registers
+
+        std::map<string, int64> registers;
+
+        int64 GetRegisterIndex(void);
+
+        // Chunks
+
+        // The chunk compilers look the labels up in the label shards of the main compiler
+        // (a label is in the shard of its hash), which are merged one by each chunk
+        // compiler, and the registers in its registers map.
+
+        static constexpr int64 MinChunkSize = 1 << 20;
+
+        struct ChunkLabel {
+                string name;
+                int64  address;    // In the chunk.
+                int64  line;
+        };
+
+        Compiler*                            mainCompiler;        // Itself when not compiling a chunk.
+        std::vector<Compiler*>               chunks;
+        std::vector<std::map<string, int64>> labelShards;
+        std::vector<std::vector<ChunkLabel>> chunkLabels;         // Labels of the chunk, by shard.
+        std::vector<int64>                   stringOffsets;       // Of the string parameters in the chunk code.
+        int64                                chunkIndex;
+        int64                                baseAddress;
+        int64                                lineCounter;
+        bool                                 endsWithNewLine;
+        bool                                 isCaching;           // Scanning for the compiler cache.
+        std::vector<int64>                   instructionLines;    // Scanned for the compiler cache.
+
+        bool SplitSource(void);
+        bool ScanChunks(void);
+        bool MergeRegisters(const Compiler& chunkCompiler);
+        bool CompileChunks(void);
+        bool NewChunk(const int64 chunkStart, const int64 chunkSize, const int firstLine);
+        void DeleteChunks(void);
+        bool RunChunks(bool (Compiler::*chunkPass)(void));
+        bool ScanChunk(void);
+        bool MergeLabelShard(void);
+        bool CompileChunk(void);
+
+        // Compiler Cache
+
+        // The cache is built by scanning the compiled source again (as a single chunk that
+        // also records the instruction lines and the label references) and the changed
+        // regions are scanned the same way.
+
+        CompilerCache* cache;
+        Program*       cachedProgram;
+        bool           isCacheBuilt;
+
+        bool BuildCache(void);
+        bool RecompileChanges(bool& isRecompiled);
+        bool PatchChanges(CompilerCache& nextCache, bool& isRecompiled);
+
+        // Program Cache
+
+        string programCachePath;
+        string machineName;
+        uint   machineVersion;
+
+        string GetCachedProgramPath(void) const;
+        bool   LoadCachedProgram(const string cachedProgramPath);
+        void   SaveCachedProgram(const string cachedProgramPath);
 };
 
 };    // namespace tinyVM
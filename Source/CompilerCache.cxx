@@ -0,0 +1,491 @@
+/*
+ * Source/CompilerCache.cxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#include "CompilerCache.hxx"
+#include "ProgramWriter.hxx"
+
+namespace tinyVM {
+
+// Compiler Cache
+
+CompilerCache::CompilerCache(void) :
+    hasDebugInfo(false),
+    maxAddress(-1),
+    operationsHash(0) {
+    // Empty
+}
+
+CompilerCache::~CompilerCache() {
+    // Empty
+}
+
+// General
+
+// The file is the header ([ Signature, Version, Flags, Operations Hash, Program Size,
+// Program Time ] and the number of lines, instructions, labels, references and registers plus
+// the highest literal address and the hash of the rest of the file) followed by the line
+// hashes (8 bytes each), the instruction lines (deltas), the labels ([ Address, Line,
+// Name Size, Name ]), the references ([ Label Index, Code Offset Delta ]) and the
+// registers ([ Name Size, Name ]), all of them variable length integers.
+
+bool CompilerCache::Load(const string cacheFilePath, const string binaryFilePath) {
+    this->Clear();
+
+    FILE* file = fopen(cacheFilePath.c_str(), "rb");
+
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    int64 fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    buffer fileData = (fileSize >= CompilerCache::HeaderSize) ? NewBuffer(fileSize) : NULL;
+
+    if ((!fileData) || (fread(fileData, fileSize, 1, file) != 1)) {
+        Warning("Could not read the compiler cache from \"%s\".", cacheFilePath.c_str());
+        DeleteBuffer(fileData);
+        fclose(file);
+        return false;
+    }
+
+    fclose(file);
+
+    // The cache only holds for the program file it was saved with.
+
+    int32 version, flags;
+    int64  programSize, programTime, binarySize, binaryTime;
+    uint64 dataHash;
+    int64 numberOfLines, numberOfInstructions, numberOfLabels, numberOfReferences, numberOfRegisters;
+
+    memcpy(&version, &fileData[4], 4);
+    memcpy(&flags, &fileData[8], 4);
+    memcpy(&this->operationsHash, &fileData[12], 4);
+    memcpy(&programSize, &fileData[16], 8);
+    memcpy(&programTime, &fileData[24], 8);
+    memcpy(&numberOfLines, &fileData[32], 8);
+    memcpy(&numberOfInstructions, &fileData[40], 8);
+    memcpy(&numberOfLabels, &fileData[48], 8);
+    memcpy(&numberOfReferences, &fileData[56], 8);
+    memcpy(&numberOfRegisters, &fileData[64], 8);
+    memcpy(&this->maxAddress, &fileData[72], 8);
+    memcpy(&dataHash, &fileData[80], 8);
+
+    if ((memcmp(fileData, CompilerCache::Signature, 4) != 0) || (version != CompilerCache::Version) || (Hash(&fileData[CompilerCache::HeaderSize], fileSize - CompilerCache::HeaderSize) != dataHash)) {
+        Warning("The compiler cache \"%s\" is damaged or has an unsupported version.", cacheFilePath.c_str());
+        DeleteBuffer(fileData);
+        return false;
+    }
+
+    if ((!CompilerCache::GetFileStamp(binaryFilePath, binarySize, binaryTime)) || (binarySize != programSize) || (binaryTime != programTime)) {
+        Info("The compiler cache \"%s\" is out of date.", cacheFilePath.c_str());
+        DeleteBuffer(fileData);
+        return false;
+    }
+
+    int64 dataOffset = CompilerCache::HeaderSize;
+    bool  isValid    = (numberOfLines >= 0) && (numberOfLines <= (fileSize - dataOffset) / 8) && (numberOfInstructions >= 0) && (numberOfLabels >= 0) && (numberOfReferences >= 0) && (numberOfRegisters >= 0);
+
+    // Every other entry takes at least one byte, which bounds the counts before reserving.
+
+    isValid = isValid && (numberOfInstructions + numberOfLabels + numberOfReferences + numberOfRegisters <= fileSize - dataOffset - (numberOfLines * 8));
+
+    if (isValid) {
+        this->hasDebugInfo = (flags & 1) != 0;
+        this->lineHashes.resize(numberOfLines);
+        this->instructionLines.resize(numberOfInstructions);
+        this->labels.resize(numberOfLabels);
+        this->references.resize(numberOfReferences);
+        this->registers.resize(numberOfRegisters);
+
+        if (numberOfLines > 0)
+            memcpy(this->lineHashes.data(), &fileData[dataOffset], numberOfLines * 8);
+
+        dataOffset += numberOfLines * 8;
+    }
+
+    uint64 value, nameSize;
+    int64  previousValue = 0;
+
+    // The values are only added up once they are read, the loops end (and the cache is
+    // dropped) at the first one that cannot be.
+
+    for (int64 instructionIndex = 0; isValid && (instructionIndex < numberOfInstructions); ++instructionIndex) {
+        isValid = ReadVarInt(fileData, fileSize, dataOffset, value);
+
+        if (isValid)
+            this->instructionLines[instructionIndex] = previousValue += value;
+    }
+
+    for (int64 labelIndex = 0; isValid && (labelIndex < numberOfLabels); ++labelIndex) {
+        Label& label = this->labels[labelIndex];
+        uint64 address, line;
+
+        isValid = ReadVarInt(fileData, fileSize, dataOffset, address) && ReadVarInt(fileData, fileSize, dataOffset, line) && ReadVarInt(fileData, fileSize, dataOffset, nameSize);
+        isValid = isValid && (nameSize <= static_cast<uint64>(fileSize - dataOffset));
+
+        if (isValid) {
+            label.name.assign(reinterpret_cast<charconst>(&fileData[dataOffset]), nameSize);
+            label.address  = address;
+            label.line     = line;
+            dataOffset    += nameSize;
+        }
+    }
+
+    previousValue = 0;
+
+    for (int64 referenceIndex = 0; isValid && (referenceIndex < numberOfReferences); ++referenceIndex) {
+        Reference& reference = this->references[referenceIndex];
+        uint64     labelIndex;
+
+        isValid = ReadVarInt(fileData, fileSize, dataOffset, labelIndex) && ReadVarInt(fileData, fileSize, dataOffset, value) && (labelIndex < static_cast<uint64>(numberOfLabels));
+
+        if (isValid) {
+            reference.labelIndex = labelIndex;
+            reference.codeOffset = previousValue += value;
+        }
+    }
+
+    for (int64 registerIndex = 0; isValid && (registerIndex < numberOfRegisters); ++registerIndex) {
+        isValid = ReadVarInt(fileData, fileSize, dataOffset, nameSize) && (nameSize <= static_cast<uint64>(fileSize - dataOffset));
+
+        if (isValid) {
+            this->registers[registerIndex].assign(reinterpret_cast<charconst>(&fileData[dataOffset]), nameSize);
+            dataOffset += nameSize;
+        }
+    }
+
+    DeleteBuffer(fileData);
+
+    if (!isValid) {
+        Warning("The compiler cache \"%s\" is damaged.", cacheFilePath.c_str());
+        this->Clear();
+        return false;
+    }
+
+    Info("Compiler cache loaded from \"%s\".", cacheFilePath.c_str());
+    return true;
+}
+
+bool CompilerCache::Save(const string cacheFilePath, const string binaryFilePath) const {
+    int64 programSize, programTime;
+
+    if (!CompilerCache::GetFileStamp(binaryFilePath, programSize, programTime)) {
+        Error("Could not get the size and time of \"%s\" for the compiler cache.", binaryFilePath.c_str());
+        return false;
+    }
+
+    // Each variable length integer takes at most 10 bytes.
+
+    int64 cacheSize = CompilerCache::HeaderSize + (this->lineHashes.size() * 8) + (this->instructionLines.size() * 10) + (this->references.size() * 20);
+
+    for (auto label = this->labels.begin(); label != this->labels.end(); ++label)
+        cacheSize += 30 + label->name.size();
+
+    for (auto registerName = this->registers.begin(); registerName != this->registers.end(); ++registerName)
+        cacheSize += 10 + registerName->size();
+
+    buffer cacheData = NewBuffer(cacheSize);
+
+    if (!cacheData) {
+        Error("Could not allocate %ld bytes for the compiler cache.", cacheSize);
+        return false;
+    }
+
+    int32 flags                = this->hasDebugInfo ? 1 : 0;
+    int64 numberOfLines        = this->lineHashes.size();
+    int64 numberOfInstructions = this->instructionLines.size();
+    int64 numberOfLabels       = this->labels.size();
+    int64 numberOfReferences   = this->references.size();
+    int64 numberOfRegisters    = this->registers.size();
+
+    memset(cacheData, 0, CompilerCache::HeaderSize);
+    memcpy(cacheData, CompilerCache::Signature, 4);
+    memcpy(&cacheData[4], &CompilerCache::Version, 4);
+    memcpy(&cacheData[8], &flags, 4);
+    memcpy(&cacheData[12], &this->operationsHash, 4);
+    memcpy(&cacheData[16], &programSize, 8);
+    memcpy(&cacheData[24], &programTime, 8);
+    memcpy(&cacheData[32], &numberOfLines, 8);
+    memcpy(&cacheData[40], &numberOfInstructions, 8);
+    memcpy(&cacheData[48], &numberOfLabels, 8);
+    memcpy(&cacheData[56], &numberOfReferences, 8);
+    memcpy(&cacheData[64], &numberOfRegisters, 8);
+    memcpy(&cacheData[72], &this->maxAddress, 8);
+
+    int64 dataOffset    = CompilerCache::HeaderSize;
+    int64 previousValue = 0;
+
+    if (numberOfLines > 0)
+        memcpy(&cacheData[dataOffset], this->lineHashes.data(), numberOfLines * 8);
+
+    dataOffset += numberOfLines * 8;
+
+    for (auto instructionLine = this->instructionLines.begin(); instructionLine != this->instructionLines.end(); ++instructionLine) {
+        dataOffset    += WriteVarInt(&cacheData[dataOffset], *instructionLine - previousValue);
+        previousValue  = *instructionLine;
+    }
+
+    for (auto label = this->labels.begin(); label != this->labels.end(); ++label) {
+        dataOffset += WriteVarInt(&cacheData[dataOffset], label->address);
+        dataOffset += WriteVarInt(&cacheData[dataOffset], label->line);
+        dataOffset += WriteVarInt(&cacheData[dataOffset], label->name.size());
+
+        memcpy(&cacheData[dataOffset], label->name.data(), label->name.size());
+        dataOffset += label->name.size();
+    }
+
+    previousValue = 0;
+
+    for (auto reference = this->references.begin(); reference != this->references.end(); ++reference) {
+        dataOffset    += WriteVarInt(&cacheData[dataOffset], reference->labelIndex);
+        dataOffset    += WriteVarInt(&cacheData[dataOffset], reference->codeOffset - previousValue);
+        previousValue  = reference->codeOffset;
+    }
+
+    for (auto registerName = this->registers.begin(); registerName != this->registers.end(); ++registerName) {
+        dataOffset += WriteVarInt(&cacheData[dataOffset], registerName->size());
+
+        memcpy(&cacheData[dataOffset], registerName->data(), registerName->size());
+        dataOffset += registerName->size();
+    }
+
+    uint64 dataHash = Hash(&cacheData[CompilerCache::HeaderSize], dataOffset - CompilerCache::HeaderSize);
+    memcpy(&cacheData[80], &dataHash, 8);
+
+    // Like the programs, the cache is written to a temporary file (named after the process)
+    // that is then put in place of the old one at once, so a crash or another compiler
+    // saving the same cache never leaves half a file next to the program.
+
+#if defined(WindowsOS)
+    int64 processId = GetCurrentProcessId();
+#else
+    int64 processId = getpid();
+#endif
+
+    string temporaryFilePath = cacheFilePath + "." + std::to_string(processId) + ProgramWriter::TemporaryExtension;
+    FILE*  file              = fopen(temporaryFilePath.c_str(), "wb");
+    bool   isSaved           = file && (fwrite(cacheData, dataOffset, 1, file) == 1);
+
+    if (file)
+        isSaved = (fclose(file) == 0) && isSaved;
+
+    DeleteBuffer(cacheData);
+
+#if defined(WindowsOS)
+    isSaved = isSaved && MoveFileExA(temporaryFilePath.c_str(), cacheFilePath.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+    isSaved = isSaved && (rename(temporaryFilePath.c_str(), cacheFilePath.c_str()) == 0);
+#endif
+
+    if (!isSaved) {
+        Error("Could not write the compiler cache to \"%s\".", cacheFilePath.c_str());
+        remove(temporaryFilePath.c_str());
+        return false;
+    }
+
+    Info("Compiler cache saved to \"%s\".", cacheFilePath.c_str());
+    return true;
+}
+
+void CompilerCache::Clear(void) {
+    this->hasDebugInfo   = false;
+    this->maxAddress     = -1;
+    this->operationsHash = 0;
+
+    this->lineHashes.clear();
+    this->instructionLines.clear();
+    this->labels.clear();
+    this->references.clear();
+    this->registers.clear();
+}
+
+int64 CompilerCache::FindLabel(const string& labelName) const {
+    auto foundLabel = std::lower_bound(this->labels.begin(), this->labels.end(), labelName, [](const Label& label, const string& name) {
+        return label.name < name;
+    });
+
+    if ((foundLabel == this->labels.end()) || (foundLabel->name != labelName))
+        return -1;
+
+    return foundLabel - this->labels.begin();
+}
+
+// Lines
+
+void CompilerCache::HashLines(const Memory* sourceCode, std::vector<uint64>& lineHashes, std::vector<int64>& lineStarts) {
+    charconst source     = reinterpret_cast<charconst>(sourceCode->data);
+    int64     sourceSize = sourceCode->size;
+    int64     lineStart  = 0;
+
+    lineHashes.clear();
+    lineStarts.clear();
+
+    for (int64 index = 0; index < sourceSize; ++index) {
+        if ((source[index] != '\n') && (source[index] != '\r'))
+            continue;
+
+        lineHashes.push_back(Hash(&source[lineStart], index - lineStart));
+        lineStarts.push_back(lineStart);
+
+        if ((source[index] == '\r') && (index + 1 < sourceSize) && (source[index + 1] == '\n'))
+            index++;
+
+        lineStart = index + 1;
+    }
+
+    // The last line has no line end (and may be empty).
+
+    lineHashes.push_back(Hash(&source[lineStart], sourceSize - lineStart));
+    lineStarts.push_back(lineStart);
+}
+
+// Finds the smallest set of changed lines (Myers' difference algorithm, after skipping
+// the lines the sources start and end with). Returns false when more than MaxChangedLines
+// lines were added or removed.
+
+bool CompilerCache::FindChanges(const std::vector<uint64>& oldLines, const std::vector<uint64>& newLines, std::vector<Change>& changes) {
+    int64 oldSize     = oldLines.size();
+    int64 newSize     = newLines.size();
+    int64 commonStart = 0;
+    int64 commonEnd   = 0;
+
+    changes.clear();
+
+    while ((commonStart < oldSize) && (commonStart < newSize) && (oldLines[commonStart] == newLines[commonStart]))
+        commonStart++;
+
+    while ((commonEnd < oldSize - commonStart) && (commonEnd < newSize - commonStart) && (oldLines[oldSize - commonEnd - 1] == newLines[newSize - commonEnd - 1]))
+        commonEnd++;
+
+    const uint64* oldData = oldLines.data() + commonStart;
+    const uint64* newData = newLines.data() + commonStart;
+    int64         oldEnd  = oldSize - commonStart - commonEnd;
+    int64         newEnd  = newSize - commonStart - commonEnd;
+
+    if ((oldEnd == 0) || (newEnd == 0)) {
+        if ((oldEnd > 0) || (newEnd > 0)) {
+            Change change = {commonStart, commonStart + oldEnd, commonStart, commonStart + newEnd};
+            changes.push_back(change);
+        }
+
+        return true;
+    }
+
+    // Keep the furthest old line reached on each diagonal for every edit count, so the
+    // path can be walked back (it takes the square of the edit count).
+
+    int64                           maxEdits  = (oldEnd + newEnd < CompilerCache::MaxChangedLines) ? oldEnd + newEnd : CompilerCache::MaxChangedLines;
+    int64                           editCount = -1;
+    std::vector<int64>              furthest((maxEdits * 2) + 3, 0);
+    std::vector<std::vector<int64>> trace;
+
+    for (int64 edits = 0; (edits <= maxEdits) && (editCount < 0); ++edits) {
+        for (int64 diagonal = -edits; diagonal <= edits; diagonal += 2) {
+            int64  diagonalIndex = diagonal + maxEdits + 1;
+            int64& oldIndex      = furthest[diagonalIndex];
+
+            if ((diagonal == -edits) || ((diagonal != edits) && (furthest[diagonalIndex - 1] < furthest[diagonalIndex + 1])))
+                oldIndex = furthest[diagonalIndex + 1];
+            else
+                oldIndex = furthest[diagonalIndex - 1] + 1;
+
+            int64 newIndex = oldIndex - diagonal;
+
+            while ((oldIndex < oldEnd) && (newIndex < newEnd) && (oldData[oldIndex] == newData[newIndex])) {
+                oldIndex++;
+                newIndex++;
+            }
+
+            if ((oldIndex >= oldEnd) && (newIndex >= newEnd)) {
+                editCount = edits;
+                break;
+            }
+        }
+
+        trace.push_back(std::vector<int64>(furthest.begin() + (maxEdits + 1 - edits), furthest.begin() + (maxEdits + 2 + edits)));
+    }
+
+    if (editCount < 0)
+        return false;
+
+    // Walk back through the matching runs, the changes are the gaps between them.
+
+    std::vector<Change> matches;    // Old start, old end (unused), new start and run size.
+    int64               oldIndex = oldEnd;
+    int64               newIndex = newEnd;
+
+    for (int64 edits = editCount; edits > 0; --edits) {
+        const std::vector<int64>& previous = trace[edits - 1];
+
+        int64 diagonal         = oldIndex - newIndex;
+        bool  isInsertion      = (diagonal == -edits) || ((diagonal != edits) && (previous[diagonal - 1 + edits - 1] < previous[diagonal + 1 + edits - 1]));
+        int64 previousDiagonal = isInsertion ? diagonal + 1 : diagonal - 1;
+        int64 previousOld      = previous[previousDiagonal + edits - 1];
+        int64 runStart         = isInsertion ? previousOld : previousOld + 1;
+
+        Change match = {runStart, 0, runStart - diagonal, oldIndex - runStart};
+        matches.push_back(match);
+
+        oldIndex = previousOld;
+        newIndex = previousOld - previousDiagonal;
+    }
+
+    Change firstMatch = {0, 0, 0, oldIndex};
+    Change lastMatch  = {oldEnd, 0, newEnd, 0};
+
+    matches.push_back(firstMatch);
+    matches.insert(matches.begin(), lastMatch);
+
+    int64 oldCursor = 0;
+    int64 newCursor = 0;
+
+    for (auto match = matches.rbegin(); match != matches.rend(); ++match) {
+        // Changes with an empty match between them are a single one.
+
+        if ((match->oldStart > oldCursor) || (match->newStart > newCursor)) {
+            Change change = {commonStart + oldCursor, commonStart + match->oldStart, commonStart + newCursor, commonStart + match->newStart};
+
+            if ((!changes.empty()) && (changes.back().oldEnd == change.oldStart) && (changes.back().newEnd == change.newStart)) {
+                changes.back().oldEnd = change.oldEnd;
+                changes.back().newEnd = change.newEnd;
+            } else
+                changes.push_back(change);
+        }
+
+        oldCursor = match->oldStart + match->newEnd;
+        newCursor = match->newStart + match->newEnd;
+    }
+
+    return true;
+}
+
+// Program File
+
+bool CompilerCache::GetFileStamp(const string filePath, int64& fileSize, int64& fileTime) {
+#if defined(WindowsOS)
+    WIN32_FILE_ATTRIBUTE_DATA fileAttributes;
+
+    if (!GetFileAttributesExA(filePath.c_str(), GetFileExInfoStandard, &fileAttributes))
+        return false;
+
+    fileSize = (static_cast<int64>(fileAttributes.nFileSizeHigh) << 32) | fileAttributes.nFileSizeLow;
+    fileTime = (static_cast<int64>(fileAttributes.ftLastWriteTime.dwHighDateTime) << 32) | fileAttributes.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat fileStatus;
+
+    if (stat(filePath.c_str(), &fileStatus) != 0)
+        return false;
+
+    fileSize = fileStatus.st_size;
+    fileTime = (static_cast<int64>(fileStatus.st_mtim.tv_sec) * 1000000000) + fileStatus.st_mtim.tv_nsec;
+#endif
+
+    return true;
+}
+
+};    // namespace tinyVM
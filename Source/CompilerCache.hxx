@@ -0,0 +1,92 @@
+/*
+ * Source/CompilerCache.hxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#ifndef VM_COMPILER_CACHE_H
+#define VM_COMPILER_CACHE_H
+
+#include "Core.hxx"
+
+namespace tinyVM {
+
+// Compiler Cache
+
+// What an incremental compilation keeps about the last compiled source, in a file next
+// to its program: the hash of each source line, the line of each instruction (so the
+// code range of each line is known), the labels, the code offset of every parameter
+// that refers to a label and the register names. It only holds for the program file it
+// was saved with (checked by its size and modification time) and the host machine
+// operations it was compiled for (checked by the compiler).
+//
+// The compiler fills and reads the compilation unit directly.
+
+class CompilerCache {
+    public:
+        CompilerCache(void);
+        ~CompilerCache();
+
+        // Constants
+
+        static constexpr int32     Version         = 1;
+        static constexpr charconst Signature       = "TVMC";
+        static constexpr charconst FileExtension   = ".cache";
+        static constexpr int       HeaderSize      = 88;
+        static constexpr int64     MaxChangedLines = 1024;
+
+        // General
+
+        bool Load(const string cacheFilePath, const string binaryFilePath);
+        bool Save(const string cacheFilePath, const string binaryFilePath) const;
+        void Clear(void);
+
+        // Compilation Unit
+
+        struct Label {
+                string name;
+                int64  address;
+                int64  line;
+        };
+
+        struct Reference {
+                int64 labelIndex;
+                int64 codeOffset;    // Of the parameter.
+        };
+
+        bool                   hasDebugInfo;
+        std::vector<uint64>    lineHashes;
+        std::vector<int64>     instructionLines;
+        std::vector<Label>     labels;            // Sorted by name.
+        std::vector<Reference> references;        // Sorted by code offset.
+        std::vector<string>    registers;         // In the register index order.
+        int64                  maxAddress;        // The highest literal address (-1 for none).
+        uint32                 operationsHash;    // The low half of the host machine operations hash.
+
+        int64 FindLabel(const string& labelName) const;
+
+        // Lines
+
+        // The lines end like the parser sees them (LF, CR+LF or CR). Their hashes do not
+        // include the line ends, the line starts are the source offsets.
+
+        struct Change {
+                int64 oldStart;
+                int64 oldEnd;
+                int64 newStart;
+                int64 newEnd;
+        };
+
+        static void HashLines(const Memory* sourceCode, std::vector<uint64>& lineHashes, std::vector<int64>& lineStarts);
+        static bool FindChanges(const std::vector<uint64>& oldLines, const std::vector<uint64>& newLines, std::vector<Change>& changes);
+
+    private:
+        // Program File
+
+        static bool GetFileStamp(const string filePath, int64& fileSize, int64& fileTime);
+};
+
+};    // namespace tinyVM
+
+#endif    // VM_COMPILER_CACHE_H
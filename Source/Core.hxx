@@ -12,17 +12,26 @@
 
 #include <cinttypes>
 #include <cmath>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <x86intrin.h>
+
 // C++
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <new>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 // Only Support C++11 Compilers
@@ -61,7 +70,7 @@
     #define Debug(message, ...) std::printf("\033[1;35m" message "\033[0m\n", ##__VA_ARGS__)
     #define Stub()              std::printf("\033[1;36m[Stub] %s in %s @ %d\033[0m\n", __PRETTY_FUNCTION__, __FILE__, __LINE__)
 #else
-    #define Debug(message, ...)
+    #define Debug(message, ...) ((void) 0)    // Still a statement, for the ifs around it.
     #define Stub(message, ...)
 #endif
 
@@ -97,7 +106,7 @@ typedef void*  pointer;
 
 // Buffers
 
-static inline buffer NewBuffer(const uint size) {
+static inline buffer NewBuffer(const int64 size) {
     return size > 0 ? new (std::nothrow) uint8[size] : NULL;
 }
 
@@ -108,6 +117,10 @@ static inline void DeleteBuffer(buffer& buf) {
     }
 }
 
+static inline int64 AlignSize(const int64 size, const int64 alignment) {
+    return ((size + alignment - 1) / alignment) * alignment;
+}
+
 // Memory
 
 struct Memory {
@@ -118,7 +131,7 @@ struct Memory {
 
 typedef Memory* memory;
 
-static inline memory AllocateMemory(const uint size) {
+static inline memory AllocateMemory(const int64 size) {
     memory newMemory = new (std::nothrow) Memory();
 
     if (newMemory) {
@@ -135,7 +148,7 @@ static inline memory AllocateMemory(const uint size) {
     return newMemory;
 }
 
-static inline bool ExpandMemory(memory& mem, const int newSize) {
+static inline bool ExpandMemory(memory& mem, const int64 newSize) {
     if (!mem)
         return false;
 
@@ -153,6 +166,19 @@ static inline bool ExpandMemory(memory& mem, const int newSize) {
     return true;
 }
 
+// Makes sure the memory can hold "neededSize" bytes, at least doubling its size when
+// it has to grow so that filling a memory byte by byte only copies it O(log n) times.
+
+static inline bool ReserveMemory(memory& mem, const int64 neededSize) {
+    if (!mem)
+        return false;
+
+    if (neededSize <= mem->size)
+        return true;
+
+    return ExpandMemory(mem, std::max(neededSize, mem->size * 2));
+}
+
 static inline void DeleteMemory(memory& mem) {
     if (mem) {
         DeleteBuffer(mem->data);
@@ -161,6 +187,83 @@ static inline void DeleteMemory(memory& mem) {
     }
 }
 
+// Variable Length Integers
+
+static inline int WriteVarInt(const buffer data, uint64 value) {
+    int size = 0;
+
+    while (value >= 0x80) {
+        data[size++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    data[size++] = value;
+    return size;
+}
+
+// Writes the value using exactly "size" bytes (padding it with empty continuation
+// bytes), which still reads back as the same value.
+
+static inline void WritePaddedVarInt(const buffer data, uint64 value, const int size) {
+    for (int byteIndex = 0; byteIndex < size - 1; ++byteIndex) {
+        data[byteIndex] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    data[size - 1] = value & 0x7F;
+}
+
+static inline bool ReadVarInt(const buffer data, const int64 dataSize, int64& offset, uint64& value) {
+    value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (offset >= dataSize)
+            return false;
+
+        uint8 currentByte = data[offset++];
+        value |= static_cast<uint64>(currentByte & 0x7F) << shift;
+
+        if (!(currentByte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+static inline uint64 ZigZagEncode(const int64 value) {
+    return (static_cast<uint64>(value) << 1) ^ static_cast<uint64>(value >> 63);
+}
+
+static inline int64 ZigZagDecode(const uint64 value) {
+    return static_cast<int64>(value >> 1) ^ -static_cast<int64>(value & 1);
+}
+
+// Hashing
+
+// 64-bit FNV-1a, pass the previous hash to continue hashing more data.
+
+static constexpr uint64 HashSeed = 0xCBF29CE484222325ULL;
+
+static inline uint64 Hash(const void* data, const int64 size, uint64 hash = HashSeed) {
+    const uint8* bytes = static_cast<const uint8*>(data);
+
+    for (int64 byteIndex = 0; byteIndex < size; ++byteIndex) {
+        hash ^= bytes[byteIndex];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+// Cycle Counter
+
+// The x86 / x64 time stamp counter. It is not a serializing read, which is fine to
+// compare the cost of different pieces of code with each other.
+
+static inline uint64 ReadCycleCounter(void) {
+    return __rdtsc();
+}
+
 // Strings
 
 static inline cstring NewCString(const uint size) {
@@ -346,4 +449,14 @@ extern "C" {
 }
 #endif
 
+#ifdef LinuxOS
+extern "C" {
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/uio.h>
+    #include <unistd.h>
+}
+#endif
+
 #endif    // VM_CORE_H
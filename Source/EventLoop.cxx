@@ -0,0 +1,170 @@
+/*
+ * Source/EventLoop.cxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#include "EventLoop.hxx"
+
+namespace tinyVM {
+
+// Event Loop
+
+EventLoop::EventLoop(VirtualMachineCore& machine) :
+    machine(machine) {
+    this->timeSlice.instructions = EventLoop::DefaultTimeSlice;
+    this->timeSlice.microseconds = 0;
+}
+
+EventLoop::~EventLoop() {
+    // The programs still in flight are dropped as they are.
+
+    for (auto task = this->tasks.begin(); task != this->tasks.end(); ++task) {
+        ExecutionContext* taskContext = task->first;
+        this->machine.DeleteContext(taskContext);
+    }
+}
+
+// General
+
+void EventLoop::Run(void) {
+    while (!this->tasks.empty()) {
+        // With every context waiting, sleep until one of them gets its operation done.
+
+        if (this->readyTasks.empty()) {
+            std::unique_lock<std::mutex> completionsLock(this->completionsMutex);
+            this->completionsAvailable.wait(completionsLock, [this] { return !this->completions.empty(); });
+        }
+
+        this->Poll();
+    }
+}
+
+bool EventLoop::Poll(void) {
+    this->WakeTasks();
+    this->RunReadyTasks();
+
+    return !this->tasks.empty();
+}
+
+void EventLoop::SetTimeSlice(const VirtualMachineCore::ExecutionBudget& timeSlice) {
+    this->timeSlice = timeSlice;
+}
+
+int64 EventLoop::GetNumberOfContexts(void) const {
+    return this->tasks.size();
+}
+
+int64 EventLoop::GetNumberOfWaitingContexts(void) const {
+    int64 numberOfWaitingContexts = 0;
+
+    for (auto task = this->tasks.begin(); task != this->tasks.end(); ++task)
+        if (task->first->IsWaiting())
+            numberOfWaitingContexts++;
+
+    return numberOfWaitingContexts;
+}
+
+void EventLoop::RunReadyTasks(void) {
+    // Only the tasks that were ready when the round started are run, so the completions
+    // are checked between rounds.
+
+    int64 numberOfReadyTasks = this->readyTasks.size();
+
+    for (int64 taskIndex = 0; taskIndex < numberOfReadyTasks; ++taskIndex) {
+        Task& task = *this->readyTasks.front();
+        this->readyTasks.pop_front();
+
+        if (!task.isStarted) {
+            task.isStarted = true;
+
+            if (!this->machine.Start(task.context, this->timeSlice)) {
+                this->EndTask(task, false);
+                continue;
+            }
+        } else if (!this->machine.Resume(task.context, this->timeSlice)) {
+            this->EndTask(task, true);
+            continue;
+        }
+
+        if (!task.context->IsRunning())
+            this->EndTask(task, true);
+        else if (!task.context->IsWaiting())
+            this->readyTasks.push_back(&task);    // Out of budget or paused, wait for its next turn.
+    }
+}
+
+void EventLoop::WakeTasks(void) {
+    {
+        std::lock_guard<std::mutex> completionsLock(this->completionsMutex);
+        this->wokenCompletions.swap(this->completions);
+    }
+
+    for (auto completion = this->wokenCompletions.begin(); completion != this->wokenCompletions.end(); ++completion) {
+        auto foundTask = this->tasks.find(completion->context);
+
+        if (foundTask == this->tasks.end()) {
+            Warning("An operation was completed for an execution context that is not in the loop.");
+            continue;
+        }
+
+        if (!this->machine.Wake(completion->context))
+            continue;
+
+        if (completion->callback)
+            completion->callback(this->machine, completion->context, completion->userData);
+
+        this->readyTasks.push_back(&foundTask->second);
+    }
+
+    this->wokenCompletions.clear();
+}
+
+// Contexts
+
+ExecutionContext* EventLoop::Submit(const ProgramImage* image, const DoneCallback callback, const pointer userData) {
+    ExecutionContext* newContext = this->machine.NewContext(image);
+
+    if (!newContext)
+        return NULL;
+
+    Task newTask      = {newContext, callback, userData, false};
+    auto insertedTask = this->tasks.insert(std::make_pair(newContext, newTask));
+
+    this->readyTasks.push_back(&insertedTask.first->second);
+    return newContext;
+}
+
+bool EventLoop::Complete(ExecutionContext* context, const CompletionCallback callback, const pointer userData) {
+    if (!context) {
+        Error("The execution context is null.");
+        return false;
+    }
+
+    Completion newCompletion = {context, callback, userData};
+
+    {
+        std::lock_guard<std::mutex> completionsLock(this->completionsMutex);
+        this->completions.push_back(newCompletion);
+    }
+
+    this->completionsAvailable.notify_one();
+    return true;
+}
+
+// Tasks
+
+void EventLoop::EndTask(Task& task, const bool started) {
+    ExecutionContext* taskContext = task.context;
+
+    if (task.callback)
+        task.callback(this->machine, taskContext, started, task.userData);
+
+    // The context is reused by the machine, it must not be completed anymore.
+
+    this->tasks.erase(taskContext);
+    this->machine.DeleteContext(taskContext);
+}
+
+}    // namespace tinyVM
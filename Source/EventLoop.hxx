@@ -0,0 +1,104 @@
+/*
+ * Source/EventLoop.hxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#ifndef VM_EVENT_LOOP_H
+#define VM_EVENT_LOOP_H
+
+#include "VirtualMachine.hxx"
+
+namespace tinyVM {
+
+// Event Loop
+
+// Keeps any number of execution contexts in flight on a single thread and machine. The
+// ready contexts take turns, each one running for a time slice, and the ones that are
+// suspended waiting for an asynchronous operation (see VirtualMachineCore::Suspend) cost
+// nothing until the operation completes: whoever completes it (from any thread) calls
+// Complete, and the loop wakes the context up, calls the completion callback (to store
+// the operation results in the context) and puts it back with the ready ones.
+//
+// A program that pauses itself only gives its turn to the other contexts.
+
+class EventLoop {
+    public:
+        // Called on the loop thread once the program has run (or could not be started),
+        // before the context is deleted, so the results can be read from the machine.
+
+        typedef void (*DoneCallback)(VirtualMachineCore& machine, ExecutionContext* context, const bool started, pointer userData);
+
+        // Called on the loop thread with the woken up context as the current machine
+        // context, right before it is resumed.
+
+        typedef void (*CompletionCallback)(VirtualMachineCore& machine, ExecutionContext* context, pointer userData);
+
+        static constexpr int64 DefaultTimeSlice = 100000;    // Instructions.
+
+        EventLoop(VirtualMachineCore& machine);
+        ~EventLoop();
+
+        // General
+
+        // Run returns once every submitted program has ended, Poll only does what can be
+        // done without waiting (so the loop can be driven by another one) and returns
+        // false once there is nothing left to run.
+
+        void  Run(void);
+        bool  Poll(void);
+        void  SetTimeSlice(const VirtualMachineCore::ExecutionBudget& timeSlice);
+        int64 GetNumberOfContexts(void) const;
+        int64 GetNumberOfWaitingContexts(void) const;
+
+        // Contexts
+
+        // Submit must be called from the loop thread (or before running the loop), as it
+        // creates the context with the loop machine. Complete can be called from any
+        // thread (even from the operation that suspends the context), once for each
+        // suspension and never after the program has ended.
+
+        ExecutionContext* Submit(const ProgramImage* image, const DoneCallback callback = NULL, const pointer userData = NULL);
+        bool              Complete(ExecutionContext* context, const CompletionCallback callback = NULL, const pointer userData = NULL);
+
+    private:
+        // General
+
+        VirtualMachineCore&                 machine;
+        VirtualMachineCore::ExecutionBudget timeSlice;
+
+        void RunReadyTasks(void);
+        void WakeTasks(void);
+
+        // Tasks
+
+        struct Task {
+                ExecutionContext* context;
+                DoneCallback      callback;
+                pointer           userData;
+                bool              isStarted;
+        };
+
+        std::unordered_map<ExecutionContext*, Task> tasks;
+        std::deque<Task*>                           readyTasks;
+
+        void EndTask(Task& task, const bool started);
+
+        // Completions
+
+        struct Completion {
+                ExecutionContext*  context;
+                CompletionCallback callback;
+                pointer            userData;
+        };
+
+        std::mutex              completionsMutex;
+        std::condition_variable completionsAvailable;
+        std::vector<Completion> completions;
+        std::vector<Completion> wokenCompletions;
+};
+
+}    // namespace tinyVM
+
+#endif    // VM_EVENT_LOOP_H
@@ -7,29 +7,170 @@
 
 #include "Compiler.hxx"
 #include "Config.hxx"
+#include "Profiler.hxx"
+#include "Tracer.hxx"
 
-int Run(const tinyVM::string programPath) {
+// Options
+
+struct Options {
+        bool compactCode;
+        bool singlePass;
+        bool debugInfo;
+        bool optimize;
+        bool parallel;
+        bool incremental;
+        bool profile;
+        bool jit;
+        bool hotJit;
+
+        tinyVM::string cachePath;
+        tinyVM::string tracePath;
+        tinyVM::string reportTracePath;
+};
+
+bool RunProfiled(tinyVM::VirtualMachine* tinyVM, tinyVM::Program* tinyProgram) {
+    tinyVM::ProgramImage* tinyImage = tinyVM->NewImage(tinyProgram);
+
+    if (!tinyImage)
+        return false;
+
+    tinyVM::Profiler*         tinyProfiler = new tinyVM::Profiler(tinyImage);
+    tinyVM::ExecutionContext* tinyContext  = tinyVM->NewContext(tinyImage);
+    bool                      hasRun       = false;
+
+    tinyVM->SetProfiler(tinyProfiler);
+
+    if (tinyContext && tinyVM->Start(tinyContext)) {
+        tinyProfiler->Report(*tinyVM);
+        hasRun = true;
+    }
+
+    tinyVM->SetProfiler(NULL);
+    tinyVM->DeleteContext(tinyContext);
+
+    delete tinyProfiler;
+    delete tinyImage;
+
+    return hasRun;
+}
+
+bool RunTraced(tinyVM::VirtualMachine* tinyVM, tinyVM::Program* tinyProgram, const tinyVM::string tracePath) {
+    tinyVM::ProgramImage* tinyImage = tinyVM->NewImage(tinyProgram);
+
+    if (!tinyImage)
+        return false;
+
+    tinyVM::Tracer*           tinyTracer  = new tinyVM::Tracer(tinyImage);
+    tinyVM::ExecutionContext* tinyContext = tinyVM->NewContext(tinyImage);
+    bool                      hasRun      = false;
+
+    // The machine dumps the trace when the program stops, and so do the signals. A program
+    // that ends paused has not stopped, its trace is dumped once the run is over.
+
+    if (tinyTracer->SetDumpFile(tracePath)) {
+        tinyVM::Tracer::DumpOnSignal(SIGINT, true);
+        tinyVM::Tracer::DumpOnSignal(SIGTERM, true);
+#if !defined(WindowsOS)
+        tinyVM::Tracer::DumpOnSignal(SIGUSR1);
+#endif
+
+        tinyVM->SetTracer(tinyTracer);
+
+        if (tinyContext && tinyVM->Start(tinyContext)) {
+            hasRun = true;
+
+            if (tinyContext->IsRunning())
+                tinyTracer->Dump();
+        }
+
+        tinyVM->SetTracer(NULL);
+    }
+
+    tinyVM->DeleteContext(tinyContext);
+
+    delete tinyTracer;
+    delete tinyImage;
+
+    return hasRun;
+}
+
+bool ReportTrace(tinyVM::VirtualMachine* tinyVM, tinyVM::Program* tinyProgram, const tinyVM::string tracePath) {
+    tinyVM::ProgramImage* tinyImage = tinyVM->NewImage(tinyProgram);
+
+    if (!tinyImage)
+        return false;
+
+    bool hasReported = tinyVM::Tracer::Report(*tinyVM, tinyImage, tracePath);
+
+    delete tinyImage;
+
+    return hasReported;
+}
+
+int Run(const tinyVM::string programPath, const Options& options) {
     int returnCode = 1;
 
     tinyVM::VirtualMachine* tinyVM      = new tinyVM::VirtualMachine();
     tinyVM::Program*        tinyProgram = new tinyVM::Program();
 
-    if (tinyProgram->Load(programPath))
-        if (tinyVM->Start(tinyProgram))
+    if (options.jit)
+        tinyVM->SetJitThreshold(0);
+    else if (options.hotJit)
+        tinyVM->SetJitThreshold(tinyVM::VirtualMachineCore::DefaultJitThreshold);
+
+    if (tinyProgram->Load(programPath, tinyVM::Program::MapFile)) {
+        bool hasRun;
+
+        if (!options.reportTracePath.empty())
+            hasRun = ReportTrace(tinyVM, tinyProgram, options.reportTracePath);
+        else if (options.profile)
+            hasRun = RunProfiled(tinyVM, tinyProgram);
+        else if (!options.tracePath.empty())
+            hasRun = RunTraced(tinyVM, tinyProgram, options.tracePath);
+        else
+            hasRun = tinyVM->Start(tinyProgram);
+
+        if (hasRun)
             returnCode = 0;
+    }
 
     delete tinyProgram;
     delete tinyVM;
 
-    return 1;
+    return returnCode;
 }
 
-int Compile(const tinyVM::string sourcePath, const tinyVM::string binaryPath) {
+int Compile(const tinyVM::string sourcePath, const tinyVM::string binaryPath, const Options& options) {
     int returnCode = 1;
 
     tinyVM::Compiler*       tinyCompiler = new tinyVM::Compiler();
     tinyVM::VirtualMachine* tinyVM       = new tinyVM::VirtualMachine();
 
+    if (options.compactCode)
+        tinyCompiler->SetCodeEncoding(tinyVM::Program::CompactEncoding);
+
+    if (options.singlePass)
+        tinyCompiler->SetSinglePass(true);
+
+    if (options.debugInfo)
+        tinyCompiler->SetDebugInfo(true);
+
+    if (options.optimize)
+        tinyCompiler->SetOptimize(true);
+
+    if (options.parallel)
+        tinyCompiler->SetNumberOfThreads(0);
+
+    // Without a (matching) cache the whole source is compiled, like it always is.
+
+    if (options.incremental) {
+        tinyCompiler->SetIncremental(true);
+        tinyCompiler->LoadCache(binaryPath);
+    }
+
+    if (!options.cachePath.empty())
+        tinyCompiler->SetProgramCache(options.cachePath, tinyVM::Name, tinyVM::Version);
+
     if (tinyCompiler->Load(sourcePath))
         if (tinyCompiler->Compile(tinyVM))
             if (tinyCompiler->Save(binaryPath))
@@ -43,10 +184,28 @@ int Compile(const tinyVM::string sourcePath, const tinyVM::string binaryPath) {
 
 void PrintUsage(const tinyVM::string programPath) {
     Info("To run a program:");
-    Info("  %s <program file path>", programPath.c_str());
+    Info("  %s [options] <program file path>", programPath.c_str());
+    Info("");
+    Info("Run options:");
+    Info("  --profile        Count and time every instruction and print a report at the end.");
+    Info("  --jit            Compile the program to native code before running it.");
+    Info("  --jit-hot        Compile the program to native code once one of its instructions is hot.");
+    Info("  --trace <path>   Record the latest instructions and write them to a file when the program stops (or on SIGUSR1).");
+    Info("");
+    Info("To show a trace:");
+    Info("  %s --trace-report <trace file path> <program file path>", programPath.c_str());
     Info("");
     Info("To compile a program:");
-    Info("  %s <source file path> <binary file path>", programPath.c_str());
+    Info("  %s [options] <source file path> <binary file path>", programPath.c_str());
+    Info("");
+    Info("Compile options:");
+    Info("  --compact        Use the compact (variable length) instruction encoding.");
+    Info("  --single-pass    Compile in a single pass, patching the forward label references at the end.");
+    Info("  --debug-info     Keep the source lines and labels in the program (shown in the profile reports).");
+    Info("  --optimize       Remove the NOPs and fuse the operation sequences the machine has superinstructions for.");
+    Info("  --parallel       Compile the chunks of big sources on one thread for each hardware thread.");
+    Info("  --incremental    Keep a compiler cache next to the program and only compile the lines changed since.");
+    Info("  --cache <path>   Keep the compiled programs in a directory and reuse them for the same sources.");
     Info("");
 }
 
@@ -57,9 +216,62 @@ int main(int numberOfArguments, char** argumentsValues) {
     Info("%s - Version %s (%s %s)", tinyVM::Name, tinyVM::VersionString, OSName, ArchName);
     Info("");
 
-    switch (numberOfArguments) {
-        case 2: return Run(argumentsValues[1]);
-        case 3: return Compile(argumentsValues[1], argumentsValues[2]);
+    // Split the options from the file paths.
+
+    Options                     options = {false, false, false, false, false, false, false, false, false, "", "", ""};
+    std::vector<tinyVM::string> paths;
+
+    for (int argumentIndex = 1; argumentIndex < numberOfArguments; ++argumentIndex) {
+        tinyVM::string argument = argumentsValues[argumentIndex];
+
+        if (argument == "--compact") {
+            options.compactCode = true;
+        } else if (argument == "--single-pass") {
+            options.singlePass = true;
+        } else if (argument == "--debug-info") {
+            options.debugInfo = true;
+        } else if (argument == "--optimize") {
+            options.optimize = true;
+        } else if (argument == "--parallel") {
+            options.parallel = true;
+        } else if (argument == "--incremental") {
+            options.incremental = true;
+        } else if (argument == "--cache") {
+            if (++argumentIndex == numberOfArguments) {
+                Error("The option \"%s\" needs a directory path.", argument.c_str());
+                PrintUsage(argumentsValues[0]);
+                return 1;
+            }
+
+            options.cachePath = argumentsValues[argumentIndex];
+        } else if ((argument == "--trace") || (argument == "--trace-report")) {
+            if (++argumentIndex == numberOfArguments) {
+                Error("The option \"%s\" needs a file path.", argument.c_str());
+                PrintUsage(argumentsValues[0]);
+                return 1;
+            }
+
+            if (argument == "--trace")
+                options.tracePath = argumentsValues[argumentIndex];
+            else
+                options.reportTracePath = argumentsValues[argumentIndex];
+        } else if (argument == "--profile") {
+            options.profile = true;
+        } else if (argument == "--jit") {
+            options.jit = true;
+        } else if (argument == "--jit-hot") {
+            options.hotJit = true;
+        } else if (argument.compare(0, 2, "--") == 0) {
+            Error("Unknown option \"%s\".", argument.c_str());
+            PrintUsage(argumentsValues[0]);
+            return 1;
+        } else
+            paths.push_back(argument);
+    }
+
+    switch (paths.size()) {
+        case 1: return Run(paths[0], options);
+        case 2: return Compile(paths[0], paths[1], options);
         default: PrintUsage(argumentsValues[0]); break;
     }
 
@@ -0,0 +1,448 @@
+/*
+ * Source/NativeCode.cxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#include "NativeCode.hxx"
+
+namespace tinyVM {
+
+// Calling Conventions
+
+// The machine pointer is kept in RBX and the instructions address in R12 (both saved by
+// the callee in both conventions), the Windows one also needs 32 bytes of shadow space.
+// The stack stays aligned to 16 bytes for the calls.
+
+#ifdef WindowsOS
+static const uint8 EnterCode[]         = {0x53, 0x41, 0x54, 0x48, 0x83, 0xEC, 0x28, 0x48, 0x89, 0xCB};    // push rbx; push r12; sub rsp, 40; mov rbx, rcx
+static const uint8 EnterJumpCode[]     = {0xFF, 0xE2};                                                    // jmp rdx
+static const uint8 LeaveCode[]         = {0x48, 0x83, 0xC4, 0x28, 0x41, 0x5C, 0x5B, 0xC3};                // add rsp, 40; pop r12; pop rbx; ret
+static const uint8 MoveMachineCode[]   = {0x48, 0x89, 0xD9};                                              // mov rcx, rbx
+static const uint8 LoadMachineCode[]   = {0x48, 0x8D, 0x8B};                                              // lea rcx, [rbx + disp32]
+static const uint8 LoadParameterCode[] = {0x49, 0x8D, 0x94, 0x24};                                        // lea rdx, [r12 + disp32]
+#else
+static const uint8 EnterCode[]         = {0x53, 0x41, 0x54, 0x48, 0x83, 0xEC, 0x08, 0x48, 0x89, 0xFB};    // push rbx; push r12; sub rsp, 8; mov rbx, rdi
+static const uint8 EnterJumpCode[]     = {0xFF, 0xE6};                                                    // jmp rsi
+static const uint8 LeaveCode[]         = {0x48, 0x83, 0xC4, 0x08, 0x41, 0x5C, 0x5B, 0xC3};                // add rsp, 8; pop r12; pop rbx; ret
+static const uint8 MoveMachineCode[]   = {0x48, 0x89, 0xDF};                                              // mov rdi, rbx
+static const uint8 LoadMachineCode[]   = {0x48, 0x8D, 0xBB};                                              // lea rdi, [rbx + disp32]
+static const uint8 LoadParameterCode[] = {0x49, 0x8D, 0xB4, 0x24};                                        // lea rsi, [r12 + disp32]
+#endif
+
+// Instructions
+
+static const uint8 MoveR12Code[]        = {0x49, 0xBC};                // mov r12, imm64
+static const uint8 MoveRcxCode[]        = {0x48, 0xB9};                // mov rcx, imm64
+static const uint8 LoadAddressCode[]    = {0x49, 0x8D, 0x84, 0x24};    // lea rax, [r12 + disp32]
+static const uint8 StoreRaxCode[]       = {0x48, 0x89, 0x83};          // mov [rbx + disp32], rax
+static const uint8 LoadRaxCode[]        = {0x48, 0x8B, 0x83};          // mov rax, [rbx + disp32]
+static const uint8 LoadRcxCode[]        = {0x48, 0x8B, 0x8B};          // mov rcx, [rbx + disp32]
+static const uint8 StoreByteCode[]      = {0xC6, 0x83};                // mov byte [rbx + disp32], imm8
+static const uint8 CallTableCode[]      = {0xFF, 0x15};                // call [rip + disp32]
+static const uint8 CallCode[]           = {0x90, 0xE8};                // nop; call rel32 (as long as the table call)
+static const uint8 TestAlCode[]         = {0x84, 0xC0};                // test al, al
+static const uint8 CompareRaxCode[]     = {0x48, 0x39, 0x83};          // cmp [rbx + disp32], rax
+static const uint8 CompareRcxRaxCode[]  = {0x48, 0x39, 0xC1};          // cmp rcx, rax
+static const uint8 SubtractR12Code[]    = {0x4C, 0x29, 0xE0};          // sub rax, r12
+static const uint8 ShiftRaxCode[]       = {0x48, 0xC1, 0xE8};          // shr rax, imm8
+static const uint8 MultiplyRcxCode[]    = {0x48, 0x0F, 0xAF, 0xC1};    // imul rax, rcx
+static const uint8 JumpTableCode[]      = {0xFF, 0x24, 0xC1};          // jmp [rcx + rax * 8]
+static const uint8 JumpCode[]           = {0xE9};                      // jmp rel32
+static const uint8 JumpIfZeroCode[]     = {0x0F, 0x84};                // jz / je rel32
+static const uint8 JumpIfNotZeroCode[]  = {0x0F, 0x85};                // jnz / jne rel32
+
+// Member Function Pointers
+
+// An Itanium C++ ABI member function pointer: the function address (or one plus the
+// virtual table offset, for a virtual function) and the "this" adjustment.
+
+struct MethodPointer {
+        uintptr_t function;
+        ptrdiff_t adjustment;
+};
+
+static_assert(sizeof(VirtualMachineCore::OperationMethod) == sizeof(MethodPointer), "Unexpected member function pointer size.");
+
+// Native Code
+
+NativeCode::NativeCode(void) :
+    code(NULL),
+    codeSize(0) {
+    // Empty
+}
+
+NativeCode::~NativeCode() {
+    NativeCode::UnmapCode(this->code, this->codeSize);
+}
+
+bool NativeCode::IsSupported(void) {
+#ifdef VM_JIT_ENABLED
+    // Try the mapping once, some systems do not allow executable memory at all.
+
+    static const bool isSupported = []() {
+        buffer testCode = NativeCode::MapCode(1);
+        bool   canRun   = testCode && NativeCode::ProtectCode(testCode, 1);
+
+        NativeCode::UnmapCode(testCode, 1);
+        return canRun;
+    }();
+
+    return isSupported;
+#else
+    return false;
+#endif
+}
+
+int64 NativeCode::GetCodeSize(void) const {
+    return this->codeSize;
+}
+
+bool NativeCode::Compile(const VirtualMachineCore* machine, const ProgramImage* image) {
+    if (!NativeCode::IsSupported())
+        return false;
+
+    typedef VirtualMachineCore::Instruction Instruction;
+
+    const Instruction* instructions         = image->instructions;
+    int64              numberOfInstructions = image->numberOfInstructions + 1;
+
+    // The instructions are reached with 32-bit displacements from their address.
+
+    if ((numberOfInstructions + 1) * static_cast<int64>(sizeof(Instruction)) > INT32_MAX) {
+        Warning("The program is too big to be compiled to native code.");
+        return false;
+    }
+
+    // The machine fields the code uses directly (the same for every machine).
+
+    const uint8* machineAddress        = reinterpret_cast<const uint8*>(machine);
+    int64        nextInstructionOffset = reinterpret_cast<const uint8*>(&machine->nextInstruction) - machineAddress;
+    int64        isRunningOffset       = reinterpret_cast<const uint8*>(&machine->isRunning) - machineAddress;
+    int64        isPausedOffset        = reinterpret_cast<const uint8*>(&machine->isPaused) - machineAddress;
+    int64        parametersOffset      = offsetof(Instruction, parameters);
+
+    // The operation codes tell which parameters are addresses.
+
+    const VirtualMachineCore::OperationList& operations = machine->GetOperations();
+    const std::vector<int64>&                opCodes    = image->opCodes;
+
+    std::vector<int64> instructionOffsets(numberOfInstructions);
+
+    this->addresses.assign(numberOfInstructions, NULL);
+    this->assembly.clear();
+    this->jumpPatches.clear();
+    this->callPatches.clear();
+    this->functions.clear();
+    this->functionIndexes.clear();
+
+    // Entry: called with the machine and the native address to start from.
+
+    this->Write(EnterCode, sizeof(EnterCode));
+    this->Write(MoveR12Code, sizeof(MoveR12Code));
+    this->WriteInt64(reinterpret_cast<int64>(instructions));
+    this->Write(EnterJumpCode, sizeof(EnterJumpCode));
+
+    // Leave: back to the interpreter (the machine state is already saved).
+
+    int64 leaveOffset = this->assembly.size();
+    this->Write(LeaveCode, sizeof(LeaveCode));
+
+    // Dispatch: an operation jumped somewhere the code did not expect, find the native
+    // address of the instruction from its index. The instruction size is a power of two
+    // times an odd number, dividing by the odd part is multiplying by its inverse.
+
+    int64  dispatchOffset  = this->assembly.size();
+    uint64 instructionSize = sizeof(Instruction);
+    uint8  sizeShift       = 0;
+
+    while ((instructionSize & 1) == 0) {
+        instructionSize >>= 1;
+        ++sizeShift;
+    }
+
+    uint64 sizeInverse = instructionSize;
+
+    for (int iteration = 0; iteration < 5; ++iteration)
+        sizeInverse *= 2 - (instructionSize * sizeInverse);
+
+    this->Write(LoadRaxCode, sizeof(LoadRaxCode));
+    this->WriteInt32(nextInstructionOffset);
+    this->Write(SubtractR12Code, sizeof(SubtractR12Code));
+    this->Write(ShiftRaxCode, sizeof(ShiftRaxCode));
+    this->Write(&sizeShift, 1);
+    this->Write(MoveRcxCode, sizeof(MoveRcxCode));
+    this->WriteInt64(sizeInverse);
+    this->Write(MultiplyRcxCode, sizeof(MultiplyRcxCode));
+    this->Write(MoveRcxCode, sizeof(MoveRcxCode));
+    this->WriteInt64(reinterpret_cast<int64>(this->addresses.data()));
+    this->Write(JumpTableCode, sizeof(JumpTableCode));
+
+    // Instructions
+
+    for (int64 address = 0; address < numberOfInstructions; ++address) {
+        const Instruction& instruction       = instructions[address];
+        int64              instructionOffset = address * sizeof(Instruction);
+        int64              nextOffset        = instructionOffset + sizeof(Instruction);
+
+        instructionOffsets[address] = this->assembly.size();
+
+        // The built-in operations only change the machine state.
+
+        if (instruction.method == &VirtualMachineCore::OpNoOp)
+            continue;
+
+        this->Write(LoadAddressCode, sizeof(LoadAddressCode));
+        this->WriteInt32(nextOffset);
+        this->Write(StoreRaxCode, sizeof(StoreRaxCode));
+        this->WriteInt32(nextInstructionOffset);
+
+        if ((instruction.method == &VirtualMachineCore::OpExit) || (instruction.method == &VirtualMachineCore::OpStop) || (instruction.method == &VirtualMachineCore::OpPause)) {
+            bool isPause = instruction.method == &VirtualMachineCore::OpPause;
+
+            this->Write(StoreByteCode, sizeof(StoreByteCode));
+            this->WriteInt32(isPause ? isPausedOffset : isRunningOffset);
+            this->assembly.push_back(isPause ? 1 : 0);
+            this->WriteJump(JumpCode, sizeof(JumpCode), leaveOffset);
+            continue;
+        }
+
+        // The other operations are called like the interpreter calls them, the virtual
+        // ones through CallOperation (the function depends on the machine).
+
+        MethodPointer methodPointer;
+        memcpy(&methodPointer, &instruction.method, sizeof(methodPointer));
+
+        if (methodPointer.function & 1) {
+            bool (*callOperation)(VirtualMachineCore*, const Instruction*) = &VirtualMachineCore::CallOperation;
+
+            this->Write(MoveMachineCode, sizeof(MoveMachineCode));
+            this->Write(LoadParameterCode, sizeof(LoadParameterCode));
+            this->WriteInt32(instructionOffset);
+            this->WriteCall(reinterpret_cast<uint64>(callOperation));
+        } else {
+            if (methodPointer.adjustment != 0) {
+                this->Write(LoadMachineCode, sizeof(LoadMachineCode));
+                this->WriteInt32(methodPointer.adjustment);
+            } else
+                this->Write(MoveMachineCode, sizeof(MoveMachineCode));
+
+            this->Write(LoadParameterCode, sizeof(LoadParameterCode));
+            this->WriteInt32(instructionOffset + parametersOffset);
+            this->WriteCall(methodPointer.function);
+        }
+
+        this->Write(TestAlCode, sizeof(TestAlCode));
+        this->WriteJump(JumpIfZeroCode, sizeof(JumpIfZeroCode), leaveOffset);
+
+        // Go on to the next instruction or to one of the jump targets (anything else
+        // goes through the dispatch code).
+
+        const VirtualMachineCore::Operation& operation = operations[opCodes[address]];
+        bool                                 hasJumps  = false;
+
+        for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex) {
+            int64 jumpAddress = instruction.values[parameterIndex].asInt;
+
+            // The addresses were verified by NewImage, no need to check them here.
+
+            if ((operation.parameterTypes[parameterIndex] != VirtualMachineCore::Address) || (jumpAddress == address + 1))
+                continue;
+
+            if (!hasJumps) {
+                this->Write(LoadRcxCode, sizeof(LoadRcxCode));
+                this->WriteInt32(nextInstructionOffset);
+                hasJumps = true;
+            }
+
+            this->Write(LoadAddressCode, sizeof(LoadAddressCode));
+            this->WriteInt32(jumpAddress * sizeof(Instruction));
+            this->Write(CompareRcxRaxCode, sizeof(CompareRcxRaxCode));
+            this->WriteInstructionJump(JumpIfZeroCode, sizeof(JumpIfZeroCode), jumpAddress);
+        }
+
+        this->Write(LoadAddressCode, sizeof(LoadAddressCode));
+        this->WriteInt32(nextOffset);
+        this->Write(CompareRaxCode, sizeof(CompareRaxCode));
+        this->WriteInt32(nextInstructionOffset);
+        this->WriteJump(JumpIfNotZeroCode, sizeof(JumpIfNotZeroCode), dispatchOffset);
+    }
+
+    // Functions Table
+
+    while (this->assembly.size() % sizeof(uint64))
+        this->assembly.push_back(0xCC);
+
+    int64 functionsOffset = this->assembly.size();
+
+    for (auto function = this->functions.begin(); function != this->functions.end(); ++function)
+        this->WriteInt64(*function);
+
+    for (auto jumpPatch = this->jumpPatches.begin(); jumpPatch != this->jumpPatches.end(); ++jumpPatch) {
+        int32 relativeAddress = instructionOffsets[jumpPatch->index] - (jumpPatch->offset + 4);
+        memcpy(&this->assembly[jumpPatch->offset], &relativeAddress, 4);
+    }
+
+    // Executable Code
+
+    // The code is mapped close to the operation functions when possible, the calls that
+    // can reach them go there directly (the processor can follow those much better than
+    // a call through the table).
+
+    bool (*callOperation)(VirtualMachineCore*, const Instruction*) = &VirtualMachineCore::CallOperation;
+
+    this->codeSize = this->assembly.size();
+    this->code     = NativeCode::MapCode(this->codeSize, reinterpret_cast<const uint8*>(callOperation));
+
+    if (!this->code) {
+        Warning("Could not map memory for the native code.");
+        return false;
+    }
+
+    memcpy(this->code, this->assembly.data(), this->codeSize);
+
+    for (auto callPatch = this->callPatches.begin(); callPatch != this->callPatches.end(); ++callPatch) {
+        buffer callAddress     = this->code + callPatch->offset;
+        int64  directAddress   = this->functions[callPatch->index] - reinterpret_cast<uint64>(callAddress + 6);
+        int64  tableAddress    = (functionsOffset + (callPatch->index * sizeof(uint64))) - (callPatch->offset + 6);
+        bool   isDirect        = (directAddress >= INT32_MIN) && (directAddress <= INT32_MAX);
+        int32  relativeAddress = isDirect ? directAddress : tableAddress;
+
+        memcpy(callAddress, isDirect ? CallCode : CallTableCode, 2);
+        memcpy(callAddress + 2, &relativeAddress, 4);
+    }
+
+    if (!NativeCode::ProtectCode(this->code, this->codeSize)) {
+        Warning("Could not make the native code executable.");
+        return false;
+    }
+
+    for (int64 address = 0; address < numberOfInstructions; ++address)
+        this->addresses[address] = this->code + instructionOffsets[address];
+
+    std::vector<uint8>().swap(this->assembly);
+    std::vector<Patch>().swap(this->jumpPatches);
+    std::vector<Patch>().swap(this->callPatches);
+    this->functions.clear();
+    this->functionIndexes.clear();
+
+    Debug("Program compiled to %ld bytes of native code.", this->codeSize);
+    return true;
+}
+
+void NativeCode::Run(VirtualMachineCore* machine, const int64 address) const {
+    reinterpret_cast<EntryPoint>(this->code)(machine, this->addresses[address]);
+}
+
+// Code Writing
+
+void NativeCode::Write(const uint8* bytes, const int64 size) {
+    this->assembly.insert(this->assembly.end(), bytes, bytes + size);
+}
+
+void NativeCode::WriteInt32(const int64 value) {
+    int32 shortValue = value;
+    this->Write(reinterpret_cast<const uint8*>(&shortValue), sizeof(shortValue));
+}
+
+void NativeCode::WriteInt64(const int64 value) {
+    this->Write(reinterpret_cast<const uint8*>(&value), sizeof(value));
+}
+
+void NativeCode::WriteJump(const uint8* opCode, const int64 opCodeSize, const int64 targetOffset) {
+    this->Write(opCode, opCodeSize);
+    this->WriteInt32(targetOffset - static_cast<int64>(this->assembly.size() + 4));
+}
+
+void NativeCode::WriteInstructionJump(const uint8* opCode, const int64 opCodeSize, const int64 address) {
+    this->Write(opCode, opCodeSize);
+
+    Patch jumpPatch = {static_cast<int64>(this->assembly.size()), address};
+    this->jumpPatches.push_back(jumpPatch);
+
+    this->WriteInt32(0);
+}
+
+void NativeCode::WriteCall(const uint64 function) {
+    auto functionIndex = this->functionIndexes.find(function);
+
+    if (functionIndex == this->functionIndexes.end()) {
+        functionIndex = this->functionIndexes.insert(std::make_pair(function, static_cast<int64>(this->functions.size()))).first;
+        this->functions.push_back(function);
+    }
+
+    // Written once the code address is known.
+
+    Patch callPatch = {static_cast<int64>(this->assembly.size()), functionIndex->second};
+    this->callPatches.push_back(callPatch);
+
+    this->Write(CallTableCode, sizeof(CallTableCode));
+    this->WriteInt32(0);
+}
+
+// Executable Memory
+
+buffer NativeCode::MapCode(const int64 size, const uint8* nearAddress) {
+    if (size <= 0)
+        return NULL;
+
+    // Try a few addresses below nearAddress (which are usually free) before taking any
+    // address the system gives.
+
+    const int64 maxDistance = 1LL << 30;
+
+    for (int64 distance = 1LL << 26; nearAddress && (distance < maxDistance); distance <<= 1) {
+        uintptr_t hintAddress = (reinterpret_cast<uintptr_t>(nearAddress) - distance) & ~static_cast<uintptr_t>(0xFFFF);
+
+        if (hintAddress >= reinterpret_cast<uintptr_t>(nearAddress))
+            break;
+
+        buffer code = NativeCode::MapCodeAt(size, reinterpret_cast<pointer>(hintAddress));
+
+        if (!code)
+            continue;
+
+        if ((code < nearAddress) && (nearAddress - (code + size) < maxDistance))
+            return code;
+
+        NativeCode::UnmapCode(code, size);
+    }
+
+    return NativeCode::MapCodeAt(size, NULL);
+}
+
+buffer NativeCode::MapCodeAt(const int64 size, const pointer address) {
+#if defined(LinuxOS)
+    pointer mapping = mmap(address, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (mapping != MAP_FAILED) ? static_cast<buffer>(mapping) : NULL;
+#elif defined(WindowsOS)
+    return static_cast<buffer>(VirtualAlloc(address, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#else
+    return NULL;
+#endif
+}
+
+bool NativeCode::ProtectCode(const buffer code, const int64 size) {
+#if defined(LinuxOS)
+    return mprotect(code, size, PROT_READ | PROT_EXEC) == 0;
+#elif defined(WindowsOS)
+    DWORD oldProtection;
+    return VirtualProtect(code, size, PAGE_EXECUTE_READ, &oldProtection) && FlushInstructionCache(GetCurrentProcess(), code, size);
+#else
+    return false;
+#endif
+}
+
+void NativeCode::UnmapCode(const buffer code, const int64 size) {
+    if (!code)
+        return;
+
+#if defined(LinuxOS)
+    munmap(code, size);
+#elif defined(WindowsOS)
+    VirtualFree(code, 0, MEM_RELEASE);
+#endif
+}
+
+}    // namespace tinyVM
@@ -0,0 +1,91 @@
+/*
+ * Source/NativeCode.hxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#ifndef VM_NATIVE_CODE_H
+#define VM_NATIVE_CODE_H
+
+#include "VirtualMachine.hxx"
+
+// JIT Support
+
+// The generated code follows the x86_64 calling conventions (System V or Windows) and
+// the Itanium C++ ABI member function pointers (GCC and Clang, MinGW included).
+
+#if defined(X64Arch) && defined(__GNUC__)
+    #define VM_JIT_ENABLED
+#endif
+
+namespace tinyVM {
+
+// Native Code
+
+// The machine code of a program image (a template JIT). Every instruction becomes a
+// direct call to its operation method, the built-in operations are written inline and
+// the jumps go straight to the code of their target, so there is no dispatch loop left.
+// The machine state is kept the same way the interpreter keeps it (nextInstruction is
+// set before each call), so the operations, the budgets and Jump work as they are.
+//
+// The code is written to a read / write mapping which is then made read / execute only,
+// it is never writable and executable at the same time. Where such a mapping cannot be
+// made (or on x86) IsSupported returns false and the interpreter is used.
+
+class NativeCode {
+    public:
+        ~NativeCode();
+
+        static bool IsSupported(void);
+        int64       GetCodeSize(void) const;
+
+    private:
+        friend class VirtualMachineCore;
+
+        typedef void (*EntryPoint)(VirtualMachineCore* machine, pointer address);
+
+        NativeCode(void);
+
+        buffer               code;
+        int64                codeSize;
+        std::vector<pointer> addresses;    // Native address of each instruction (plus the final EXIT).
+
+        bool Compile(const VirtualMachineCore* machine, const ProgramImage* image);
+        void Run(VirtualMachineCore* machine, const int64 address) const;
+
+        // Code Writing
+
+        // The code is written to the assembly first. The jumps to the instructions and
+        // the calls (through a table of the operation functions, after the code) are
+        // patched once all of it is written.
+
+        struct Patch {
+                int64 offset;    // Where the 32-bit relative address is.
+                int64 index;     // Instruction or function it points to.
+        };
+
+        std::vector<uint8>      assembly;
+        std::vector<Patch>      jumpPatches;
+        std::vector<Patch>      callPatches;
+        std::vector<uint64>     functions;
+        std::map<uint64, int64> functionIndexes;
+
+        void Write(const uint8* bytes, const int64 size);
+        void WriteInt32(const int64 value);
+        void WriteInt64(const int64 value);
+        void WriteJump(const uint8* opCode, const int64 opCodeSize, const int64 targetOffset);
+        void WriteInstructionJump(const uint8* opCode, const int64 opCodeSize, const int64 address);
+        void WriteCall(const uint64 function);
+
+        // Executable Memory
+
+        static buffer MapCode(const int64 size, const uint8* nearAddress = NULL);
+        static buffer MapCodeAt(const int64 size, const pointer address);
+        static bool   ProtectCode(const buffer code, const int64 size);
+        static void   UnmapCode(const buffer code, const int64 size);
+};
+
+}    // namespace tinyVM
+
+#endif    // VM_NATIVE_CODE_H
@@ -0,0 +1,553 @@
+/*
+ * Source/Optimizer.cxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#include "Optimizer.hxx"
+
+namespace tinyVM {
+
+// Optimizer
+
+Optimizer::Optimizer(const VirtualMachineCore* hostMachine) :
+    hostMachine(hostMachine) {
+    // Empty
+}
+
+Optimizer::~Optimizer() {
+    // Empty
+}
+
+// General
+
+bool Optimizer::Optimize(const Program& sourceProgram, Program& optimizedProgram) {
+    if (!this->hostMachine) {
+        Error("The optimizer has no host machine.");
+        return false;
+    }
+
+    if (!this->ReadProgram(sourceProgram))
+        return false;
+
+    int64 numberOfInstructions = this->instructions.size();
+    int64 numberOfNoOps        = 0;
+    int64 numberOfThreaded     = 0;
+    int64 numberOfUnreachable  = 0;
+    int64 numberOfJumps        = 0;
+    int64 numberOfFused        = 0;
+
+    if (this->HasIndirectJumps()) {
+        // A computed address is not moved with the instructions, so nothing can be
+        // removed or fused: only the Address parameters are changed.
+
+        Warning("The host machine has indirect jumps, only the jumps are threaded.");
+        numberOfThreaded = this->ThreadJumps();
+    } else {
+        this->RemoveNoOps();
+        numberOfNoOps = numberOfInstructions - this->instructions.size();
+
+        // Removing code can make more jumps go to the next instruction (and removing those
+        // can leave more code unreachable), repeat until nothing changes.
+
+        int64 numberOfChanges = 0;
+
+        do {
+            int64 threaded    = this->ThreadJumps();
+            int64 unreachable = this->RemoveUnreachableCode();
+            int64 jumps       = this->RemoveJumpsToNext();
+
+            numberOfThreaded += threaded;
+            numberOfUnreachable += unreachable;
+            numberOfJumps += jumps;
+            numberOfChanges = threaded + unreachable + jumps;
+        } while (numberOfChanges > 0);
+
+        int64 numberOfRemoved = numberOfInstructions - this->instructions.size();
+
+        this->FuseOperations();
+        numberOfFused = numberOfInstructions - numberOfRemoved - this->instructions.size();
+    }
+
+    if (!this->WriteProgram(sourceProgram, optimizedProgram))
+        return false;
+
+    Info("Program optimized: %ld instructions, %ld NOPs removed, %ld jumps threaded, %ld unreachable and %ld jump instructions removed, %ld instructions fused.", this->instructions.size(), numberOfNoOps, numberOfThreaded, numberOfUnreachable, numberOfJumps, numberOfFused);
+
+    this->instructions.clear();
+    this->labels.clear();
+    this->addresses.clear();
+    this->blocks.clear();
+    this->blockIndexes.clear();
+
+    return true;
+}
+
+bool Optimizer::HasIndirectJumps(void) const {
+    const VirtualMachineCore::OperationList& operations = this->hostMachine->GetOperations();
+
+    for (int64 opCode = 0; opCode < operations.size(); ++opCode)
+        if ((operations[opCode].flags & VirtualMachineCore::IndirectJumpFlag) != 0)
+            return true;
+
+    return false;
+}
+
+// Instructions
+
+bool Optimizer::ReadProgram(const Program& sourceProgram) {
+    const VirtualMachineCore::OperationList& operations           = this->hostMachine->GetOperations();
+    int64                                    numberOfInstructions = sourceProgram.GetNumberOfInstructions();
+    int64                                    codeOffset           = 0;
+
+    this->instructions.resize(numberOfInstructions);
+    this->labels.clear();
+    this->addresses.resize(numberOfInstructions + 1);
+
+    for (int64 address = 0; address < numberOfInstructions; ++address) {
+        Instruction& instruction = this->instructions[address];
+
+        if ((!this->hostMachine->ReadInstruction(&sourceProgram, codeOffset, instruction.opCode, instruction.parameterValues)) || (instruction.opCode >= operations.size())) {
+            Error("Instruction @%ld: invalid or truncated instruction.", address);
+            return false;
+        }
+
+        // The addresses can point to the end of the program (where the final EXIT is).
+
+        const VirtualMachineCore::Operation& operation = operations[instruction.opCode];
+
+        for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex)
+            if ((operation.parameterTypes[parameterIndex] == VirtualMachineCore::Address) && ((instruction.parameterValues[parameterIndex] < 0) || (instruction.parameterValues[parameterIndex] > numberOfInstructions))) {
+                Error("Instruction @%ld: address @%ld out of range.", address, instruction.parameterValues[parameterIndex]);
+                return false;
+            }
+
+        instruction.line         = 0;
+        this->addresses[address] = address;
+    }
+
+    this->addresses[numberOfInstructions] = numberOfInstructions;
+
+    // Keep the debug information, if any.
+
+    Program::DebugEntry entry;
+    int64               debugOffset = 0;
+
+    while (sourceProgram.ReadDebugEntry(debugOffset, entry)) {
+        if ((entry.address < 0) || (entry.address > numberOfInstructions))
+            continue;
+
+        if ((entry.type == Program::LineEntry) && (entry.address < numberOfInstructions)) {
+            this->instructions[entry.address].line = entry.line;
+        } else if (entry.type == Program::LabelEntry) {
+            Label label = {entry.address, string(entry.name, entry.nameSize)};
+            this->labels.push_back(label);
+        }
+    }
+
+    return true;
+}
+
+bool Optimizer::WriteProgram(const Program& sourceProgram, Program& optimizedProgram) {
+    const VirtualMachineCore::OperationList& operations = this->hostMachine->GetOperations();
+
+    if ((!optimizedProgram.New(sourceProgram.GetCodeEncoding())) || (!optimizedProgram.Reserve(sourceProgram.GetCode()->index, 0, 0)))
+        return false;
+
+    Value                          parameterValues[4];
+    Program::InstructionParameters instructionParameters;
+
+    for (int64 address = 0; address < this->instructions.size(); ++address) {
+        const Instruction&                   instruction = this->instructions[address];
+        const VirtualMachineCore::Operation& operation   = operations[instruction.opCode];
+
+        // Rebuild the parameter values the program was compiled from.
+
+        for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex) {
+            Value& value          = parameterValues[parameterIndex];
+            int64  parameterValue = instruction.parameterValues[parameterIndex];
+
+            instructionParameters[parameterIndex] = &value;
+
+            switch (operation.parameterTypes[parameterIndex]) {
+                case VirtualMachineCore::Address:
+                case VirtualMachineCore::Identifier:
+                case VirtualMachineCore::IntLiteral: {
+                    value.type  = Value::Int;
+                    value.size  = sizeof(int64);
+                    value.asInt = parameterValue;
+                    break;
+                }
+
+                case VirtualMachineCore::BoolLiteral: {
+                    value.type   = Value::Bool;
+                    value.size   = sizeof(bool);
+                    value.asBool = parameterValue != 0;
+                    break;
+                }
+
+                case VirtualMachineCore::FloatLiteral: {
+                    value.type = Value::Float;
+                    value.size = sizeof(double);
+                    memcpy(&value.asFloat, &parameterValue, 8);
+                    break;
+                }
+
+                case VirtualMachineCore::StringLiteral: {
+                    charconst stringData;
+
+                    if (!sourceProgram.GetString(parameterValue, stringData, value.size)) {
+                        Error("Instruction @%ld: invalid string index %ld.", address, parameterValue);
+                        return false;
+                    }
+
+                    value.type     = Value::String;
+                    value.asString = const_cast<cstring>(stringData);
+                    break;
+                }
+
+                default: {
+                    instructionParameters[parameterIndex] = NULL;
+                    break;
+                }
+            }
+        }
+
+        if (!optimizedProgram.Emit(instruction.opCode, instructionParameters))
+            return false;
+
+        if ((instruction.line > 0) && (!optimizedProgram.AddLineEntry(address, instruction.line)))
+            return false;
+    }
+
+    for (auto label = this->labels.begin(); label != this->labels.end(); ++label)
+        if (!optimizedProgram.AddLabelEntry(this->addresses[label->address], label->name.data(), label->name.size()))
+            return false;
+
+    return optimizedProgram.PackStrings();
+}
+
+void Optimizer::MoveInstructions(std::vector<Instruction>& movedInstructions, const std::vector<int64>& newAddresses) {
+    const VirtualMachineCore::OperationList& operations = this->hostMachine->GetOperations();
+
+    // newAddresses has the new address of every current one (and of the end of the
+    // program), the jumps and the source addresses follow them.
+
+    for (auto instruction = movedInstructions.begin(); instruction != movedInstructions.end(); ++instruction) {
+        const VirtualMachineCore::Operation& operation = operations[instruction->opCode];
+
+        for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex)
+            if (operation.parameterTypes[parameterIndex] == VirtualMachineCore::Address)
+                instruction->parameterValues[parameterIndex] = newAddresses[instruction->parameterValues[parameterIndex]];
+    }
+
+    for (auto address = this->addresses.begin(); address != this->addresses.end(); ++address)
+        *address = newAddresses[*address];
+
+    this->instructions.swap(movedInstructions);
+}
+
+// Passes
+
+void Optimizer::RemoveNoOps(void) {
+    // A jump to a NOP goes to the instruction that follows it.
+
+    std::vector<Instruction> movedInstructions;
+    std::vector<int64>       newAddresses(this->instructions.size() + 1);
+
+    movedInstructions.reserve(this->instructions.size());
+
+    for (int64 address = 0; address < this->instructions.size(); ++address) {
+        newAddresses[address] = movedInstructions.size();
+
+        if (this->instructions[address].opCode != VirtualMachineCore::BuiltInOperations[0].opCode)
+            movedInstructions.push_back(this->instructions[address]);
+    }
+
+    newAddresses[this->instructions.size()] = movedInstructions.size();
+    this->MoveInstructions(movedInstructions, newAddresses);
+}
+
+int64 Optimizer::ThreadJumps(void) {
+    // A jump that lands on an unconditional jump can go straight to where that one goes.
+    // Returns how many addresses were changed.
+
+    const VirtualMachineCore::OperationList& operations      = this->hostMachine->GetOperations();
+    int64                                    numberOfChanges = 0;
+    std::vector<bool>                        isVisited(this->instructions.size() + 1, false);
+    std::vector<int64>                       visitedAddresses;
+
+    for (auto instruction = this->instructions.begin(); instruction != this->instructions.end(); ++instruction) {
+        const VirtualMachineCore::Operation& operation = operations[instruction->opCode];
+
+        for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex) {
+            if (operation.parameterTypes[parameterIndex] != VirtualMachineCore::Address)
+                continue;
+
+            int64 jumpAddress  = instruction->parameterValues[parameterIndex];
+            int64 finalAddress = jumpAddress;
+
+            // Follow the chain, a loop made only of jumps is left as it is.
+
+            while ((finalAddress >= 0) && (finalAddress < this->instructions.size()) && (!isVisited[finalAddress])) {
+                int64 nextAddress = this->GetJumpAddress(this->instructions[finalAddress]);
+
+                if (nextAddress < 0)
+                    break;
+
+                isVisited[finalAddress] = true;
+                visitedAddresses.push_back(finalAddress);
+                finalAddress = nextAddress;
+            }
+
+            bool isLoop = (finalAddress < this->instructions.size()) && isVisited[finalAddress];
+
+            for (auto visitedAddress = visitedAddresses.begin(); visitedAddress != visitedAddresses.end(); ++visitedAddress)
+                isVisited[*visitedAddress] = false;
+
+            visitedAddresses.clear();
+
+            if ((!isLoop) && (finalAddress != jumpAddress)) {
+                instruction->parameterValues[parameterIndex] = finalAddress;
+                ++numberOfChanges;
+            }
+        }
+    }
+
+    return numberOfChanges;
+}
+
+int64 Optimizer::RemoveUnreachableCode(void) {
+    // Walks the basic blocks from the entry point, following the jumps and going on to the
+    // next block unless the last instruction never does. Returns how many instructions
+    // were removed.
+
+    const VirtualMachineCore::OperationList& operations = this->hostMachine->GetOperations();
+
+    if (this->instructions.empty())
+        return 0;
+
+    this->FindBasicBlocks();
+
+    std::vector<int64> pendingBlocks(1, 0);
+    this->blocks[0].isReachable = true;
+
+    while (!pendingBlocks.empty()) {
+        const BasicBlock& block = this->blocks[pendingBlocks.back()];
+        pendingBlocks.pop_back();
+
+        std::vector<int64> nextAddresses;
+
+        for (int64 address = block.start; address < block.end; ++address) {
+            const VirtualMachineCore::Operation& operation = operations[this->instructions[address].opCode];
+
+            for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex)
+                if (operation.parameterTypes[parameterIndex] == VirtualMachineCore::Address)
+                    nextAddresses.push_back(this->instructions[address].parameterValues[parameterIndex]);
+        }
+
+        if ((operations[this->instructions[block.end - 1].opCode].flags & (VirtualMachineCore::JumpFlag | VirtualMachineCore::EndFlag)) == 0)
+            nextAddresses.push_back(block.end);
+
+        // The end of the program is the final EXIT, which is not in any block.
+
+        for (auto nextAddress = nextAddresses.begin(); nextAddress != nextAddresses.end(); ++nextAddress) {
+            if (*nextAddress >= this->instructions.size())
+                continue;
+
+            int64 nextBlockIndex = this->blockIndexes[*nextAddress];
+
+            if (!this->blocks[nextBlockIndex].isReachable) {
+                this->blocks[nextBlockIndex].isReachable = true;
+                pendingBlocks.push_back(nextBlockIndex);
+            }
+        }
+    }
+
+    // A label in the removed code goes to the next instruction that is kept.
+
+    std::vector<Instruction> movedInstructions;
+    std::vector<int64>       newAddresses(this->instructions.size() + 1);
+
+    movedInstructions.reserve(this->instructions.size());
+
+    for (auto block = this->blocks.begin(); block != this->blocks.end(); ++block)
+        for (int64 address = block->start; address < block->end; ++address) {
+            newAddresses[address] = movedInstructions.size();
+
+            if (block->isReachable)
+                movedInstructions.push_back(this->instructions[address]);
+        }
+
+    int64 numberOfRemoved = this->instructions.size() - movedInstructions.size();
+
+    newAddresses[this->instructions.size()] = movedInstructions.size();
+    this->MoveInstructions(movedInstructions, newAddresses);
+
+    return numberOfRemoved;
+}
+
+int64 Optimizer::RemoveJumpsToNext(void) {
+    // An unconditional jump to the next instruction does nothing. Returns how many
+    // instructions were removed.
+
+    std::vector<Instruction> movedInstructions;
+    std::vector<int64>       newAddresses(this->instructions.size() + 1);
+
+    movedInstructions.reserve(this->instructions.size());
+
+    for (int64 address = 0; address < this->instructions.size(); ++address) {
+        newAddresses[address] = movedInstructions.size();
+
+        if (this->GetJumpAddress(this->instructions[address]) != address + 1)
+            movedInstructions.push_back(this->instructions[address]);
+    }
+
+    int64 numberOfRemoved = this->instructions.size() - movedInstructions.size();
+
+    newAddresses[this->instructions.size()] = movedInstructions.size();
+    this->MoveInstructions(movedInstructions, newAddresses);
+
+    return numberOfRemoved;
+}
+
+void Optimizer::FuseOperations(void) {
+    const VirtualMachineCore::OperationList&       operations = this->hostMachine->GetOperations();
+    const VirtualMachineCore::OperationFusionList& fusions    = this->hostMachine->GetFusions();
+
+    if (fusions.empty())
+        return;
+
+    this->FindJumpTargets();
+
+    std::vector<Instruction> movedInstructions;
+    std::vector<int64>       newAddresses(this->instructions.size() + 1);
+
+    movedInstructions.reserve(this->instructions.size());
+
+    for (int64 address = 0; address < this->instructions.size();) {
+        int64 fusionIndex = this->FindFusion(address);
+
+        if (fusionIndex < 0) {
+            newAddresses[address] = movedInstructions.size();
+            movedInstructions.push_back(this->instructions[address++]);
+            continue;
+        }
+
+        // The fused instruction takes the used parameters of the sequence, in order
+        // (the fusion was checked against the operations when it was registered).
+
+        const VirtualMachineCore::OperationFusion& fusion = fusions[fusionIndex];
+        Instruction                                fusedInstruction;
+        int                                        parameterCount = 0;
+
+        memset(&fusedInstruction, 0, sizeof(fusedInstruction));
+        fusedInstruction.opCode = fusion.fusedOpCode;
+        fusedInstruction.line   = this->instructions[address].line;
+
+        for (int opCodeIndex = 0; opCodeIndex < fusion.numberOfOpCodes; ++opCodeIndex, ++address) {
+            const Instruction&                   instruction = this->instructions[address];
+            const VirtualMachineCore::Operation& operation   = operations[instruction.opCode];
+
+            for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex)
+                if (operation.parameterTypes[parameterIndex] != VirtualMachineCore::None)
+                    fusedInstruction.parameterValues[parameterCount++] = instruction.parameterValues[parameterIndex];
+
+            newAddresses[address] = movedInstructions.size();
+        }
+
+        movedInstructions.push_back(fusedInstruction);
+    }
+
+    newAddresses[this->instructions.size()] = movedInstructions.size();
+    this->MoveInstructions(movedInstructions, newAddresses);
+}
+
+void Optimizer::FindJumpTargets(void) {
+    const VirtualMachineCore::OperationList& operations = this->hostMachine->GetOperations();
+
+    this->isJumpTarget.assign(this->instructions.size() + 1, false);
+
+    for (auto instruction = this->instructions.begin(); instruction != this->instructions.end(); ++instruction) {
+        const VirtualMachineCore::Operation& operation = operations[instruction->opCode];
+
+        for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex)
+            if (operation.parameterTypes[parameterIndex] == VirtualMachineCore::Address)
+                this->isJumpTarget[instruction->parameterValues[parameterIndex]] = true;
+    }
+}
+
+void Optimizer::FindBasicBlocks(void) {
+    // A block starts at the entry point, at every jump target and after every instruction
+    // that can change the execution flow.
+
+    const VirtualMachineCore::OperationList& operations = this->hostMachine->GetOperations();
+
+    this->FindJumpTargets();
+
+    this->blocks.clear();
+    this->blockIndexes.resize(this->instructions.size());
+
+    bool isBlockEnd = true;
+
+    for (int64 address = 0; address < this->instructions.size(); ++address) {
+        if (isBlockEnd || this->isJumpTarget[address]) {
+            BasicBlock block = {address, address, false};
+            this->blocks.push_back(block);
+        }
+
+        const VirtualMachineCore::Operation& operation = operations[this->instructions[address].opCode];
+
+        isBlockEnd = (operation.flags & (VirtualMachineCore::JumpFlag | VirtualMachineCore::EndFlag)) != 0;
+
+        for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex)
+            if (operation.parameterTypes[parameterIndex] == VirtualMachineCore::Address)
+                isBlockEnd = true;
+
+        this->blocks.back().end     = address + 1;
+        this->blockIndexes[address] = this->blocks.size() - 1;
+    }
+}
+
+int64 Optimizer::FindFusion(const int64 address) const {
+    // Returns the longest fusion that matches the instructions at the address (-1 if
+    // there is none). Only the first instruction of a sequence can be a jump target.
+
+    const VirtualMachineCore::OperationFusionList& fusions     = this->hostMachine->GetFusions();
+    int64                                          foundFusion = -1;
+
+    for (int64 fusionIndex = 0; fusionIndex < fusions.size(); ++fusionIndex) {
+        const VirtualMachineCore::OperationFusion& fusion = fusions[fusionIndex];
+
+        if ((address + fusion.numberOfOpCodes > this->instructions.size()) || ((foundFusion >= 0) && (fusions[foundFusion].numberOfOpCodes >= fusion.numberOfOpCodes)))
+            continue;
+
+        bool isMatch = true;
+
+        for (int opCodeIndex = 0; isMatch && (opCodeIndex < fusion.numberOfOpCodes); ++opCodeIndex)
+            isMatch = (this->instructions[address + opCodeIndex].opCode == fusion.opCodes[opCodeIndex]) && ((opCodeIndex == 0) || (!this->isJumpTarget[address + opCodeIndex]));
+
+        if (isMatch)
+            foundFusion = fusionIndex;
+    }
+
+    return foundFusion;
+}
+
+int64 Optimizer::GetJumpAddress(const Instruction& instruction) const {
+    // Returns where an unconditional jump goes (-1 if the instruction is not one).
+
+    const VirtualMachineCore::Operation& operation = this->hostMachine->GetOperations()[instruction.opCode];
+
+    if ((operation.flags & VirtualMachineCore::JumpFlag) == 0)
+        return -1;
+
+    for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex)
+        if (operation.parameterTypes[parameterIndex] == VirtualMachineCore::Address)
+            return instruction.parameterValues[parameterIndex];
+
+    return -1;
+}
+
+};    // namespace tinyVM
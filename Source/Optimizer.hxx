@@ -0,0 +1,94 @@
+/*
+ * Source/Optimizer.hxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#ifndef VM_OPTIMIZER_H
+#define VM_OPTIMIZER_H
+
+#include "Core.hxx"
+#include "Program.hxx"
+#include "VirtualMachine.hxx"
+
+namespace tinyVM {
+
+// Optimizer
+
+// Rewrites a compiled program into one that does the same work with fewer dispatches:
+// the NOPs are removed, the jumps to jumps go straight to their final target, the code
+// that can never run is dropped and the operation sequences the host machine knows how
+// to fuse are replaced by their superinstructions. The jump addresses and the debug
+// information are moved to the new instruction addresses.
+//
+// Jumps can only land where an Address parameter points to, so the basic blocks start at
+// those and end after the operations that change the execution flow (see the operation
+// flags). A sequence is fused only when no jump lands inside of it. An operation that can
+// jump to a computed address (IndirectJumpFlag) could land anywhere, so with one of those
+// in the host machine the instructions are left where they are and only the jumps are
+// threaded.
+
+class Optimizer {
+    public:
+        Optimizer(const VirtualMachineCore* hostMachine);
+        ~Optimizer();
+
+        // The optimized program is created from scratch (with the same code encoding).
+
+        bool Optimize(const Program& sourceProgram, Program& optimizedProgram);
+
+    private:
+        // General
+
+        const VirtualMachineCore* hostMachine;
+
+        bool HasIndirectJumps(void) const;
+
+        // Instructions
+
+        struct Instruction {
+                int64 opCode;
+                int64 parameterValues[4];
+                int64 line;
+        };
+
+        struct Label {
+                int64  address;
+                string name;
+        };
+
+        std::vector<Instruction> instructions;
+        std::vector<Label>       labels;
+        std::vector<int64>       addresses;    // Current address of each source address.
+
+        bool ReadProgram(const Program& sourceProgram);
+        bool WriteProgram(const Program& sourceProgram, Program& optimizedProgram);
+        void MoveInstructions(std::vector<Instruction>& movedInstructions, const std::vector<int64>& newAddresses);
+
+        // Passes
+
+        struct BasicBlock {
+                int64 start;
+                int64 end;    // Address after the last instruction of the block.
+                bool  isReachable;
+        };
+
+        std::vector<bool>       isJumpTarget;
+        std::vector<BasicBlock> blocks;
+        std::vector<int64>      blockIndexes;    // Block of each address.
+
+        void  RemoveNoOps(void);
+        int64 ThreadJumps(void);
+        int64 RemoveUnreachableCode(void);
+        int64 RemoveJumpsToNext(void);
+        void  FuseOperations(void);
+        void  FindJumpTargets(void);
+        void  FindBasicBlocks(void);
+        int64 FindFusion(const int64 address) const;
+        int64 GetJumpAddress(const Instruction& instruction) const;
+};
+
+};    // namespace tinyVM
+
+#endif    // VM_OPTIMIZER_H
@@ -7,13 +7,20 @@
 
 #include "Parser.hxx"
 
+#if defined(__SSE2__) && defined(__GNUC__)
+    #include <emmintrin.h>
+#endif
+
 namespace tinyVM {
 
 // Parser
 
-Parser::Parser(void) :
+Parser::Parser(Arena& arena) :
+    arena(arena),
     sourceCode(NULL),
-    lineNumber(0) {
+    lineNumber(0),
+    firstLine(1),
+    isChunk(false) {
     // Empty
 }
 
@@ -26,7 +33,7 @@ void Parser::Reset(void) {
         return;
 
     this->sourceCode->index = 0;
-    this->lineNumber        = 1;
+    this->lineNumber        = this->firstLine;
 }
 
 // General
@@ -74,214 +81,365 @@ void Parser::Unload(void) {
         return;
 
     this->lineNumber = 0;
+    this->firstLine  = 1;
+
+    // A chunk does not own the source code it reads.
+
+    if (this->isChunk) {
+        delete this->sourceCode;
+        this->sourceCode = NULL;
+        this->isChunk    = false;
+        return;
+    }
 
     DeleteMemory(this->sourceCode);
     Debug("Source code unloaded.");
 }
 
-// Tokens
-
-bool Parser::GetNextToken(Token& token) {
-    token.type  = Token::None;
-    token.value = NULL;
-    token.line  = this->lineNumber;
+// Chunks
 
-    string value = this->GetNextTokenValue();
+bool Parser::LoadChunk(const Parser& sourceParser, const int64 chunkStart, const int64 chunkSize) {
+    this->Unload();
 
-    // Did we reach the end of the file?
+    const Memory* sourceCode = sourceParser.GetSourceCode();
 
-    if (value.empty())
+    if ((!sourceCode) || (chunkStart < 0) || (chunkSize < 0) || (chunkStart + chunkSize > sourceCode->size))
         return false;
 
-    // Parse the token value.
+    this->sourceCode = new (std::nothrow) Memory();
 
-    if (value[0] == '"') {
-        token.type  = Token::StringLiteral;
-        token.value = NewStringValue(value.substr(1));
-        Debug("TOKEN: STRING = %s", value.c_str());
-    } else if (value[0] == '@') {
-        token.type  = Token::Address;
-        token.value = NewStringValue(value.substr(1));
-        Debug("TOKEN: ADDRESS = %s", value.c_str());
-    } else if (value[0] == '!') {
-        token.type  = Token::Label;
-        token.value = NewStringValue(value.substr(1));
-        Debug("TOKEN: LABEL = %s", value.c_str());
-    } else if ((value[0] == '\r') || (value[0] == '\n')) {
-        token.type = Token::NewLine;
-        this->lineNumber++;
-        Debug("TOKEN: NEW LINE");
-    } else if (value[0] == ',') {
-        token.type = Token::ArgumentSeparator;
-        Debug("TOKEN: ARGUMENT SEPARATOR");
-    } else if (this->IsBoolean(value)) {
-        token.type  = Token::BoolLiteral;
-        token.value = NewBoolValue(value == "true");
-        Debug("TOKEN: BOOLEAN = %s", value.c_str());
-    } else if (this->IsInt(value)) {
-        token.type  = Token::IntLiteral;
-        token.value = NewIntValue(ToInt(value));
-        Debug("TOKEN: INT = %s", value.c_str());
-    } else if (this->IsFloat(value)) {
-        token.type  = Token::FloatLiteral;
-        token.value = NewFloatValue(ToFloat(value));
-        Debug("TOKEN: FLOAT = %s", value.c_str());
-    } else {
-        token.type  = Token::Identifier;
-        token.value = NewStringValue(value);
-        Debug("TOKEN: IDENTIFIER = %s", value.c_str());
+    if (!this->sourceCode) {
+        Error("Could not allocate memory for the source code chunk.");
+        return false;
     }
 
+    this->sourceCode->size = chunkSize;
+    this->sourceCode->data = &sourceCode->data[chunkStart];
+    this->isChunk          = true;
+    this->Reset();
+
     return true;
 }
 
-string Parser::GetNextTokenValue(void) {
-    if (this->sourceCode->index >= this->sourceCode->size)
-        return "";
+void Parser::SetFirstLine(const int firstLine) {
+    this->firstLine = firstLine;
+    this->Reset();
+}
 
-    char currentChar = this->sourceCode->data[this->sourceCode->index++];
+const Memory* Parser::GetSourceCode(void) const {
+    return this->sourceCode;
+}
 
-    // Ignore any initial control character or space (except for line endings).
+// Tokens
 
-    while ((currentChar <= ' ') && (this->sourceCode->index < this->sourceCode->size)) {
-        if ((currentChar == '\r') || (currentChar == '\n'))
-            break;
+bool Parser::GetNextToken(Token& token) {
+    token.type = Token::None;
+    token.line = this->lineNumber;
+
+    memset(&token.value, 0, sizeof(Value));
+
+    charconst source     = reinterpret_cast<charconst>(this->sourceCode->data);
+    int64     sourceSize = this->sourceCode->size;
+    int64     index      = this->SkipSpaces(this->sourceCode->index);
+
+    token.offset = index;
+    token.length = 0;
+
+    // Did we reach the end of the file?
 
-        currentChar = this->sourceCode->data[this->sourceCode->index++];
+    if (index >= sourceSize) {
+        this->sourceCode->index = index;
+        return false;
     }
 
-    // Rewind one character to start from the first one that is not a control character or a space.
+    // The first character is enough to know what kind of token we have (the words
+    // are classified while we look for their end).
 
-    this->sourceCode->index--;
+    switch (source[index]) {
+        case '\r':
+        case '\n': {
+            // It may be a "CR+LF" (Windows) line end.
 
-    bool   inString = false;
-    string value    = "";
+            if ((source[index] == '\r') && (index + 1 < sourceSize) && (source[index + 1] == '\n'))
+                index++;
 
-    while (this->sourceCode->index < this->sourceCode->size) {
-        currentChar = this->sourceCode->data[this->sourceCode->index++];
+            index++;
 
-        if (currentChar == '"') {
-            if (inString)
-                break;
+            token.type = Token::NewLine;
+            this->lineNumber++;
+            Debug("TOKEN: NEW LINE");
+            break;
+        }
 
-            // We keep the string separator so the value can be recognized as a string.
+        case ',': {
+            index++;
 
-            value += currentChar;
-            inString = true;
-            continue;
+            token.type = Token::ArgumentSeparator;
+            Debug("TOKEN: ARGUMENT SEPARATOR");
+            break;
         }
 
-        // If we hit an escape character, no matter where we are at, we just get the next character and continue.
+        case '"': {
+            bool  hasEscapes = false;
+            int64 stringEnd  = this->FindStringEnd(index + 1, hasEscapes);
 
-        if ((currentChar == '\\') and (this->sourceCode->index < this->sourceCode->size)) {
-            value += this->sourceCode->data[this->sourceCode->index++];
-            continue;
+            token.type = Token::StringLiteral;
+
+            if (!this->SetStringValue(token, &source[index + 1], stringEnd - (index + 1), hasEscapes))
+                return false;
+
+            // Skip the closing string separator (if the string was closed at all).
+
+            index = (stringEnd < sourceSize) ? stringEnd + 1 : stringEnd;
+            Debug("TOKEN: STRING = %.*s", static_cast<int>(token.value.size), token.value.asString);
+            break;
         }
 
-        if (!inString) {
-            // Break on any separator character.
+        default: {
+            index = this->ScanWord(token, index);
 
-            if (currentChar == ' ')
-                break;
+            if (index < 0)
+                return false;
 
-            if (currentChar == ',') {
-                // If we hit a one-character only separator we must keep it.
-                // Otherwise we rewind one character so the one-character separator
-                // will be processed next time this method is called.
+            break;
+        }
+    }
 
-                if (value.empty())
-                    value += currentChar;
-                else
-                    this->sourceCode->index--;
+    token.length            = index - token.offset;
+    this->sourceCode->index = index;
 
-                break;
-            }
+    return true;
+}
+
+// Skips any control character or space, except for line endings.
+
+int64 Parser::SkipSpaces(int64 index) const {
+    charconst source     = reinterpret_cast<charconst>(this->sourceCode->data);
+    int64     sourceSize = this->sourceCode->size;
 
-            // If we hit a line end character we must check if it's a "separator" line end or the line end itself.
+    while ((index < sourceSize) && (static_cast<uchar>(source[index]) <= ' ') && (source[index] != '\r') && (source[index] != '\n'))
+        index++;
 
-            if ((currentChar == '\r') || (currentChar == '\n')) {
-                // If it is a "separator" line end, we rewind one character (so it will be processed
-                // next time this method is called) and break.
+    return index;
+}
+
+// Returns the index of the closing string separator (or the end of the source code).
+// If we hit an escape character, no matter where we are at, we just skip the next
+// character and continue.
 
-                if (!value.empty()) {
-                    this->sourceCode->index--;
-                    break;
-                }
+int64 Parser::FindStringEnd(int64 index, bool& hasEscapes) const {
+    charconst source     = reinterpret_cast<charconst>(this->sourceCode->data);
+    int64     sourceSize = this->sourceCode->size;
 
-                value += currentChar;
+#if defined(__SSE2__) && defined(__GNUC__)
+    const __m128i stringSeparators = _mm_set1_epi8('"');
+    const __m128i escapeCharacters = _mm_set1_epi8('\\');
+#endif
 
-                // If it is a line end token we must test the line end type.
-                // It may be a "CR+LF" (Windows) one.
+    while (index < sourceSize) {
+#if defined(__SSE2__) && defined(__GNUC__)
+        // Look for the next string separator or escape character 16 bytes at a time.
 
-                if ((currentChar == '\r') && (this->sourceCode->index < this->sourceCode->size))
-                    if (this->sourceCode->data[this->sourceCode->index] == '\n')
-                        value += this->sourceCode->data[this->sourceCode->index++];
+        while (index + 16 <= sourceSize) {
+            __m128i sourceBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&source[index]));
+            int     foundMask   = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(sourceBytes, stringSeparators), _mm_cmpeq_epi8(sourceBytes, escapeCharacters)));
 
+            if (foundMask) {
+                index += __builtin_ctz(foundMask);
                 break;
             }
+
+            index += 16;
         }
 
-        value += currentChar;
+        if (index >= sourceSize)
+            break;
+#endif
+
+        if (source[index] == '"')
+            return index;
+
+        if (source[index] == '\\') {
+            hasEscapes  = true;
+            index      += 2;
+            continue;
+        }
+
+        index++;
     }
 
-    return value;
+    return sourceSize;
 }
 
-string Parser::TokenValueToString(Token& token) {
-    switch (token.type) {
-        case Token::Identifier: return token.value->asString;
-        case Token::Label: return "!" + string(token.value->asString);
-        case Token::Address: return "@" + string(token.value->asString);
-        case Token::StringLiteral: return "\"" + string(token.value->asString) + "\"";
-        case Token::IntLiteral: return FromInt(token.value->asInt);
-        case Token::FloatLiteral: return FromFloat(token.value->asFloat);
-        case Token::BoolLiteral: return FromBool(token.value->asBool);
-        case Token::ArgumentSeparator: return ",";
-        case Token::NewLine: return "new line";
-        default: return "";
+// Scans an identifier, label, address or literal value and classifies it on the way.
+// Returns the index right after the word or -1 on error.
+
+int64 Parser::ScanWord(Token& token, int64 index) {
+    charconst source     = reinterpret_cast<charconst>(this->sourceCode->data);
+    int64     sourceSize = this->sourceCode->size;
+
+    char prefix = source[index];
+
+    if ((prefix == '!') || (prefix == '@'))
+        index++;
+
+    int64  wordStart  = index;
+    bool   hasEscapes = false;
+    bool   isNegative = false;
+    bool   isNumber   = true;
+    int    dotCount   = 0;
+    uint64 intValue   = 0;
+
+    if ((index < sourceSize) && (source[index] == '-')) {
+        isNegative = true;
+        index++;
     }
-}
 
-void Parser::DeleteToken(Token& token) {
-    DeleteValue(token.value);
-}
+    // Break on any separator character.
 
-bool Parser::IsBoolean(const string value) {
-    return (value == "true") || (value == "false");
-}
+    while (index < sourceSize) {
+        char currentChar = source[index];
+
+        if ((static_cast<uchar>(currentChar) <= ' ') || (currentChar == ','))
+            break;
 
-bool Parser::IsInt(const string value) {
-    for (int charIndex = 0; charIndex < value.size(); charIndex++) {
-        if ((charIndex == 0) && (value[charIndex] == '-'))
+        if (currentChar == '\\') {
+            hasEscapes  = true;
+            isNumber    = false;
+            index      += 2;
             continue;
+        }
+
+        if ((currentChar >= '0') && (currentChar <= '9')) {
+            // Only the leading digits make the integer value.
+
+            if (isNumber && (dotCount == 0))
+                intValue = (intValue * 10) + (currentChar - '0');
+        } else if (currentChar == '.')
+            dotCount++;
+        else
+            isNumber = false;
 
-        if ((value[charIndex] < '0') || (value[charIndex] > '9'))
-            return false;
+        index++;
     }
 
-    return true;
+    if (index > sourceSize)
+        index = sourceSize;
+
+    charconst wordData = &source[wordStart];
+    int64     wordSize = index - wordStart;
+    int64     number   = isNegative ? -static_cast<int64>(intValue) : static_cast<int64>(intValue);
+
+    // Parse the token value.
+
+    if (prefix == '@') {
+        token.type        = Token::Address;
+        token.value.type  = Value::Int;
+        token.value.size  = sizeof(int64);
+        token.value.asInt = number;
+        Debug("TOKEN: ADDRESS = %ld", number);
+    } else if (prefix == '!') {
+        token.type = Token::Label;
+
+        if (!this->SetStringValue(token, wordData, wordSize, hasEscapes))
+            return -1;
+
+        Debug("TOKEN: LABEL = %.*s", static_cast<int>(wordSize), wordData);
+    } else if ((!hasEscapes) && (wordSize == 4) && (memcmp(wordData, "true", 4) == 0)) {
+        token.type         = Token::BoolLiteral;
+        token.value.type   = Value::Bool;
+        token.value.size   = sizeof(bool);
+        token.value.asBool = true;
+        Debug("TOKEN: BOOLEAN = true");
+    } else if ((!hasEscapes) && (wordSize == 5) && (memcmp(wordData, "false", 5) == 0)) {
+        token.type         = Token::BoolLiteral;
+        token.value.type   = Value::Bool;
+        token.value.size   = sizeof(bool);
+        token.value.asBool = false;
+        Debug("TOKEN: BOOLEAN = false");
+    } else if (isNumber && (dotCount == 0)) {
+        token.type        = Token::IntLiteral;
+        token.value.type  = Value::Int;
+        token.value.size  = sizeof(int64);
+        token.value.asInt = number;
+        Debug("TOKEN: INT = %ld", number);
+    } else if (isNumber && (dotCount == 1)) {
+        // The float has to be NUL terminated to be converted, which is done on the stack
+        // for any reasonable number length.
+
+        char floatString[Parser::MaxFloatLength];
+
+        token.type       = Token::FloatLiteral;
+        token.value.type = Value::Float;
+        token.value.size = sizeof(double);
+
+        if (wordSize < Parser::MaxFloatLength) {
+            memcpy(floatString, wordData, wordSize);
+            floatString[wordSize] = 0;
+            token.value.asFloat   = std::strtod(floatString, NULL);
+        } else
+            token.value.asFloat = ToFloat(string(wordData, wordSize));
+
+        Debug("TOKEN: FLOAT = %f", token.value.asFloat);
+    } else {
+        token.type = Token::Identifier;
+
+        if (!this->SetStringValue(token, wordData, wordSize, hasEscapes))
+            return -1;
+
+        Debug("TOKEN: IDENTIFIER = %.*s", static_cast<int>(wordSize), wordData);
+    }
+
+    return index;
 }
 
-bool Parser::IsFloat(const string value) {
-    bool dotFound = false;
+// Without escape sequences the value is just the span in the source code, otherwise
+// the unescaped value is built in the arena.
 
-    for (int charIndex = 0; charIndex < value.size(); charIndex++) {
-        if ((charIndex == 0) && (value[charIndex] == '-'))
-            continue;
+bool Parser::SetStringValue(Token& token, const charconst stringData, const int64 stringSize, const bool hasEscapes) {
+    token.value.type = Value::String;
 
-        if (value[charIndex] == '.') {
-            if (dotFound)
-                return false;
+    if (!hasEscapes) {
+        token.value.size     = stringSize;
+        token.value.asString = const_cast<cstring>(stringData);
+        return true;
+    }
 
-            dotFound = true;
-            continue;
-        }
+    token.value.asString = static_cast<cstring>(this->arena.Allocate(stringSize + 1));
+
+    if (!token.value.asString) {
+        Error("Line %d: could not allocate memory to hold the token value.", token.line);
+        return false;
+    }
+
+    int64 valueSize = 0;
+
+    for (int64 charIndex = 0; charIndex < stringSize; ++charIndex) {
+        if ((stringData[charIndex] == '\\') && (charIndex + 1 < stringSize))
+            charIndex++;
 
-        if ((value[charIndex] < '0') || (value[charIndex] > '9'))
-            return false;
+        token.value.asString[valueSize++] = stringData[charIndex];
     }
 
+    token.value.asString[valueSize] = 0;
+    token.value.size                = valueSize;
+
     return true;
 }
 
+string Parser::TokenValueToString(Token& token) {
+    switch (token.type) {
+        case Token::Identifier: return string(token.value.asString, token.value.size);
+        case Token::Label: return "!" + string(token.value.asString, token.value.size);
+        case Token::Address: return "@" + FromInt(token.value.asInt);
+        case Token::StringLiteral: return "\"" + string(token.value.asString, token.value.size) + "\"";
+        case Token::IntLiteral: return FromInt(token.value.asInt);
+        case Token::FloatLiteral: return FromFloat(token.value.asFloat);
+        case Token::BoolLiteral: return FromBool(token.value.asBool);
+        case Token::ArgumentSeparator: return ",";
+        case Token::NewLine: return "new line";
+        default: return "";
+    }
+}
+
 };    // namespace tinyVM
@@ -8,6 +8,7 @@
 #ifndef VM_PARSER_H
 #define VM_PARSER_H
 
+#include "Arena.hxx"
 #include "Core.hxx"
 
 namespace tinyVM {
@@ -16,7 +17,7 @@ namespace tinyVM {
 
 class Parser {
     public:
-        Parser(void);
+        Parser(Arena& arena);
         ~Parser();
 
         // General
@@ -25,8 +26,23 @@ class Parser {
         void Unload(void);
         void Reset(void);
 
+        // Chunks
+
+        // A chunk parser reads a part of the source code loaded by another parser (which
+        // must outlive it), without copying it. Its token offsets are relative to the
+        // chunk start and its lines are counted from the first line set for it.
+
+        bool          LoadChunk(const Parser& sourceParser, const int64 chunkStart, const int64 chunkSize);
+        void          SetFirstLine(const int firstLine);
+        const Memory* GetSourceCode(void) const;
+
         // Tokens
 
+        // Tokens are spans (offset and length) into the loaded source code. String values
+        // (identifiers, labels and string literals) point straight into the source and are
+        // not NUL terminated, only the ones with escape sequences are copied to the arena
+        // (and stay valid until it is reset).
+
         struct Token {
                 enum {
                     None,
@@ -41,26 +57,32 @@ class Parser {
                     NewLine
                 } type;
 
-                val value;
-                int line;
+                Value value;
+                int   line;
+                int64 offset;
+                int64 length;
         };
 
-        bool        GetNextToken(Token& token);
-        string      TokenValueToString(Token& token);
-        static void DeleteToken(Token& token);
+        bool   GetNextToken(Token& token);
+        string TokenValueToString(Token& token);
 
     private:
         // Source
 
+        Arena& arena;
         memory sourceCode;
         int    lineNumber;
+        int    firstLine;
+        bool   isChunk;
 
         // Tokens
 
-        string GetNextTokenValue(void);
-        bool   IsBoolean(const string value);
-        bool   IsInt(const string value);
-        bool   IsFloat(const string value);
+        static constexpr int MaxFloatLength = 64;
+
+        int64 SkipSpaces(int64 index) const;
+        int64 FindStringEnd(int64 index, bool& hasEscapes) const;
+        int64 ScanWord(Token& token, int64 index);
+        bool  SetStringValue(Token& token, const charconst stringData, const int64 stringSize, const bool hasEscapes);
 };
 
 };    // namespace tinyVM
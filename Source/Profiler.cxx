@@ -0,0 +1,155 @@
+/*
+ * Source/Profiler.cxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#include "Profiler.hxx"
+
+namespace tinyVM {
+
+// Profiler
+
+Profiler::Profiler(const ProgramImage* image) :
+    image(image),
+    counters(image ? image->GetNumberOfInstructions() + 1 : 0) {
+    // Empty
+}
+
+Profiler::~Profiler() {
+    // Empty
+}
+
+const ProgramImage* Profiler::GetImage(void) const {
+    return this->image;
+}
+
+uint64 Profiler::GetNumberOfExecutions(const int64 address) const {
+    return ((address >= 0) && (address < this->counters.size())) ? this->counters[address].executions : 0;
+}
+
+uint64 Profiler::GetNumberOfCycles(const int64 address) const {
+    return ((address >= 0) && (address < this->counters.size())) ? this->counters[address].cycles : 0;
+}
+
+void Profiler::Clear(void) {
+    std::fill(this->counters.begin(), this->counters.end(), Counter());
+}
+
+// Report
+
+void Profiler::Report(const VirtualMachineCore& machine, const int64 numberOfInstructions) const {
+    if (!this->image) {
+        Error("The profiler has no program image.");
+        return;
+    }
+
+    const VirtualMachineCore::OperationList& operations  = machine.GetOperations();
+    const std::vector<int64>&                opCodes     = this->image->GetOpCodes();
+    int64                                    lastAddress = this->image->GetNumberOfInstructions();
+
+    // Operations
+
+    std::vector<Counter> operationCounters(operations.size());
+    std::vector<int64>   operationIndexes;
+    uint64               totalExecutions = 0;
+    uint64               totalCycles     = 0;
+
+    for (int64 address = 0; address <= lastAddress; ++address) {
+        Counter& operationCounter = operationCounters[opCodes[address]];
+
+        operationCounter.executions += this->counters[address].executions;
+        operationCounter.cycles += this->counters[address].cycles;
+        totalExecutions += this->counters[address].executions;
+        totalCycles += this->counters[address].cycles;
+    }
+
+    for (int64 operationIndex = 0; operationIndex < operations.size(); ++operationIndex)
+        if (operationCounters[operationIndex].executions > 0)
+            operationIndexes.push_back(operationIndex);
+
+    std::sort(operationIndexes.begin(), operationIndexes.end(), [&operationCounters](const int64 first, const int64 second) {
+        return operationCounters[first].cycles > operationCounters[second].cycles;
+    });
+
+    Info("Profile: %lu instructions executed in %lu cycles.", totalExecutions, totalCycles);
+    Info("");
+    Info("  Operation      Executions           Cycles   Cycles/Exec   Cycles %%");
+
+    for (auto operationIndex = operationIndexes.begin(); operationIndex != operationIndexes.end(); ++operationIndex) {
+        const Counter& operationCounter = operationCounters[*operationIndex];
+
+        Info("  %-8s %16lu %16lu %13.1f %9.1f%%", operations[*operationIndex].mnemonic, operationCounter.executions, operationCounter.cycles, static_cast<double>(operationCounter.cycles) / operationCounter.executions, totalCycles ? (100.0 * operationCounter.cycles) / totalCycles : 0.0);
+    }
+
+    // Hottest Instructions
+
+    std::vector<int64>      lines;
+    std::map<int64, string> labels;
+    std::vector<int64>      addresses;
+
+    if (!this->ReadDebugInfo(lines, labels))
+        Warning("The program has no valid debug information, there are no source lines or labels to show.");
+
+    for (int64 address = 0; address <= lastAddress; ++address)
+        if (this->counters[address].executions > 0)
+            addresses.push_back(address);
+
+    int64 numberOfAddresses = std::min(static_cast<int64>(addresses.size()), numberOfInstructions);
+
+    std::partial_sort(addresses.begin(), addresses.begin() + numberOfAddresses, addresses.end(), [this](const int64 first, const int64 second) {
+        return this->counters[first].cycles > this->counters[second].cycles;
+    });
+
+    Info("");
+    Info("  Address   Operation      Executions           Cycles   Cycles/Exec   Line   Label");
+
+    for (int64 addressIndex = 0; addressIndex < numberOfAddresses; ++addressIndex) {
+        int64          address = addresses[addressIndex];
+        const Counter& counter = this->counters[address];
+        string         location;
+
+        // Show the address relative to the closest label before it.
+
+        auto label = labels.upper_bound(address);
+
+        if (label != labels.begin()) {
+            --label;
+            location = "!" + label->second;
+
+            if (address > label->first)
+                location += "+" + std::to_string(address - label->first);
+        }
+
+        Info("  @%-8ld %-8s %16lu %16lu %13.1f %6ld   %s", address, operations[opCodes[address]].mnemonic, counter.executions, counter.cycles, static_cast<double>(counter.cycles) / counter.executions, (address < lines.size()) ? lines[address] : 0, location.c_str());
+    }
+
+    Info("");
+}
+
+bool Profiler::ReadDebugInfo(std::vector<int64>& lines, std::map<int64, string>& labels) const {
+    const Program* program = this->image->GetProgram();
+
+    if (!program->HasDebugInfo())
+        return false;
+
+    lines.assign(this->counters.size(), 0);
+
+    Program::DebugEntry entry;
+    int64               debugOffset = 0;
+
+    while (program->ReadDebugEntry(debugOffset, entry)) {
+        if ((entry.address < 0) || (entry.address >= this->counters.size()))
+            return false;
+
+        if (entry.type == Program::LineEntry)
+            lines[entry.address] = entry.line;
+        else if (labels.find(entry.address) == labels.end())
+            labels[entry.address] = string(entry.name, entry.nameSize);
+    }
+
+    return true;
+}
+
+}    // namespace tinyVM
@@ -0,0 +1,56 @@
+/*
+ * Source/Profiler.hxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#ifndef VM_PROFILER_H
+#define VM_PROFILER_H
+
+#include "VirtualMachine.hxx"
+
+namespace tinyVM {
+
+// Profiler
+
+// Counts how many times each instruction of a program image ran and how many cycles
+// (time stamp counter ticks) it took, operation method included. A machine only uses
+// the profiled execution loop while a profiler is set (see SetProfiler) and the context
+// it resumes runs the profiler image, the normal loop is left untouched.
+//
+// The report maps the addresses back to the source lines and labels when the program
+// was compiled with debug information.
+
+class Profiler {
+    public:
+        Profiler(const ProgramImage* image);
+        ~Profiler();
+
+        const ProgramImage* GetImage(void) const;
+        uint64              GetNumberOfExecutions(const int64 address) const;
+        uint64              GetNumberOfCycles(const int64 address) const;
+        void                Clear(void);
+
+        // Prints the time spent in each operation and the hottest instructions (the
+        // machine is only used to get the operations mnemonics).
+
+        void Report(const VirtualMachineCore& machine, const int64 numberOfInstructions = 20) const;
+
+    private:
+        friend class VirtualMachineCore;
+
+        struct Counter {
+                uint64 executions;
+                uint64 cycles;
+        };
+
+        const ProgramImage*  image;
+        std::vector<Counter> counters;    // One per instruction, plus the final EXIT.
+
+        bool ReadDebugInfo(std::vector<int64>& lines, std::map<int64, string>& labels) const;
+};
+
+}    // namespace tinyVM
+
+#endif    // VM_PROFILER_H
@@ -7,15 +7,22 @@
 
 #include "Program.hxx"
 
+#include "ProgramWriter.hxx"
+
 namespace tinyVM {
 
 // Program
 
 Program::Program(void) :
     canEmit(false),
+    codeEncoding(FixedEncoding),
+    version(Program::Version),
+    mappedFile(NULL),
+    mappedFileSize(0),
     code(NULL),
     data(NULL),
-    strings(NULL) {
+    strings(NULL),
+    debug(NULL) {
     // Empty
 }
 
@@ -25,7 +32,7 @@ Program::~Program() {
 
 // General
 
-bool Program::New(void) {
+bool Program::New(const CodeEncoding codeEncoding) {
     // Make sure we do not leave any memory used.
 
     this->Delete();
@@ -33,18 +40,27 @@ bool Program::New(void) {
     this->code    = AllocateMemory(Program::MemoryBlockSize);
     this->data    = AllocateMemory(Program::MemoryBlockSize);
     this->strings = AllocateMemory(Program::MemoryBlockSize);
+    this->debug   = AllocateMemory(Program::MemoryBlockSize);
 
-    if ((!this->code) || (!this->data) || (!this->strings)) {
+    if ((!this->code) || (!this->data) || (!this->strings) || (!this->debug)) {
         Error("Could not allocate memory to hold the new program.");
 
         DeleteMemory(this->code);
         DeleteMemory(this->data);
         DeleteMemory(this->strings);
+        DeleteMemory(this->debug);
 
         return false;
     }
 
-    this->canEmit = true;
+    this->canEmit      = true;
+    this->codeEncoding = codeEncoding;
+    this->version      = Program::Version;
+
+    if (this->codeEncoding == Program::CompactEncoding) {
+        memset(this->code->data, 0, Program::CompactCodeHeaderSize);
+        this->code->index = Program::CompactCodeHeaderSize;
+    }
 
     Debug("New program created.");
     return true;
@@ -54,37 +70,92 @@ bool Program::Save(const string filePath) {
     if (!this->code)
         return false;
 
-    FILE* file = fopen(filePath.c_str(), "wb");
+    // The sections are streamed straight from the program memory, each one aligned to
+    // Program::SectionAlignment bytes after the header and the section directory (the
+    // debug section is left out when there is no debug information).
+
+    const memory  sectionsMemory[Program::NumberOfSections] = {this->code, this->data, this->strings, this->debug};
+    int32         numberOfSections = (this->debug->index > 0) ? Program::NumberOfSections : Program::NumberOfSections - 1;
+    ProgramWriter programWriter;
+
+    if (!programWriter.Open(filePath, numberOfSections))
+        return false;
+
+    for (int sectionIndex = 0; sectionIndex < numberOfSections; ++sectionIndex) {
+        int32 sectionFlags = ((sectionIndex == 0) && (this->codeEncoding == Program::CompactEncoding)) ? Program::CompactCodeFlag : 0;
+
+        if ((!programWriter.BeginSection(sectionIndex + 1, sectionFlags)) || (!programWriter.Write(sectionsMemory[sectionIndex]->data, sectionsMemory[sectionIndex]->index)) || (!programWriter.EndSection())) {
+            Error("Could not write the program sections to \"%s\"", filePath.c_str());
+            programWriter.Abort();
+            return false;
+        }
+    }
+
+    if (!programWriter.Close())
+        return false;
+
+    Info("Program saved to \"%s\"", filePath.c_str());
+    return true;
+}
+
+bool Program::Load(const string filePath, const LoadMode loadMode) {
+    // Make sure we do not leave any memory in use.
+
+    this->Delete();
+
+    if (loadMode == Program::MapFile)
+        return this->Map(filePath);
+
+    // Try to open the program file.
+
+    FILE* file = fopen(filePath.c_str(), "rb");
 
     if (!file) {
-        Error("Could not create the program file in \"%s\"", filePath.c_str());
+        Error("Could not open the program file \"%s\"", filePath.c_str());
         return false;
     }
 
-    // Write the program header.
+    // Read the program header and the section directory.
 
-    // ID (4)
-    // Version (4)
-    // Code Size (8)
-    // Data Size (8)
-    // String Index Size (8)
+    fseeko(file, 0, SEEK_END);
+    int64 fileSize = ftello(file);
+    fseeko(file, 0, SEEK_SET);
 
-    buffer programHeader = NewBuffer(32);
+    uint8 headerStart[Program::HeaderSize];
+
+    if (fread(headerStart, Program::HeaderSize, 1, file) != 1) {
+        Error("Could not read the program header from \"%s\"", filePath.c_str());
+        fclose(file);
+        return false;
+    }
+
+    int64 headerSize = this->GetHeaderSize(headerStart);
+
+    if (headerSize == 0) {
+        fclose(file);
+        return false;
+    }
+
+    buffer programHeader = NewBuffer(headerSize);
 
     if (!programHeader) {
-        Error("Could not allocate memory to hold the file header.");
+        Error("Could not allocate memory to hold the program header.");
+        fclose(file);
+        return false;
+    }
+
+    memcpy(programHeader, headerStart, Program::HeaderSize);
+
+    if (fread(&programHeader[Program::HeaderSize], headerSize - Program::HeaderSize, 1, file) != 1) {
+        Error("Could not read the program header from \"%s\"", filePath.c_str());
+        DeleteBuffer(programHeader);
         fclose(file);
         return false;
     }
 
-    memcpy(programHeader, Program::Signature, 4);
-    memcpy(&programHeader[4], &Program::Version, 4);
-    memcpy(&programHeader[8], &this->code->index, 8);
-    memcpy(&programHeader[16], &this->data->index, 8);
-    memcpy(&programHeader[24], &this->strings->index, 8);
+    Section sections[Program::NumberOfSections];
 
-    if (fwrite(programHeader, 32, 1, file) != 1) {
-        Error("Could not write the program header to \"%s\"", filePath.c_str());
+    if (!this->ReadHeader(programHeader, fileSize, sections)) {
         DeleteBuffer(programHeader);
         fclose(file);
         return false;
@@ -92,177 +163,415 @@ bool Program::Save(const string filePath) {
 
     DeleteBuffer(programHeader);
 
-    // Write the program code.
+    // Allocate the needed memory and read the program code, data, strings and debug
+    // information (the missing sections are just empty).
 
-    if (this->code->index > 0)
-        if (fwrite(this->code->data, this->code->index, 1, file) != 1) {
-            Error("Could not write the program code to \"%s\"", filePath.c_str());
+    memory* sectionsMemory[Program::NumberOfSections] = {&this->code, &this->data, &this->strings, &this->debug};
+
+    for (int sectionIndex = 0; sectionIndex < Program::NumberOfSections; ++sectionIndex) {
+        memory& sectionMemory = *sectionsMemory[sectionIndex];
+        int64   sectionSize   = sections[sectionIndex].size;
+
+        sectionMemory = AllocateMemory((ceil(sectionSize / Program::MemoryBlockSize) + 1) * Program::MemoryBlockSize);
+
+        if (!sectionMemory) {
+            Error("Could not allocate memory to hold the program.");
             fclose(file);
+            this->Delete();
             return false;
         }
 
-    // Write the program data.
+        memset(sectionMemory->data, 0, sectionMemory->size);
+        sectionMemory->index = sectionSize;
 
-    if (this->data->index > 0)
-        if (fwrite(this->data->data, this->data->index, 1, file) != 1) {
-            Error("Could not write the program data to \"%s\"", filePath.c_str());
-            fclose(file);
+        if (sectionSize > 0)
+            if ((fseeko(file, sections[sectionIndex].offset, SEEK_SET) != 0) || (fread(sectionMemory->data, sectionSize, 1, file) != 1)) {
+                Error("Could not read the program sections from \"%s\"", filePath.c_str());
+                fclose(file);
+                this->Delete();
+                return false;
+            }
+    }
+
+    fclose(file);
+
+    this->codeEncoding = (sections[0].flags & Program::CompactCodeFlag) ? Program::CompactEncoding : Program::FixedEncoding;
+
+    if (!this->Verify()) {
+        Error("The program file \"%s\" is invalid.", filePath.c_str());
+        this->Delete();
+        return false;
+    }
+
+    Info("Program loaded from \"%s\"", filePath.c_str());
+    return true;
+}
+
+void Program::Delete(void) {
+    if (!this->code)
+        return;
+
+    // The mapped blocks point into the file mapping, there is nothing to free there.
+
+    if (this->mappedFile) {
+        this->code->data    = NULL;
+        this->data->data    = NULL;
+        this->strings->data = NULL;
+        this->debug->data   = NULL;
+
+        this->Unmap();
+    }
+
+    DeleteMemory(this->code);
+    DeleteMemory(this->data);
+    DeleteMemory(this->strings);
+    DeleteMemory(this->debug);
+
+    this->stringSlots.clear();
+    this->canEmit      = false;
+    this->codeEncoding = Program::FixedEncoding;
+    this->version      = Program::Version;
+
+    Debug("Program deleted.");
+}
+
+bool Program::IsMapped(void) const {
+    return this->mappedFile != NULL;
+}
+
+// Checks what can be checked without the machine operations (the machine checks the
+// instructions when it decodes them, and ReadHeader already checked that every section
+// is inside the file): the code size, the string index entries and the debug entries,
+// so nothing read from them later can point outside of the program.
+
+bool Program::Verify(void) const {
+    int64 numberOfInstructions = this->GetNumberOfInstructions();
+
+    if (this->codeEncoding == Program::FixedEncoding) {
+        if ((this->code->index % Program::InstructionSize) != 0) {
+            Error("The program code is truncated.");
             return false;
         }
+    } else if (this->code->index > 0) {
+        // Every compact instruction takes at least one byte.
 
-    // Write the program string index.
+        if ((this->code->index < Program::CompactCodeHeaderSize) || (numberOfInstructions < 0) || (numberOfInstructions > this->code->index - Program::CompactCodeHeaderSize)) {
+            Error("The program code is truncated.");
+            return false;
+        }
+    }
 
-    if (this->strings->index > 0)
-        if (fwrite(this->strings->data, this->strings->index, 1, file) != 1) {
-            Error("Could not write the program string index to \"%s\"", filePath.c_str());
-            fclose(file);
+    if ((this->strings->index % 16) != 0) {
+        Error("The program string index is truncated.");
+        return false;
+    }
+
+    for (int64 stringIndex = 1; stringIndex <= this->GetNumberOfStrings(); ++stringIndex) {
+        charconst stringData;
+        int64     stringSize;
+
+        if (!this->GetString(stringIndex, stringData, stringSize)) {
+            Error("The program string %ld is invalid.", stringIndex);
+            return false;
+        }
+    }
+
+    // The labels may point right after the last instruction.
+
+    int64      debugOffset = 0;
+    DebugEntry entry;
+
+    while (debugOffset < this->debug->index)
+        if ((!this->ReadDebugEntry(debugOffset, entry)) || (entry.address < 0) || (entry.address > numberOfInstructions)) {
+            Error("The program debug information is invalid.");
             return false;
         }
 
-    fclose(file);
-    Info("Program saved to \"%s\"", filePath.c_str());
     return true;
 }
 
-bool Program::Load(const string filePath) {
-    // Make sure we do not leave any memory in use.
+int64 Program::GetHeaderSize(const buffer headerStart) {
+    // Version 1 (32 bytes):
+    //   ID (4)
+    //   Version (4)
+    //   Code Size (8)
+    //   Data Size (8)
+    //   String Index Size (8)
+    //
+    // Version 2 (16 bytes + 24 bytes per section):
+    //   ID (4)
+    //   Version (4)
+    //   Number Of Sections (4)
+    //   Reserved (4)
+    //   Sections:
+    //     Type (4)
+    //     Flags (4)
+    //     Offset (8)
+    //     Size (8)
+
+    if (memcmp(Program::Signature, headerStart, 4) != 0) {
+        Error("The program signature is invalid.");
+        return 0;
+    }
 
-    this->Delete();
+    int32 version, numberOfSections;
 
-    // Try to open the program file.
+    memcpy(&version, &headerStart[4], 4);
 
-    FILE* file = fopen(filePath.c_str(), "rb");
+    switch (version) {
+        case Program::LegacyVersion: return Program::LegacyHeaderSize;
 
-    if (!file) {
+        case Program::Version: {
+            memcpy(&numberOfSections, &headerStart[8], 4);
+
+            if ((numberOfSections < 0) || (numberOfSections > Program::MaxNumberOfSections)) {
+                Error("Invalid number of program sections (%d).", numberOfSections);
+                return 0;
+            }
+
+            return Program::HeaderSize + (numberOfSections * Program::SectionEntrySize);
+        }
+
+        default: {
+            Error("Unsupported program version.");
+            return 0;
+        }
+    }
+}
+
+bool Program::ReadHeader(const buffer programHeader, const int64 fileSize, Section sections[Program::NumberOfSections]) {
+    memset(sections, 0, sizeof(Section) * Program::NumberOfSections);
+
+    memcpy(&this->version, &programHeader[4], 4);
+
+    if (this->version == Program::LegacyVersion) {
+        // The version 1 sections are packed right after the header.
+
+        int64 sectionOffset = Program::LegacyHeaderSize;
+
+        for (int sectionIndex = 0; sectionIndex < Program::LegacyNumberOfSections; ++sectionIndex) {
+            sections[sectionIndex].type   = sectionIndex + 1;
+            sections[sectionIndex].offset = sectionOffset;
+
+            memcpy(&sections[sectionIndex].size, &programHeader[8 + (sectionIndex * 8)], 8);
+
+            if ((sections[sectionIndex].size < 0) || (sections[sectionIndex].size > INT64_MAX - sectionOffset)) {
+                Error("The program blocks sizes are invalid.");
+                return false;
+            }
+
+            sectionOffset += sections[sectionIndex].size;
+        }
+    } else {
+        int32 numberOfSections;
+        memcpy(&numberOfSections, &programHeader[8], 4);
+
+        for (int entryIndex = 0; entryIndex < numberOfSections; ++entryIndex) {
+            buffer  sectionEntry = &programHeader[Program::HeaderSize + (entryIndex * Program::SectionEntrySize)];
+            Section section;
+
+            memcpy(&section.type, sectionEntry, 4);
+            memcpy(&section.flags, &sectionEntry[4], 4);
+            memcpy(&section.offset, &sectionEntry[8], 8);
+            memcpy(&section.size, &sectionEntry[16], 8);
+
+            if ((section.offset < 0) || (section.size < 0)) {
+                Error("The program section %d is invalid.", section.type);
+                return false;
+            }
+
+            // Sections that we do not know about are just skipped.
+
+            if ((section.type < Program::CodeSection) || (section.type > Program::NumberOfSections)) {
+                Debug("Skipping unknown program section %d.", section.type);
+                continue;
+            }
+
+            if (sections[section.type - 1].type != 0) {
+                Error("The program section %d is duplicated.", section.type);
+                return false;
+            }
+
+            sections[section.type - 1] = section;
+        }
+    }
+
+    // Written so it cannot overflow, the offsets and sizes come straight from the file.
+
+    for (int sectionIndex = 0; sectionIndex < Program::NumberOfSections; ++sectionIndex)
+        if ((sections[sectionIndex].offset > fileSize) || (sections[sectionIndex].size > fileSize - sections[sectionIndex].offset)) {
+            Error("The program file is truncated.");
+            return false;
+        }
+
+    Debug("Program blocks sizes: %ld, %ld, %ld, %ld", sections[0].size, sections[1].size, sections[2].size, sections[3].size);
+    return true;
+}
+
+// File Mapping
+
+bool Program::Map(const string filePath) {
+#if defined(LinuxOS)
+    int fileDescriptor = open(filePath.c_str(), O_RDONLY);
+
+    if (fileDescriptor < 0) {
         Error("Could not open the program file \"%s\"", filePath.c_str());
         return false;
     }
 
-    // Read the program header.
+    struct stat fileStatus;
 
-    // ID (4)
-    // Version (4)
-    // Code Size (8)
-    // Data Size (8)
-    // String Index Size (8)
+    if (fstat(fileDescriptor, &fileStatus) != 0) {
+        Error("Could not get the size of the program file \"%s\" (error %d)", filePath.c_str(), errno);
+        close(fileDescriptor);
+        return false;
+    }
 
-    buffer programHeader = NewBuffer(32);
+    this->mappedFileSize = fileStatus.st_size;
 
-    if (fread(programHeader, 32, 1, file) != 1) {
+    if (this->mappedFileSize < Program::HeaderSize) {
         Error("Could not read the program header from \"%s\"", filePath.c_str());
-        DeleteBuffer(programHeader);
-        fclose(file);
+        close(fileDescriptor);
         return false;
     }
 
-    // Check the program signature and version.
+    pointer mapping = mmap(NULL, this->mappedFileSize, PROT_READ, MAP_SHARED, fileDescriptor, 0);
 
-    if (memcmp(Program::Signature, programHeader, 4) != 0) {
-        Error("The program signature is invalid.");
-        DeleteBuffer(programHeader);
-        fclose(file);
+    // The mapping stays valid after the file is closed.
+
+    close(fileDescriptor);
+
+    if (mapping == MAP_FAILED) {
+        Error("Could not map the program file \"%s\" (error %d)", filePath.c_str(), errno);
         return false;
     }
 
-    int32 version = Program::Version;
+    this->mappedFile = static_cast<buffer>(mapping);
+#elif defined(WindowsOS)
+    HANDLE fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 
-    if (memcmp(&version, &programHeader[4], 4) != 0) {
-        Error("Unsupported program version.");
-        DeleteBuffer(programHeader);
-        fclose(file);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        Error("Could not open the program file \"%s\"", filePath.c_str());
         return false;
     }
 
-    // Read the program blocks sizes.
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(fileHandle, &fileSize)) {
+        Error("Could not get the size of the program file \"%s\" (error %lu)", filePath.c_str(), GetLastError());
+        CloseHandle(fileHandle);
+        return false;
+    }
 
-    int64 codeSize, dataSize, stringsSize;
+    this->mappedFileSize = fileSize.QuadPart;
 
-    memcpy(&codeSize, &programHeader[8], 8);
-    memcpy(&dataSize, &programHeader[16], 8);
-    memcpy(&stringsSize, &programHeader[24], 8);
+    if (this->mappedFileSize < Program::HeaderSize) {
+        Error("Could not read the program header from \"%s\"", filePath.c_str());
+        CloseHandle(fileHandle);
+        return false;
+    }
 
-    DeleteBuffer(programHeader);
+    HANDLE mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(fileHandle);
 
-    Debug("Program blocks sizes: %ld, %ld, %ld", codeSize, dataSize, stringsSize);
+    if (!mappingHandle) {
+        Error("Could not map the program file \"%s\" (error %lu)", filePath.c_str(), GetLastError());
+        return false;
+    }
 
-    // Allocate the needed memory.
+    // The view keeps the mapping alive after its handle is closed.
 
-    this->code    = AllocateMemory((ceil(codeSize / Program::MemoryBlockSize) + 1) * Program::MemoryBlockSize);
-    this->data    = AllocateMemory((ceil(dataSize / Program::MemoryBlockSize) + 1) * Program::MemoryBlockSize);
-    this->strings = AllocateMemory((ceil(stringsSize / Program::MemoryBlockSize) + 1) * Program::MemoryBlockSize);
+    this->mappedFile = static_cast<buffer>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    CloseHandle(mappingHandle);
 
-    if ((!this->code) || (!this->data) || (!this->strings)) {
-        Error("Could not allocate memory to hold the program.");
-        fclose(file);
-        this->Delete();
+    if (!this->mappedFile) {
+        Error("Could not map the program file \"%s\" (error %lu)", filePath.c_str(), GetLastError());
         return false;
     }
+#endif
 
-    memset(this->code->data, 0, this->code->size);
-    memset(this->data->data, 0, this->data->size);
-    memset(this->strings->data, 0, this->strings->size);
+    // Point the program blocks straight into the mapping.
 
-    // Read the program code, data and strings.
+    int64   headerSize = this->GetHeaderSize(this->mappedFile);
+    Section sections[Program::NumberOfSections];
 
-    this->code->index    = codeSize;
-    this->data->index    = dataSize;
-    this->strings->index = stringsSize;
+    if ((headerSize == 0) || (headerSize > this->mappedFileSize) || (!this->ReadHeader(this->mappedFile, this->mappedFileSize, sections))) {
+        if (headerSize > this->mappedFileSize)
+            Error("Could not read the program header from \"%s\"", filePath.c_str());
 
-    if (this->code->index > 0)
-        if (fread(this->code->data, this->code->index, 1, file) != 1) {
-            Error("Could not read the program code from \"%s\"", filePath.c_str());
-            fclose(file);
-            this->Delete();
-            return false;
-        }
+        this->Unmap();
+        return false;
+    }
 
-    if (this->data->index > 0)
-        if (fread(this->data->data, this->data->index, 1, file) != 1) {
-            Error("Could not read the program data from \"%s\"", filePath.c_str());
-            fclose(file);
-            return false;
-        }
+    memory* sectionsMemory[Program::NumberOfSections] = {&this->code, &this->data, &this->strings, &this->debug};
 
-    if (this->strings->index > 0)
-        if (fread(this->strings->data, this->strings->index, 1, file) != 1) {
-            Error("Could not read the program string index from \"%s\"", filePath.c_str());
-            fclose(file);
+    for (int sectionIndex = 0; sectionIndex < Program::NumberOfSections; ++sectionIndex) {
+        memory& sectionMemory = *sectionsMemory[sectionIndex];
+        sectionMemory         = new (std::nothrow) Memory();
+
+        if (!sectionMemory) {
+            Error("Could not allocate memory to hold the program.");
+
+            delete this->code;
+            delete this->data;
+            delete this->strings;
+            delete this->debug;
+
+            this->code    = NULL;
+            this->data    = NULL;
+            this->strings = NULL;
+            this->debug   = NULL;
+
+            this->Unmap();
             return false;
         }
 
-    fclose(file);
+        sectionMemory->size  = sections[sectionIndex].size;
+        sectionMemory->index = sections[sectionIndex].size;
+        sectionMemory->data  = &this->mappedFile[sections[sectionIndex].offset];
+    }
 
-    Info("Program loaded from \"%s\"", filePath.c_str());
+    this->codeEncoding = (sections[0].flags & Program::CompactCodeFlag) ? Program::CompactEncoding : Program::FixedEncoding;
+
+    if (!this->Verify()) {
+        Error("The program file \"%s\" is invalid.", filePath.c_str());
+        this->Delete();
+        return false;
+    }
+
+    Info("Program mapped from \"%s\"", filePath.c_str());
     return true;
 }
 
-void Program::Delete(void) {
-    if (!this->code)
+void Program::Unmap(void) {
+    if (!this->mappedFile)
         return;
 
-    DeleteMemory(this->code);
-    DeleteMemory(this->data);
-    DeleteMemory(this->strings);
-
-    this->stringIndex.clear();
-    this->canEmit = false;
+#if defined(LinuxOS)
+    munmap(this->mappedFile, this->mappedFileSize);
+#elif defined(WindowsOS)
+    UnmapViewOfFile(this->mappedFile);
+#endif
 
-    Debug("Program deleted.");
+    this->mappedFile     = NULL;
+    this->mappedFileSize = 0;
 }
 
 // Instructions
 
-bool Program::Emit(const int64 opCode, const InstructionParameters parameters) {
+bool Program::Emit(const int64 opCode, const InstructionParameters parameters, int64* parameterOffsets) {
     if ((!this->code) || (!this->canEmit))
         return false;
 
+    if (this->codeEncoding == Program::CompactEncoding)
+        return this->EmitCompact(opCode, parameters, parameterOffsets);
+
     // Expand the program memory if needed.
 
-    if (this->code->size < this->code->index + 32)
-        if (!ExpandMemory(this->code, this->code->size + Program::MemoryBlockSize)) {
-            Error("Could not expand the program memory to hold the new code.");
-            return false;
-        }
+    if (!ReserveMemory(this->code, this->code->index + Program::InstructionSize)) {
+        Error("Could not expand the program memory to hold the new code.");
+        return false;
+    }
 
     Debug("Emit %ld:", opCode);
 
@@ -277,9 +586,17 @@ bool Program::Emit(const int64 opCode, const InstructionParameters parameters) {
                 case Value::Int: parameterValue = parameters[parameterIndex]->asInt; break;
                 case Value::Float: memcpy(&parameterValue, &parameters[parameterIndex]->asFloat, 8); break;
                 case Value::Bool: parameterValue = static_cast<int64>(parameters[parameterIndex]->asBool); break;
-                case Value::String: parameterValue = this->GetStringIndex(parameters[parameterIndex]->asString); break;
+                case Value::String: {
+                    if (!(parameterValue = this->GetStringIndex(parameters[parameterIndex]->asString, parameters[parameterIndex]->size)))
+                        return false;
+
+                    break;
+                }
             }
 
+        if (parameterOffsets)
+            parameterOffsets[parameterIndex] = this->code->index + 8;
+
         memcpy(&this->code->data[this->code->index += 8], &parameterValue, 8);
         Debug("  P%d = %ld", parameterIndex, parameterValue);
     }
@@ -288,53 +605,624 @@ bool Program::Emit(const int64 opCode, const InstructionParameters parameters) {
     return true;
 }
 
+bool Program::EmitCompact(const int64 opCode, const InstructionParameters parameters, int64* parameterOffsets) {
+    if (!ReserveMemory(this->code, this->code->index + Program::MaxCompactInstructionSize)) {
+        Error("Could not expand the program memory to hold the new code.");
+        return false;
+    }
+
+    Debug("Emit %ld (compact):", opCode);
+
+    buffer instructionData = &this->code->data[this->code->index];
+    int    instructionSize = WriteVarInt(instructionData, opCode);
+
+    for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex) {
+        if (parameterOffsets)
+            parameterOffsets[parameterIndex] = this->code->index + instructionSize;
+
+        if (!parameters[parameterIndex])
+            continue;
+
+        switch (parameters[parameterIndex]->type) {
+            case Value::Int: {
+                if (parameters[parameterIndex]->asInt == Program::AddressPlaceholder) {
+                    WritePaddedVarInt(&instructionData[instructionSize], ZigZagEncode(Program::AddressPlaceholder), Program::CompactAddressSize);
+                    instructionSize += Program::CompactAddressSize;
+                    break;
+                }
+
+                instructionSize += WriteVarInt(&instructionData[instructionSize], ZigZagEncode(parameters[parameterIndex]->asInt));
+                break;
+            }
+
+            case Value::Float: {
+                memcpy(&instructionData[instructionSize], &parameters[parameterIndex]->asFloat, 8);
+                instructionSize += 8;
+                break;
+            }
+
+            case Value::Bool: {
+                instructionData[instructionSize++] = parameters[parameterIndex]->asBool ? 1 : 0;
+                break;
+            }
+
+            case Value::String: {
+                int64 stringIndex = this->GetStringIndex(parameters[parameterIndex]->asString, parameters[parameterIndex]->size);
+
+                if (!stringIndex)
+                    return false;
+
+                instructionSize += WriteVarInt(&instructionData[instructionSize], stringIndex);
+                break;
+            }
+        }
+    }
+
+    this->code->index += instructionSize;
+
+    // Keep the number of instructions up to date at the start of the code block.
+
+    int64 numberOfInstructions = this->GetNumberOfInstructions() + 1;
+    memcpy(this->code->data, &numberOfInstructions, 8);
+
+    Debug("  %d bytes", instructionSize);
+    return true;
+}
+
+bool Program::Reserve(const int64 codeBytes, const int64 dataBytes, const int64 stringBytes) {
+    if ((!this->code) || (!this->canEmit))
+        return false;
+
+    // Reserve exactly what was asked for, the growth only doubles when it is not enough.
+
+    memory* blocksMemory[Program::NumberOfSections] = {&this->code, &this->data, &this->strings, &this->debug};
+    int64   blocksBytes[Program::NumberOfSections]  = {codeBytes, dataBytes, stringBytes, 0};
+
+    for (int blockIndex = 0; blockIndex < Program::NumberOfSections; ++blockIndex) {
+        memory& blockMemory = *blocksMemory[blockIndex];
+
+        if (blockMemory->index + blocksBytes[blockIndex] > blockMemory->size)
+            if (!ExpandMemory(blockMemory, blockMemory->index + blocksBytes[blockIndex])) {
+                Error("Could not reserve %ld bytes of program memory.", blocksBytes[blockIndex]);
+                return false;
+            }
+    }
+
+    // Size the string index for all the strings that may come.
+
+    int64 numberOfSlots = this->stringSlots.empty() ? 256 : this->stringSlots.size();
+
+    while ((this->GetNumberOfStrings() + (stringBytes / 16)) * 2 > numberOfSlots)
+        numberOfSlots *= 2;
+
+    if (numberOfSlots > this->stringSlots.size())
+        this->GrowStringSlots(numberOfSlots);
+
+    Debug("Program memory reserved: %ld, %ld, %ld.", this->code->size, this->data->size, this->strings->size);
+    return true;
+}
+
+bool Program::Append(const Program& nextProgram, const std::vector<int64>& stringOffsets) {
+    if ((!this->code) || (!this->canEmit) || (!nextProgram.code) || (nextProgram.codeEncoding != this->codeEncoding))
+        return false;
+
+    int64              numberOfStrings = nextProgram.GetNumberOfStrings();
+    std::vector<int64> stringIndexes;
+
+    if (!this->MapStrings(nextProgram, stringIndexes))
+        return false;
+
+    // Copy the code between the string parameters, which are written again with their new
+    // indexes (a compact index may take more or fewer bytes now).
+
+    bool   isCompact  = (this->codeEncoding == Program::CompactEncoding);
+    int64  codeOffset = isCompact ? Program::CompactCodeHeaderSize : 0;
+    int64  codeSize   = nextProgram.code->index;
+    buffer codeData   = nextProgram.code->data;
+
+    if (!ReserveMemory(this->code, this->code->index + (codeSize - codeOffset) + (stringOffsets.size() * (isCompact ? 10 : 0)))) {
+        Error("Could not expand the program memory to hold the appended code.");
+        return false;
+    }
+
+    for (auto stringOffset = stringOffsets.begin(); stringOffset != stringOffsets.end(); ++stringOffset) {
+        int64  parameterOffset = *stringOffset;
+        uint64 stringIndex     = 0;
+
+        if ((parameterOffset < codeOffset) || (parameterOffset >= codeSize))
+            return false;
+
+        memcpy(&this->code->data[this->code->index], &codeData[codeOffset], parameterOffset - codeOffset);
+        this->code->index += parameterOffset - codeOffset;
+
+        if (isCompact) {
+            if (!ReadVarInt(codeData, codeSize, parameterOffset, stringIndex))
+                return false;
+        } else {
+            memcpy(&stringIndex, &codeData[parameterOffset], 8);
+            parameterOffset += 8;
+        }
+
+        if ((stringIndex < 1) || (stringIndex > static_cast<uint64>(numberOfStrings)))
+            return false;
+
+        if (isCompact)
+            this->code->index += WriteVarInt(&this->code->data[this->code->index], stringIndexes[stringIndex]);
+        else {
+            memcpy(&this->code->data[this->code->index], &stringIndexes[stringIndex], 8);
+            this->code->index += 8;
+        }
+
+        codeOffset = parameterOffset;
+    }
+
+    memcpy(&this->code->data[this->code->index], &codeData[codeOffset], codeSize - codeOffset);
+    this->code->index += codeSize - codeOffset;
+
+    if (isCompact) {
+        int64 numberOfInstructions = this->GetNumberOfInstructions() + nextProgram.GetNumberOfInstructions();
+        memcpy(this->code->data, &numberOfInstructions, 8);
+    }
+
+    // The debug entries hold the final addresses already.
+
+    if (nextProgram.debug && (nextProgram.debug->index > 0)) {
+        if (!ReserveMemory(this->debug, this->debug->index + nextProgram.debug->index)) {
+            Error("Could not expand the program memory to hold the appended debug information.");
+            return false;
+        }
+
+        memcpy(&this->debug->data[this->debug->index], nextProgram.debug->data, nextProgram.debug->index);
+        this->debug->index += nextProgram.debug->index;
+    }
+
+    return true;
+}
+
+bool Program::Edit(void) {
+    if ((!this->code) || this->mappedFile)
+        return false;
+
+    if (this->canEmit)
+        return true;
+
+    int64 numberOfSlots = 256;
+
+    while (this->GetNumberOfStrings() * 2 >= numberOfSlots)
+        numberOfSlots *= 2;
+
+    this->stringSlots.clear();
+    this->GrowStringSlots(numberOfSlots);
+
+    uint64 slotMask = this->stringSlots.size() - 1;
+
+    for (int64 stringIndex = 1; stringIndex <= this->GetNumberOfStrings(); ++stringIndex) {
+        charconst stringData;
+        int64     stringSize;
+
+        if (!this->GetString(stringIndex, stringData, stringSize))
+            return false;
+
+        uint64 stringHash = Hash(stringData, stringSize);
+        uint64 slotIndex  = stringHash & slotMask;
+
+        while (this->stringSlots[slotIndex].stringIndex)
+            slotIndex = (slotIndex + 1) & slotMask;
+
+        StringSlot stringSlot        = {stringHash, stringIndex};
+        this->stringSlots[slotIndex] = stringSlot;
+    }
+
+    this->canEmit = true;
+    return true;
+}
+
+bool Program::Splice(const int64 firstAddress, const int64 numberOfInstructions, const Program& newProgram, const std::vector<int64>& stringOffsets) {
+    if ((!this->code) || (!this->canEmit) || (!newProgram.code) || (this->codeEncoding != Program::FixedEncoding) || (newProgram.codeEncoding != Program::FixedEncoding))
+        return false;
+
+    if ((firstAddress < 0) || (numberOfInstructions < 0) || (firstAddress + numberOfInstructions > this->GetNumberOfInstructions()))
+        return false;
+
+    int64              numberOfStrings = newProgram.GetNumberOfStrings();
+    std::vector<int64> stringIndexes;
+
+    if (!this->MapStrings(newProgram, stringIndexes))
+        return false;
+
+    // Move the code after the replaced instructions and copy the new code in between.
+
+    int64 spliceOffset = firstAddress * Program::InstructionSize;
+    int64 removedSize  = numberOfInstructions * Program::InstructionSize;
+    int64 insertedSize = newProgram.code->index;
+    int64 tailSize     = this->code->index - spliceOffset - removedSize;
+
+    if (!ReserveMemory(this->code, this->code->index - removedSize + insertedSize)) {
+        Error("Could not expand the program memory to hold the spliced code.");
+        return false;
+    }
+
+    buffer spliceData = &this->code->data[spliceOffset];
+
+    memmove(&spliceData[insertedSize], &spliceData[removedSize], tailSize);
+    memcpy(spliceData, newProgram.code->data, insertedSize);
+
+    this->code->index += insertedSize - removedSize;
+
+    for (auto stringOffset = stringOffsets.begin(); stringOffset != stringOffsets.end(); ++stringOffset) {
+        int64 stringIndex = 0;
+
+        if ((*stringOffset < 0) || (*stringOffset + 8 > insertedSize))
+            return false;
+
+        memcpy(&stringIndex, &spliceData[*stringOffset], 8);
+
+        if ((stringIndex < 1) || (stringIndex > numberOfStrings))
+            return false;
+
+        memcpy(&spliceData[*stringOffset], &stringIndexes[stringIndex], 8);
+    }
+
+    return true;
+}
+
+bool Program::PatchAddress(const int64 parameterOffset, const int64 address) {
+    if ((!this->code) || (!this->canEmit))
+        return false;
+
+    int parameterSize = (this->codeEncoding == Program::CompactEncoding) ? Program::CompactAddressSize : 8;
+
+    if ((address < 0) || (address >= Program::AddressPlaceholder) || (parameterOffset < 0) || (parameterOffset + parameterSize > this->code->index)) {
+        Error("Could not patch the address at offset %ld.", parameterOffset);
+        return false;
+    }
+
+    if (this->codeEncoding == Program::CompactEncoding)
+        WritePaddedVarInt(&this->code->data[parameterOffset], ZigZagEncode(address), Program::CompactAddressSize);
+    else
+        memcpy(&this->code->data[parameterOffset], &address, 8);
+
+    return true;
+}
+
 void Program::DeleteParameters(InstructionParameters& theParameters) {
     for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex)
         DeleteValue(theParameters[parameterIndex]);
 }
 
-// Strings
+// Program Data
+
+const Memory* Program::GetCode(void) const {
+    return this->code;
+}
+
+Program::CodeEncoding Program::GetCodeEncoding(void) const {
+    return this->codeEncoding;
+}
 
-int64 Program::GetStringIndex(const string stringValue) {
-    auto foundString = this->stringIndex.find(stringValue);
+int32 Program::GetVersion(void) const {
+    return this->version;
+}
 
-    // If the string is not in the index yet we have to save it and return its index.
+int64 Program::GetNumberOfInstructions(void) const {
+    if (!this->code)
+        return 0;
 
-    if (foundString == this->stringIndex.end()) {
-        int64 stringStart = this->data->index;
-        int64 stringSize  = stringValue.size();
+    if (this->codeEncoding == Program::FixedEncoding)
+        return this->code->index / Program::InstructionSize;
 
-        // Save the string data.
+    int64 numberOfInstructions = 0;
 
-        int neededBlocks = 0;
+    if (this->code->index >= Program::CompactCodeHeaderSize)
+        memcpy(&numberOfInstructions, this->code->data, 8);
 
-        while (this->data->size + (neededBlocks * Program::MemoryBlockSize) < this->data->index + stringSize)
-            neededBlocks++;
+    return numberOfInstructions;
+}
 
-        if (neededBlocks > 0)
-            if (!ExpandMemory(this->data, this->data->size + (Program::MemoryBlockSize * neededBlocks))) {
-                Error("Could not expand the program memory to hold the new string data.");
-                return false;
+bool Program::GetString(const int64 stringIndex, charconst& stringData, int64& stringSize) const {
+    // String indexes start at 1 (see GetStringIndex), 0 is never a valid one.
+
+    if ((!this->strings) || (stringIndex < 1) || (stringIndex > this->strings->index / 16))
+        return false;
+
+    int64 stringStart;
+
+    memcpy(&stringStart, &this->strings->data[(stringIndex - 1) * 16], 8);
+    memcpy(&stringSize, &this->strings->data[((stringIndex - 1) * 16) + 8], 8);
+
+    if ((stringStart < 0) || (stringSize < 0) || (stringStart + stringSize > this->data->index))
+        return false;
+
+    stringData = reinterpret_cast<charconst>(&this->data->data[stringStart]);
+    return true;
+}
+
+int64 Program::GetNumberOfStrings(void) const {
+    return this->strings ? this->strings->index / 16 : 0;
+}
+
+bool Program::PackStrings(void) {
+    if ((!this->data) || (!this->canEmit))
+        return false;
+
+    int64 numberOfStrings = this->GetNumberOfStrings();
+
+    if (numberOfStrings < 2)
+        return true;
+
+    std::vector<int64> stringStarts(numberOfStrings + 1);
+    std::vector<int64> stringSizes(numberOfStrings + 1);
+    std::vector<int64> sortedStrings(numberOfStrings);
+
+    for (int64 stringIndex = 1; stringIndex <= numberOfStrings; ++stringIndex) {
+        memcpy(&stringStarts[stringIndex], &this->strings->data[(stringIndex - 1) * 16], 8);
+        memcpy(&stringSizes[stringIndex], &this->strings->data[((stringIndex - 1) * 16) + 8], 8);
+        sortedStrings[stringIndex - 1] = stringIndex;
+    }
+
+    // Sort the strings by their reversed characters: a string that ends another one
+    // comes right before it (or before another string that also ends it).
+
+    const buffer stringsData = this->data->data;
+
+    std::sort(sortedStrings.begin(), sortedStrings.end(), [&](const int64 firstIndex, const int64 secondIndex) {
+        int64 firstSize  = stringSizes[firstIndex];
+        int64 secondSize = stringSizes[secondIndex];
+
+        for (int64 charIndex = 1; (charIndex <= firstSize) && (charIndex <= secondSize); ++charIndex) {
+            uint8 firstChar  = stringsData[stringStarts[firstIndex] + firstSize - charIndex];
+            uint8 secondChar = stringsData[stringStarts[secondIndex] + secondSize - charIndex];
+
+            if (firstChar != secondChar)
+                return firstChar < secondChar;
+        }
+
+        return firstSize < secondSize;
+    });
+
+    // Lay out the strings from the last one, so the string that a shared one ends is
+    // always placed before it.
+
+    memory packedData = AllocateMemory(this->data->size);
+
+    if (!packedData) {
+        Error("Could not allocate memory to pack the program strings.");
+        return false;
+    }
+
+    std::vector<int64> packedStarts(numberOfStrings + 1);
+
+    for (int64 sortedIndex = numberOfStrings - 1; sortedIndex >= 0; --sortedIndex) {
+        int64 stringIndex = sortedStrings[sortedIndex];
+        int64 stringSize  = stringSizes[stringIndex];
+
+        if (sortedIndex < numberOfStrings - 1) {
+            int64 nextIndex = sortedStrings[sortedIndex + 1];
+            int64 nextSize  = stringSizes[nextIndex];
+
+            if ((stringSize <= nextSize) && (memcmp(&stringsData[stringStarts[stringIndex]], &stringsData[stringStarts[nextIndex] + nextSize - stringSize], stringSize) == 0)) {
+                packedStarts[stringIndex] = packedStarts[nextIndex] + nextSize - stringSize;
+                continue;
             }
+        }
+
+        packedStarts[stringIndex] = packedData->index;
+        memcpy(&packedData->data[packedData->index], &stringsData[stringStarts[stringIndex]], stringSize);
+        packedData->index += stringSize;
+    }
+
+    Debug("Strings packed from %ld to %ld bytes.", this->data->index, packedData->index);
+
+    DeleteMemory(this->data);
+    this->data = packedData;
+
+    for (int64 stringIndex = 1; stringIndex <= numberOfStrings; ++stringIndex)
+        this->SetStringEntry(stringIndex, packedStarts[stringIndex], stringSizes[stringIndex]);
+
+    return true;
+}
+
+// Debug Information
+
+bool Program::AddLineEntry(const int64 address, const int64 line) {
+    if ((!this->debug) || (!this->canEmit))
+        return false;
+
+    if (!ReserveMemory(this->debug, this->debug->index + Program::MaxDebugEntrySize)) {
+        Error("Could not expand the program memory to hold the debug information.");
+        return false;
+    }
+
+    buffer entryData = &this->debug->data[this->debug->index];
+    int    entrySize = 0;
+
+    entryData[entrySize++] = Program::LineEntry;
+    entrySize += WriteVarInt(&entryData[entrySize], address);
+    entrySize += WriteVarInt(&entryData[entrySize], line);
+
+    this->debug->index += entrySize;
+    return true;
+}
+
+bool Program::AddLabelEntry(const int64 address, const charconst name, const int64 nameSize) {
+    if ((!this->debug) || (!this->canEmit))
+        return false;
+
+    if (!ReserveMemory(this->debug, this->debug->index + Program::MaxDebugEntrySize + nameSize)) {
+        Error("Could not expand the program memory to hold the debug information.");
+        return false;
+    }
+
+    buffer entryData = &this->debug->data[this->debug->index];
+    int    entrySize = 0;
+
+    entryData[entrySize++] = Program::LabelEntry;
+    entrySize += WriteVarInt(&entryData[entrySize], address);
+    entrySize += WriteVarInt(&entryData[entrySize], nameSize);
+
+    memcpy(&entryData[entrySize], name, nameSize);
+
+    this->debug->index += entrySize + nameSize;
+    return true;
+}
+
+bool Program::ReadDebugEntry(int64& debugOffset, DebugEntry& entry) const {
+    if ((!this->debug) || (debugOffset < 0) || (debugOffset >= this->debug->index))
+        return false;
+
+    buffer entryData = this->debug->data;
+    int64  dataSize  = this->debug->index;
+    uint64 address, value;
+
+    entry.type = static_cast<DebugEntryType>(entryData[debugOffset++]);
+
+    if ((!ReadVarInt(entryData, dataSize, debugOffset, address)) || (!ReadVarInt(entryData, dataSize, debugOffset, value)))
+        return false;
 
-        memcpy(&this->data->data[stringStart], stringValue.c_str(), stringSize);
-        this->data->index += stringSize;
+    entry.address = address;
 
-        // Save the string in the index.
+    switch (entry.type) {
+        case Program::LineEntry: {
+            entry.line     = value;
+            entry.name     = NULL;
+            entry.nameSize = 0;
+            return true;
+        }
 
-        if (this->strings->size < this->strings->index + 16)
-            if (!ExpandMemory(this->strings, this->strings->size + Program::MemoryBlockSize)) {
-                Error("Could not expand the program memory to hold the new string index.");
+        case Program::LabelEntry: {
+            if (value > static_cast<uint64>(dataSize - debugOffset))
                 return false;
-            }
 
-        memcpy(&this->strings->data[this->strings->index], &stringStart, 8);
-        memcpy(&this->strings->data[this->strings->index += 8], &stringSize, 8);
-        this->strings->index += 8;
+            entry.line     = 0;
+            entry.name     = reinterpret_cast<charconst>(&entryData[debugOffset]);
+            entry.nameSize = value;
+            debugOffset += value;
+            return true;
+        }
+
+        default: return false;
+    }
+}
+
+bool Program::HasDebugInfo(void) const {
+    return this->debug && (this->debug->index > 0);
+}
+
+void Program::ClearDebugInfo(void) {
+    if (this->debug && this->canEmit)
+        this->debug->index = 0;
+}
+
+// Strings
+
+int64 Program::GetStringIndex(const charconst stringData, const int64 stringSize) {
+    // Keep the table at most half full so the probe sequences stay short.
+
+    if ((this->GetNumberOfStrings() + 1) * 2 > this->stringSlots.size())
+        this->GrowStringSlots(this->stringSlots.empty() ? 256 : this->stringSlots.size() * 2);
+
+    uint64 stringHash = Hash(stringData, stringSize);
+    uint64 slotMask   = this->stringSlots.size() - 1;
+    uint64 slotIndex  = stringHash & slotMask;
+
+    while (this->stringSlots[slotIndex].stringIndex) {
+        const StringSlot& stringSlot = this->stringSlots[slotIndex];
+
+        charconst slotData;
+        int64     slotSize;
+
+        if ((stringSlot.hash == stringHash) && this->GetString(stringSlot.stringIndex, slotData, slotSize))
+            if ((slotSize == stringSize) && (memcmp(slotData, stringData, stringSize) == 0))
+                return stringSlot.stringIndex;
+
+        slotIndex = (slotIndex + 1) & slotMask;
+    }
+
+    // The string is not in the index yet, we have to save it and return its index.
+
+    int64 stringStart = this->data->index;
+    int64 stringIndex = this->GetNumberOfStrings() + 1;
+
+    // Save the string data.
+
+    if (!ReserveMemory(this->data, this->data->index + stringSize)) {
+        Error("Could not expand the program memory to hold the new string data.");
+        return 0;
+    }
+
+    memcpy(&this->data->data[stringStart], stringData, stringSize);
+    this->data->index += stringSize;
+
+    // Save the string in the index.
+
+    if (!ReserveMemory(this->strings, this->strings->index + 16)) {
+        Error("Could not expand the program memory to hold the new string index.");
+        return 0;
+    }
+
+    this->strings->index += 16;
+    this->SetStringEntry(stringIndex, stringStart, stringSize);
+
+    StringSlot newSlot = {stringHash, stringIndex};
+    this->stringSlots[slotIndex] = newSlot;
+
+    return stringIndex;
+}
+
+// Adds the strings of another program in their index order, so they get the same
+// indexes they would get if its code was emitted here.
+
+bool Program::MapStrings(const Program& otherProgram, std::vector<int64>& stringIndexes) {
+    int64 numberOfStrings = otherProgram.GetNumberOfStrings();
+
+    stringIndexes.assign(numberOfStrings + 1, 0);
+
+    for (int64 stringIndex = 1; stringIndex <= numberOfStrings; ++stringIndex) {
+        charconst stringData;
+        int64     stringSize;
+
+        if (!otherProgram.GetString(stringIndex, stringData, stringSize))
+            return false;
+
+        if (!(stringIndexes[stringIndex] = this->GetStringIndex(stringData, stringSize)))
+            return false;
+    }
+
+    return true;
+}
+
+bool Program::SetStringEntry(const int64 stringIndex, const int64 stringStart, const int64 stringSize) {
+    if ((stringIndex < 1) || (stringIndex > this->GetNumberOfStrings()))
+        return false;
+
+    memcpy(&this->strings->data[(stringIndex - 1) * 16], &stringStart, 8);
+    memcpy(&this->strings->data[((stringIndex - 1) * 16) + 8], &stringSize, 8);
+
+    return true;
+}
+
+void Program::GrowStringSlots(const int64 numberOfSlots) {
+    std::vector<StringSlot> oldSlots;
+    oldSlots.swap(this->stringSlots);
 
-        return this->strings->index / 16;
-    } else
-        return foundString->second;
+    // The number of slots must always be a power of 2.
+
+    StringSlot emptySlot = {0, 0};
+    this->stringSlots.resize(numberOfSlots, emptySlot);
+
+    uint64 slotMask = this->stringSlots.size() - 1;
+
+    for (auto oldSlot = oldSlots.begin(); oldSlot != oldSlots.end(); ++oldSlot) {
+        if (!oldSlot->stringIndex)
+            continue;
+
+        uint64 slotIndex = oldSlot->hash & slotMask;
+
+        while (this->stringSlots[slotIndex].stringIndex)
+            slotIndex = (slotIndex + 1) & slotMask;
+
+        this->stringSlots[slotIndex] = *oldSlot;
+    }
 }
 
 };    // namespace tinyVM
@@ -21,40 +21,204 @@ class Program {
 
         // Constants
 
-        static constexpr int32     Version         = 1;
+        static constexpr int32     Version         = 2;
+        static constexpr int32     LegacyVersion   = 1;
         static constexpr charconst Signature       = "TVMP";
         static constexpr int       MemoryBlockSize = 8192;
+        static constexpr int       InstructionSize = 40;
+
+        // File Sections
+
+        // Every section starts at an offset aligned to SectionAlignment bytes, so a
+        // mapped program can read its values straight from the file. Sections of an
+        // unknown type are skipped when loading, which leaves room for new ones.
+
+        static constexpr int HeaderSize          = 16;
+        static constexpr int LegacyHeaderSize    = 32;
+        static constexpr int SectionEntrySize    = 24;
+        static constexpr int SectionAlignment    = 64;
+        static constexpr int MaxNumberOfSections = 256;
+        static constexpr int NumberOfSections       = 4;
+        static constexpr int LegacyNumberOfSections = 3;
+
+        enum SectionType {
+            CodeSection = 1,
+            DataSection,
+            StringsSection,
+            DebugSection    // Optional, only written when it is not empty.
+        };
 
         // General
 
-        bool New(void);
+        // A mapped program shares the file pages with every other process that maps
+        // it. Its code, data and strings are read-only and it cannot emit new code.
+
+        enum LoadMode {
+            CopyFile,
+            MapFile
+        };
+
+        // Instructions are either written as fixed 40 bytes records or in the compact
+        // encoding: the operation code and the parameters as variable length integers
+        // (zig-zag for int values), bools as one byte and floats as 8 bytes. Empty
+        // parameters are not written at all, the reader takes the parameter types from
+        // the host machine operations. A compact code block starts with the number of
+        // instructions (8).
+
+        enum CodeEncoding {
+            FixedEncoding,
+            CompactEncoding
+        };
+
+        static constexpr int   CompactCodeHeaderSize     = 8;
+        static constexpr int   MaxCompactInstructionSize = 50;
+        static constexpr int32 CompactCodeFlag           = 1;
+
+        bool New(const CodeEncoding codeEncoding = FixedEncoding);
         bool Save(const string filePath);
-        bool Load(const string filePath);
+        bool Load(const string filePath, const LoadMode loadMode = CopyFile);
         void Delete(void);
+        bool IsMapped(void) const;
 
         // Instructions
 
         typedef val InstructionParameters[4];
 
-        bool        Emit(const int64 opCode, const InstructionParameters parameters);
+        // Addresses that are not known yet can be emitted as AddressPlaceholder and set
+        // later by PatchAddress, using the parameter offset returned by Emit (the
+        // placeholder takes as many bytes as any address in the compact encoding).
+
+        static constexpr int64 AddressPlaceholder = (1 << 30) - 1;
+        static constexpr int   CompactAddressSize = 5;
+
+        bool        Emit(const int64 opCode, const InstructionParameters parameters, int64* parameterOffsets = NULL);
+        bool        PatchAddress(const int64 parameterOffset, const int64 address);
         static void DeleteParameters(InstructionParameters& parameters);
 
+        // Makes room for that many more bytes of code, string data and string index
+        // entries (16 bytes each), so emitting them does not have to grow the memory.
+
+        bool Reserve(const int64 codeBytes, const int64 dataBytes, const int64 stringBytes);
+
+        // Appends the code, strings and debug information of a program emitted (with the
+        // same encoding and its final addresses) for the next part of the same source. The
+        // string parameters found at stringOffsets (in order, in the appended code) get the
+        // indexes of their strings in this program.
+
+        bool Append(const Program& nextProgram, const std::vector<int64>& stringOffsets);
+
+        // Lets a copied (not mapped) program be emitted to, patched and spliced like a new
+        // one, its string index is rebuilt.
+
+        bool Edit(void);
+
+        // Replaces that many instructions, from firstAddress on, by the code of another
+        // program (both with the fixed encoding), the instructions after them move. The
+        // string parameters are handled like Append does, the debug entries are not copied.
+
+        bool Splice(const int64 firstAddress, const int64 numberOfInstructions, const Program& newProgram, const std::vector<int64>& stringOffsets);
+
+        // Program Data
+
+        const Memory* GetCode(void) const;
+        CodeEncoding  GetCodeEncoding(void) const;
+        int32         GetVersion(void) const;    // Of the file it was loaded from (Version if it is a new one).
+        int64         GetNumberOfInstructions(void) const;
+        bool          GetString(const int64 stringIndex, charconst& stringData, int64& stringSize) const;
+        int64         GetNumberOfStrings(void) const;
+
+        // Rewrites the string data so that strings that end another string share its
+        // bytes (the string indexes do not change). The compiler calls it when done.
+
+        bool PackStrings(void);
+
+        // Debug Information
+
+        // The compiler can record the source line of each instruction and the address of
+        // each label, so tools (like the profiler) can map the addresses back to the
+        // source. The entries are read in order with ReadDebugEntry, starting at offset
+        // 0, until it returns false.
+
+        enum DebugEntryType {
+            LineEntry = 1,
+            LabelEntry
+        };
+
+        static constexpr int MaxDebugEntrySize = 21;    // Without the label name.
+
+        struct DebugEntry {
+                DebugEntryType type;
+                int64          address;
+                int64          line;        // LineEntry
+                charconst      name;        // LabelEntry (not null terminated)
+                int64          nameSize;    // LabelEntry
+        };
+
+        bool AddLineEntry(const int64 address, const int64 line);
+        bool AddLabelEntry(const int64 address, const charconst name, const int64 nameSize);
+        bool ReadDebugEntry(int64& debugOffset, DebugEntry& entry) const;
+        bool HasDebugInfo(void) const;
+        void ClearDebugInfo(void);
+
     private:
         // General
 
-        bool canEmit;
+        bool         canEmit;
+        CodeEncoding codeEncoding;
+        int32        version;
+
+        bool Verify(void) const;
+
+        // File Sections
+
+        struct Section {
+                int32 type;
+                int32 flags;
+                int64 offset;
+                int64 size;
+        };
+
+        // ReadHeader checks every section against the file size, so neither load mode can
+        // read or map anything outside of the file.
+
+        int64 GetHeaderSize(const buffer headerStart);
+        bool  ReadHeader(const buffer programHeader, const int64 fileSize, Section sections[Program::NumberOfSections]);
+
+        // Instructions
+
+        bool EmitCompact(const int64 opCode, const InstructionParameters parameters, int64* parameterOffsets);
+
+        // File Mapping
+
+        buffer mappedFile;
+        int64  mappedFileSize;
+
+        bool Map(const string filePath);
+        void Unmap(void);
 
         // Program Data
 
-        memory code;       // [ OpCode, Param1, Param2, Param3, Param4 ]
+        memory code;       // [ OpCode, Param1, Param2, Param3, Param4 ] or [ Count, { OpCode, Params... } ]
         memory data;       // [ * ]
         memory strings;    // [ Start, Size ]
+        memory debug;      // [ Type, Address, Line ] or [ Type, Address, Name Size, Name ]
 
         // Strings
 
-        std::map<string, int64> stringIndex;
+        // Every distinct string is stored only once: the string indexes are kept in an
+        // open addressing hash table (a zero index marks an empty slot) while emitting.
+
+        struct StringSlot {
+                uint64 hash;
+                int64  stringIndex;
+        };
+
+        std::vector<StringSlot> stringSlots;
 
-        int64 GetStringIndex(const string stringValue);
+        int64 GetStringIndex(const charconst stringData, const int64 stringSize);
+        bool  MapStrings(const Program& otherProgram, std::vector<int64>& stringIndexes);
+        bool  SetStringEntry(const int64 stringIndex, const int64 stringStart, const int64 stringSize);
+        void  GrowStringSlots(const int64 numberOfSlots);
 };
 
 };    // namespace tinyVM
@@ -0,0 +1,358 @@
+/*
+ * Source/ProgramWriter.cxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#include "ProgramWriter.hxx"
+
+namespace tinyVM {
+
+// Program Writer
+
+ProgramWriter::ProgramWriter(void) :
+    fileOffset(0),
+#if defined(WindowsOS)
+    fileHandle(INVALID_HANDLE_VALUE),
+#else
+    fileDescriptor(-1),
+#endif
+    numberOfSections(0),
+    isInSection(false),
+    chunkBuffer(NewBuffer(ProgramWriter::ChunkSize)),
+    chunkIndex(0) {
+    // Empty
+}
+
+ProgramWriter::~ProgramWriter() {
+    this->Abort();
+    DeleteBuffer(this->chunkBuffer);
+}
+
+// General
+
+bool ProgramWriter::Open(const string filePath, const int32 numberOfSections) {
+    this->Abort();
+
+    if ((!this->chunkBuffer) || (numberOfSections < 1) || (numberOfSections > Program::MaxNumberOfSections))
+        return false;
+
+    // The temporary file is named after the process, so two processes writing the same
+    // file (like two compilers sharing a program cache) do not write over each other.
+
+#if defined(WindowsOS)
+    int64 processId = GetCurrentProcessId();
+#else
+    int64 processId = getpid();
+#endif
+
+    this->filePath          = filePath;
+    this->temporaryFilePath = filePath + "." + std::to_string(processId) + ProgramWriter::TemporaryExtension;
+
+#if defined(WindowsOS)
+    this->fileHandle = CreateFileA(this->temporaryFilePath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+    this->fileDescriptor = open(this->temporaryFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+#endif
+
+    if (!this->IsOpen()) {
+        Error("Could not create the program file in \"%s\"", this->temporaryFilePath.c_str());
+        this->temporaryFilePath.clear();
+        return false;
+    }
+
+    // Leave room for the header and the section directory, they are written at the end.
+
+    const uint8 emptyHeader[Program::HeaderSize + (Program::MaxNumberOfSections * Program::SectionEntrySize)] = {0};
+
+    this->numberOfSections = numberOfSections;
+    return this->Write(emptyHeader, Program::HeaderSize + (numberOfSections * Program::SectionEntrySize));
+}
+
+bool ProgramWriter::Close(void) {
+    if ((!this->IsOpen()) || this->isInSection || (static_cast<int32>(this->sections.size()) != this->numberOfSections) || (!this->Flush())) {
+        this->Abort();
+        return false;
+    }
+
+    // Write the program header and the section directory.
+
+    uint8 programHeader[Program::HeaderSize + (Program::MaxNumberOfSections * Program::SectionEntrySize)];
+    int64 programHeaderSize = Program::HeaderSize + (this->numberOfSections * Program::SectionEntrySize);
+
+    memset(programHeader, 0, programHeaderSize);
+    memcpy(programHeader, Program::Signature, 4);
+    memcpy(&programHeader[4], &Program::Version, 4);
+    memcpy(&programHeader[8], &this->numberOfSections, 4);
+
+    for (int sectionIndex = 0; sectionIndex < this->numberOfSections; ++sectionIndex) {
+        buffer sectionEntry = &programHeader[Program::HeaderSize + (sectionIndex * Program::SectionEntrySize)];
+
+        memcpy(sectionEntry, &this->sections[sectionIndex].type, 4);
+        memcpy(&sectionEntry[4], &this->sections[sectionIndex].flags, 4);
+        memcpy(&sectionEntry[8], &this->sections[sectionIndex].offset, 8);
+        memcpy(&sectionEntry[16], &this->sections[sectionIndex].size, 8);
+    }
+
+    if (!this->WriteAt(0, programHeader, programHeaderSize)) {
+        Error("Could not write the program header to \"%s\"", this->temporaryFilePath.c_str());
+        this->Abort();
+        return false;
+    }
+
+    // The data has to be on the disk before the file is renamed, otherwise a power loss
+    // could leave an empty or truncated program in place of the old one.
+
+#if defined(WindowsOS)
+    bool isSynced = FlushFileBuffers(this->fileHandle);
+#else
+    bool isSynced = (fsync(this->fileDescriptor) == 0);
+#endif
+
+    if (!isSynced) {
+        Error("Could not write the program file to the disk in \"%s\"", this->temporaryFilePath.c_str());
+        this->Abort();
+        return false;
+    }
+
+    this->CloseFile();
+
+    // Put the complete file in place of the old one at once.
+
+#if defined(WindowsOS)
+    bool isRenamed = MoveFileExA(this->temporaryFilePath.c_str(), this->filePath.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+    bool isRenamed = (rename(this->temporaryFilePath.c_str(), this->filePath.c_str()) == 0);
+#endif
+
+    if (!isRenamed) {
+        Error("Could not replace the program file \"%s\"", this->filePath.c_str());
+        this->Abort();
+        return false;
+    }
+
+    this->temporaryFilePath.clear();
+    return true;
+}
+
+// Closes the file (if not closed yet) and removes the temporary file, leaving the old
+// file as it was.
+
+void ProgramWriter::Abort(void) {
+    this->CloseFile();
+
+    if (!this->temporaryFilePath.empty())
+        remove(this->temporaryFilePath.c_str());
+
+    this->temporaryFilePath.clear();
+    this->sections.clear();
+    this->queuedWrites.clear();
+
+    this->fileOffset       = 0;
+    this->numberOfSections = 0;
+    this->isInSection      = false;
+    this->chunkIndex       = 0;
+}
+
+// File
+
+bool ProgramWriter::IsOpen(void) const {
+#if defined(WindowsOS)
+    return this->fileHandle != INVALID_HANDLE_VALUE;
+#else
+    return this->fileDescriptor >= 0;
+#endif
+}
+
+bool ProgramWriter::WriteAt(const int64 offset, const uint8* data, const int64 size) {
+    int64 writtenSize = 0;
+
+#if defined(WindowsOS)
+    LARGE_INTEGER filePosition;
+    filePosition.QuadPart = offset;
+
+    if (!SetFilePointerEx(this->fileHandle, filePosition, NULL, FILE_BEGIN))
+        return false;
+
+    while (writtenSize < size) {
+        DWORD partSize = std::min<int64>(size - writtenSize, 1 << 30);
+        DWORD partWritten;
+
+        if ((!WriteFile(this->fileHandle, &data[writtenSize], partSize, &partWritten, NULL)) || (partWritten == 0))
+            return false;
+
+        writtenSize += partWritten;
+    }
+#else
+    while (writtenSize < size) {
+        ssize_t partWritten = pwrite(this->fileDescriptor, &data[writtenSize], size - writtenSize, offset + writtenSize);
+
+        if ((partWritten < 0) && (errno == EINTR))
+            continue;
+
+        if (partWritten <= 0)
+            return false;
+
+        writtenSize += partWritten;
+    }
+#endif
+
+    return true;
+}
+
+void ProgramWriter::CloseFile(void) {
+#if defined(WindowsOS)
+    if (this->fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(this->fileHandle);
+
+    this->fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (this->fileDescriptor >= 0)
+        close(this->fileDescriptor);
+
+    this->fileDescriptor = -1;
+#endif
+}
+
+// Sections
+
+bool ProgramWriter::BeginSection(const int32 type, const int32 flags) {
+    if ((!this->IsOpen()) || this->isInSection || (static_cast<int32>(this->sections.size()) >= this->numberOfSections))
+        return false;
+
+    // Every section starts aligned to Program::SectionAlignment bytes.
+
+    const uint8 padding[Program::SectionAlignment] = {0};
+
+    if (!this->Write(padding, AlignSize(this->fileOffset, Program::SectionAlignment) - this->fileOffset))
+        return false;
+
+    Section section = {type, flags, this->fileOffset, 0};
+
+    this->sections.push_back(section);
+    this->isInSection = true;
+
+    return true;
+}
+
+bool ProgramWriter::Write(const void* data, const int64 size) {
+    if ((!this->IsOpen()) || (size < 0))
+        return false;
+
+    if (size == 0)
+        return true;
+
+    const uint8* writeData = static_cast<const uint8*>(data);
+
+    if (size < ProgramWriter::MinDirectWriteSize) {
+        // Copy it to the chunk buffer, next to the last small write if it is there.
+
+        if ((this->chunkIndex + size > ProgramWriter::ChunkSize) && (!this->Flush()))
+            return false;
+
+        buffer chunkData = &this->chunkBuffer[this->chunkIndex];
+        memcpy(chunkData, writeData, size);
+
+        if ((!this->queuedWrites.empty()) && (this->queuedWrites.back().data + this->queuedWrites.back().size == chunkData))
+            this->queuedWrites.back().size += size;
+        else {
+            QueuedWrite queuedWrite = {chunkData, size};
+            this->queuedWrites.push_back(queuedWrite);
+        }
+
+        this->chunkIndex += size;
+    } else {
+        QueuedWrite queuedWrite = {writeData, size};
+        this->queuedWrites.push_back(queuedWrite);
+    }
+
+    this->fileOffset += size;
+
+    if ((static_cast<int64>(this->queuedWrites.size()) >= ProgramWriter::MaxQueuedWrites) && (!this->Flush()))
+        return false;
+
+    return true;
+}
+
+bool ProgramWriter::EndSection(void) {
+    if ((!this->IsOpen()) || (!this->isInSection))
+        return false;
+
+    // The data of the big writes may go away once the section ends.
+
+    this->sections.back().size = this->fileOffset - this->sections.back().offset;
+    this->isInSection          = false;
+
+    return this->Flush();
+}
+
+// Queued Writes
+
+bool ProgramWriter::Flush(void) {
+    if (this->queuedWrites.empty())
+        return true;
+
+#if defined(WindowsOS)
+    // WriteFileGather only takes whole pages of unbuffered files, the queued writes are
+    // written one by one instead.
+
+    for (auto queuedWrite = this->queuedWrites.begin(); queuedWrite != this->queuedWrites.end(); ++queuedWrite) {
+        int64 writtenSize = 0;
+
+        while (writtenSize < queuedWrite->size) {
+            DWORD partSize = std::min<int64>(queuedWrite->size - writtenSize, 1 << 30);
+            DWORD partWritten;
+
+            if ((!WriteFile(this->fileHandle, &queuedWrite->data[writtenSize], partSize, &partWritten, NULL)) || (partWritten == 0)) {
+                Error("Could not write the program sections to \"%s\" (error %lu)", this->temporaryFilePath.c_str(), GetLastError());
+                return false;
+            }
+
+            writtenSize += partWritten;
+        }
+    }
+#else
+    struct iovec writeVectors[ProgramWriter::MaxQueuedWrites];
+    int          numberOfVectors = this->queuedWrites.size();
+
+    for (int vectorIndex = 0; vectorIndex < numberOfVectors; ++vectorIndex) {
+        writeVectors[vectorIndex].iov_base = const_cast<uint8*>(this->queuedWrites[vectorIndex].data);
+        writeVectors[vectorIndex].iov_len  = this->queuedWrites[vectorIndex].size;
+    }
+
+    // A vectored write may write only part of the data, the rest is written again.
+
+    struct iovec* nextVector = writeVectors;
+
+    while (numberOfVectors > 0) {
+        ssize_t writtenSize = writev(this->fileDescriptor, nextVector, numberOfVectors);
+
+        if ((writtenSize < 0) && (errno == EINTR))
+            continue;
+
+        if (writtenSize <= 0) {
+            Error("Could not write the program sections to \"%s\" (error %d)", this->temporaryFilePath.c_str(), errno);
+            return false;
+        }
+
+        while ((numberOfVectors > 0) && (static_cast<size_t>(writtenSize) >= nextVector->iov_len)) {
+            writtenSize -= nextVector->iov_len;
+            nextVector++;
+            numberOfVectors--;
+        }
+
+        if (numberOfVectors > 0) {
+            nextVector->iov_base  = static_cast<uint8*>(nextVector->iov_base) + writtenSize;
+            nextVector->iov_len  -= writtenSize;
+        }
+    }
+#endif
+
+    this->queuedWrites.clear();
+    this->chunkIndex = 0;
+
+    return true;
+}
+
+};    // namespace tinyVM
@@ -0,0 +1,100 @@
+/*
+ * Source/ProgramWriter.hxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#ifndef VM_PROGRAM_WRITER_H
+#define VM_PROGRAM_WRITER_H
+
+#include "Core.hxx"
+#include "Program.hxx"
+
+namespace tinyVM {
+
+// Program Writer
+
+// Writes a program file as a stream of sections, so the sections do not have to be in
+// memory all at once: each one is written in as many parts as needed between
+// BeginSection and EndSection. The small writes are copied to a chunk buffer and the
+// big ones are queued as they are, everything queued is written with a single vectored
+// write (writev) when the chunk buffer or the queue is full, so the data of a big
+// write must stay valid until the end of its section.
+//
+// The header and the section directory are written last, over the room left for them
+// at the start. The file is written to a temporary file next to it and renamed over it
+// when closed, so whoever has the old file mapped never sees a partly written program
+// (on Windows the rename fails while the old file is mapped).
+
+class ProgramWriter {
+    public:
+        ProgramWriter(void);
+        ~ProgramWriter();
+
+        // Constants
+
+        static constexpr int       ChunkSize          = 65536;
+        static constexpr int       MaxQueuedWrites    = 64;
+        static constexpr int64     MinDirectWriteSize = ChunkSize / 4;
+        static constexpr charconst TemporaryExtension = ".tmp";
+
+        // General
+
+        bool Open(const string filePath, const int32 numberOfSections);
+        bool Close(void);
+        void Abort(void);
+
+        // Sections
+
+        bool BeginSection(const int32 type, const int32 flags);
+        bool Write(const void* data, const int64 size);
+        bool EndSection(void);
+
+    private:
+        // File
+
+        string filePath;
+        string temporaryFilePath;
+        int64  fileOffset;
+
+#if defined(WindowsOS)
+        HANDLE fileHandle;
+#else
+        int fileDescriptor;
+#endif
+
+        bool IsOpen(void) const;
+        bool WriteAt(const int64 offset, const uint8* data, const int64 size);
+        void CloseFile(void);
+
+        // Sections
+
+        struct Section {
+                int32 type;
+                int32 flags;
+                int64 offset;
+                int64 size;
+        };
+
+        std::vector<Section> sections;
+        int32                numberOfSections;
+        bool                 isInSection;
+
+        // Queued Writes
+
+        struct QueuedWrite {
+                const uint8* data;
+                int64        size;
+        };
+
+        buffer                   chunkBuffer;
+        int64                    chunkIndex;
+        std::vector<QueuedWrite> queuedWrites;
+
+        bool Flush(void);
+};
+
+};    // namespace tinyVM
+
+#endif    // VM_PROGRAM_WRITER_H
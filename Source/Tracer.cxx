@@ -0,0 +1,387 @@
+/*
+ * Source/Tracer.cxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#include "Tracer.hxx"
+
+namespace tinyVM {
+
+// Tracer
+
+std::atomic<Tracer*> Tracer::dumpTracers[Tracer::MaxNumberOfDumpTracers];
+std::atomic<uint64>  Tracer::fatalSignals(0);
+
+Tracer::Tracer(const ProgramImage* image, const int64 numberOfEvents) :
+    image(image),
+    eventMask(0),
+    numberOfEvents(0),
+    lastCycles(0),
+#if defined(WindowsOS)
+    dumpFileHandle(INVALID_HANDLE_VALUE) {
+#else
+    dumpFileDescriptor(-1) {
+#endif
+    uint64 bufferSize = 1;
+
+    while (static_cast<int64>(bufferSize) < numberOfEvents)
+        bufferSize <<= 1;
+
+    this->events.resize(bufferSize);
+    this->eventMask = bufferSize - 1;
+}
+
+Tracer::~Tracer() {
+    this->CloseDumpFile();
+}
+
+const ProgramImage* Tracer::GetImage(void) const {
+    return this->image;
+}
+
+uint64 Tracer::GetNumberOfEvents(void) const {
+    return this->numberOfEvents.load(std::memory_order_acquire);
+}
+
+void Tracer::Clear(void) {
+    this->numberOfEvents.store(0, std::memory_order_release);
+}
+
+// Dumping
+
+bool Tracer::SetDumpFile(const string filePath) {
+    if (!this->image) {
+        Error("The tracer has no program image.");
+        return false;
+    }
+
+    this->CloseDumpFile();
+
+#if defined(WindowsOS)
+    this->dumpFileHandle = CreateFileA(filePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    bool isOpen          = this->dumpFileHandle != INVALID_HANDLE_VALUE;
+#else
+    this->dumpFileDescriptor = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    bool isOpen              = this->dumpFileDescriptor >= 0;
+#endif
+
+    if (!isOpen) {
+        Error("Could not create the trace file \"%s\"", filePath.c_str());
+        return false;
+    }
+
+    this->dumpFilePath = filePath;
+
+    // Let the signal handler find it.
+
+    for (int tracerIndex = 0; tracerIndex < Tracer::MaxNumberOfDumpTracers; ++tracerIndex) {
+        Tracer* freeSlot = NULL;
+
+        if (this->dumpTracers[tracerIndex].compare_exchange_strong(freeSlot, this))
+            return true;
+    }
+
+    Warning("There are too many tracers with a dump file, \"%s\" is not dumped on signals.", filePath.c_str());
+    return true;
+}
+
+bool Tracer::Dump(void) const {
+    if (this->dumpFilePath.empty()) {
+        Error("The tracer has no dump file.");
+        return false;
+    }
+
+    if (!this->WriteDump()) {
+        Error("Could not write the trace to \"%s\"", this->dumpFilePath.c_str());
+        return false;
+    }
+
+    Info("Trace dumped to \"%s\"", this->dumpFilePath.c_str());
+    return true;
+}
+
+bool Tracer::DumpOnSignal(const int signalNumber, const bool isFatal) {
+    if ((signalNumber < 1) || (signalNumber >= 64)) {
+        Error("Invalid signal number %d.", signalNumber);
+        return false;
+    }
+
+    if (isFatal)
+        Tracer::fatalSignals.fetch_or(1ULL << signalNumber);
+    else
+        Tracer::fatalSignals.fetch_and(~(1ULL << signalNumber));
+
+#if defined(WindowsOS)
+    bool isSet = signal(signalNumber, &Tracer::DumpTracers) != SIG_ERR;
+#else
+    struct sigaction signalAction;
+
+    memset(&signalAction, 0, sizeof(signalAction));
+    sigemptyset(&signalAction.sa_mask);
+
+    signalAction.sa_handler = &Tracer::DumpTracers;
+    signalAction.sa_flags   = SA_RESTART | (isFatal ? SA_RESETHAND : 0);
+
+    bool isSet = sigaction(signalNumber, &signalAction, NULL) == 0;
+#endif
+
+    if (!isSet) {
+        Error("Could not set the handler of the signal %d.", signalNumber);
+        return false;
+    }
+
+    return true;
+}
+
+// Writes the header and the kept events, only with calls that can be made from a signal
+// handler. A dump taken from another thread while the program runs may get some of its
+// oldest events overwritten by the newest ones.
+
+bool Tracer::WriteDump(void) const {
+    uint64 numberOfEvents       = this->numberOfEvents.load(std::memory_order_acquire);
+    uint64 bufferSize           = this->events.size();
+    uint64 numberOfKeptEvents   = (numberOfEvents < bufferSize) ? numberOfEvents : bufferSize;
+    int64  numberOfInstructions = this->image->GetNumberOfInstructions();
+    int32  version              = Tracer::Version;
+
+    uint8 header[Tracer::HeaderSize];
+
+    memcpy(header, Tracer::Signature, 4);
+    memcpy(&header[4], &version, 4);
+    memcpy(&header[8], &numberOfInstructions, 8);
+    memcpy(&header[16], &numberOfEvents, 8);
+    memcpy(&header[24], &numberOfKeptEvents, 8);
+
+    // The kept events may wrap around the end of the buffer.
+
+    uint64 firstEvent      = (numberOfEvents - numberOfKeptEvents) & this->eventMask;
+    uint64 firstPartEvents = (firstEvent + numberOfKeptEvents > bufferSize) ? bufferSize - firstEvent : numberOfKeptEvents;
+    int64  firstPartSize   = firstPartEvents * sizeof(Event);
+    int64  dumpSize        = Tracer::HeaderSize + (numberOfKeptEvents * sizeof(Event));
+
+    if ((!this->WriteDumpAt(0, header, Tracer::HeaderSize)) || (!this->WriteDumpAt(Tracer::HeaderSize, &this->events[firstEvent], firstPartSize)) || (!this->WriteDumpAt(Tracer::HeaderSize + firstPartSize, this->events.data(), (numberOfKeptEvents - firstPartEvents) * sizeof(Event))))
+        return false;
+
+    // Cut what is left of a longer dump.
+
+#if defined(WindowsOS)
+    LARGE_INTEGER filePosition;
+    filePosition.QuadPart = dumpSize;
+
+    return SetFilePointerEx(this->dumpFileHandle, filePosition, NULL, FILE_BEGIN) && SetEndOfFile(this->dumpFileHandle);
+#else
+    return ftruncate(this->dumpFileDescriptor, dumpSize) == 0;
+#endif
+}
+
+bool Tracer::WriteDumpAt(const int64 offset, const void* data, const int64 size) const {
+    const uint8* writeData   = static_cast<const uint8*>(data);
+    int64        writtenSize = 0;
+
+#if defined(WindowsOS)
+    LARGE_INTEGER filePosition;
+    filePosition.QuadPart = offset;
+
+    if (!SetFilePointerEx(this->dumpFileHandle, filePosition, NULL, FILE_BEGIN))
+        return false;
+
+    while (writtenSize < size) {
+        DWORD partSize = std::min<int64>(size - writtenSize, 1 << 30);
+        DWORD partWritten;
+
+        if ((!WriteFile(this->dumpFileHandle, &writeData[writtenSize], partSize, &partWritten, NULL)) || (partWritten == 0))
+            return false;
+
+        writtenSize += partWritten;
+    }
+#else
+    while (writtenSize < size) {
+        ssize_t partWritten = pwrite(this->dumpFileDescriptor, &writeData[writtenSize], size - writtenSize, offset + writtenSize);
+
+        if ((partWritten < 0) && (errno == EINTR))
+            continue;
+
+        if (partWritten <= 0)
+            return false;
+
+        writtenSize += partWritten;
+    }
+#endif
+
+    return true;
+}
+
+void Tracer::CloseDumpFile(void) {
+    // Make sure the signal handler does not use it anymore.
+
+    for (int tracerIndex = 0; tracerIndex < Tracer::MaxNumberOfDumpTracers; ++tracerIndex) {
+        Tracer* usedSlot = this;
+        this->dumpTracers[tracerIndex].compare_exchange_strong(usedSlot, NULL);
+    }
+
+#if defined(WindowsOS)
+    if (this->dumpFileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(this->dumpFileHandle);
+
+    this->dumpFileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (this->dumpFileDescriptor >= 0)
+        close(this->dumpFileDescriptor);
+
+    this->dumpFileDescriptor = -1;
+#endif
+
+    this->dumpFilePath.clear();
+}
+
+void Tracer::DumpTracers(int signalNumber) {
+    for (int tracerIndex = 0; tracerIndex < Tracer::MaxNumberOfDumpTracers; ++tracerIndex) {
+        Tracer* tracer = Tracer::dumpTracers[tracerIndex].load(std::memory_order_acquire);
+
+        if (tracer)
+            tracer->WriteDump();
+    }
+
+    // The fatal signals already have their default action back, raising it again ends the
+    // process the way it would have ended.
+
+    if (Tracer::fatalSignals.load() & (1ULL << signalNumber))
+        raise(signalNumber);
+#if defined(WindowsOS)
+    else
+        signal(signalNumber, &Tracer::DumpTracers);    // Windows always resets the handler.
+#endif
+}
+
+// Report
+
+bool Tracer::Report(const VirtualMachineCore& machine, const ProgramImage* image, const string traceFilePath) {
+    if (!image) {
+        Error("The program image is null.");
+        return false;
+    }
+
+    // Read the whole trace file.
+
+    FILE* file = fopen(traceFilePath.c_str(), "rb");
+
+    if (!file) {
+        Error("Could not open the trace file \"%s\"", traceFilePath.c_str());
+        return false;
+    }
+
+    std::vector<uint8> traceData;
+    uint8              readBuffer[8192];
+    size_t             readSize;
+
+    while ((readSize = fread(readBuffer, 1, sizeof(readBuffer), file)) > 0)
+        traceData.insert(traceData.end(), readBuffer, readBuffer + readSize);
+
+    fclose(file);
+
+    int32  version;
+    int64  numberOfInstructions;
+    uint64 numberOfEvents, numberOfKeptEvents;
+
+    if ((traceData.size() < Tracer::HeaderSize) || (memcmp(traceData.data(), Tracer::Signature, 4) != 0)) {
+        Error("The file \"%s\" is not a trace file.", traceFilePath.c_str());
+        return false;
+    }
+
+    memcpy(&version, &traceData[4], 4);
+    memcpy(&numberOfInstructions, &traceData[8], 8);
+    memcpy(&numberOfEvents, &traceData[16], 8);
+    memcpy(&numberOfKeptEvents, &traceData[24], 8);
+
+    if (version != Tracer::Version) {
+        Error("The trace file version (%d) is not supported.", version);
+        return false;
+    }
+
+    if ((numberOfKeptEvents > numberOfEvents) || (numberOfKeptEvents != (traceData.size() - Tracer::HeaderSize) / sizeof(Event)) || (((traceData.size() - Tracer::HeaderSize) % sizeof(Event)) != 0)) {
+        Error("The trace file \"%s\" is truncated.", traceFilePath.c_str());
+        return false;
+    }
+
+    const Program* program = image->GetProgram();
+
+    if (numberOfInstructions != program->GetNumberOfInstructions()) {
+        Error("The trace was recorded with another program (of %ld instructions).", numberOfInstructions);
+        return false;
+    }
+
+    // The operation of each instruction (the last one is the final EXIT).
+
+    const VirtualMachineCore::OperationList& operations = machine.GetOperations();
+    const std::vector<int64>&                opCodes    = image->GetOpCodes();
+
+    // The source lines and labels, when the program has them (the program was verified
+    // when it was loaded, the addresses are in range).
+
+    std::vector<int64>      lines(numberOfInstructions + 1, 0);
+    std::map<int64, string> labels;
+
+    if (program->HasDebugInfo()) {
+        Program::DebugEntry entry;
+        int64               debugOffset = 0;
+
+        while (program->ReadDebugEntry(debugOffset, entry))
+            if (entry.type == Program::LineEntry)
+                lines[entry.address] = entry.line;
+            else if (labels.find(entry.address) == labels.end())
+                labels[entry.address] = string(entry.name, entry.nameSize);
+    } else
+        Warning("The program has no debug information, there are no source lines or labels to show.");
+
+    // Events
+
+    // The cycles are relative to the oldest kept event and only shown when they change.
+
+    Info("Trace: %lu events recorded, the last %lu of them kept.", numberOfEvents, numberOfKeptEvents);
+    Info("");
+    Info("            Cycles   Address   Operation     Line   Label");
+
+    const Event* events      = reinterpret_cast<const Event*>(&traceData[Tracer::HeaderSize]);
+    uint64       firstCycles = (numberOfKeptEvents > 0) ? events[0].cycles : 0;
+    uint64       lastCycles  = firstCycles - 1;
+
+    for (uint64 eventIndex = 0; eventIndex < numberOfKeptEvents; ++eventIndex) {
+        const Event& event = events[eventIndex];
+
+        if (static_cast<int64>(event.address) + event.numberOfInstructions > numberOfInstructions + 1) {
+            Error("Event %lu: invalid instructions @%u (+%u).", eventIndex, event.address, event.numberOfInstructions);
+            return false;
+        }
+
+        for (int64 address = event.address; address < static_cast<int64>(event.address) + event.numberOfInstructions; ++address) {
+            string cycles;
+            string location;
+
+            if ((address == event.address) && (event.cycles != lastCycles))
+                cycles = "+" + std::to_string(event.cycles - firstCycles);
+
+            // Show the address relative to the closest label before it.
+
+            auto label = labels.upper_bound(address);
+
+            if (label != labels.begin()) {
+                --label;
+                location = "!" + label->second;
+
+                if (address > label->first)
+                    location += "+" + std::to_string(address - label->first);
+            }
+
+            Info("  %16s   @%-8ld %-8s %8ld   %s", cycles.c_str(), address, operations[opCodes[address]].mnemonic, lines[address], location.c_str());
+        }
+
+        lastCycles = event.cycles;
+    }
+
+    Info("");
+    return true;
+}
+
+}    // namespace tinyVM
@@ -0,0 +1,123 @@
+/*
+ * Source/Tracer.hxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#ifndef VM_TRACER_H
+#define VM_TRACER_H
+
+#include "VirtualMachine.hxx"
+
+namespace tinyVM {
+
+// Tracer
+
+// Records what a program image runs into a ring buffer that keeps the latest events. A
+// machine only records them while a tracer is set (see SetTracer) and the context it
+// resumes runs the tracer image, in any execution mode.
+//
+// To keep the overhead low an event is not written for every instruction: each event is
+// a basic block, the instructions that ran one after the other until a jump (or until
+// the program left the execution loop), which the machine already keeps track of for
+// the budgets. Reading the time stamp counter costs more than a short block, so it is
+// only read every CyclesInterval events, the ones in between get the last value read.
+// Report expands the blocks back to the instructions, their operations and their source
+// lines and labels.
+//
+// Only the machine thread writes the events (a tracer is used by one machine at a time)
+// and it never waits, the trace can be dumped from a signal handler at any moment.
+
+class Tracer {
+    public:
+        static constexpr int64     DefaultNumberOfEvents = 1 << 16;
+        static constexpr int64     CyclesInterval        = 16;
+        static constexpr int32     Version               = 1;
+        static constexpr charconst Signature             = "TVMT";
+
+        // The number of events is rounded up to a power of two.
+
+        Tracer(const ProgramImage* image, const int64 numberOfEvents = DefaultNumberOfEvents);
+        ~Tracer();
+
+        const ProgramImage* GetImage(void) const;
+        uint64              GetNumberOfEvents(void) const;    // Ever recorded, not only the ones kept.
+        void                Clear(void);
+
+        // Dumping
+
+        // With a dump file the machine dumps the trace once the traced program stops (Dump
+        // writes it for a program left paused), and so does a signal set with DumpOnSignal
+        // (for every tracer with a dump file). The file is created right away, so the
+        // signal handler only has to write it. A fatal signal gets its default action back
+        // once the traces are dumped, a non fatal one (like SIGUSR1) leaves the programs
+        // running.
+        //
+        // The file has a header ([ Signature, Version, Number of Instructions, Number of
+        // Events, Number of Events Kept ]) and the kept events, the oldest first.
+
+        static constexpr int HeaderSize             = 32;
+        static constexpr int MaxNumberOfDumpTracers = 64;
+
+        bool        SetDumpFile(const string filePath);
+        bool        Dump(void) const;
+        static bool DumpOnSignal(const int signalNumber, const bool isFatal = false);
+
+        // Report
+
+        // Prints the trace in a dump file, one line per instruction (the image must be one of
+        // the program the trace was recorded with, the machine gives the operation names).
+
+        static bool Report(const VirtualMachineCore& machine, const ProgramImage* image, const string traceFilePath);
+
+    private:
+        friend class VirtualMachineCore;
+
+        struct Event {
+                uint64 cycles;
+                uint32 address;
+                uint32 numberOfInstructions;
+        };
+
+        const ProgramImage* image;
+        std::vector<Event>  events;
+        uint64              eventMask;
+        std::atomic<uint64> numberOfEvents;
+        uint64              lastCycles;
+
+        void Record(const int64 address, const int64 numberOfInstructions) {
+            uint64 eventIndex = this->numberOfEvents.load(std::memory_order_relaxed);
+            Event& event      = this->events[eventIndex & this->eventMask];
+
+            if ((eventIndex % Tracer::CyclesInterval) == 0)
+                this->lastCycles = ReadCycleCounter();
+
+            event.cycles               = this->lastCycles;
+            event.address              = address;
+            event.numberOfInstructions = numberOfInstructions;
+
+            this->numberOfEvents.store(eventIndex + 1, std::memory_order_release);
+        }
+
+        // Dumping
+
+        string dumpFilePath;
+#if defined(WindowsOS)
+        HANDLE dumpFileHandle;
+#else
+        int dumpFileDescriptor;
+#endif
+
+        static std::atomic<Tracer*> dumpTracers[MaxNumberOfDumpTracers];
+        static std::atomic<uint64>  fatalSignals;
+
+        bool        WriteDump(void) const;
+        bool        WriteDumpAt(const int64 offset, const void* data, const int64 size) const;
+        void        CloseDumpFile(void);
+        static void DumpTracers(int signalNumber);
+};
+
+}    // namespace tinyVM
+
+#endif    // VM_TRACER_H
@@ -7,6 +7,9 @@
 
 #include "VirtualMachine.hxx"
 
+#include "NativeCode.hxx"
+#include "Profiler.hxx"
+#include "Tracer.hxx"
 #include "Program.hxx"
 
 namespace tinyVM {
@@ -14,25 +17,149 @@ namespace tinyVM {
 // Virtual Machine
 
 VirtualMachineCore::VirtualMachineCore(void) :
+    operations(&this->operationsTable),
+    hasStaticOperations(false),
+    context(NULL),
     isRunning(false),
     isPaused(false),
-    currentProgram(NULL),
-    currentProgramInstruction(0) {
-    OperationParameterTypes noParameters = {None, None, None, None};
+    isWaiting(false),
+    instructions(NULL),
+    numberOfInstructions(0),
+    nextInstruction(NULL),
+    ownImage(NULL),
+    ownContext(NULL),
+    freeContexts(NULL),
+    isOutOfBudget(false),
+    blockStart(NULL),
+    budgetLeft(VirtualMachineCore::UnlimitedBudget),
+    sliceSize(VirtualMachineCore::UnlimitedBudget),
+    instructionsLeft(VirtualMachineCore::UnlimitedBudget),
+    hasDeadline(false),
+    profiler(NULL),
+    tracer(NULL),
+    activeTracer(NULL),
+    jitThreshold(-1),
+    hotnessCounters(NULL),
+    isJitPending(false),
+    registers(NULL),
+    registerTypes(NULL),
+    numberOfRegisters(0),
+    stack(NULL),
+    stackTypes(NULL),
+    stackDepth(0) {
+    for (int operationIndex = 0; operationIndex < 4; ++operationIndex) {
+        const Operation& builtInOperation = VirtualMachineCore::BuiltInOperations[operationIndex];
+        this->RegisterOperation(builtInOperation.opCode, builtInOperation.mnemonic, builtInOperation.method, builtInOperation.parameterTypes, builtInOperation.flags);
+    }
+}
 
-    this->RegisterOperation(0, "NOP", &VirtualMachineCore::OpNoOp, noParameters);
-    this->RegisterOperation(1, "EXIT", &VirtualMachineCore::OpExit, noParameters);
-    this->RegisterOperation(2, "PAUSE", &VirtualMachineCore::OpPause, noParameters);
-    this->RegisterOperation(3, "STOP", &VirtualMachineCore::OpStop, noParameters);
+VirtualMachineCore::VirtualMachineCore(const OperationTable& staticOperations) :
+    operations(&staticOperations),
+    hasStaticOperations(true),
+    context(NULL),
+    isRunning(false),
+    isPaused(false),
+    isWaiting(false),
+    instructions(NULL),
+    numberOfInstructions(0),
+    nextInstruction(NULL),
+    ownImage(NULL),
+    ownContext(NULL),
+    freeContexts(NULL),
+    isOutOfBudget(false),
+    blockStart(NULL),
+    budgetLeft(VirtualMachineCore::UnlimitedBudget),
+    sliceSize(VirtualMachineCore::UnlimitedBudget),
+    instructionsLeft(VirtualMachineCore::UnlimitedBudget),
+    hasDeadline(false),
+    profiler(NULL),
+    tracer(NULL),
+    activeTracer(NULL),
+    jitThreshold(-1),
+    hotnessCounters(NULL),
+    isJitPending(false),
+    registers(NULL),
+    registerTypes(NULL),
+    numberOfRegisters(0),
+    stack(NULL),
+    stackTypes(NULL),
+    stackDepth(0) {
+    // Empty
 }
 
 VirtualMachineCore::~VirtualMachineCore() {
     this->Stop();
+    this->DeleteContext(this->ownContext);
+
+    delete this->ownImage;
+
+    while (this->freeContexts) {
+        ExecutionContext* freeContext = this->freeContexts;
+        this->freeContexts            = freeContext->nextFreeContext;
+
+        delete freeContext;
+    }
 }
 
 // Operations
 
-bool VirtualMachineCore::RegisterOperation(const int64 opCode, const OperationMnemonic mnemonic, const OperationMethod method, const OperationParameterTypes parameterTypes) {
+const VirtualMachineCore::Operation VirtualMachineCore::BuiltInOperations[4] = {
+    {0,   "NOP",  &VirtualMachineCore::OpNoOp, {None, None, None, None}, NoFlags, NULL},
+    {1,  "EXIT",  &VirtualMachineCore::OpExit, {None, None, None, None}, EndFlag, NULL},
+    {2, "PAUSE", &VirtualMachineCore::OpPause, {None, None, None, None}, NoFlags, NULL},
+    {3,  "STOP",  &VirtualMachineCore::OpStop, {None, None, None, None}, EndFlag, NULL}
+};
+
+const VirtualMachineCore::OperationTable& VirtualMachineCore::GetBuiltInOperations(void) {
+    static const OperationTable builtInOperations = VirtualMachineCore::BuildStaticOperations(NULL, 0);
+    return builtInOperations;
+}
+
+VirtualMachineCore::OperationTable VirtualMachineCore::BuildStaticOperations(const Operation* machineOperations, const int64 numberOfOperations, const OperationFusion* machineFusions, const int64 numberOfFusions) {
+    OperationTable    staticTable;
+    OperationList&    staticOperations = staticTable.list;
+    std::vector<bool> isRegistered(4, true);
+
+    staticOperations.assign(VirtualMachineCore::BuiltInOperations, VirtualMachineCore::BuiltInOperations + 4);
+
+    // Same rules as BuildOperationsList: the list is indexed by operation code and
+    // any code without an operation is a NOP.
+
+    for (int64 operationIndex = 0; operationIndex < numberOfOperations; ++operationIndex) {
+        const Operation& machineOperation = machineOperations[operationIndex];
+
+        if (machineOperation.opCode < 0) {
+            Warning("Invalid operation code %ld for %s.", machineOperation.opCode, machineOperation.mnemonic);
+            continue;
+        }
+
+        if (machineOperation.opCode >= staticOperations.size()) {
+            staticOperations.resize(machineOperation.opCode + 1, staticOperations[0]);
+            isRegistered.resize(machineOperation.opCode + 1, false);
+        }
+
+        if (isRegistered[machineOperation.opCode]) {
+            Warning("Operation code %ld already in use by %s.", machineOperation.opCode, staticOperations[machineOperation.opCode].mnemonic);
+            continue;
+        }
+
+        staticOperations[machineOperation.opCode] = machineOperation;
+        isRegistered[machineOperation.opCode]     = true;
+    }
+
+    VirtualMachineCore::BuildOperationsIndex(staticTable);
+    VirtualMachineCore::BuildFusionsList(staticTable, machineFusions, numberOfFusions);
+
+    Debug("Static operations list built. Operations supported: %ld.", staticOperations.size());
+    return staticTable;
+}
+
+bool VirtualMachineCore::RegisterOperation(const int64 opCode, const OperationMnemonic mnemonic, const OperationMethod method, const OperationParameterTypes parameterTypes, const int flags, const BatchOperationMethod batchMethod) {
+    if (this->hasStaticOperations) {
+        Warning("Cannot register %s, the machine uses a static operations list.", mnemonic);
+        return false;
+    }
+
     auto foundOperation = this->operationsMap.find(opCode);
 
     if (foundOperation != this->operationsMap.end()) {
@@ -44,11 +171,13 @@ bool VirtualMachineCore::RegisterOperation(const int64 opCode, const OperationMn
         opCode,
         "",
         method,
-        {None, None, None, None}
+        {None, None, None, None},
+        flags,
+        batchMethod
     };
 
-    memcpy(newOperation.mnemonic, mnemonic, sizeof(mnemonic));
-    memcpy(newOperation.parameterTypes, parameterTypes, sizeof(parameterTypes));
+    strncpy(newOperation.mnemonic, mnemonic, sizeof(OperationMnemonic) - 1);
+    memcpy(newOperation.parameterTypes, parameterTypes, sizeof(OperationParameterTypes));
 
     this->operationsMap[opCode] = newOperation;
     Debug("Operation %ld registered (%s).", opCode, mnemonic);
@@ -57,9 +186,13 @@ bool VirtualMachineCore::RegisterOperation(const int64 opCode, const OperationMn
 }
 
 void VirtualMachineCore::BuildOperationsList(void) {
+    if (this->hasStaticOperations)
+        return;
+
     Debug("Building operations list...");
 
-    this->operations.clear();
+    OperationList& operationsList = this->operationsTable.list;
+    operationsList.clear();
 
     // Find the maximum operation code used.
 
@@ -76,14 +209,154 @@ void VirtualMachineCore::BuildOperationsList(void) {
 
     for (int64 currentOpCode = 0; currentOpCode <= maxOpCode; ++currentOpCode) {
         auto foundOperation = this->operationsMap.find(currentOpCode);
-        this->operations.push_back(foundOperation != this->operationsMap.end() ? foundOperation->second : this->operationsMap[0]);
+        operationsList.push_back(foundOperation != this->operationsMap.end() ? foundOperation->second : this->operationsMap[0]);
     }
 
-    Debug("Operations list built. Operations supported: %ld.", this->operations.size());
+    VirtualMachineCore::BuildOperationsIndex(this->operationsTable);
+    VirtualMachineCore::BuildFusionsList(this->operationsTable, this->fusionsList.data(), this->fusionsList.size());
+
+    Debug("Operations list built. Operations supported: %ld.", operationsList.size());
 }
 
 const VirtualMachineCore::OperationList& VirtualMachineCore::GetOperations(void) const {
-    return this->operations;
+    return this->operations->list;
+}
+
+uint64 VirtualMachineCore::GetOperationsHash(void) const {
+    return this->operations->signaturesHash;
+}
+
+const VirtualMachineCore::Operation* VirtualMachineCore::FindOperation(const string& mnemonic, const OperationParameterTypes parameterTypes) const {
+    if (mnemonic.size() >= sizeof(OperationMnemonic))
+        return NULL;
+
+    auto foundOperation = this->operations->index.find(VirtualMachineCore::GetOperationSignature(mnemonic.c_str(), parameterTypes));
+
+    if (foundOperation == this->operations->index.end())
+        return NULL;
+
+    return &this->operations->list[foundOperation->second];
+}
+
+bool VirtualMachineCore::RegisterFusion(const int64 fusedOpCode, const int64 firstOpCode, const int64 secondOpCode, const int64 thirdOpCode) {
+    if (this->hasStaticOperations) {
+        Warning("Cannot register the fusion for %ld, the machine uses a static operations list.", fusedOpCode);
+        return false;
+    }
+
+    OperationFusion newFusion = {
+        fusedOpCode,
+        (thirdOpCode < 0) ? 2 : 3,
+        {firstOpCode, secondOpCode, thirdOpCode}
+    };
+
+    this->fusionsList.push_back(newFusion);
+    Debug("Fusion registered for operation %ld.", fusedOpCode);
+
+    return true;
+}
+
+const VirtualMachineCore::OperationFusionList& VirtualMachineCore::GetFusions(void) const {
+    return this->operations->fusions;
+}
+
+VirtualMachineCore::OperationSignature VirtualMachineCore::GetOperationSignature(const charconst mnemonic, const OperationParameterTypes parameterTypes) {
+    OperationSignature signature = {0, 0};
+
+    // The mnemonic fits in 8 bytes (with the NUL terminator), and so do the parameter types.
+
+    memcpy(&signature.mnemonic, mnemonic, strnlen(mnemonic, sizeof(OperationMnemonic) - 1));
+
+    for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex)
+        signature.parameterTypes |= static_cast<uint64>(parameterTypes[parameterIndex]) << (parameterIndex * 8);
+
+    return signature;
+}
+
+void VirtualMachineCore::BuildOperationsIndex(OperationTable& operationsTable) {
+    operationsTable.index.clear();
+    operationsTable.index.reserve(operationsTable.list.size());
+    operationsTable.hash           = Hash(NULL, 0);
+    operationsTable.signaturesHash = Hash(NULL, 0);
+
+    // The operation codes without an operation are filled with copies of NOP, which must
+    // not be indexed. If an operation is declared twice the lowest code is kept.
+
+    for (int64 operationIndex = 0; operationIndex < operationsTable.list.size(); ++operationIndex) {
+        const Operation& operation = operationsTable.list[operationIndex];
+
+        if (operation.opCode != operationIndex)
+            continue;
+
+        OperationSignature signature = VirtualMachineCore::GetOperationSignature(operation.mnemonic, operation.parameterTypes);
+
+        // Two tables with the same operations (methods included) run the same images.
+
+        operationsTable.hash = Hash(&operation.opCode, sizeof(operation.opCode), operationsTable.hash);
+        operationsTable.hash = Hash(&signature, sizeof(signature), operationsTable.hash);
+        operationsTable.hash = Hash(&operation.method, sizeof(operation.method), operationsTable.hash);
+        operationsTable.hash = Hash(&operation.batchMethod, sizeof(operation.batchMethod), operationsTable.hash);
+
+        // The methods are not at the same addresses from one process to the next, the
+        // snapshots can only tell the operations apart by their signatures (like the
+        // program cache does).
+
+        operationsTable.signaturesHash = Hash(&operation.opCode, sizeof(operation.opCode), operationsTable.signaturesHash);
+        operationsTable.signaturesHash = Hash(operation.mnemonic, strnlen(operation.mnemonic, sizeof(operation.mnemonic)), operationsTable.signaturesHash);
+        operationsTable.signaturesHash = Hash(operation.parameterTypes, sizeof(operation.parameterTypes), operationsTable.signaturesHash);
+        operationsTable.signaturesHash = Hash(&operation.flags, sizeof(operation.flags), operationsTable.signaturesHash);
+
+        if (!operationsTable.index.insert(std::make_pair(signature, operationIndex)).second)
+            Warning("Operation %ld (%s) has the same parameters as operation %ld.", operation.opCode, operation.mnemonic, operationsTable.index[signature]);
+    }
+}
+
+void VirtualMachineCore::BuildFusionsList(OperationTable& operationsTable, const OperationFusion* fusions, const int64 numberOfFusions) {
+    const OperationList& operationsList = operationsTable.list;
+    operationsTable.fusions.clear();
+
+    for (int64 fusionIndex = 0; fusionIndex < numberOfFusions; ++fusionIndex) {
+        const OperationFusion& fusion = fusions[fusionIndex];
+
+        // All the operations must be registered ones (the NOPs are removed before
+        // fusing, there is no point in fusing them).
+
+        bool isValid = (fusion.numberOfOpCodes >= 2) && (fusion.numberOfOpCodes <= 3) && (fusion.fusedOpCode > 0) && (fusion.fusedOpCode < operationsList.size()) && (operationsList[fusion.fusedOpCode].opCode == fusion.fusedOpCode);
+
+        for (int opCodeIndex = 0; isValid && (opCodeIndex < fusion.numberOfOpCodes); ++opCodeIndex) {
+            int64 opCode = fusion.opCodes[opCodeIndex];
+            isValid      = (opCode > 0) && (opCode < operationsList.size()) && (operationsList[opCode].opCode == opCode);
+        }
+
+        if (!isValid) {
+            Warning("The fusion for operation %ld uses invalid operation codes.", fusion.fusedOpCode);
+            continue;
+        }
+
+        // The fused operation takes the parameters of the sequence, in order.
+
+        OperationParameterTypes parameterTypes = {None, None, None, None};
+        int                     parameterCount = 0;
+
+        for (int opCodeIndex = 0; isValid && (opCodeIndex < fusion.numberOfOpCodes); ++opCodeIndex) {
+            const Operation& operation = operationsList[fusion.opCodes[opCodeIndex]];
+
+            for (int parameterIndex = 0; isValid && (parameterIndex < 4); ++parameterIndex)
+                if (operation.parameterTypes[parameterIndex] != None) {
+                    isValid = parameterCount < 4;
+
+                    if (isValid)
+                        parameterTypes[parameterCount++] = operation.parameterTypes[parameterIndex];
+                }
+        }
+
+        if ((!isValid) || (memcmp(parameterTypes, operationsList[fusion.fusedOpCode].parameterTypes, sizeof(OperationParameterTypes)) != 0)) {
+            Warning("The parameters of operation %ld (%s) do not match the ones of the sequence it fuses.", fusion.fusedOpCode, operationsList[fusion.fusedOpCode].mnemonic);
+            continue;
+        }
+
+        operationsTable.fusions.push_back(fusion);
+    }
 }
 
 // Execution
@@ -99,14 +372,20 @@ bool VirtualMachineCore::Start(Program* program) {
         return false;
     }
 
-    this->currentProgramInstruction = 0;
-    this->currentProgram            = program;
+    // The previous image is only deleted once nothing can be using it anymore.
+
+    ProgramImage* newImage = this->NewImage(program);
 
-    this->isRunning = true;
-    this->isPaused  = false;
+    if (!newImage)
+        return false;
+
+    this->DeleteContext(this->ownContext);
+    delete this->ownImage;
 
-    Info("Starting program execution...");
-    return this->Resume();
+    this->ownImage   = newImage;
+    this->ownContext = this->NewContext(newImage);
+
+    return this->Start(this->ownContext);
 }
 
 void VirtualMachineCore::Pause(void) {
@@ -114,70 +393,1654 @@ void VirtualMachineCore::Pause(void) {
 }
 
 bool VirtualMachineCore::Resume(void) {
-    if (!this->currentProgram) {
+    if (!this->context) {
         Error("No program to resume execution from.");
         return false;
     }
 
-    if (!this->isRunning) {
-        Warning("The program is not running. Cannot resume execution.");
+    return this->Resume(this->context);
+}
+
+bool VirtualMachineCore::Step(void) {
+    return this->Step(1);
+}
+
+void VirtualMachineCore::Stop(void) {
+    this->isRunning = false;
+}
+
+bool VirtualMachineCore::IsRunning(void) const {
+    return this->isRunning;
+}
+
+bool VirtualMachineCore::IsPaused(void) const {
+    return this->isPaused;
+}
+
+bool VirtualMachineCore::IsWaiting(void) const {
+    return this->isWaiting;
+}
+
+bool VirtualMachineCore::Jump(const int64 address) {
+    // Jumping to the end of the program is allowed (it will hit the final EXIT).
+
+    if ((address < 0) || (address > this->numberOfInstructions)) {
+        Error("Jump to invalid address @%ld.", address);
+        this->Stop();
         return false;
     }
 
-    if (this->isPaused) {
-        Info("Resuming program execution...");
-        this->isPaused = false;
+    // A jump ends a basic block, the whole block is taken from the budget at once.
+
+    this->budgetLeft -= this->nextInstruction - this->blockStart;
+
+    if (this->activeTracer)
+        this->activeTracer->Record(this->blockStart - this->instructions, this->nextInstruction - this->blockStart);
+
+    this->nextInstruction = &this->instructions[address];
+    this->blockStart      = this->nextInstruction;
+
+    if (this->budgetLeft <= 0)
+        return this->NextBudgetSlice();
+
+    // Stop the interpreter as soon as the image is hot, so it can be compiled.
+
+    if (this->hotnessCounters && (++this->hotnessCounters[address] >= this->jitThreshold)) {
+        this->hotnessCounters = NULL;
+        this->isJitPending    = true;
+        return false;
+    }
+
+    return true;
+}
+
+void VirtualMachineCore::Run(void) {
+    // The last decoded instruction is always an EXIT, so there is no need to check
+    // for the end of the program in here.
+
+#ifdef VM_THREADED_DISPATCH
+    // Each instruction jumps straight to the handler of the next one (in the order of the
+    // InstructionHandler values).
+
+    static const pointer handlers[] = {&&CallOperation, &&NoOp, &&Exit, &&Pause, &&Stop};
+
+    const Instruction* instruction = this->nextInstruction;
+    goto *handlers[instruction->handler];
+
+CallOperation:
+    this->nextInstruction = instruction + 1;
+
+    if (!(this->*instruction->method)(instruction->parameters))
+        return;
+
+    instruction = this->nextInstruction;
+    goto *handlers[instruction->handler];
+
+NoOp:
+    ++instruction;
+    goto *handlers[instruction->handler];
+
+Exit:
+Stop:
+    this->nextInstruction = instruction + 1;
+    this->Stop();
+    return;
+
+Pause:
+    this->nextInstruction = instruction + 1;
+    this->Pause();
+    return;
+#else
+    const Instruction* instruction;
+
+    do {
+        instruction = this->nextInstruction++;
+    } while ((this->*instruction->method)(instruction->parameters));
+#endif
+}
+
+#ifdef VM_THREADED_DISPATCH
+// Sets the handlers of the decoded instructions, it does not touch the machine state.
+
+void VirtualMachineCore::ThreadInstructions(Instruction* instructions, const int64 numberOfInstructions) {
+    for (int64 instructionIndex = 0; instructionIndex < numberOfInstructions; ++instructionIndex) {
+        Instruction&    instruction = instructions[instructionIndex];
+        OperationMethod method      = instruction.method;
+
+        if (method == &VirtualMachineCore::OpNoOp)
+            instruction.handler = NoOpHandler;
+        else if (method == &VirtualMachineCore::OpExit)
+            instruction.handler = ExitHandler;
+        else if (method == &VirtualMachineCore::OpPause)
+            instruction.handler = PauseHandler;
+        else if (method == &VirtualMachineCore::OpStop)
+            instruction.handler = StopHandler;
+        else
+            instruction.handler = CallOperationHandler;
+    }
+}
+#endif
+
+// Program Images and Execution Contexts
+
+ProgramImage* VirtualMachineCore::NewImage(const Program* program) const {
+    if (!program) {
+        Error("The program is null.");
+        return NULL;
+    }
+
+    if (this->operations->list.empty()) {
+        Error("The operations list is empty (was BuildOperationsList called?).");
+        return NULL;
+    }
+
+    int64 numberOfInstructions = program->GetNumberOfInstructions();
+    Debug("Decoding %ld instructions...", numberOfInstructions);
+
+    // Allocate one more instruction to hold the final EXIT.
+
+    ProgramImage* newImage = new (std::nothrow) ProgramImage();
+
+    if (newImage)
+        newImage->instructions = new (std::nothrow) Instruction[numberOfInstructions + 1];
+
+    if ((!newImage) || (!newImage->instructions)) {
+        Error("Could not allocate memory to hold the decoded program.");
+        delete newImage;
+        return NULL;
     }
 
-    while (this->isRunning && (!this->isPaused)) {
-        if (!this->Step())
+    newImage->opCodes.resize(numberOfInstructions + 1);
+
+    // The batch methods are only kept when there are any.
+
+    for (auto operation = this->operations->list.begin(); operation != this->operations->list.end(); ++operation)
+        if (operation->batchMethod) {
+            newImage->batchMethods.assign(numberOfInstructions + 1, NULL);
             break;
+        }
+
+    int64 codeOffset        = 0;
+    int64 numberOfRegisters = 0;
+    int64 opCode, parameterValues[4];
+
+    for (int64 instructionIndex = 0; instructionIndex < numberOfInstructions; ++instructionIndex) {
+        Instruction& instruction = newImage->instructions[instructionIndex];
+
+        if (!this->ReadInstruction(program, codeOffset, opCode, parameterValues)) {
+            Error("Instruction @%ld: invalid or truncated instruction.", instructionIndex);
+            delete newImage;
+            return NULL;
+        }
+
+        const Operation& operation = this->operations->list[opCode];
+        instruction.method         = operation.method;
+
+        newImage->opCodes[instructionIndex] = opCode;
+
+        if (!newImage->batchMethods.empty())
+            newImage->batchMethods[instructionIndex] = operation.batchMethod;
+
+        for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex) {
+            Value& value          = instruction.values[parameterIndex];
+            int64  parameterValue = parameterValues[parameterIndex];
+
+            instruction.parameters[parameterIndex] = &value;
+
+            switch (operation.parameterTypes[parameterIndex]) {
+                case Identifier: {
+                    // The version 1 programs named their identifiers with strings, their
+                    // string indexes cannot be taken for registers.
+
+                    if (program->GetVersion() == Program::LegacyVersion) {
+                        Error("Instruction @%ld: version 1 programs have no registers, compile it again.", instructionIndex);
+                        delete newImage;
+                        return NULL;
+                    }
+
+                    if ((parameterValue < 0) || (parameterValue >= VirtualMachineCore::MaxNumberOfRegisters)) {
+                        Error("Instruction @%ld: invalid register %ld.", instructionIndex, parameterValue);
+                        delete newImage;
+                        return NULL;
+                    }
+
+                    if (parameterValue >= numberOfRegisters)
+                        numberOfRegisters = parameterValue + 1;
+
+                    value.type  = Value::Int;
+                    value.size  = sizeof(int64);
+                    value.asInt = parameterValue;
+                    break;
+                }
+
+                case Address: {
+                    // Jumping to the end of the program is allowed (see Jump).
+
+                    if ((parameterValue < 0) || (parameterValue > numberOfInstructions)) {
+                        Error("Instruction @%ld: invalid address @%ld.", instructionIndex, parameterValue);
+                        delete newImage;
+                        return NULL;
+                    }
+
+                    value.type  = Value::Int;
+                    value.size  = sizeof(int64);
+                    value.asInt = parameterValue;
+                    break;
+                }
+
+                case IntLiteral: {
+                    value.type  = Value::Int;
+                    value.size  = sizeof(int64);
+                    value.asInt = parameterValue;
+                    break;
+                }
+
+                case BoolLiteral: {
+                    value.type   = Value::Bool;
+                    value.size   = sizeof(bool);
+                    value.asBool = parameterValue != 0;
+                    break;
+                }
+
+                case FloatLiteral: {
+                    value.type = Value::Float;
+                    value.size = sizeof(double);
+                    memcpy(&value.asFloat, &parameterValue, 8);
+                    break;
+                }
+
+                case StringLiteral: {
+                    charconst stringData;
+
+                    if (!program->GetString(parameterValue, stringData, value.size)) {
+                        Error("Instruction @%ld: invalid string index %ld.", instructionIndex, parameterValue);
+                        delete newImage;
+                        return NULL;
+                    }
+
+                    value.type     = Value::String;
+                    value.asString = const_cast<cstring>(stringData);
+                    break;
+                }
+
+                default: {
+                    instruction.parameters[parameterIndex] = NULL;
+                    break;
+                }
+            }
+        }
     }
 
-    Info("Program execution %s.", this->isPaused ? "paused" : "stopped");
-    return true;
+    // The compact code must end with the last instruction (the fixed one always does).
+
+    if ((numberOfInstructions > 0) && (codeOffset != program->GetCode()->index)) {
+        Error("Instruction @%ld: the program code goes on after the last instruction.", numberOfInstructions);
+        delete newImage;
+        return NULL;
+    }
+
+    Instruction& lastInstruction = newImage->instructions[numberOfInstructions];
+
+    lastInstruction.method = &VirtualMachineCore::OpExit;
+    memset(lastInstruction.parameters, 0, sizeof(lastInstruction.parameters));
+
+    newImage->opCodes[numberOfInstructions] = VirtualMachineCore::BuiltInOperations[1].opCode;
+
+    newImage->program              = program;
+    newImage->numberOfInstructions = numberOfInstructions;
+    newImage->numberOfRegisters    = numberOfRegisters;
+    newImage->operationsHash       = this->operations->hash;
+
+#ifdef VM_THREADED_DISPATCH
+    VirtualMachineCore::ThreadInstructions(newImage->instructions, numberOfInstructions + 1);
+#endif
+
+    Debug("Program decoded.");
+    return newImage;
 }
 
-bool VirtualMachineCore::Step(void) {
-    if (!this->isRunning)
-        return false;
+ExecutionContext* VirtualMachineCore::NewContext(const ProgramImage* image) {
+    if (!image) {
+        Error("The program image is null.");
+        return NULL;
+    }
 
-    // TODO: implement.
-    Stub();
+    if (image->operationsHash != this->operations->hash) {
+        Error("The program image was decoded for a machine with other operations.");
+        return NULL;
+    }
 
-    return false;
+    ExecutionContext* newContext = this->freeContexts;
+
+    if (newContext)
+        this->freeContexts = newContext->nextFreeContext;
+    else
+        newContext = new (std::nothrow) ExecutionContext();
+
+    if ((!newContext) || (!newContext->Reset(image))) {
+        Error("Could not allocate memory to hold the execution context.");
+        delete newContext;
+        return NULL;
+    }
+
+    return newContext;
 }
 
-void VirtualMachineCore::Stop(void) {
-    this->isRunning = false;
+void VirtualMachineCore::DeleteContext(ExecutionContext*& context) {
+    if (!context)
+        return;
+
+    if (context == this->context)
+        this->LoadContext(NULL);
+
+    context->image           = NULL;
+    context->nextFreeContext = this->freeContexts;
+    this->freeContexts       = context;
+
+    context = NULL;
 }
 
-bool VirtualMachineCore::IsRunning(void) const {
-    return this->isRunning;
+bool VirtualMachineCore::Start(ExecutionContext* context) {
+    static const ExecutionBudget noBudget = {0, 0};
+    return this->Start(context, noBudget);
 }
 
-bool VirtualMachineCore::IsPaused(void) const {
-    return this->isPaused;
+bool VirtualMachineCore::Start(ExecutionContext* context, const ExecutionBudget& budget) {
+    if (!context) {
+        Error("The execution context is null.");
+        return false;
+    }
+
+    // Any other context keeps its own state, it can be resumed later.
+
+    this->LoadContext(context);
+
+    this->nextInstruction = this->instructions;
+    this->isRunning       = true;
+    this->isPaused        = false;
+    this->isWaiting       = false;
+
+    if (context == this->ownContext)
+        Debug("Starting program execution...");
+
+    return this->Resume(context, budget);
 }
 
-// Bult-in Instructions
+bool VirtualMachineCore::Resume(ExecutionContext* context) {
+    static const ExecutionBudget noBudget = {0, 0};
+    return this->Resume(context, noBudget);
+}
+
+bool VirtualMachineCore::Resume(ExecutionContext* context, const ExecutionBudget& budget) {
+    if (!context) {
+        Error("The execution context is null.");
+        return false;
+    }
+
+    this->LoadContext(context);
+
+    if (!this->isRunning) {
+        Warning("The program is not running. Cannot resume execution.");
+        return false;
+    }
+
+    if (this->isWaiting) {
+        Warning("The program is waiting for an operation. Cannot resume execution.");
+        return false;
+    }
+
+    // Only the programs the machine started on its own context get the messages, the
+    // contexts are for the ones that run many short programs (like the pool).
+
+    bool isLogged = context == this->ownContext;
+
+    if (this->isPaused) {
+        if (isLogged)
+            Debug("Resuming program execution...");
+
+        this->isPaused = false;
+    }
+
+    this->StartBudget(budget);
+
+    bool isTraced = false;
+
+    if (this->profiler && (this->profiler->image == context->image))
+        this->RunProfiled();
+    else if (this->tracer && (this->tracer->image == context->image)) {
+        this->RunTraced();
+        isTraced = true;
+    } else
+        this->Execute();
+
+    this->SaveContext();
+
+    if (isTraced && (!this->isRunning) && (!this->tracer->dumpFilePath.empty()))
+        this->tracer->Dump();
+
+    // The time slices and the suspended operations are not worth a message, a resumed
+    // context only gets one when it pauses or stops.
+
+    if (isLogged && (!this->isOutOfBudget) && (!this->isWaiting))
+        Debug("Program execution %s.", this->isPaused ? "paused" : "stopped");
 
-bool VirtualMachineCore::OpNoOp(const Program::InstructionParameters parameters) {
     return true;
 }
 
-bool VirtualMachineCore::OpExit(const Program::InstructionParameters parameters) {
-    return false;
+bool VirtualMachineCore::Step(ExecutionContext* context) {
+    return this->Step(context, 1);
 }
 
-bool VirtualMachineCore::OpPause(const Program::InstructionParameters parameters) {
-    this->Pause();
-    return true;
+ExecutionContext* VirtualMachineCore::GetContext(void) const {
+    return this->context;
 }
 
-bool VirtualMachineCore::OpStop(const Program::InstructionParameters parameters) {
-    this->Stop();
+// Asynchronous Operations
+
+bool VirtualMachineCore::Wake(ExecutionContext* context) {
+    if (!context) {
+        Error("The execution context is null.");
+        return false;
+    }
+
+    this->LoadContext(context);
+
+    if (!this->isWaiting) {
+        Warning("The program is not waiting for an operation. Cannot wake it up.");
+        return false;
+    }
+
+    // It is left paused, the next Resume goes on from the suspending operation.
+
+    this->isWaiting = false;
+    this->SaveContext();
+
     return true;
 }
 
+bool VirtualMachineCore::Suspend(void) {
+    this->isPaused  = true;
+    this->isWaiting = true;
+
+    return false;
+}
+
+bool VirtualMachineCore::Step(ExecutionContext* context, const int64 count) {
+    static const ExecutionBudget noBudget = {0, 0};
+
+    if (!context)
+        return false;
+
+    this->LoadContext(context);
+
+    if ((!this->isRunning) || this->isPaused)
+        return false;
+
+    // The instructions are counted here, the jumps must not run out of budget.
+
+    this->StartBudget(noBudget);
+
+    bool canGoOn = true;
+
+    for (int64 stepIndex = 0; canGoOn && (stepIndex < count); ++stepIndex) {
+        const Instruction* instruction = this->nextInstruction++;
+        canGoOn                        = (this->*instruction->method)(instruction->parameters) && this->isRunning && (!this->isPaused);
+    }
+
+    this->SaveContext();
+    return canGoOn;
+}
+
+// Snapshots
+
+bool VirtualMachineCore::Snapshot(ExecutionContext* context, std::vector<uint8>& snapshot) {
+    if ((!context) || (!context->image)) {
+        Error("The execution context is null.");
+        return false;
+    }
+
+    // The current context may be running, its state is in the machine.
+
+    if (context == this->context)
+        this->SaveContext();
+
+    if (context->isWaiting) {
+        Error("The program is waiting for an operation. Cannot take a snapshot.");
+        return false;
+    }
+
+    // The operations are written by their signatures, which only stand for the ones the
+    // image was decoded with on this machine.
+
+    if (context->image->operationsHash != this->operations->hash) {
+        Error("The program image was decoded for a machine with other operations.");
+        return false;
+    }
+
+    const ProgramImage* image             = context->image;
+    uint64              programHash       = VirtualMachineCore::GetProgramHash(image);
+    int64               nextAddress       = context->nextInstruction - image->instructions;
+    int64               numberOfRegisters = image->numberOfRegisters;
+    int64               stackDepth        = context->stackDepth;
+    int32               version           = VirtualMachineCore::SnapshotVersion;
+    int64               flags             = (context->isRunning ? 1 : 0) | (context->isPaused ? 2 : 0) | (context->isOutOfBudget ? 4 : 0);
+    int64               slotsSize         = (numberOfRegisters + stackDepth) * sizeof(Slot);
+
+    snapshot.assign(VirtualMachineCore::SnapshotHeaderSize + slotsSize + numberOfRegisters + stackDepth, 0);
+
+    uint8* snapshotData = snapshot.data();
+
+    memcpy(snapshotData, VirtualMachineCore::SnapshotSignature, 4);
+    memcpy(&snapshotData[4], &version, 4);
+    memcpy(&snapshotData[8], &this->operations->signaturesHash, 8);
+    memcpy(&snapshotData[16], &programHash, 8);
+    memcpy(&snapshotData[24], &image->numberOfInstructions, 8);
+    memcpy(&snapshotData[32], &nextAddress, 8);
+    memcpy(&snapshotData[40], &numberOfRegisters, 8);
+    memcpy(&snapshotData[48], &stackDepth, 8);
+    memcpy(&snapshotData[56], &flags, 8);
+
+    uint8* slotsData = &snapshotData[VirtualMachineCore::SnapshotHeaderSize];
+
+    memcpy(slotsData, context->registers, numberOfRegisters * sizeof(Slot));
+    memcpy(&slotsData[numberOfRegisters * sizeof(Slot)], context->stack, stackDepth * sizeof(Slot));
+    memcpy(&slotsData[slotsSize], context->registerTypes, numberOfRegisters);
+    memcpy(&slotsData[slotsSize + numberOfRegisters], context->stackTypes, stackDepth);
+
+    return true;
+}
+
+ExecutionContext* VirtualMachineCore::Restore(const ProgramImage* image, const uint8* snapshot, const int64 snapshotSize) {
+    if ((!image) || (!snapshot)) {
+        Error("The program image or the snapshot is null.");
+        return NULL;
+    }
+
+    if ((snapshotSize < VirtualMachineCore::SnapshotHeaderSize) || (memcmp(snapshot, VirtualMachineCore::SnapshotSignature, 4) != 0)) {
+        Error("The snapshot is not valid.");
+        return NULL;
+    }
+
+    int32  version;
+    uint64 operationsHash, programHash;
+    int64  numberOfInstructions, nextAddress, numberOfRegisters, stackDepth, flags;
+
+    memcpy(&version, &snapshot[4], 4);
+    memcpy(&operationsHash, &snapshot[8], 8);
+    memcpy(&programHash, &snapshot[16], 8);
+    memcpy(&numberOfInstructions, &snapshot[24], 8);
+    memcpy(&nextAddress, &snapshot[32], 8);
+    memcpy(&numberOfRegisters, &snapshot[40], 8);
+    memcpy(&stackDepth, &snapshot[48], 8);
+    memcpy(&flags, &snapshot[56], 8);
+
+    if (version != VirtualMachineCore::SnapshotVersion) {
+        Error("The snapshot version (%d) is not supported.", version);
+        return NULL;
+    }
+
+    if (operationsHash != this->operations->signaturesHash) {
+        Error("The snapshot was taken on a machine with other operations.");
+        return NULL;
+    }
+
+    if ((numberOfInstructions != image->numberOfInstructions) || (numberOfRegisters != image->numberOfRegisters) || (programHash != VirtualMachineCore::GetProgramHash(image))) {
+        Error("The snapshot was taken with another program.");
+        return NULL;
+    }
+
+    // The final EXIT is a valid next instruction (the program has just ended).
+
+    int64 slotsSize = (numberOfRegisters + stackDepth) * sizeof(Slot);
+
+    if ((nextAddress < 0) || (nextAddress > numberOfInstructions) || (stackDepth < 0) || (stackDepth > VirtualMachineCore::StackSize) || (snapshotSize != VirtualMachineCore::SnapshotHeaderSize + slotsSize + numberOfRegisters + stackDepth)) {
+        Error("The snapshot is not valid.");
+        return NULL;
+    }
+
+    const uint8* slotsData = &snapshot[VirtualMachineCore::SnapshotHeaderSize];
+
+    for (int64 typeIndex = 0; typeIndex < numberOfRegisters + stackDepth; ++typeIndex)
+        if (slotsData[slotsSize + typeIndex] > BoolSlot) {
+            Error("The snapshot is not valid.");
+            return NULL;
+        }
+
+    ExecutionContext* newContext = this->NewContext(image);
+
+    if (!newContext)
+        return NULL;
+
+    memcpy(newContext->registers, slotsData, numberOfRegisters * sizeof(Slot));
+    memcpy(newContext->stack, &slotsData[numberOfRegisters * sizeof(Slot)], stackDepth * sizeof(Slot));
+    memcpy(newContext->registerTypes, &slotsData[slotsSize], numberOfRegisters);
+    memcpy(newContext->stackTypes, &slotsData[slotsSize + numberOfRegisters], stackDepth);
+
+    newContext->nextInstruction = &image->instructions[nextAddress];
+    newContext->stackDepth      = stackDepth;
+    newContext->isRunning       = (flags & 1) != 0;
+    newContext->isPaused        = (flags & 2) != 0;
+    newContext->isOutOfBudget   = (flags & 4) != 0;
+
+    return newContext;
+}
+
+// The program code and strings identify the program (the other sections do not change
+// how it runs), the hash is only worked out once for each image.
+
+uint64 VirtualMachineCore::GetProgramHash(const ProgramImage* image) {
+    uint64 programHash = image->programHash.load(std::memory_order_acquire);
+
+    if (programHash != 0)
+        return programHash;
+
+    const Program* program = image->program;
+    const Memory*  code    = program->GetCode();
+
+    programHash = Hash(code->data, code->index);
+
+    for (int64 stringIndex = 1; stringIndex <= program->GetNumberOfStrings(); ++stringIndex) {
+        charconst stringData;
+        int64     stringSize;
+
+        if (program->GetString(stringIndex, stringData, stringSize))
+            programHash = Hash(stringData, stringSize, Hash(&stringSize, 8, programHash));
+    }
+
+    image->programHash.store(programHash, std::memory_order_release);
+    return programHash;
+}
+
+// Time Slicing
+
+bool VirtualMachineCore::Resume(const ExecutionBudget& budget) {
+    if (!this->context) {
+        Error("No program to resume execution from.");
+        return false;
+    }
+
+    return this->Resume(this->context, budget);
+}
+
+bool VirtualMachineCore::Step(const int64 count) {
+    if (!this->context)
+        return false;
+
+    return this->Step(this->context, count);
+}
+
+bool VirtualMachineCore::IsOutOfBudget(void) const {
+    return this->isOutOfBudget;
+}
+
+void VirtualMachineCore::StartBudget(const ExecutionBudget& budget) {
+    this->isOutOfBudget    = false;
+    this->blockStart       = this->nextInstruction;
+    this->instructionsLeft = (budget.instructions > 0) ? budget.instructions : VirtualMachineCore::UnlimitedBudget;
+    this->hasDeadline      = budget.microseconds > 0;
+
+    if (this->hasDeadline)
+        this->deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(budget.microseconds);
+
+    this->StartBudgetSlice();
+}
+
+bool VirtualMachineCore::NextBudgetSlice(void) {
+    // Only called from Jump, when the current slice was spent (nextInstruction is
+    // already the jump target, which is where the program is resumed from).
+
+    this->instructionsLeft -= this->sliceSize - this->budgetLeft;
+
+    if ((this->instructionsLeft <= 0) || (this->hasDeadline && (std::chrono::steady_clock::now() >= this->deadline))) {
+        this->isOutOfBudget = true;
+        return false;
+    }
+
+    this->StartBudgetSlice();
+    return true;
+}
+
+void VirtualMachineCore::StartBudgetSlice(void) {
+    this->sliceSize = this->instructionsLeft;
+
+    if (this->hasDeadline && (this->sliceSize > VirtualMachineCore::ClockCheckInterval))
+        this->sliceSize = VirtualMachineCore::ClockCheckInterval;
+
+    this->budgetLeft = this->sliceSize;
+}
+
+void VirtualMachineCore::LoadContext(ExecutionContext* context) {
+    if (context == this->context)
+        return;
+
+    this->SaveContext();
+    this->context = context;
+
+    if (!context) {
+        this->ClearState();
+        return;
+    }
+
+    this->isRunning            = context->isRunning;
+    this->isPaused             = context->isPaused;
+    this->isWaiting            = context->isWaiting;
+    this->isOutOfBudget        = context->isOutOfBudget;
+    this->instructions         = context->image->instructions;
+    this->numberOfInstructions = context->image->numberOfInstructions;
+    this->nextInstruction      = context->nextInstruction;
+    this->registers            = context->registers;
+    this->registerTypes        = context->registerTypes;
+    this->numberOfRegisters    = context->image->numberOfRegisters;
+    this->stack                = context->stack;
+    this->stackTypes           = context->stackTypes;
+    this->stackDepth           = context->stackDepth;
+}
+
+void VirtualMachineCore::ClearState(void) {
+    this->isRunning            = false;
+    this->isPaused             = false;
+    this->isWaiting            = false;
+    this->isOutOfBudget        = false;
+    this->instructions         = NULL;
+    this->numberOfInstructions = 0;
+    this->nextInstruction      = NULL;
+    this->registers            = NULL;
+    this->registerTypes        = NULL;
+    this->numberOfRegisters    = 0;
+    this->stack                = NULL;
+    this->stackTypes           = NULL;
+    this->stackDepth           = 0;
+}
+
+void VirtualMachineCore::SaveContext(void) {
+    if (!this->context)
+        return;
+
+    this->context->isRunning       = this->isRunning;
+    this->context->isPaused        = this->isPaused;
+    this->context->isWaiting       = this->isWaiting;
+    this->context->isOutOfBudget   = this->isOutOfBudget;
+    this->context->nextInstruction = this->nextInstruction;
+    this->context->stackDepth      = this->stackDepth;
+}
+
+// Profiling
+
+void VirtualMachineCore::SetProfiler(Profiler* profiler) {
+    this->profiler = profiler;
+}
+
+Profiler* VirtualMachineCore::GetProfiler(void) const {
+    return this->profiler;
+}
+
+void VirtualMachineCore::RunProfiled(void) {
+    // The same as the call dispatch loop, timing each operation method (the built-in
+    // operations included, in both dispatch modes).
+
+    Profiler::Counter* counters = this->profiler->counters.data();
+    const Instruction* instruction;
+    bool               canGoOn;
+
+    do {
+        instruction = this->nextInstruction++;
+
+        Profiler::Counter& counter     = counters[instruction - this->instructions];
+        uint64             startCycles = ReadCycleCounter();
+
+        canGoOn = (this->*instruction->method)(instruction->parameters);
+
+        counter.cycles += ReadCycleCounter() - startCycles;
+        counter.executions++;
+    } while (canGoOn);
+}
+
+// Tracing
+
+void VirtualMachineCore::SetTracer(Tracer* tracer) {
+    this->tracer = tracer;
+}
+
+Tracer* VirtualMachineCore::GetTracer(void) const {
+    return this->tracer;
+}
+
+void VirtualMachineCore::RunTraced(void) {
+    // Jump records the basic blocks as they end and the last one is recorded here, so
+    // the program runs the usual way (with the native code too).
+
+    this->activeTracer = this->tracer;
+    this->Execute();
+    this->activeTracer = NULL;
+
+    if (this->nextInstruction > this->blockStart)
+        this->tracer->Record(this->blockStart - this->instructions, this->nextInstruction - this->blockStart);
+}
+
+// JIT Compiler
+
+bool VirtualMachineCore::CompileImage(const ProgramImage* image) const {
+    if (!image) {
+        Error("The program image is null.");
+        return false;
+    }
+
+    if (image->nativeCode.load(std::memory_order_acquire))
+        return true;
+
+    if (!NativeCode::IsSupported())
+        return false;
+
+    if (image->operationsHash != this->operations->hash) {
+        Error("The program image was decoded for a machine with other operations.");
+        return false;
+    }
+
+    NativeCode* newCode = new (std::nothrow) NativeCode();
+
+    if ((!newCode) || (!newCode->Compile(this, image))) {
+        Warning("Could not compile the program image, it will be interpreted.");
+        delete newCode;
+        return false;
+    }
+
+    // Another thread may have compiled the same image meanwhile, keep the first one.
+
+    NativeCode* noCode = NULL;
+
+    if (!const_cast<ProgramImage*>(image)->nativeCode.compare_exchange_strong(noCode, newCode, std::memory_order_acq_rel))
+        delete newCode;
+
+    Info("Program compiled to native code (%ld bytes).", image->nativeCode.load(std::memory_order_acquire)->GetCodeSize());
+    return true;
+}
+
+void VirtualMachineCore::SetJitThreshold(const int64 threshold) {
+    this->jitThreshold = threshold;
+}
+
+int64 VirtualMachineCore::GetJitThreshold(void) const {
+    return this->jitThreshold;
+}
+
+void VirtualMachineCore::Execute(void) {
+    const ProgramImage* image      = this->context->image;
+    const NativeCode*   nativeCode = image->nativeCode.load(std::memory_order_acquire);
+
+    if ((!nativeCode) && (this->jitThreshold == 0) && this->CompileImage(image))
+        nativeCode = image->nativeCode.load(std::memory_order_acquire);
+
+    if ((!nativeCode) && (this->jitThreshold > 0) && NativeCode::IsSupported()) {
+        std::vector<uint32>& hotnessCounters = this->context->hotnessCounters;
+
+        if (hotnessCounters.empty())
+            hotnessCounters.assign(this->numberOfInstructions + 1, 0);
+
+        this->hotnessCounters = hotnessCounters.data();
+        this->Run();
+        this->hotnessCounters = NULL;
+
+        if (!this->isJitPending)
+            return;
+
+        // The jump that made the image hot stopped the interpreter right at its target,
+        // go on from there (with the interpreter if the image cannot be compiled).
+
+        this->isJitPending = false;
+
+        if ((!this->isRunning) || this->isPaused || this->isOutOfBudget)
+            return;
+
+        if (this->CompileImage(image))
+            nativeCode = image->nativeCode.load(std::memory_order_acquire);
+    }
+
+    if (nativeCode)
+        nativeCode->Run(this, this->nextInstruction - this->instructions);
+    else
+        this->Run();
+}
+
+bool VirtualMachineCore::CallOperation(VirtualMachineCore* machine, const Instruction* instruction) {
+    return (machine->*instruction->method)(instruction->parameters);
+}
+
+// Batch Execution
+
+ExecutionBatch* VirtualMachineCore::NewBatch(const ProgramImage* image, const int numberOfLanes) const {
+    if (!image) {
+        Error("The program image is null.");
+        return NULL;
+    }
+
+    if (image->operationsHash != this->operations->hash) {
+        Error("The program image was decoded for a machine with other operations.");
+        return NULL;
+    }
+
+    if ((numberOfLanes < 1) || (numberOfLanes > VirtualMachineCore::MaxNumberOfLanes)) {
+        Error("Invalid number of batch lanes (%d).", numberOfLanes);
+        return NULL;
+    }
+
+    ExecutionBatch* newBatch = new (std::nothrow) ExecutionBatch();
+
+    if ((!newBatch) || (!newBatch->Reset(image, numberOfLanes))) {
+        Error("Could not allocate memory to hold the execution batch.");
+        delete newBatch;
+        return NULL;
+    }
+
+    return newBatch;
+}
+
+bool VirtualMachineCore::Start(ExecutionBatch* batch) {
+    static const ExecutionBudget noBudget = {0, 0};
+
+    if (!batch) {
+        Error("The execution batch is null.");
+        return false;
+    }
+
+    const ProgramImage* image = batch->image;
+
+    if (image->operationsHash != this->operations->hash) {
+        Error("The program image was decoded for a machine with other operations.");
+        return false;
+    }
+
+    // The operations without a batch method see the lane being called as the current
+    // program (with its registers copied to the batch lane registers).
+
+    this->LoadContext(NULL);
+
+    this->instructions         = image->instructions;
+    this->numberOfInstructions = image->numberOfInstructions;
+    this->registers            = batch->laneRegisters.data();
+    this->registerTypes        = batch->laneRegisterTypes.data();
+    this->numberOfRegisters    = image->numberOfRegisters;
+
+    this->StartBudget(noBudget);
+    batch->Restart();
+
+    Debug("Starting batch execution (%d lanes)...", batch->numberOfLanes);
+
+    while (batch->numberOfRunningLanes > 0) {
+        if (!batch->isConverged)
+            batch->GatherLanes();
+
+        batch->StartDispatch();
+
+        const Instruction*   instruction = &this->instructions[batch->address];
+        BatchOperationMethod batchMethod = image->batchMethods.empty() ? NULL : image->batchMethods[batch->address];
+
+        if ((instruction->method == &VirtualMachineCore::OpExit) || (instruction->method == &VirtualMachineCore::OpStop) || (instruction->method == &VirtualMachineCore::OpPause)) {
+            batch->StopActiveLanes();
+            continue;
+        }
+
+        if (batchMethod) {
+            if (!(this->*batchMethod)(instruction->parameters, *batch)) {
+                Error("Instruction @%ld failed, stopping the batch.", batch->address);
+                batch->StopAllLanes();
+                continue;
+            }
+        } else if (instruction->method != &VirtualMachineCore::OpNoOp)
+            this->CallLanes(instruction, *batch);
+
+        batch->EndDispatch();
+    }
+
+    this->ClearState();
+
+    Debug("Batch execution stopped.");
+    return true;
+}
+
+void VirtualMachineCore::CallLanes(const Instruction* instruction, ExecutionBatch& batch) {
+    int64        numberOfRegisters = this->numberOfRegisters;
+    int64        laneStride        = batch.laneStride;
+    int          numberOfLanes     = batch.numberOfActiveLanes;
+    const int32* activeLanes       = batch.activeLanes.data();
+
+    for (int laneIndex = 0; laneIndex < numberOfLanes; ++laneIndex) {
+        int lane = activeLanes[laneIndex];
+
+        if (!batch.LoadLaneStack(lane)) {
+            Error("Could not allocate memory to hold the stack of the batch lane %d.", lane);
+            batch.RecordJump(lane, -1);
+            continue;
+        }
+
+        this->stack      = reinterpret_cast<Slot*>(batch.laneStacks[lane]);
+        this->stackTypes = reinterpret_cast<uint8*>(this->stack + VirtualMachineCore::StackSize);
+        this->stackDepth = batch.laneStackDepths[lane];
+
+        for (int64 registerIndex = 0; registerIndex < numberOfRegisters; ++registerIndex) {
+            this->registers[registerIndex]     = batch.registers[(registerIndex * laneStride) + lane];
+            this->registerTypes[registerIndex] = batch.registerTypes[(registerIndex * laneStride) + lane];
+        }
+
+        this->nextInstruction = instruction + 1;
+        this->blockStart      = this->nextInstruction;
+        this->isRunning       = true;
+        this->isPaused        = false;
+        this->isWaiting       = false;
+
+        (this->*instruction->method)(instruction->parameters);
+
+        for (int64 registerIndex = 0; registerIndex < numberOfRegisters; ++registerIndex) {
+            batch.registers[(registerIndex * laneStride) + lane]     = this->registers[registerIndex];
+            batch.registerTypes[(registerIndex * laneStride) + lane] = this->registerTypes[registerIndex];
+        }
+
+        batch.laneStackDepths[lane] = this->stackDepth;
+
+        // Jump already checked the address. A lane has no context to wait in, an operation
+        // that suspends it only stops it.
+
+        if (this->isWaiting) {
+            Error("Instruction @%ld suspended the batch lane %d, the batches cannot wait for operations.", instruction - this->instructions, lane);
+            batch.RecordJump(lane, -1);
+        } else if ((!this->isRunning) || this->isPaused)
+            batch.RecordJump(lane, -1);
+        else if (this->nextInstruction != instruction + 1)
+            batch.RecordJump(lane, this->nextInstruction - this->instructions);
+    }
+
+    this->stack      = NULL;
+    this->stackTypes = NULL;
+    this->stackDepth = 0;
+}
+
+// Programs
+
+bool VirtualMachineCore::ReadInstruction(const Program* program, int64& codeOffset, int64& opCode, int64 parameterValues[4]) const {
+    const Memory* code = program->GetCode();
+
+    if (codeOffset == 0)
+        codeOffset = (program->GetCodeEncoding() == Program::CompactEncoding) ? Program::CompactCodeHeaderSize : 0;
+
+    // Fixed encoding: [ OpCode, Param1, Param2, Param3, Param4 ], 8 bytes each.
+
+    if (program->GetCodeEncoding() == Program::FixedEncoding) {
+        if (codeOffset + Program::InstructionSize > code->index)
+            return false;
+
+        memcpy(&opCode, &code->data[codeOffset], 8);
+        memcpy(parameterValues, &code->data[codeOffset + 8], 32);
+
+        codeOffset += Program::InstructionSize;
+        return (opCode >= 0) && (opCode < this->operations->list.size());
+    }
+
+    // Compact encoding: only the parameters used by the operation are there.
+
+    uint64 encodedValue;
+
+    if ((!ReadVarInt(code->data, code->index, codeOffset, encodedValue)) || (encodedValue >= this->operations->list.size()))
+        return false;
+
+    opCode = encodedValue;
+
+    const Operation& operation = this->operations->list[opCode];
+
+    for (int parameterIndex = 0; parameterIndex < 4; ++parameterIndex) {
+        parameterValues[parameterIndex] = 0;
+
+        switch (operation.parameterTypes[parameterIndex]) {
+            case None: break;
+
+            case Address:
+            case IntLiteral: {
+                if (!ReadVarInt(code->data, code->index, codeOffset, encodedValue))
+                    return false;
+
+                parameterValues[parameterIndex] = ZigZagDecode(encodedValue);
+                break;
+            }
+
+            case BoolLiteral: {
+                if (codeOffset >= code->index)
+                    return false;
+
+                parameterValues[parameterIndex] = code->data[codeOffset++];
+                break;
+            }
+
+            case FloatLiteral: {
+                if (codeOffset + 8 > code->index)
+                    return false;
+
+                memcpy(&parameterValues[parameterIndex], &code->data[codeOffset], 8);
+                codeOffset += 8;
+                break;
+            }
+
+            case Identifier:
+            case StringLiteral: {
+                if (!ReadVarInt(code->data, code->index, codeOffset, encodedValue))
+                    return false;
+
+                parameterValues[parameterIndex] = encodedValue;
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Registers and Stack
+
+int64 VirtualMachineCore::GetNumberOfRegisters(void) const {
+    return this->numberOfRegisters;
+}
+
+int64 VirtualMachineCore::GetStackDepth(void) const {
+    return this->stackDepth;
+}
+
+bool VirtualMachineCore::Push(const Slot value, const SlotType valueType) {
+    if (this->stackDepth >= VirtualMachineCore::StackSize) {
+        Error("Stack overflow.");
+        this->Stop();
+        return false;
+    }
+
+    this->stack[this->stackDepth]      = value;
+    this->stackTypes[this->stackDepth] = valueType;
+    this->stackDepth++;
+
+    return true;
+}
+
+bool VirtualMachineCore::PushInt(const int64 value) {
+    Slot slotValue;
+    slotValue.asInt = value;
+
+    return this->Push(slotValue, IntSlot);
+}
+
+bool VirtualMachineCore::PushFloat(const double value) {
+    Slot slotValue;
+    slotValue.asFloat = value;
+
+    return this->Push(slotValue, FloatSlot);
+}
+
+bool VirtualMachineCore::PushBool(const bool value) {
+    Slot slotValue;
+    slotValue.asInt = value ? 1 : 0;
+
+    return this->Push(slotValue, BoolSlot);
+}
+
+bool VirtualMachineCore::Pop(Slot& value, SlotType& valueType) {
+    if (this->stackDepth <= 0) {
+        Error("Stack underflow.");
+        this->Stop();
+        return false;
+    }
+
+    this->stackDepth--;
+    value     = this->stack[this->stackDepth];
+    valueType = static_cast<SlotType>(this->stackTypes[this->stackDepth]);
+
+    return true;
+}
+
+bool VirtualMachineCore::PopInt(int64& value) {
+    Slot     slotValue;
+    SlotType slotType;
+
+    if (!this->Pop(slotValue, slotType))
+        return false;
+
+    value = (slotType == FloatSlot) ? static_cast<int64>(slotValue.asFloat) : slotValue.asInt;
+    return true;
+}
+
+bool VirtualMachineCore::PopFloat(double& value) {
+    Slot     slotValue;
+    SlotType slotType;
+
+    if (!this->Pop(slotValue, slotType))
+        return false;
+
+    value = (slotType == FloatSlot) ? slotValue.asFloat : static_cast<double>(slotValue.asInt);
+    return true;
+}
+
+// Bult-in Instructions
+
+bool VirtualMachineCore::OpNoOp(const Program::InstructionParameters parameters) {
+    return true;
+}
+
+bool VirtualMachineCore::OpExit(const Program::InstructionParameters parameters) {
+    this->Stop();
+    return false;
+}
+
+bool VirtualMachineCore::OpPause(const Program::InstructionParameters parameters) {
+    this->Pause();
+    return false;
+}
+
+bool VirtualMachineCore::OpStop(const Program::InstructionParameters parameters) {
+    this->Stop();
+    return false;
+}
+
+// Program Image
+
+ProgramImage::ProgramImage(void) :
+    program(NULL),
+    instructions(NULL),
+    numberOfInstructions(0),
+    numberOfRegisters(0),
+    operationsHash(0),
+    nativeCode(NULL),
+    programHash(0) {
+    // Empty
+}
+
+ProgramImage::~ProgramImage() {
+    delete this->nativeCode.load();
+    delete[] this->instructions;
+}
+
+const Program* ProgramImage::GetProgram(void) const {
+    return this->program;
+}
+
+int64 ProgramImage::GetNumberOfInstructions(void) const {
+    return this->numberOfInstructions;
+}
+
+const std::vector<int64>& ProgramImage::GetOpCodes(void) const {
+    return this->opCodes;
+}
+
+int64 ProgramImage::GetNumberOfRegisters(void) const {
+    return this->numberOfRegisters;
+}
+
+const NativeCode* ProgramImage::GetNativeCode(void) const {
+    return this->nativeCode.load(std::memory_order_acquire);
+}
+
+// Execution Context
+
+ExecutionContext::ExecutionContext(void) :
+    image(NULL),
+    nextInstruction(NULL),
+    isRunning(false),
+    isPaused(false),
+    isWaiting(false),
+    isOutOfBudget(false),
+    nextFreeContext(NULL),
+    slotsMemory(NULL),
+    slotsCapacity(-1),
+    registers(NULL),
+    registerTypes(NULL),
+    stack(NULL),
+    stackTypes(NULL),
+    stackDepth(0) {
+    // Empty
+}
+
+ExecutionContext::~ExecutionContext() {
+    DeleteBuffer(this->slotsMemory);
+}
+
+const ProgramImage* ExecutionContext::GetImage(void) const {
+    return this->image;
+}
+
+bool ExecutionContext::IsRunning(void) const {
+    return this->isRunning;
+}
+
+bool ExecutionContext::IsPaused(void) const {
+    return this->isPaused;
+}
+
+bool ExecutionContext::IsWaiting(void) const {
+    return this->isWaiting;
+}
+
+bool ExecutionContext::IsOutOfBudget(void) const {
+    return this->isOutOfBudget;
+}
+
+int64 ExecutionContext::GetStackDepth(void) const {
+    return this->stackDepth;
+}
+
+bool ExecutionContext::Reset(const ProgramImage* image) {
+    int64 numberOfRegisters = image->numberOfRegisters;
+
+    // The slots memory is kept while it is big enough for the image registers.
+
+    if (numberOfRegisters > this->slotsCapacity) {
+        DeleteBuffer(this->slotsMemory);
+
+        int64 numberOfSlots = numberOfRegisters + VirtualMachineCore::StackSize;
+        int64 slotsSize     = (numberOfSlots * sizeof(VirtualMachineCore::Slot)) + numberOfSlots;
+
+        this->slotsMemory   = NewBuffer(slotsSize + VirtualMachineCore::SlotsAlignment);
+        this->slotsCapacity = -1;
+
+        if (!this->slotsMemory)
+            return false;
+
+        uintptr_t alignedAddress = (reinterpret_cast<uintptr_t>(this->slotsMemory) + VirtualMachineCore::SlotsAlignment - 1) & ~static_cast<uintptr_t>(VirtualMachineCore::SlotsAlignment - 1);
+
+        this->registers     = reinterpret_cast<VirtualMachineCore::Slot*>(alignedAddress);
+        this->stack         = this->registers + numberOfRegisters;
+        this->registerTypes = reinterpret_cast<uint8*>(this->stack + VirtualMachineCore::StackSize);
+        this->stackTypes    = this->registerTypes + numberOfRegisters;
+        this->slotsCapacity = numberOfRegisters;
+    }
+
+    // Only the registers have to be cleared, the stack starts empty.
+
+    memset(this->registers, 0, numberOfRegisters * sizeof(VirtualMachineCore::Slot));
+    memset(this->registerTypes, 0, numberOfRegisters);
+
+    this->image           = image;
+    this->nextInstruction = image->instructions;
+    this->isRunning       = false;
+    this->isPaused        = false;
+    this->isWaiting       = false;
+    this->isOutOfBudget   = false;
+    this->stackDepth      = 0;
+
+    this->hotnessCounters.clear();
+    return true;
+}
+
+// Execution Batch
+
+ExecutionBatch::ExecutionBatch(void) :
+    image(NULL),
+    numberOfLanes(0),
+    numberOfRegisters(0),
+    slotsMemory(NULL),
+    laneStride(0),
+    registers(NULL),
+    registerTypes(NULL),
+    numberOfActiveLanes(0),
+    numberOfRunningLanes(0),
+    isConverged(false),
+    address(0),
+    dispatchCounter(0),
+    numberOfJumps(0),
+    jumpTarget(0),
+    hasSplitJumps(false),
+    hasUniformJump(false) {
+    // Empty
+}
+
+ExecutionBatch::~ExecutionBatch() {
+    for (auto laneStack = this->laneStacks.begin(); laneStack != this->laneStacks.end(); ++laneStack)
+        DeleteBuffer(*laneStack);
+
+    DeleteBuffer(this->slotsMemory);
+}
+
+const ProgramImage* ExecutionBatch::GetImage(void) const {
+    return this->image;
+}
+
+int ExecutionBatch::GetNumberOfLanes(void) const {
+    return this->numberOfLanes;
+}
+
+bool ExecutionBatch::IsRunning(void) const {
+    return this->numberOfRunningLanes > 0;
+}
+
+bool ExecutionBatch::IsLaneRunning(const int lane) const {
+    return this->laneAddresses[lane] >= 0;
+}
+
+bool ExecutionBatch::Reset(const ProgramImage* image, const int numberOfLanes) {
+    // Every register gets a whole number of cache lines, for all the lanes.
+
+    int64 laneStride    = AlignSize(numberOfLanes, VirtualMachineCore::SlotsAlignment / sizeof(VirtualMachineCore::Slot));
+    int64 numberOfSlots = image->numberOfRegisters * laneStride;
+    int64 slotsSize     = (numberOfSlots * sizeof(VirtualMachineCore::Slot)) + numberOfSlots;
+
+    this->slotsMemory = NewBuffer(slotsSize + VirtualMachineCore::SlotsAlignment);
+
+    if (!this->slotsMemory)
+        return false;
+
+    memset(this->slotsMemory, 0, slotsSize + VirtualMachineCore::SlotsAlignment);
+
+    uintptr_t alignedAddress = (reinterpret_cast<uintptr_t>(this->slotsMemory) + VirtualMachineCore::SlotsAlignment - 1) & ~static_cast<uintptr_t>(VirtualMachineCore::SlotsAlignment - 1);
+
+    this->image             = image;
+    this->numberOfLanes     = numberOfLanes;
+    this->numberOfRegisters = image->numberOfRegisters;
+    this->laneStride        = laneStride;
+    this->registers         = reinterpret_cast<VirtualMachineCore::Slot*>(alignedAddress);
+    this->registerTypes     = reinterpret_cast<uint8*>(this->registers + numberOfSlots);
+
+    this->laneAddresses.assign(numberOfLanes, -1);
+    this->laneDispatches.assign(numberOfLanes, -1);
+    this->activeLanes.assign(numberOfLanes, 0);
+    this->laneRegisters.resize(this->numberOfRegisters);
+    this->laneRegisterTypes.resize(this->numberOfRegisters);
+    this->laneStacks.assign(numberOfLanes, NULL);
+    this->laneStackDepths.assign(numberOfLanes, 0);
+
+    return true;
+}
+
+// Active Lanes
+
+bool ExecutionBatch::Jump(const int64 address) {
+    if ((address < 0) || (address > this->image->numberOfInstructions)) {
+        Error("Jump to invalid address @%ld.", address);
+
+        for (int laneIndex = 0; laneIndex < this->numberOfActiveLanes; ++laneIndex)
+            this->RecordJump(this->activeLanes[laneIndex], -1);
+
+        return false;
+    }
+
+    // The common case (no lane took another way yet) is not recorded per lane.
+
+    if (this->isConverged && (this->numberOfJumps == 0)) {
+        this->hasUniformJump = true;
+        this->numberOfJumps  = this->numberOfActiveLanes;
+        this->jumpTarget     = address;
+
+        return true;
+    }
+
+    for (int laneIndex = 0; laneIndex < this->numberOfActiveLanes; ++laneIndex)
+        this->RecordJump(this->activeLanes[laneIndex], address);
+
+    return true;
+}
+
+bool ExecutionBatch::Jump(const int lane, const int64 address) {
+    if ((address < 0) || (address > this->image->numberOfInstructions)) {
+        Error("Batch lane %d: jump to invalid address @%ld.", lane, address);
+        this->RecordJump(lane, -1);
+        return false;
+    }
+
+    this->RecordJump(lane, address);
+    return true;
+}
+
+void ExecutionBatch::Stop(const int lane) {
+    this->RecordJump(lane, -1);
+}
+
+// Registers
+
+VirtualMachineCore::SlotType ExecutionBatch::GetRegisterType(const int lane, const int64 registerIndex) const {
+    return static_cast<VirtualMachineCore::SlotType>(this->registerTypes[(registerIndex * this->laneStride) + lane]);
+}
+
+int64 ExecutionBatch::GetIntRegister(const int lane, const int64 registerIndex) const {
+    return this->registers[(registerIndex * this->laneStride) + lane].asInt;
+}
+
+double ExecutionBatch::GetFloatRegister(const int lane, const int64 registerIndex) const {
+    return this->registers[(registerIndex * this->laneStride) + lane].asFloat;
+}
+
+bool ExecutionBatch::GetBoolRegister(const int lane, const int64 registerIndex) const {
+    return this->registers[(registerIndex * this->laneStride) + lane].asInt != 0;
+}
+
+void ExecutionBatch::SetIntRegister(const int lane, const int64 registerIndex, const int64 value) {
+    this->registers[(registerIndex * this->laneStride) + lane].asInt = value;
+    this->registerTypes[(registerIndex * this->laneStride) + lane]   = VirtualMachineCore::IntSlot;
+}
+
+void ExecutionBatch::SetFloatRegister(const int lane, const int64 registerIndex, const double value) {
+    this->registers[(registerIndex * this->laneStride) + lane].asFloat = value;
+    this->registerTypes[(registerIndex * this->laneStride) + lane]     = VirtualMachineCore::FloatSlot;
+}
+
+void ExecutionBatch::SetBoolRegister(const int lane, const int64 registerIndex, const bool value) {
+    this->registers[(registerIndex * this->laneStride) + lane].asInt = value ? 1 : 0;
+    this->registerTypes[(registerIndex * this->laneStride) + lane]   = VirtualMachineCore::BoolSlot;
+}
+
+// Lanes
+
+void ExecutionBatch::Restart(void) {
+    // All the lanes start together, with empty stacks.
+
+    for (int lane = 0; lane < this->numberOfLanes; ++lane) {
+        this->laneAddresses[lane]   = 0;
+        this->laneDispatches[lane]  = -1;
+        this->activeLanes[lane]     = lane;
+        this->laneStackDepths[lane] = 0;
+    }
+
+    this->numberOfActiveLanes  = this->numberOfLanes;
+    this->numberOfRunningLanes = this->numberOfLanes;
+    this->isConverged          = true;
+    this->address              = 0;
+    this->dispatchCounter      = 0;
+}
+
+void ExecutionBatch::GatherLanes(void) {
+    // The lanes at the lowest address go first, the others wait for them.
+
+    int64 lowestAddress = INT64_MAX;
+
+    for (int lane = 0; lane < this->numberOfLanes; ++lane)
+        if ((this->laneAddresses[lane] >= 0) && (this->laneAddresses[lane] < lowestAddress))
+            lowestAddress = this->laneAddresses[lane];
+
+    this->numberOfActiveLanes = 0;
+
+    for (int lane = 0; lane < this->numberOfLanes; ++lane)
+        if (this->laneAddresses[lane] == lowestAddress)
+            this->activeLanes[this->numberOfActiveLanes++] = lane;
+
+    this->address     = lowestAddress;
+    this->isConverged = this->numberOfActiveLanes == this->numberOfRunningLanes;
+}
+
+void ExecutionBatch::StartDispatch(void) {
+    this->dispatchCounter++;
+
+    this->numberOfJumps  = 0;
+    this->hasSplitJumps  = false;
+    this->hasUniformJump = false;
+}
+
+void ExecutionBatch::EndDispatch(void) {
+    int64 nextAddress = this->address + 1;
+
+    if (this->isConverged) {
+        if (this->numberOfJumps == 0) {
+            this->address = nextAddress;
+            return;
+        }
+
+        if (this->hasUniformJump || ((this->numberOfJumps == this->numberOfActiveLanes) && (!this->hasSplitJumps) && (this->jumpTarget >= 0))) {
+            this->address = this->jumpTarget;
+            return;
+        }
+    }
+
+    // The lanes took different ways, or some of them stopped.
+
+    for (int laneIndex = 0; laneIndex < this->numberOfActiveLanes; ++laneIndex) {
+        int lane = this->activeLanes[laneIndex];
+
+        if (this->laneDispatches[lane] != this->dispatchCounter)
+            this->laneAddresses[lane] = nextAddress;
+        else if (this->laneAddresses[lane] < 0)
+            this->numberOfRunningLanes--;
+    }
+
+    this->isConverged = false;
+}
+
+void ExecutionBatch::RecordJump(const int lane, const int64 address) {
+    // A jump of all the lanes has to be recorded per lane before any lane can jump on
+    // its own.
+
+    if (this->hasUniformJump) {
+        this->hasUniformJump = false;
+        this->numberOfJumps  = 0;
+
+        for (int laneIndex = 0; laneIndex < this->numberOfActiveLanes; ++laneIndex)
+            this->RecordJump(this->activeLanes[laneIndex], this->jumpTarget);
+    }
+
+    if (this->laneDispatches[lane] != this->dispatchCounter) {
+        this->laneDispatches[lane] = this->dispatchCounter;
+
+        if (this->numberOfJumps++ == 0)
+            this->jumpTarget = address;
+    }
+
+    if (address != this->jumpTarget)
+        this->hasSplitJumps = true;
+
+    this->laneAddresses[lane] = address;
+}
+
+void ExecutionBatch::StopActiveLanes(void) {
+    for (int laneIndex = 0; laneIndex < this->numberOfActiveLanes; ++laneIndex)
+        this->laneAddresses[this->activeLanes[laneIndex]] = -1;
+
+    this->numberOfRunningLanes -= this->numberOfActiveLanes;
+    this->isConverged           = false;
+}
+
+void ExecutionBatch::StopAllLanes(void) {
+    for (int lane = 0; lane < this->numberOfLanes; ++lane)
+        this->laneAddresses[lane] = -1;
+
+    this->numberOfRunningLanes = 0;
+    this->isConverged          = false;
+}
+
+// Lane Stacks
+
+bool ExecutionBatch::LoadLaneStack(const int lane) {
+    if (this->laneStacks[lane])
+        return true;
+
+    this->laneStacks[lane] = NewBuffer((VirtualMachineCore::StackSize * sizeof(VirtualMachineCore::Slot)) + VirtualMachineCore::StackSize);
+    return this->laneStacks[lane] != NULL;
+}
+
 }    // namespace tinyVM
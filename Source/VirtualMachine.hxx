@@ -10,8 +10,27 @@
 
 #include "Program.hxx"
 
+// Dispatch Modes
+
+#ifdef VM_THREADED_DISPATCH
+    #ifndef __GNUC__
+        #error "The threaded dispatch mode needs a compiler that supports labels as values (GCC or Clang)."
+    #endif
+
+    #define DispatchName "threaded"
+#else
+    #define DispatchName "call"
+#endif
+
 namespace tinyVM {
 
+class ProgramImage;
+class ExecutionContext;
+class ExecutionBatch;
+class Profiler;
+class Tracer;
+class NativeCode;
+
 // Virtual Machine Core
 
 class VirtualMachineCore {
@@ -36,21 +55,122 @@ class VirtualMachineCore {
         typedef OperationParameterType OperationParameterTypes[4];
         typedef bool (VirtualMachineCore::*OperationMethod)(const Program::InstructionParameters parameters);
 
+        // An operation can also have a batch method, which does the operation for all the
+        // active lanes of a batch at once (see Batch Execution).
+
+        typedef bool (VirtualMachineCore::*BatchOperationMethod)(const Program::InstructionParameters parameters, ExecutionBatch& batch);
+
+        // What an operation does to the execution flow, which is what tells the optimizer
+        // where the basic blocks end. An operation with an Address parameter and no flags
+        // is taken as a conditional jump (it may go on to either instruction). A machine
+        // with any IndirectJumpFlag operation keeps its instructions where they are.
+
+        enum OperationFlag {
+            NoFlags          = 0,
+            JumpFlag         = 1,    // Does nothing but jump to its (first) Address parameter.
+            EndFlag          = 2,    // Never goes on to the next instruction (like EXIT and STOP).
+            IndirectJumpFlag = 4     // Can jump to a computed address (a register or an int value).
+        };
+
         struct Operation {
                 int64                   opCode;
                 OperationMnemonic       mnemonic;
                 OperationMethod         method;
                 OperationParameterTypes parameterTypes;
+                int                     flags;          // Can be left out of the static operations arrays.
+                BatchOperationMethod    batchMethod;    // Same, NULL to do it lane by lane.
         };
 
         typedef std::vector<Operation> OperationList;
 
-        bool                 RegisterOperation(const int64 opCode, const OperationMnemonic mnemonic, const OperationMethod method, const OperationParameterTypes parameterTypes);
+        // The operations are indexed by mnemonic and parameter types, so finding the one
+        // that matches a source code line is a single hash lookup.
+
+        struct OperationSignature {
+                uint64 mnemonic;
+                uint64 parameterTypes;
+
+                bool operator==(const OperationSignature& other) const {
+                    return (this->mnemonic == other.mnemonic) && (this->parameterTypes == other.parameterTypes);
+                }
+        };
+
+        struct OperationSignatureHash {
+                size_t operator()(const OperationSignature& signature) const {
+                    return std::hash<uint64>()(signature.mnemonic ^ (signature.parameterTypes * 0x9E3779B97F4A7C15ULL));
+                }
+        };
+
+        typedef std::unordered_map<OperationSignature, int64, OperationSignatureHash> OperationIndex;
+
+        // Superinstructions
+
+        // A fusion replaces a sequence of two or three operations with a single operation
+        // that does the same work, so the sequence is dispatched only once (see Optimizer).
+        // The fused operation gets the parameters of the whole sequence in order, so its
+        // parameter types must be the sequence ones without the unused (None) parameters.
+
+        struct OperationFusion {
+                int64 fusedOpCode;
+                int   numberOfOpCodes;
+                int64 opCodes[3];
+        };
+
+        typedef std::vector<OperationFusion> OperationFusionList;
+
+        // The operations list (indexed by operation code), its index and the fusions.
+
+        struct OperationTable {
+                OperationList       list;
+                OperationIndex      index;
+                OperationFusionList fusions;
+                uint64              hash;             // Tells if a program image can run on this machine.
+                uint64              signaturesHash;   // The same in every process (the methods are left out).
+        };
+
+        // Instructions
+
+        // A decoded program instruction. The operation method is resolved once when the
+        // program is started, so the execution loop does not need to look anything up.
+        // String parameters point straight into the program data and are not null
+        // terminated (use the value size).
+
+        struct Instruction {
+                OperationMethod                method;
+                Program::InstructionParameters parameters;
+                Value                          values[4];
+#ifdef VM_THREADED_DISPATCH
+                int64 handler;    // Label to jump to in the execution loop (an InstructionHandler).
+#endif
+        };
+
+        bool                 RegisterOperation(const int64 opCode, const OperationMnemonic mnemonic, const OperationMethod method, const OperationParameterTypes parameterTypes, const int flags = NoFlags, const BatchOperationMethod batchMethod = NULL);
         void                 BuildOperationsList(void);
         const OperationList& GetOperations(void) const;
+        uint64               GetOperationsHash(void) const;    // The signatures hash, the same in every process.
+
+        // Finds the operation that matches the mnemonic and the parameter types (the
+        // unused parameters must be None). Returns NULL if there is no such operation.
+
+        const Operation* FindOperation(const string& mnemonic, const OperationParameterTypes parameterTypes) const;
+
+        // The fusions are checked against the operations when the list is built (the
+        // invalid ones are left out), so they must be registered before that.
+
+        bool                       RegisterFusion(const int64 fusedOpCode, const int64 firstOpCode, const int64 secondOpCode, const int64 thirdOpCode = -1);
+        const OperationFusionList& GetFusions(void) const;
+
+        static const Operation       BuiltInOperations[4];
+        static const OperationTable& GetBuiltInOperations(void);
 
         // Execution
 
+        // Operations must return false whenever they change the execution state (pause,
+        // stop, ...), that is what makes the execution loop check it again.
+        //
+        // Starting a program decodes it into an image and a context owned by the machine.
+        // The methods without a context work on the current one (the last one used).
+
         bool Start(Program* program);
         void Pause(void);
         bool Resume(void);
@@ -58,6 +178,194 @@ class VirtualMachineCore {
         void Stop(void);
         bool IsRunning(void) const;
         bool IsPaused(void) const;
+        bool IsWaiting(void) const;
+
+        // Program Images and Execution Contexts
+
+        // An image can be created once and shared by any number of contexts, from this
+        // machine or any other one with the same operations (and from any thread, as
+        // NewImage does not change the machine). The contexts are kept by the machine that
+        // created them for reuse, so creating one usually allocates nothing.
+        //
+        // NewImage verifies every instruction once: the operation codes, the registers,
+        // the string indexes and the addresses, so the execution loops (and the native
+        // code) can trust the parameters of their host machine operation types.
+
+        ProgramImage*     NewImage(const Program* program) const;
+        ExecutionContext* NewContext(const ProgramImage* image);
+        void              DeleteContext(ExecutionContext*& context);
+        bool              Start(ExecutionContext* context);
+        bool              Resume(ExecutionContext* context);
+        bool              Step(ExecutionContext* context);
+        ExecutionContext* GetContext(void) const;
+
+        // Asynchronous Operations
+
+        // An operation that starts something which completes later (like a network or a
+        // file request) can suspend the context instead of blocking the thread (see
+        // Suspend): the context is paused, waiting for the operation, and cannot be
+        // resumed until Wake is called for it. Wake makes it the current context, so the
+        // operation results can be stored in its registers or stack before resuming it.
+        // The EventLoop keeps any number of suspended contexts on one thread.
+
+        bool Wake(ExecutionContext* context);
+
+        // Snapshots
+
+        // A snapshot is the state of a context (the next instruction, the flags, the
+        // registers and the used part of the stack) in a blob with no pointers, so it can
+        // be written to a file as it is and a context restored from it (or from a mapping
+        // of the file) later, in another process or on another host, to skip the work the
+        // program did up to there. The programs are read-only, there is nothing else of
+        // theirs to keep, but the members of the machine classes are not in there.
+        //
+        // The context must not be waiting for an operation. It can be the current context
+        // (an operation can take a snapshot of the program it runs, which goes on from the
+        // next instruction once restored). Restore checks the blob was taken with the same
+        // operations (their codes, mnemonics, parameters and flags, as the methods are not
+        // at the same addresses in another process) and program and returns a new context
+        // of the image.
+        //
+        // [ Signature, Version, Operations Hash, Program Hash, Number of Instructions, Next
+        //   Instruction, Number of Registers, Stack Depth, Flags | Register Values | Stack
+        //   Values | Register Types | Stack Types ]
+
+        static constexpr int32     SnapshotVersion    = 1;
+        static constexpr charconst SnapshotSignature  = "TVMS";
+        static constexpr int       SnapshotHeaderSize = 64;
+
+        bool              Snapshot(ExecutionContext* context, std::vector<uint8>& snapshot);
+        ExecutionContext* Restore(const ProgramImage* image, const uint8* snapshot, const int64 snapshotSize);
+
+        // Time Slicing
+
+        // A budget limits how much a Resume call runs before it gives the control back (a
+        // zero means no limit). The instructions are counted once per basic block, when the
+        // block jumps away, so a run can go over the budget by the length of the block it
+        // was in, and the clock is only read every ClockCheckInterval instructions. A
+        // program that ran out of budget is still running (and not paused), it just has to
+        // be resumed again. Step runs exactly up to "count" instructions.
+
+        struct ExecutionBudget {
+                int64 instructions;
+                int64 microseconds;
+        };
+
+        static constexpr int64 ClockCheckInterval = 4096;
+
+        bool Start(ExecutionContext* context, const ExecutionBudget& budget);
+        bool Resume(const ExecutionBudget& budget);
+        bool Resume(ExecutionContext* context, const ExecutionBudget& budget);
+        bool Step(const int64 count);
+        bool Step(ExecutionContext* context, const int64 count);
+        bool IsOutOfBudget(void) const;
+
+        // Profiling
+
+        // While a profiler is set, resuming a context of its image runs a separate
+        // execution loop that counts and times every instruction (the profiler must
+        // outlive its use, set it to NULL to stop profiling).
+
+        void      SetProfiler(Profiler* profiler);
+        Profiler* GetProfiler(void) const;
+
+        // Tracing
+
+        // While a tracer is set (and no profiler is on the same image), resuming a context
+        // of its image records the basic blocks it runs in the tracer, which is dumped when
+        // the program stops if it has a dump file (the tracer must outlive its use, set it
+        // to NULL to stop tracing).
+
+        void    SetTracer(Tracer* tracer);
+        Tracer* GetTracer(void) const;
+
+        // JIT Compiler
+
+        // An image can be compiled to native code that calls the operation methods one
+        // after the other, with no dispatch loop (see NativeCode). CompileImage does it up
+        // front, every context of the image then runs the native code (on any machine
+        // with the same operations). With a JIT threshold, a context compiles its image
+        // once the jumps to one of its instructions reach it (zero compiles it when it is
+        // resumed). Where there is no native code the interpreter is used, stepping and
+        // profiling always use it.
+
+        static constexpr int64 DefaultJitThreshold = 1000;
+
+        bool  CompileImage(const ProgramImage* image) const;
+        void  SetJitThreshold(const int64 threshold);    // Negative (the default) to turn it off.
+        int64 GetJitThreshold(void) const;
+
+        // Batch Execution
+
+        // A batch runs one image over a number of lanes (independent inputs, like the
+        // records of a file) at once, with the registers of all the lanes side by side
+        // (see ExecutionBatch). Every instruction is dispatched once for all the lanes that
+        // are at it: operations with a batch method do it for all of them (with SIMD code,
+        // for instance), the others are called once for each lane, with the lane registers
+        // copied in and out of the machine (which is slow, it is only there so every
+        // program runs). While the lanes take different jumps, the ones at the lowest
+        // address run first, so they get back together where the paths meet.
+        //
+        // A batch always runs to the end, without budgets, profiling or native code. A lane
+        // that pauses (or suspends itself) is stopped, there is no one to resume it.
+
+        static constexpr int MaxNumberOfLanes = 4096;
+
+        ExecutionBatch* NewBatch(const ProgramImage* image, const int numberOfLanes) const;
+        bool            Start(ExecutionBatch* batch);
+
+        // Registers and Stack
+
+        // Every Identifier parameter is a register, resolved to its index when the program
+        // is compiled (the operations get the index as an Int value). The registers and the
+        // operand stack are fixed size 8 bytes slots in one cache line aligned block, with
+        // their type tags kept apart in a separate array. They belong to the execution
+        // context, these methods use the current one.
+
+        static constexpr int64 MaxNumberOfRegisters = 65536;
+        static constexpr int64 StackSize            = 4096;
+        static constexpr int   SlotsAlignment       = 64;
+
+        union Slot {
+                int64  asInt;
+                double asFloat;
+        };
+
+        enum SlotType : uint8 {
+            EmptySlot,
+            IntSlot,
+            FloatSlot,
+            BoolSlot
+        };
+
+        int64 GetNumberOfRegisters(void) const;
+        int64 GetStackDepth(void) const;
+
+        // The register indexes come from the decoded program, which makes sure they are
+        // in range, so they are not checked again.
+
+        SlotType GetRegisterType(const int64 registerIndex) const {
+            return static_cast<SlotType>(this->registerTypes[registerIndex]);
+        }
+
+        int64 GetIntRegister(const int64 registerIndex) const {
+            return this->registers[registerIndex].asInt;
+        }
+
+        double GetFloatRegister(const int64 registerIndex) const {
+            return this->registers[registerIndex].asFloat;
+        }
+
+        bool GetBoolRegister(const int64 registerIndex) const {
+            return this->registers[registerIndex].asInt != 0;
+        }
+
+        // Programs
+
+        // Reads the operation code and the raw parameter values of the instruction at
+        // codeOffset (0 for the first one) and moves codeOffset to the next instruction.
+
+        bool ReadInstruction(const Program* program, int64& codeOffset, int64& opCode, int64 parameterValues[4]) const;
 
         // Bult-in Instructions
 
@@ -66,21 +374,395 @@ class VirtualMachineCore {
         bool OpPause(const Program::InstructionParameters parameters);
         bool OpStop(const Program::InstructionParameters parameters);
 
+    protected:
+        // Static Operations
+
+        // Machines that always have the same operations can declare them once in a
+        // constant initialized "static const Operation Operations[]" array (the built-in
+        // operations are added automatically) and pass GetStaticOperations<MachineType>()
+        // to the constructor. The list is built on the first use and then shared by all
+        // the instances, which do not need to register anything.
+
+        VirtualMachineCore(const OperationTable& staticOperations);
+
+        template <class MachineType>
+        static const OperationTable& GetStaticOperations(void) {
+            static const OperationTable staticOperations = VirtualMachineCore::BuildStaticOperations(MachineType::Operations, sizeof(MachineType::Operations) / sizeof(Operation));
+            return staticOperations;
+        }
+
+        // The same, for machines that also declare a "static const OperationFusion
+        // Fusions[]" array.
+
+        template <class MachineType>
+        static const OperationTable& GetStaticFusedOperations(void) {
+            static const OperationTable staticOperations = VirtualMachineCore::BuildStaticOperations(MachineType::Operations, sizeof(MachineType::Operations) / sizeof(Operation), MachineType::Fusions, sizeof(MachineType::Fusions) / sizeof(OperationFusion));
+            return staticOperations;
+        }
+
+        static OperationTable BuildStaticOperations(const Operation* machineOperations, const int64 numberOfOperations, const OperationFusion* machineFusions = NULL, const int64 numberOfFusions = 0);
+
+        // Execution
+
+        // Operations should return what Jump returns, it is false when the address is not
+        // valid or when the jump used up the time slice budget. The Address parameters are
+        // always valid, only the computed addresses can fail.
+
+        bool Jump(const int64 address);
+
+        // Operations that suspend the context return what Suspend returns, the context
+        // goes on from the next instruction once it is woken up and resumed. Whatever
+        // completes the operation must be given the context (GetContext) to wake up.
+
+        bool Suspend(void);
+
+        // Registers
+
+        void SetIntRegister(const int64 registerIndex, const int64 value) {
+            this->registers[registerIndex].asInt = value;
+            this->registerTypes[registerIndex]   = IntSlot;
+        }
+
+        void SetFloatRegister(const int64 registerIndex, const double value) {
+            this->registers[registerIndex].asFloat = value;
+            this->registerTypes[registerIndex]     = FloatSlot;
+        }
+
+        void SetBoolRegister(const int64 registerIndex, const bool value) {
+            this->registers[registerIndex].asInt = value ? 1 : 0;
+            this->registerTypes[registerIndex]   = BoolSlot;
+        }
+
+        // Stack
+
+        // Same rules as the operations: they return false (and stop the program) on a stack
+        // overflow or underflow, so an operation can just return what they return.
+
+        bool PushInt(const int64 value);
+        bool PushFloat(const double value);
+        bool PushBool(const bool value);
+        bool Pop(Slot& value, SlotType& valueType);
+        bool PopInt(int64& value);
+        bool PopFloat(double& value);
+
     private:
         // Operations
 
         std::map<int64, Operation> operationsMap;
-        OperationList              operations;
+        OperationFusionList        fusionsList;
+        OperationTable             operationsTable;
+        const OperationTable*      operations;
+        bool                       hasStaticOperations;
+
+        static OperationSignature GetOperationSignature(const charconst mnemonic, const OperationParameterTypes parameterTypes);
+        static void               BuildOperationsIndex(OperationTable& operationsTable);
+        static void               BuildFusionsList(OperationTable& operationsTable, const OperationFusion* fusions, const int64 numberOfFusions);
 
         // Execution
 
-        bool isRunning;
-        bool isPaused;
+        // The state of the current context is copied to the machine while it runs, so the
+        // execution loop and the operations do not have to go through the context.
 
-        // Programs
+        friend class NativeCode;
+
+        ExecutionContext*  context;
+        bool               isRunning;
+        bool               isPaused;
+        bool               isWaiting;
+        const Instruction* instructions;
+        int64              numberOfInstructions;
+        const Instruction* nextInstruction;
+
+        void Run(void);
+        void Execute(void);
+        void LoadContext(ExecutionContext* context);
+        void SaveContext(void);
+        void ClearState(void);
+
+#ifdef VM_THREADED_DISPATCH
+        // The handlers of the threaded execution loop, the built-in operations are handled
+        // inline and everything else goes through the operation method.
+
+        enum InstructionHandler {
+            CallOperationHandler,
+            NoOpHandler,
+            ExitHandler,
+            PauseHandler,
+            StopHandler
+        };
+
+        static void ThreadInstructions(Instruction* instructions, const int64 numberOfInstructions);
+#endif
+
+        // Program Images and Execution Contexts
+
+        ProgramImage*     ownImage;
+        ExecutionContext* ownContext;
+        ExecutionContext* freeContexts;
+
+        // Snapshots
+
+        static uint64 GetProgramHash(const ProgramImage* image);
+
+        // Time Slicing
+
+        // The budget of a run is spent in slices (a clock check interval if there is a
+        // deadline, the whole budget otherwise), Jump takes the length of each block from
+        // what is left of the current slice.
+
+        static constexpr int64 UnlimitedBudget = INT64_MAX / 2;
+
+        bool                                  isOutOfBudget;
+        const Instruction*                    blockStart;
+        int64                                 budgetLeft;
+        int64                                 sliceSize;
+        int64                                 instructionsLeft;
+        bool                                  hasDeadline;
+        std::chrono::steady_clock::time_point deadline;
+
+        void StartBudget(const ExecutionBudget& budget);
+        bool NextBudgetSlice(void);
+        void StartBudgetSlice(void);
+
+        // Profiling
+
+        Profiler* profiler;
+
+        void RunProfiled(void);
+
+        // Tracing
+
+        Tracer* tracer;
+        Tracer* activeTracer;    // The tracer of the running context, if it is traced.
+
+        void RunTraced(void);
+
+        // JIT Compiler
+
+        int64   jitThreshold;
+        uint32* hotnessCounters;    // Jumps to each instruction, only while the interpreter counts them.
+        bool    isJitPending;
+
+        static bool CallOperation(VirtualMachineCore* machine, const Instruction* instruction);
+
+        // Registers and Stack
+
+        Slot*  registers;
+        uint8* registerTypes;
+        int64  numberOfRegisters;
+        Slot*  stack;
+        uint8* stackTypes;
+        int64  stackDepth;
+
+        bool Push(const Slot value, const SlotType valueType);
+
+        // Batch Execution
+
+        void CallLanes(const Instruction* instruction, ExecutionBatch& batch);
+};
+
+// Program Image
+
+// A decoded program, ready to run: every instruction has its operation method resolved
+// and its parameter values built. It is never changed after it is created, other than
+// getting its native code (once). The program it was created from must outlive it (the
+// string values point into the program data).
+
+class ProgramImage {
+    public:
+        ~ProgramImage();
+
+        const Program*            GetProgram(void) const;
+        int64                     GetNumberOfInstructions(void) const;
+        int64                     GetNumberOfRegisters(void) const;
+        const NativeCode*         GetNativeCode(void) const;
+        const std::vector<int64>& GetOpCodes(void) const;    // Of every instruction and the final EXIT.
+
+    private:
+        friend class VirtualMachineCore;
+        friend class ExecutionContext;
+        friend class ExecutionBatch;
+        friend class NativeCode;
+
+        ProgramImage(void);
+
+        const Program*                                        program;
+        VirtualMachineCore::Instruction*                      instructions;
+        int64                                                 numberOfInstructions;
+        int64                                                 numberOfRegisters;
+        uint64                                                operationsHash;
+        std::atomic<NativeCode*>                              nativeCode;
+        std::vector<int64>                                    opCodes;
+        std::vector<VirtualMachineCore::BatchOperationMethod> batchMethods;    // Empty if there are none.
+        mutable std::atomic<uint64>                           programHash;     // For the snapshots, 0 until needed.
+};
+
+// Execution Context
+
+// The state of one execution of a program image: the next instruction, the pause,
+// waiting, running and budget flags, the registers and the stack.
+
+class ExecutionContext {
+    public:
+        ~ExecutionContext();
+
+        const ProgramImage* GetImage(void) const;
+        bool                IsRunning(void) const;
+        bool                IsPaused(void) const;
+        bool                IsWaiting(void) const;
+        bool                IsOutOfBudget(void) const;
+        int64               GetStackDepth(void) const;
+
+    private:
+        friend class VirtualMachineCore;
+
+        ExecutionContext(void);
+
+        const ProgramImage*                    image;
+        const VirtualMachineCore::Instruction* nextInstruction;
+        bool                                   isRunning;
+        bool                                   isPaused;
+        bool                                   isWaiting;
+        bool                                   isOutOfBudget;
+        ExecutionContext*                      nextFreeContext;
+
+        // [ Register Values | Stack Values | Register Types | Stack Types ]
+
+        buffer                    slotsMemory;
+        int64                     slotsCapacity;
+        VirtualMachineCore::Slot* registers;
+        uint8*                    registerTypes;
+        VirtualMachineCore::Slot* stack;
+        uint8*                    stackTypes;
+        int64                     stackDepth;
+        std::vector<uint32>       hotnessCounters;
+
+        bool Reset(const ProgramImage* image);
+};
+
+// Execution Batch
+
+// The state of one batch run (see VirtualMachineCore::NewBatch): where each lane is and
+// the lane registers, in struct of arrays form. The values of a register for all the
+// lanes are next to each other (GetRegisterLanes), in a cache line aligned block of
+// GetLaneStride slots, so they can be loaded into SIMD registers straight away (the
+// types are kept the same way, in bytes).
+//
+// The batch methods work on the active lanes: all of them in order when
+// AreAllLanesActive, the ones listed by GetActiveLanes otherwise. They must only change
+// the active lanes and tell the batch about the ones that jump or stop (any other lane
+// goes on to the next instruction). They return false on errors, which stop the batch.
+//
+// The registers are cleared when the batch is created and kept between runs, so the
+// lane inputs can be set before starting it and the results read once it is done. The
+// lane stacks are only there for the operations without a batch method.
+
+class ExecutionBatch {
+    public:
+        ~ExecutionBatch();
+
+        const ProgramImage* GetImage(void) const;
+        int                 GetNumberOfLanes(void) const;
+        bool                IsRunning(void) const;
+        bool                IsLaneRunning(const int lane) const;
+
+        // Active Lanes
+
+        bool AreAllLanesActive(void) const {
+            return this->isConverged && (this->numberOfRunningLanes == this->numberOfLanes);
+        }
+
+        int GetNumberOfActiveLanes(void) const {
+            return this->numberOfActiveLanes;
+        }
+
+        const int32* GetActiveLanes(void) const {
+            return this->activeLanes.data();
+        }
+
+        // Both return false (and stop the lanes) if the address is not valid, the first
+        // one jumps all the active lanes.
+
+        bool Jump(const int64 address);
+        bool Jump(const int lane, const int64 address);
+        void Stop(const int lane);
+
+        // Registers
+
+        int64 GetLaneStride(void) const {
+            return this->laneStride;
+        }
+
+        VirtualMachineCore::Slot* GetRegisterLanes(const int64 registerIndex) {
+            return &this->registers[registerIndex * this->laneStride];
+        }
+
+        uint8* GetRegisterTypeLanes(const int64 registerIndex) {
+            return &this->registerTypes[registerIndex * this->laneStride];
+        }
+
+        VirtualMachineCore::SlotType GetRegisterType(const int lane, const int64 registerIndex) const;
+        int64                        GetIntRegister(const int lane, const int64 registerIndex) const;
+        double                       GetFloatRegister(const int lane, const int64 registerIndex) const;
+        bool                         GetBoolRegister(const int lane, const int64 registerIndex) const;
+        void                         SetIntRegister(const int lane, const int64 registerIndex, const int64 value);
+        void                         SetFloatRegister(const int lane, const int64 registerIndex, const double value);
+        void                         SetBoolRegister(const int lane, const int64 registerIndex, const bool value);
+
+    private:
+        friend class VirtualMachineCore;
+
+        ExecutionBatch(void);
+
+        const ProgramImage* image;
+        int                 numberOfLanes;
+        int64               numberOfRegisters;
+
+        // [ Register Values | Register Types ]
+
+        buffer                    slotsMemory;
+        int64                     laneStride;
+        VirtualMachineCore::Slot* registers;
+        uint8*                    registerTypes;
+
+        bool Reset(const ProgramImage* image, const int numberOfLanes);
+
+        // Lanes
+
+        // While every running lane is at the same address (isConverged) only that address
+        // is kept, the lane addresses are only updated once they take different paths (a
+        // stopped lane is always at -1). The jumps are counted per dispatch, the lanes that
+        // did not jump (in the current dispatch) go on to the next instruction.
+
+        std::vector<int64> laneAddresses;
+        std::vector<int64> laneDispatches;    // The dispatch of the last jump of each lane.
+        std::vector<int32> activeLanes;
+        int                numberOfActiveLanes;
+        int                numberOfRunningLanes;
+        bool               isConverged;
+        int64              address;
+        int64              dispatchCounter;
+        int                numberOfJumps;
+        int64              jumpTarget;
+        bool               hasSplitJumps;     // The lanes jumped to different addresses.
+        bool               hasUniformJump;    // All the active lanes jumped at once (not recorded per lane).
+
+        void Restart(void);
+        void GatherLanes(void);
+        void StartDispatch(void);
+        void EndDispatch(void);
+        void RecordJump(const int lane, const int64 address);
+        void StopActiveLanes(void);
+        void StopAllLanes(void);
+
+        // Lane Stacks
+
+        std::vector<VirtualMachineCore::Slot> laneRegisters;    // The lane being called, in machine form.
+        std::vector<uint8>                    laneRegisterTypes;
+        std::vector<buffer>                   laneStacks;         // [ Stack Values | Stack Types ], on first use.
+        std::vector<int64>                    laneStackDepths;
 
-        Program* currentProgram;
-        int64    currentProgramInstruction;
+        bool LoadLaneStack(const int lane);
 };
 
 }    // namespace tinyVM
@@ -0,0 +1,252 @@
+/*
+ * Source/VirtualMachinePool.cxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#include "VirtualMachinePool.hxx"
+
+namespace tinyVM {
+
+// The pool and the index of the worker running on the current thread (NULL and -1 for
+// any other thread), so the jobs submitted by a job callback go straight to the deque of
+// its own worker. A job can submit to another pool, where the index means nothing.
+
+static thread_local const VirtualMachinePool* currentPool        = NULL;
+static thread_local int                       currentWorkerIndex = -1;
+
+// Virtual Machine Pool
+
+VirtualMachinePool::VirtualMachinePool(const MachineFactory machineFactory, const int numberOfWorkers) :
+    machineFactory(machineFactory),
+    numberOfWorkers(numberOfWorkers),
+    isRunning(false),
+    isStopping(false),
+    queuedJobs(0),
+    pendingJobs(0),
+    completedJobs(0),
+    nextWorker(0) {
+    if (this->numberOfWorkers <= 0)
+        this->numberOfWorkers = std::max(1U, std::thread::hardware_concurrency());
+}
+
+VirtualMachinePool::~VirtualMachinePool() {
+    this->Stop();
+}
+
+// General
+
+bool VirtualMachinePool::Start(void) {
+    if (this->isRunning) {
+        Warning("The pool is already running.");
+        return false;
+    }
+
+    if (!this->machineFactory) {
+        Error("The pool has no machine factory.");
+        return false;
+    }
+
+    // Create all the machines before starting any thread, the machines may not be ready to
+    // be created concurrently.
+
+    for (int workerIndex = 0; workerIndex < this->numberOfWorkers; ++workerIndex) {
+        Worker* newWorker = new (std::nothrow) Worker();
+
+        if ((!newWorker) || (!(newWorker->machine = this->machineFactory()))) {
+            Error("Could not create the pool worker %d.", workerIndex);
+            delete newWorker;
+            this->DeleteWorkers();
+            return false;
+        }
+
+        this->workers.push_back(newWorker);
+    }
+
+    this->isStopping = false;
+    this->isRunning  = true;
+
+    for (int workerIndex = 0; workerIndex < this->numberOfWorkers; ++workerIndex)
+        this->workers[workerIndex]->thread = std::thread(&VirtualMachinePool::RunWorker, this, workerIndex);
+
+    Debug("Pool started with %d workers.", this->numberOfWorkers);
+    return true;
+}
+
+void VirtualMachinePool::Stop(void) {
+    if (!this->isRunning)
+        return;
+
+    {
+        std::lock_guard<std::mutex> stateLock(this->stateMutex);
+        this->isStopping = true;
+    }
+
+    this->jobsAvailable.notify_all();
+
+    for (auto worker = this->workers.begin(); worker != this->workers.end(); ++worker)
+        (*worker)->thread.join();
+
+    this->DeleteWorkers();
+    this->isRunning = false;
+
+    Debug("Pool stopped.");
+}
+
+bool VirtualMachinePool::IsRunning(void) const {
+    return this->isRunning;
+}
+
+int VirtualMachinePool::GetNumberOfWorkers(void) const {
+    return this->numberOfWorkers;
+}
+
+// Jobs
+
+ProgramImage* VirtualMachinePool::NewImage(const Program* program) const {
+    if (!this->isRunning) {
+        Error("The pool is not running.");
+        return NULL;
+    }
+
+    return this->workers[0]->machine->NewImage(program);
+}
+
+bool VirtualMachinePool::Submit(const ProgramImage* image, const JobCallback callback, const pointer userData) {
+    if ((!this->isRunning) || this->isStopping) {
+        Error("The pool is not running.");
+        return false;
+    }
+
+    if (!image) {
+        Error("The program image is null.");
+        return false;
+    }
+
+    // Jobs from the outside (including the jobs of another pool) are spread over the
+    // workers, the ones submitted by a worker stay with it (the other workers will steal
+    // them if they are idle).
+
+    int workerIndex = (currentPool == this) ? currentWorkerIndex : -1;
+
+    if (workerIndex < 0)
+        workerIndex = this->nextWorker++ % this->numberOfWorkers;
+
+    Job     newJob = {image, callback, userData};
+    Worker& worker = *this->workers[workerIndex];
+
+    this->pendingJobs++;
+
+    {
+        std::lock_guard<std::mutex> jobsLock(worker.jobsMutex);
+        worker.jobs.push_back(newJob);
+    }
+
+    {
+        std::lock_guard<std::mutex> stateLock(this->stateMutex);
+        this->queuedJobs++;
+    }
+
+    this->jobsAvailable.notify_one();
+    return true;
+}
+
+void VirtualMachinePool::Wait(void) {
+    std::unique_lock<std::mutex> stateLock(this->stateMutex);
+    this->jobsDone.wait(stateLock, [this] { return this->pendingJobs == 0; });
+}
+
+int64 VirtualMachinePool::GetNumberOfCompletedJobs(void) const {
+    return this->completedJobs;
+}
+
+// Workers
+
+void VirtualMachinePool::RunWorker(const int workerIndex) {
+    currentPool        = this;
+    currentWorkerIndex = workerIndex;
+
+    Worker& worker = *this->workers[workerIndex];
+    Job     currentJob;
+
+    while (true) {
+        if (this->PopJob(workerIndex, currentJob) || this->StealJob(workerIndex, currentJob)) {
+            this->RunJob(worker, currentJob);
+            continue;
+        }
+
+        // Nothing to do: sleep until a new job is submitted or the pool is stopped (the
+        // queued jobs are all done before leaving).
+
+        std::unique_lock<std::mutex> stateLock(this->stateMutex);
+        this->jobsAvailable.wait(stateLock, [this] { return this->isStopping || (this->queuedJobs > 0); });
+
+        if (this->isStopping && (this->queuedJobs <= 0))
+            break;
+    }
+
+    currentPool        = NULL;
+    currentWorkerIndex = -1;
+}
+
+void VirtualMachinePool::RunJob(Worker& worker, const Job& job) {
+    ExecutionContext* jobContext = worker.machine->NewContext(job.image);
+    bool              started    = jobContext && worker.machine->Start(jobContext);
+
+    if (job.callback)
+        job.callback(*worker.machine, jobContext, started, job.userData);
+
+    // A paused program has no one to resume it.
+
+    worker.machine->DeleteContext(jobContext);
+    this->completedJobs++;
+
+    if (--this->pendingJobs == 0) {
+        std::lock_guard<std::mutex> stateLock(this->stateMutex);
+        this->jobsDone.notify_all();
+    }
+}
+
+bool VirtualMachinePool::PopJob(const int workerIndex, Job& job) {
+    Worker&                     worker = *this->workers[workerIndex];
+    std::lock_guard<std::mutex> jobsLock(worker.jobsMutex);
+
+    if (worker.jobs.empty())
+        return false;
+
+    job = worker.jobs.back();
+    worker.jobs.pop_back();
+    this->queuedJobs--;
+
+    return true;
+}
+
+bool VirtualMachinePool::StealJob(const int workerIndex, Job& job) {
+    for (int workerOffset = 1; workerOffset < this->numberOfWorkers; ++workerOffset) {
+        Worker&                     victim = *this->workers[(workerIndex + workerOffset) % this->numberOfWorkers];
+        std::lock_guard<std::mutex> jobsLock(victim.jobsMutex);
+
+        if (victim.jobs.empty())
+            continue;
+
+        job = victim.jobs.front();
+        victim.jobs.pop_front();
+        this->queuedJobs--;
+
+        return true;
+    }
+
+    return false;
+}
+
+void VirtualMachinePool::DeleteWorkers(void) {
+    for (auto worker = this->workers.begin(); worker != this->workers.end(); ++worker) {
+        delete (*worker)->machine;
+        delete *worker;
+    }
+
+    this->workers.clear();
+}
+
+}    // namespace tinyVM
@@ -0,0 +1,102 @@
+/*
+ * Source/VirtualMachinePool.hxx
+ *
+ * This file is part of the tinyVM source code.
+ * Copyright 2023 Patrick Melo <patrick@patrickmelo.com.br>
+ */
+
+#ifndef VM_VIRTUAL_MACHINE_POOL_H
+#define VM_VIRTUAL_MACHINE_POOL_H
+
+#include "VirtualMachine.hxx"
+
+namespace tinyVM {
+
+// Virtual Machine Pool
+
+// Runs program images on a set of worker threads, each one with its own machine. Every
+// job gets its own execution context (registers, stack and execution state) from the
+// worker machine, so one image can be submitted any number of times.
+//
+// Every worker has its own job deque: it takes its jobs from the back and, when it runs
+// out of them, steals from the front of the other workers deques.
+
+class VirtualMachinePool {
+    public:
+        typedef VirtualMachineCore* (*MachineFactory)(void);
+
+        // Called on the worker thread once the program has run (or could not be started),
+        // before the context is deleted, so the results can be read from the machine.
+
+        typedef void (*JobCallback)(VirtualMachineCore& machine, ExecutionContext* context, const bool started, pointer userData);
+
+        template <class MachineType>
+        static VirtualMachineCore* NewMachine(void) {
+            return new (std::nothrow) MachineType();
+        }
+
+        VirtualMachinePool(const MachineFactory machineFactory, const int numberOfWorkers = 0);
+        ~VirtualMachinePool();
+
+        // General
+
+        // Zero workers means one per hardware thread. Stop runs all the jobs that were
+        // already submitted before stopping the workers.
+
+        bool Start(void);
+        void Stop(void);
+        bool IsRunning(void) const;
+        int  GetNumberOfWorkers(void) const;
+
+        // Jobs
+
+        // The images are created by the first worker machine (they run on any of them) and
+        // must be deleted by the caller once no job is using them anymore.
+
+        ProgramImage* NewImage(const Program* program) const;
+        bool          Submit(const ProgramImage* image, const JobCallback callback = NULL, const pointer userData = NULL);
+        void          Wait(void);
+        int64         GetNumberOfCompletedJobs(void) const;
+
+    private:
+        // Workers
+
+        struct Job {
+                const ProgramImage* image;
+                JobCallback         callback;
+                pointer             userData;
+        };
+
+        struct Worker {
+                VirtualMachineCore* machine;
+                std::thread         thread;
+                std::mutex          jobsMutex;
+                std::deque<Job>     jobs;
+        };
+
+        MachineFactory       machineFactory;
+        int                  numberOfWorkers;
+        std::vector<Worker*> workers;
+        bool                 isRunning;
+
+        void RunWorker(const int workerIndex);
+        void RunJob(Worker& worker, const Job& job);
+        bool PopJob(const int workerIndex, Job& job);
+        bool StealJob(const int workerIndex, Job& job);
+        void DeleteWorkers(void);
+
+        // Jobs
+
+        std::mutex              stateMutex;
+        std::condition_variable jobsAvailable;
+        std::condition_variable jobsDone;
+        std::atomic<bool>       isStopping;
+        std::atomic<int64>      queuedJobs;
+        std::atomic<int64>      pendingJobs;
+        std::atomic<int64>      completedJobs;
+        std::atomic<uint64>     nextWorker;
+};
+
+}    // namespace tinyVM
+
+#endif    // VM_VIRTUAL_MACHINE_POOL_H